@@ -0,0 +1,108 @@
+#!/usr/bin/env bash
+#===- check_loops.sh - Check the Toy loops against their unrolled form ---===#
+#
+# Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+# See https://llvm.org/LICENSE.txt for license information.
+# SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+#
+#===----------------------------------------------------------------------===#
+#
+# Compile Toy programs whose loops assign their variables, from calls and from
+# each other, and check that they print what their unrolled form prints,
+# through both lowering paths, with and without optimizations:
+#   call  the loop carries the results of calls, whose buffers are freed at
+#         the end of each iteration
+#   swap  the loop exchanges its variables, which overwrites a value before
+#         it is read unless it is staged
+#
+# Usage: check_loops.sh <toyc>
+#
+#===----------------------------------------------------------------------===#
+
+set -euo pipefail
+
+toyc=${1:?usage: $0 <toyc>}
+
+workdir=$(mktemp -d)
+trap 'rm -rf "$workdir"' EXIT
+
+cat > "$workdir/call.toy" <<'TOY'
+def step(x, y) {
+  return x * y + transpose(y);
+}
+
+def main() {
+  var x = [[1, 2], [3, 4]];
+  var y = [[0.5, 1.5], [2.5, 3.5]];
+  for i in 0..3 {
+    x = step(x, y);
+    y = step(y, x);
+  }
+  print(x);
+  print(y);
+}
+TOY
+
+cat > "$workdir/call_unrolled.toy" <<'TOY'
+def step(x, y) {
+  return x * y + transpose(y);
+}
+
+def main() {
+  var x0 = [[1, 2], [3, 4]];
+  var y0 = [[0.5, 1.5], [2.5, 3.5]];
+  var x1 = step(x0, y0);
+  var y1 = step(y0, x1);
+  var x2 = step(x1, y1);
+  var y2 = step(y1, x2);
+  var x3 = step(x2, y2);
+  var y3 = step(y2, x3);
+  print(x3);
+  print(y3);
+}
+TOY
+
+cat > "$workdir/swap.toy" <<'TOY'
+def main() {
+  var x = [[1, 2], [3, 4]];
+  var y = [[5, 6], [7, 8]];
+  for i in 0..3 {
+    var t = x + y;
+    x = y;
+    y = t;
+  }
+  print(x);
+  print(y);
+}
+TOY
+
+cat > "$workdir/swap_unrolled.toy" <<'TOY'
+def main() {
+  var x0 = [[1, 2], [3, 4]];
+  var y0 = [[5, 6], [7, 8]];
+  var y1 = x0 + y0;
+  var y2 = y0 + y1;
+  var y3 = y1 + y2;
+  print(y2);
+  print(y3);
+}
+TOY
+
+status=0
+for program in call swap; do
+  expected="$workdir/$program.expected"
+  "$toyc" "$workdir/${program}_unrolled.toy" -emit=jit \
+    -interpret-threshold=0 > "$expected"
+  for path in affine linalg; do
+    for opt in "" -opt; do
+      actual="$workdir/$program.actual"
+      if ! "$toyc" "$workdir/$program.toy" -emit=jit -interpret-threshold=0 \
+          -lower-via="$path" $opt > "$actual" ||
+          ! cmp -s "$expected" "$actual"; then
+        echo "FAIL: $program -lower-via=$path $opt"
+        status=1
+      fi
+    done
+  done
+done
+exit $status
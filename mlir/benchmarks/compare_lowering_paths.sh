@@ -0,0 +1,62 @@
+#!/usr/bin/env bash
+#===- compare_lowering_paths.sh - Compare the Toy lowering paths ---------===#
+#
+# Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+# See https://llvm.org/LICENSE.txt for license information.
+# SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+#
+#===----------------------------------------------------------------------===#
+#
+# Time the kernels of an elementwise and transpose heavy Toy program, lowered
+# through affine loops and through linalg, with `toyc -bench`: the parsing, the
+# compilation and the printing of the result aren't timed. The program is
+# always compiled, however small, rather than interpreted.
+#
+# Usage: compare_lowering_paths.sh <toyc> [size] [runs]
+#
+#===----------------------------------------------------------------------===#
+
+set -euo pipefail
+
+toyc=${1:?usage: $0 <toyc> [size] [runs]}
+size=${2:-256}
+runs=${3:-5}
+
+workdir=$(mktemp -d)
+trap 'rm -rf "$workdir"' EXIT
+input="$workdir/bench.toy"
+
+# The program chains elementwise operations and transposes on <size x size>
+# literals.
+awk -v n="$size" 'function literal(seed,   i, j, row, s) {
+  s = "["
+  for (i = 0; i < n; ++i) {
+    row = "["
+    for (j = 0; j < n; ++j)
+      row = row (j ? ", " : "") ((i * n + j + seed) % 17) ".0"
+    s = s (i ? ", " : "") row "]"
+  }
+  return s "]"
+}
+BEGIN {
+  print "def kernel(a, b) {"
+  print "  var c = a * b + transpose(a);"
+  print "  var d = transpose(c) * c + b;"
+  print "  return transpose(d) * a + d;"
+  print "}"
+  print ""
+  print "def main() {"
+  print "  var a<" n ", " n "> = " literal(1) ";"
+  print "  var b<" n ", " n "> = " literal(5) ";"
+  print "  var r = kernel(kernel(a, b), b);"
+  print "  print(r);"
+  print "}"
+}' > "$input"
+
+for path in affine linalg; do
+  "$toyc" "$input" -emit=jit -opt -lower-via="$path" -interpret-threshold=0 \
+    -bench="$runs" -bench-output="$workdir/$path.json" > /dev/null
+  median=$(sed -n 's/.*"median_ms": \([0-9.eE+-]*\).*/\1/p' \
+    "$workdir/$path.json")
+  echo "$path: ${median} ms (median of $runs, ${size}x${size})"
+done
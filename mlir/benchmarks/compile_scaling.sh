@@ -0,0 +1,137 @@
+#!/usr/bin/env bash
+#===- compile_scaling.sh - Check the compile time scaling of toyc --------===#
+#
+# Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+# See https://llvm.org/LICENSE.txt for license information.
+# SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+#
+#===----------------------------------------------------------------------===#
+#
+# Grow the synthetic programs of generate_scaling.sh along each of their axes
+# in turn, the others staying at a small baseline, and time toyc up to each
+# `-emit` stage on them. The growth of the compile time of each stage is fit
+# with a power law, time ~ size^exponent, by least squares on the logarithms of
+# the largest sizes, where the start up of toyc no longer dominates. A stage
+# whose exponent exceeds <threshold> (1.5 by default) is flagged as super
+# linear, and the script then exits with a failure.
+#
+# The time of each point is the best of <runs>. The flags passed to toyc are
+# taken from $TOYC_FLAGS, `-opt` by default. A compilation that fails aborts
+# the script, with the diagnostics toyc printed.
+#
+# Usage: compile_scaling.sh <toyc> [runs] [threshold]
+#
+#===----------------------------------------------------------------------===#
+
+set -euo pipefail
+
+toyc=${1:?usage: $0 <toyc> [runs] [threshold]}
+runs=${2:-3}
+threshold=${3:-1.5}
+
+workdir=$(mktemp -d)
+trap 'rm -rf "$workdir"' EXIT
+generate="$(dirname "$0")/generate_scaling.sh"
+read -r -a flags <<< "${TOYC_FLAGS--opt}"
+
+stages=(ast mlir mlir-affine mlir-llvm llvm)
+axes=(functions depth expr literal structs)
+# The baseline of each axis, in the order of the arguments of the generator,
+# and the sizes each axis is grown through. The sizes double, so the points are
+# evenly spaced on the logarithmic scale the fit is done on.
+baseline=(8 2 4 16 1)
+declare -A sizes=(
+  [functions]="16 32 64 128 256"
+  [depth]="4 8 16 32 64"
+  [expr]="16 32 64 128 256"
+  [literal]="1024 2048 4096 8192 16384"
+  [structs]="8 16 32 64 128"
+)
+# The number of largest sizes the fit is done on.
+fitted=3
+
+now() { date +%s%N; }
+
+# Print the best time of <runs> compilations of <input> up to <stage>, in
+# microseconds. The diagnostics of toyc are kept in <input>.<stage>.log, and
+# printed if a compilation fails, which fails the function.
+measure() {
+  local input=$1 stage=$2 best="" start elapsed status
+  local log="${input%.toy}.$stage.log"
+  for ((run = 0; run < runs; ++run)); do
+    start=$(now)
+    status=0
+    "$toyc" "$input" -emit="$stage" "${flags[@]}" > /dev/null 2> "$log" ||
+      status=$?
+    elapsed=$(( ($(now) - start) / 1000 ))
+    if (( status != 0 )); then
+      echo "toyc failed with status $status on $(basename "$input")" \
+        "-emit=$stage:" >&2
+      cat "$log" >&2
+      return 1
+    fi
+    if [[ -z "$best" || "$elapsed" -lt "$best" ]]; then
+      best=$elapsed
+    fi
+  done
+  echo "$best"
+}
+
+# Each line of the measurements is "<axis> <stage> <size> <microseconds>".
+measurements="$workdir/measurements"
+: > "$measurements"
+for index in "${!axes[@]}"; do
+  axis=${axes[$index]}
+  for size in ${sizes[$axis]}; do
+    args=("${baseline[@]}")
+    args[$index]=$size
+    # The chains of calls can't be deeper than the number of functions.
+    if [[ $axis == depth ]]; then
+      args[0]=$size
+    fi
+    input="$workdir/${axis}_${size}.toy"
+    "$generate" "${args[@]}" > "$input"
+    for stage in "${stages[@]}"; do
+      micros=$(measure "$input" "$stage")
+      echo "$axis $stage $size $micros" >> "$measurements"
+    done
+  done
+done
+
+printf '%-10s %-12s %10s %10s  %s\n' axis stage "first us" "last us" exponent
+awk -v threshold="$threshold" -v fitted="$fitted" '
+{
+  key = $1 " " $2
+  if (!(key in count))
+    keys[numKeys++] = key
+  n = count[key]++
+  size[key, n] = $3
+  time[key, n] = $4 > 0 ? $4 : 1
+}
+END {
+  failed = 0
+  for (k = 0; k < numKeys; ++k) {
+    key = keys[k]
+    n = count[key]
+    first = n > fitted ? n - fitted : 0
+    # The least squares slope of log(time) over log(size).
+    sx = sy = sxx = sxy = 0
+    for (i = first; i < n; ++i) {
+      x = log(size[key, i])
+      y = log(time[key, i])
+      sx += x; sy += y; sxx += x * x; sxy += x * y
+    }
+    m = n - first
+    denominator = m * sxx - sx * sx
+    exponent = denominator ? (m * sxy - sx * sy) / denominator : 0
+    flag = ""
+    if (exponent > threshold) {
+      flag = "  SUPER-LINEAR"
+      failed = 1
+    }
+    split(key, names, " ")
+    printf "%-10s %-12s %10d %10d  %.2f%s\n", names[1], names[2],
+           time[key, 0], time[key, n - 1], exponent, flag
+  }
+  exit failed
+}' "$measurements"
@@ -0,0 +1,85 @@
+#!/usr/bin/env bash
+#===- generate_scaling.sh - Generate a synthetic Toy program -------------===#
+#
+# Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+# See https://llvm.org/LICENSE.txt for license information.
+# SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+#
+#===----------------------------------------------------------------------===#
+#
+# Print a synthetic Toy program stressing the compiler along five axes:
+#   functions  the number of generic functions
+#   depth      the length of the chains of calls between them
+#   expr       the number of binary operations in the body of each function
+#   literal    the number of elements of the literals, shaped <1 x literal>
+#   structs    the number of struct types, each with a function and a value
+# Every function is called, so that none of them is dropped before the passes
+# that are measured.
+#
+# Usage: generate_scaling.sh <functions> <depth> <expr> <literal> <structs>
+#
+#===----------------------------------------------------------------------===#
+
+set -euo pipefail
+
+if [[ $# -ne 5 ]]; then
+  echo "usage: $0 <functions> <depth> <expr> <literal> <structs>" >&2
+  exit 1
+fi
+
+awk -v functions="$1" -v depth="$2" -v expr="$3" -v literal="$4" \
+    -v structs="$5" 'function tensor(seed,   i, s) {
+  s = "[["
+  for (i = 0; i < literal; ++i)
+    s = s (i ? ", " : "") ((i + seed) % 17) ".0"
+  return s "]]"
+}
+# The body of each function: a chain of <expr> operations on its arguments.
+function body(   i, s) {
+  s = "a"
+  for (i = 0; i < expr; ++i)
+    s = s (i % 2 ? " + " : " * ") (i % 3 ? "b" : "a")
+  return s
+}
+BEGIN {
+  # The functions form chains of <depth> calls: each one calls the next in its
+  # chain, and main calls the head of every chain.
+  for (f = 0; f < functions; ++f) {
+    print "def f" f "(a, b) {"
+    if ((f + 1) % depth && f + 1 < functions)
+      print "  return f" f + 1 "(" body() ", b);"
+    else
+      print "  return " body() ";"
+    print "}"
+    print ""
+  }
+
+  for (s = 0; s < structs; ++s) {
+    print "struct S" s " {"
+    print "  var x;"
+    print "  var y;"
+    print "}"
+    print ""
+    print "def g" s "(S" s " value) {"
+    print "  return value.x * value.y + value.x;"
+    print "}"
+    print ""
+  }
+
+  print "def main() {"
+  print "  var a<1, " literal "> = " tensor(1) ";"
+  print "  var b<1, " literal "> = " tensor(5) ";"
+  print "  var r0 = a;"
+  results = 0
+  for (f = 0; f < functions; f += depth) {
+    print "  var r" results + 1 " = r" results " + f" f "(a, b);"
+    ++results
+  }
+  for (s = 0; s < structs; ++s) {
+    print "  S" s " v" s " = {" tensor(s) ", " tensor(s + 3) "};"
+    print "  var r" results + 1 " = r" results " + g" s "(v" s ");"
+    ++results
+  }
+  print "  print(r" results ");"
+  print "}"
+}'
@@ -0,0 +1,120 @@
+#!/usr/bin/env bash
+#===- generate_suite.sh - Generate the Toy benchmark suite ---------------===#
+#
+# Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+# See https://llvm.org/LICENSE.txt for license information.
+# SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+#
+#===----------------------------------------------------------------------===#
+#
+# Write the Toy programs of the benchmark suite to <outdir>, each at every
+# given size. The programs operate on <size x size> literals:
+#   elementwise_<size>.toy  a long chain of additions and multiplications
+#   transpose_<size>.toy    transposes interleaved with elementwise operations
+#   struct_<size>.toy       structs of tensors passed through several calls
+#   literal_<size>.toy      many large literals, each used once
+# Each program prints its result. With `toyc -bench`, only the first run, a
+# warmup, prints, so that the timed runs measure the computation alone.
+#
+# Usage: generate_suite.sh <outdir> [sizes...]
+#
+#===----------------------------------------------------------------------===#
+
+set -euo pipefail
+
+outdir=${1:?usage: $0 <outdir> [sizes...]}
+shift
+sizes=("$@")
+if [[ ${#sizes[@]} -eq 0 ]]; then
+  sizes=(16 64 256)
+fi
+mkdir -p "$outdir"
+
+# Print the Toy program <kind> at size <n>.
+generate() {
+  awk -v kind="$1" -v n="$2" 'function literal(seed,   i, j, row, s) {
+  s = "["
+  for (i = 0; i < n; ++i) {
+    row = "["
+    for (j = 0; j < n; ++j)
+      row = row (j ? ", " : "") ((i * n + j + seed) % 17) ".0"
+    s = s (i ? ", " : "") row "]"
+  }
+  return s "]"
+}
+function decl(name, seed) {
+  print "  var " name "<" n ", " n "> = " literal(seed) ";"
+}
+function elementwise(   i) {
+  print "def step(a, b) {"
+  print "  return a * b + a;"
+  print "}"
+  print ""
+  print "def main() {"
+  decl("a", 1)
+  decl("b", 5)
+  print "  var c0 = step(a, b);"
+  for (i = 0; i < 16; ++i)
+    print "  var c" i + 1 " = step(c" i ", b) + a;"
+  print "  print(c16);"
+  print "}"
+}
+function transpose(   i) {
+  print "def rotate(a, b) {"
+  print "  return transpose(a) * b + transpose(b);"
+  print "}"
+  print ""
+  print "def main() {"
+  decl("a", 2)
+  decl("b", 7)
+  print "  var c0 = rotate(a, b);"
+  for (i = 0; i < 8; ++i)
+    print "  var c" i + 1 " = rotate(transpose(c" i "), a);"
+  print "  print(c8);"
+  print "}"
+}
+function struct(   i) {
+  print "struct Pair {"
+  print "  var first;"
+  print "  var second;"
+  print "}"
+  print ""
+  print "def mix(Pair p) {"
+  print "  return p.first * p.second + transpose(p.first);"
+  print "}"
+  print ""
+  print "def swap_mix(Pair p) {"
+  print "  return mix(p) + p.second * transpose(p.second);"
+  print "}"
+  print ""
+  print "def main() {"
+  print "  Pair p = {" literal(3) ", " literal(11) "};"
+  print "  var c = swap_mix(p) + mix(p);"
+  print "  print(c);"
+  print "}"
+}
+function literal_heavy(   i) {
+  print "def main() {"
+  for (i = 0; i < 8; ++i)
+    decl("l" i, i)
+  print "  var c = l0 + l1 + l2 + l3 + l4 + l5 + l6 + l7;"
+  print "  print(c);"
+  print "}"
+}
+BEGIN {
+  if (kind == "elementwise")
+    elementwise()
+  else if (kind == "transpose")
+    transpose()
+  else if (kind == "struct")
+    struct()
+  else
+    literal_heavy()
+}'
+}
+
+for size in "${sizes[@]}"; do
+  for kind in elementwise transpose struct literal; do
+    generate "$kind" "$size" > "$outdir/${kind}_${size}.toy"
+  done
+done
@@ -0,0 +1,42 @@
+#!/usr/bin/env bash
+#===- run_suite.sh - Run the Toy benchmark suite -------------------------===#
+#
+# Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+# See https://llvm.org/LICENSE.txt for license information.
+# SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+#
+#===----------------------------------------------------------------------===#
+#
+# Generate the benchmark suite (see generate_suite.sh), then compile each
+# program once and time <runs> runs of it with `toyc -bench`. The results are
+# printed as a JSON array, one object per program. The flags passed to toyc
+# are taken from $TOYC_FLAGS, `-opt` by default.
+#
+# Usage: run_suite.sh <toyc> [runs] [sizes...]
+#
+#===----------------------------------------------------------------------===#
+
+set -euo pipefail
+
+toyc=${1:?usage: $0 <toyc> [runs] [sizes...]}
+runs=${2:-20}
+shift $(( $# < 2 ? $# : 2 ))
+
+workdir=$(mktemp -d)
+trap 'rm -rf "$workdir"' EXIT
+"$(dirname "$0")/generate_suite.sh" "$workdir" "$@"
+
+read -r -a flags <<< "${TOYC_FLAGS--opt}"
+separator=""
+echo "["
+for input in "$workdir"/*.toy; do
+  "$toyc" "$input" -emit=jit "${flags[@]}" -bench="$runs" \
+    -bench-output="$workdir/result.json" > /dev/null
+  # Name each result after its program rather than its temporary path.
+  name=$(basename "$input" .toy)
+  printf '%s' "$separator"
+  sed "s|\"benchmark\": \".*\"|\"benchmark\": \"$name\"|" \
+    "$workdir/result.json"
+  separator=","
+done
+echo "]"
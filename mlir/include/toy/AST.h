@@ -6,9 +6,9 @@
 //
 //===----------------------------------------------------------------------===//
 //
-// This file implements the AST for the Toy language. It is optimized for
-// simplicity, not efficiency. The AST forms a tree structure where each node
-// references its children using std::unique_ptr<>.
+// This file implements the AST for the Toy language. The AST forms a tree
+// structure. The nodes of a module are allocated from an arena, and each node
+// references its children with plain pointers and ArrayRefs into the arena.
 //
 //===----------------------------------------------------------------------===//
 
@@ -18,16 +18,107 @@
 #include "toy/Lexer.h"
 
 #include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/STLExtras.h"
 #include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Allocator.h"
 #include "llvm/Support/Casting.h"
+#include "llvm/Support/MemAlloc.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <memory>
+#include <type_traits>
 #include <vector>
 
 namespace toy {
+class ASTArena;
+
+/// A buffer of values growing at its end, for the arrays whose size is only
+/// known once they are parsed. Its storage is malloc'ed, so that growing a
+/// large buffer remaps its pages rather than copying them, and it is handed to
+/// the arena once complete (see ASTArena::adopt).
+template <typename T> class GrowableBuffer {
+  static_assert(std::is_trivially_copyable<T>::value,
+                "the values are moved by realloc");
+
+public:
+  GrowableBuffer() = default;
+  GrowableBuffer(const GrowableBuffer &) = delete;
+  GrowableBuffer &operator=(const GrowableBuffer &) = delete;
+  ~GrowableBuffer() { std::free(data); }
+
+  void push_back(T value) {
+    if (size == capacity) {
+      capacity = std::max<size_t>(16, capacity * 2);
+      data = static_cast<T *>(llvm::safe_realloc(data, capacity * sizeof(T)));
+    }
+    data[size++] = value;
+  }
+
+  size_t getSize() const { return size; }
+
+private:
+  friend class ASTArena;
+
+  T *data = nullptr;
+  size_t size = 0;
+  size_t capacity = 0;
+};
+
+/// The storage of the nodes of an AST. The nodes and their lists of children
+/// are allocated from a bump allocator, the data of their literals are adopted
+/// buffers, and all are freed at once with the arena: the nodes are never
+/// destroyed one by one. The names refer to the source buffers, which the
+/// SourceManager keeps alive.
+class ASTArena {
+public:
+  /// Allocate a node constructed from `args`.
+  template <typename T, typename... Args> T *create(Args &&...args) {
+    static_assert(std::is_trivially_destructible<T>::value,
+                  "the nodes are never destroyed");
+    return new (allocator.Allocate<T>()) T(std::forward<Args>(args)...);
+  }
+
+  /// Copy `values` into the arena.
+  template <typename T> llvm::ArrayRef<T> copy(llvm::ArrayRef<T> values) {
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "the values are never destroyed");
+    T *data = allocator.Allocate<T>(values.size());
+    std::uninitialized_copy(values.begin(), values.end(), data);
+    return llvm::makeArrayRef(data, values.size());
+  }
+
+  /// Take the storage of `buffer`, trimmed to its size but not copied, and
+  /// leave `buffer` empty.
+  template <typename T> llvm::ArrayRef<T> adopt(GrowableBuffer<T> &buffer) {
+    if (buffer.size == 0)
+      return {};
+    T *data = buffer.data;
+    if (buffer.size != buffer.capacity)
+      data = static_cast<T *>(
+          llvm::safe_realloc(data, buffer.size * sizeof(T)));
+    adopted.emplace_back(data);
+    llvm::ArrayRef<T> values = llvm::makeArrayRef(data, buffer.size);
+    buffer.data = nullptr;
+    buffer.size = buffer.capacity = 0;
+    return values;
+  }
+
+private:
+  struct FreeDeleter {
+    void operator()(void *ptr) const { std::free(ptr); }
+  };
+
+  llvm::BumpPtrAllocator allocator;
+  /// The storage taken from the buffers, see adopt.
+  std::vector<std::unique_ptr<void, FreeDeleter>> adopted;
+};
 
 /// A variable type with either name or shape information.
 struct VarType {
-  std::string name;
-  std::vector<int64_t> shape;
+  llvm::StringRef name;
+  llvm::ArrayRef<int64_t> shape;
 };
 
 /// Base class for all expression nodes.
@@ -43,11 +134,12 @@ public:
     Expr_BinOp,
     Expr_Call,
     Expr_Print,
+    Expr_Assign,
+    Expr_For,
   };
 
   ExprAST(ExprASTKind kind, Location location)
       : kind(kind), location(location) {}
-  virtual ~ExprAST() = default;
 
   ExprASTKind getKind() const { return kind; }
 
@@ -59,7 +151,7 @@ private:
 };
 
 /// A block-list of expressions.
-using ExprASTList = std::vector<std::unique_ptr<ExprAST>>;
+using ExprASTList = llvm::ArrayRef<ExprAST *>;
 
 /// Expression class for numeric literals like "1.0".
 class NumberExprAST : public ExprAST {
@@ -74,34 +166,39 @@ public:
   static bool classof(const ExprAST *c) { return c->getKind() == Expr_Num; }
 };
 
-/// Expression class for a literal value.
+/// Expression class for a literal value. The numbers are stored in a single
+/// row-major buffer, whatever the nesting in the source.
 class LiteralExprAST : public ExprAST {
-  std::vector<std::unique_ptr<ExprAST>> values;
-  std::vector<int64_t> dims;
+  llvm::ArrayRef<double> data;
+  llvm::ArrayRef<int64_t> dims;
+  bool splat;
 
 public:
-  LiteralExprAST(Location loc, std::vector<std::unique_ptr<ExprAST>> values,
-                 std::vector<int64_t> dims)
-      : ExprAST(Expr_Literal, loc), values(std::move(values)),
-        dims(std::move(dims)) {}
+  LiteralExprAST(Location loc, llvm::ArrayRef<double> data,
+                 llvm::ArrayRef<int64_t> dims)
+      : ExprAST(Expr_Literal, loc), data(data), dims(dims) {
+    splat = llvm::all_of(data, [&](double value) { return value == data[0]; });
+  }
 
-  llvm::ArrayRef<std::unique_ptr<ExprAST>> getValues() { return values; }
+  llvm::ArrayRef<double> getData() { return data; }
   llvm::ArrayRef<int64_t> getDims() { return dims; }
 
+  /// Return true if all the numbers of the literal are the same.
+  bool isSplat() { return splat; }
+
   /// LLVM style RTTI
   static bool classof(const ExprAST *c) { return c->getKind() == Expr_Literal; }
 };
 
 /// Expression class for a literal struct value.
 class StructLiteralExprAST : public ExprAST {
-  std::vector<std::unique_ptr<ExprAST>> values;
+  llvm::ArrayRef<ExprAST *> values;
 
 public:
-  StructLiteralExprAST(Location loc,
-                       std::vector<std::unique_ptr<ExprAST>> values)
-      : ExprAST(Expr_StructLiteral, loc), values(std::move(values)) {}
+  StructLiteralExprAST(Location loc, llvm::ArrayRef<ExprAST *> values)
+      : ExprAST(Expr_StructLiteral, loc), values(values) {}
 
-  llvm::ArrayRef<std::unique_ptr<ExprAST>> getValues() { return values; }
+  llvm::ArrayRef<ExprAST *> getValues() { return values; }
 
   /// LLVM style RTTI
   static bool classof(const ExprAST *c) {
@@ -111,7 +208,7 @@ public:
 
 /// Expression class for referencing a variable, like "a".
 class VariableExprAST : public ExprAST {
-  std::string name;
+  llvm::StringRef name;
 
 public:
   VariableExprAST(Location loc, llvm::StringRef name)
@@ -125,18 +222,17 @@ public:
 
 /// Expression class for defining a variable.
 class VarDeclExprAST : public ExprAST {
-  std::string name;
+  llvm::StringRef name;
   VarType type;
-  std::unique_ptr<ExprAST> initVal;
+  ExprAST *initVal;
 
 public:
   VarDeclExprAST(Location loc, llvm::StringRef name, VarType type,
-                 std::unique_ptr<ExprAST> initVal = nullptr)
-      : ExprAST(Expr_VarDecl, loc), name(name), type(std::move(type)),
-        initVal(std::move(initVal)) {}
+                 ExprAST *initVal = nullptr)
+      : ExprAST(Expr_VarDecl, loc), name(name), type(type), initVal(initVal) {}
 
   llvm::StringRef getName() { return name; }
-  ExprAST *getInitVal() { return initVal.get(); }
+  ExprAST *getInitVal() { return initVal; }
   const VarType &getType() { return type; }
 
   /// LLVM style RTTI
@@ -145,15 +241,15 @@ public:
 
 /// Expression class for a return operator.
 class ReturnExprAST : public ExprAST {
-  llvm::Optional<std::unique_ptr<ExprAST>> expr;
+  ExprAST *expr;
 
 public:
-  ReturnExprAST(Location loc, llvm::Optional<std::unique_ptr<ExprAST>> expr)
-      : ExprAST(Expr_Return, loc), expr(std::move(expr)) {}
+  ReturnExprAST(Location loc, ExprAST *expr = nullptr)
+      : ExprAST(Expr_Return, loc), expr(expr) {}
 
   llvm::Optional<ExprAST *> getExpr() {
-    if (expr.hasValue())
-      return expr->get();
+    if (expr)
+      return expr;
     return llvm::None;
   }
 
@@ -164,17 +260,15 @@ public:
 /// Expression class for a binary operator.
 class BinaryExprAST : public ExprAST {
   char op;
-  std::unique_ptr<ExprAST> lhs, rhs;
+  ExprAST *lhs, *rhs;
 
 public:
   char getOp() { return op; }
-  ExprAST *getLHS() { return lhs.get(); }
-  ExprAST *getRHS() { return rhs.get(); }
+  ExprAST *getLHS() { return lhs; }
+  ExprAST *getRHS() { return rhs; }
 
-  BinaryExprAST(Location loc, char Op, std::unique_ptr<ExprAST> lhs,
-                std::unique_ptr<ExprAST> rhs)
-      : ExprAST(Expr_BinOp, loc), op(Op), lhs(std::move(lhs)),
-        rhs(std::move(rhs)) {}
+  BinaryExprAST(Location loc, char Op, ExprAST *lhs, ExprAST *rhs)
+      : ExprAST(Expr_BinOp, loc), op(Op), lhs(lhs), rhs(rhs) {}
 
   /// LLVM style RTTI
   static bool classof(const ExprAST *c) { return c->getKind() == Expr_BinOp; }
@@ -182,16 +276,16 @@ public:
 
 /// Expression class for function calls.
 class CallExprAST : public ExprAST {
-  std::string callee;
-  std::vector<std::unique_ptr<ExprAST>> args;
+  llvm::StringRef callee;
+  llvm::ArrayRef<ExprAST *> args;
 
 public:
-  CallExprAST(Location loc, const std::string &callee,
-              std::vector<std::unique_ptr<ExprAST>> args)
-      : ExprAST(Expr_Call, loc), callee(callee), args(std::move(args)) {}
+  CallExprAST(Location loc, llvm::StringRef callee,
+              llvm::ArrayRef<ExprAST *> args)
+      : ExprAST(Expr_Call, loc), callee(callee), args(args) {}
 
   llvm::StringRef getCallee() { return callee; }
-  llvm::ArrayRef<std::unique_ptr<ExprAST>> getArgs() { return args; }
+  llvm::ArrayRef<ExprAST *> getArgs() { return args; }
 
   /// LLVM style RTTI
   static bool classof(const ExprAST *c) { return c->getKind() == Expr_Call; }
@@ -199,34 +293,72 @@ public:
 
 /// Expression class for builtin print calls.
 class PrintExprAST : public ExprAST {
-  std::unique_ptr<ExprAST> arg;
+  ExprAST *arg;
 
 public:
-  PrintExprAST(Location loc, std::unique_ptr<ExprAST> arg)
-      : ExprAST(Expr_Print, loc), arg(std::move(arg)) {}
+  PrintExprAST(Location loc, ExprAST *arg)
+      : ExprAST(Expr_Print, loc), arg(arg) {}
 
-  ExprAST *getArg() { return arg.get(); }
+  ExprAST *getArg() { return arg; }
 
   /// LLVM style RTTI
   static bool classof(const ExprAST *c) { return c->getKind() == Expr_Print; }
 };
 
+/// Expression class for assigning a new value to a variable, like "a = b * c".
+class AssignExprAST : public ExprAST {
+  llvm::StringRef name;
+  ExprAST *value;
+
+public:
+  AssignExprAST(Location loc, llvm::StringRef name, ExprAST *value)
+      : ExprAST(Expr_Assign, loc), name(name), value(value) {}
+
+  llvm::StringRef getName() { return name; }
+  ExprAST *getValue() { return value; }
+
+  /// LLVM style RTTI
+  static bool classof(const ExprAST *c) { return c->getKind() == Expr_Assign; }
+};
+
+/// Expression class for a counted loop, like "for i in 0..10 { ... }". The
+/// bounds are integer literals, the upper bound is excluded.
+class ForExprAST : public ExprAST {
+  llvm::StringRef inductionVar;
+  int64_t lowerBound, upperBound;
+  ExprASTList body;
+
+public:
+  ForExprAST(Location loc, llvm::StringRef inductionVar, int64_t lowerBound,
+             int64_t upperBound, ExprASTList body)
+      : ExprAST(Expr_For, loc), inductionVar(inductionVar),
+        lowerBound(lowerBound), upperBound(upperBound), body(body) {}
+
+  llvm::StringRef getInductionVar() { return inductionVar; }
+  int64_t getLowerBound() { return lowerBound; }
+  int64_t getUpperBound() { return upperBound; }
+  ExprASTList getBody() { return body; }
+
+  /// LLVM style RTTI
+  static bool classof(const ExprAST *c) { return c->getKind() == Expr_For; }
+};
+
 /// This class represents the "prototype" for a function, which captures its
 /// name, and its argument names (thus implicitly the number of arguments the
 /// function takes).
 class PrototypeAST {
   Location location;
-  std::string name;
-  std::vector<std::unique_ptr<VarDeclExprAST>> args;
+  llvm::StringRef name;
+  llvm::ArrayRef<VarDeclExprAST *> args;
 
 public:
-  PrototypeAST(Location location, const std::string &name,
-               std::vector<std::unique_ptr<VarDeclExprAST>> args)
-      : location(location), name(name), args(std::move(args)) {}
+  PrototypeAST(Location location, llvm::StringRef name,
+               llvm::ArrayRef<VarDeclExprAST *> args)
+      : location(location), name(name), args(args) {}
 
   const Location &loc() { return location; }
   llvm::StringRef getName() const { return name; }
-  llvm::ArrayRef<std::unique_ptr<VarDeclExprAST>> getArgs() { return args; }
+  llvm::ArrayRef<VarDeclExprAST *> getArgs() { return args; }
 };
 
 /// This class represents a top level record in a module.
@@ -238,7 +370,6 @@ public:
   };
 
   RecordAST(RecordASTKind kind) : kind(kind) {}
-  virtual ~RecordAST() = default;
 
   RecordASTKind getKind() const { return kind; }
 
@@ -248,16 +379,14 @@ private:
 
 /// This class represents a function definition itself.
 class FunctionAST : public RecordAST {
-  std::unique_ptr<PrototypeAST> proto;
-  std::unique_ptr<ExprASTList> body;
+  PrototypeAST *proto;
+  ExprASTList body;
 
 public:
-  FunctionAST(std::unique_ptr<PrototypeAST> proto,
-              std::unique_ptr<ExprASTList> body)
-      : RecordAST(Record_Function), proto(std::move(proto)),
-        body(std::move(body)) {}
-  PrototypeAST *getProto() { return proto.get(); }
-  ExprASTList *getBody() { return body.get(); }
+  FunctionAST(PrototypeAST *proto, ExprASTList body)
+      : RecordAST(Record_Function), proto(proto), body(body) {}
+  PrototypeAST *getProto() { return proto; }
+  ExprASTList getBody() { return body; }
 
   /// LLVM style RTTI
   static bool classof(const RecordAST *R) {
@@ -268,20 +397,18 @@ public:
 /// This class represents a struct definition.
 class StructAST : public RecordAST {
   Location location;
-  std::string name;
-  std::vector<std::unique_ptr<VarDeclExprAST>> variables;
+  llvm::StringRef name;
+  llvm::ArrayRef<VarDeclExprAST *> variables;
 
 public:
-  StructAST(Location location, const std::string &name,
-            std::vector<std::unique_ptr<VarDeclExprAST>> variables)
+  StructAST(Location location, llvm::StringRef name,
+            llvm::ArrayRef<VarDeclExprAST *> variables)
       : RecordAST(Record_Struct), location(location), name(name),
-        variables(std::move(variables)) {}
+        variables(variables) {}
 
   const Location &loc() { return location; }
   llvm::StringRef getName() const { return name; }
-  llvm::ArrayRef<std::unique_ptr<VarDeclExprAST>> getVariables() {
-    return variables;
-  }
+  llvm::ArrayRef<VarDeclExprAST *> getVariables() { return variables; }
 
   /// LLVM style RTTI
   static bool classof(const RecordAST *R) {
@@ -289,16 +416,35 @@ public:
   }
 };
 
-/// This class represents a list of functions to be processed together
+/// This class represents the import of the definitions of another file.
+class ImportAST {
+  Location location;
+  llvm::StringRef path;
+
+public:
+  ImportAST(Location location, llvm::StringRef path)
+      : location(location), path(path) {}
+
+  const Location &loc() { return location; }
+  llvm::StringRef getPath() const { return path; }
+};
+
+/// This class represents a list of functions to be processed together, with
+/// the files they import. It owns the arena of its nodes.
 class ModuleAST {
-  std::vector<std::unique_ptr<RecordAST>> records;
+  std::unique_ptr<ASTArena> arena;
+  llvm::ArrayRef<RecordAST *> records;
+  llvm::ArrayRef<ImportAST *> imports;
 
 public:
-  ModuleAST(std::vector<std::unique_ptr<RecordAST>> records)
-      : records(std::move(records)) {}
+  ModuleAST(std::unique_ptr<ASTArena> arena,
+            llvm::ArrayRef<RecordAST *> records,
+            llvm::ArrayRef<ImportAST *> imports = llvm::None)
+      : arena(std::move(arena)), records(records), imports(imports) {}
 
   auto begin() -> decltype(records.begin()) { return records.begin(); }
   auto end() -> decltype(records.end()) { return records.end(); }
+  llvm::ArrayRef<ImportAST *> getImports() { return imports; }
 };
 
 void dump(ModuleAST &);
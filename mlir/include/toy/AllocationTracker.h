@@ -0,0 +1,90 @@
+//===- AllocationTracker.h - Toy allocation telemetry -----------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares the allocation tracker of the Toy programs. When tracking
+// allocations, the compiled code reports each buffer it allocates and
+// deallocates, and the memory traffic of each function call, to the runtime
+// functions below.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef MLIR_TUTORIAL_TOY_ALLOCATIONTRACKER_H_
+#define MLIR_TUTORIAL_TOY_ALLOCATIONTRACKER_H_
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringRef.h"
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace llvm {
+class raw_ostream;
+} // namespace llvm
+
+namespace toy {
+
+/// The allocations of the process: the live bytes and their high-water mark,
+/// and the bytes allocated at each source location. Allocations can be
+/// recorded concurrently from any thread.
+class AllocationTracker {
+public:
+  /// Return the allocation tracker of the process.
+  static AllocationTracker &get();
+
+  /// Clear the statistics.
+  void reset();
+
+  /// Record the allocation of the buffer `ptr` of `bytes` bytes at `location`.
+  /// The location is a constant of the compiled code, identified by its
+  /// address.
+  void recordAlloc(const void *ptr, int64_t bytes, const char *location);
+
+  /// Record the deallocation of the buffer `ptr`.
+  void recordDealloc(const void *ptr);
+
+  /// Record `bytes` bytes loaded or stored.
+  void recordTraffic(int64_t bytes);
+
+  /// Print the statistics, and the locations by decreasing bytes allocated.
+  /// The traffic is reported as a bandwidth over the `seconds` the program
+  /// ran.
+  void printReport(llvm::raw_ostream &os, double seconds);
+
+private:
+  struct Site {
+    std::string location;
+    uint64_t allocations = 0;
+    int64_t bytes = 0;
+  };
+
+  AllocationTracker() = default;
+
+  std::mutex mutex;
+  std::vector<Site> sites;
+  llvm::DenseMap<const char *, unsigned> siteIds;
+  /// The size of each live buffer.
+  llvm::DenseMap<const void *, int64_t> liveBuffers;
+  int64_t liveBytes = 0;
+  int64_t peakBytes = 0;
+  int64_t totalBytes = 0;
+  uint64_t allocations = 0;
+  uint64_t deallocations = 0;
+  int64_t trafficBytes = 0;
+};
+
+/// Return the runtime functions called by the compiled code, by name, to make
+/// them visible to it.
+std::vector<std::pair<llvm::StringRef, void *>>
+getAllocationTrackerRuntimeSymbols();
+
+} // namespace toy
+
+#endif // MLIR_TUTORIAL_TOY_ALLOCATIONTRACKER_H_
@@ -0,0 +1,86 @@
+//===- BatchRunner.h - Run a Toy kernel over many files ---------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares the batch runner, which invokes a kernel compiled once
+// (see toy/ToyCompiler.h) on the inputs of many jobs in parallel. The arguments
+// and the result of a job are files of raw f64 elements in row-major order.
+// The inputs are memory-mapped and passed to the kernel in place.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef MLIR_TUTORIAL_TOY_BATCHRUNNER_H_
+#define MLIR_TUTORIAL_TOY_BATCHRUNNER_H_
+
+#include "toy/ToyCompiler.h"
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Error.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace llvm {
+class raw_ostream;
+} // namespace llvm
+
+namespace toy {
+
+/// A job of a batch: the files of the arguments of the kernel, and the file
+/// its result is written to.
+struct BatchJob {
+  std::string outputFilename;
+  std::vector<std::string> inputFilenames;
+};
+
+/// Parse the manifest of a batch, with a job per line: its output file then
+/// its input files, separated by whitespace. Blank lines and the comments
+/// starting with '#' are ignored, and the relative paths are resolved against
+/// `baseDir`.
+llvm::Expected<std::vector<BatchJob>>
+parseBatchManifest(llvm::StringRef manifest, llvm::StringRef baseDir);
+
+/// The measurements of a batch.
+struct BatchResult {
+  /// The latency of each job, from mapping its inputs to writing its result,
+  /// in seconds.
+  std::vector<double> seconds;
+  /// The time of the whole batch, in seconds.
+  double wallSeconds = 0;
+  /// The bytes of the inputs read and of the results written.
+  uint64_t numBytes = 0;
+  /// The error of each failed job, which isn't timed.
+  std::vector<std::string> errors;
+};
+
+/// The function running a job, which returns the bytes it read and wrote.
+using BatchJobFn =
+    llvm::function_ref<llvm::Expected<uint64_t>(const BatchJob &job)>;
+
+/// Run each job of `jobs` with `runJob`, with `numThreads` threads, or one per
+/// core if 0. The threads claim the jobs one at a time, in order, and a failed
+/// job doesn't stop the others.
+BatchResult runBatch(llvm::ArrayRef<BatchJob> jobs, BatchJobFn runJob,
+                     unsigned numThreads);
+
+/// Invoke the kernel `kernel` of `module` on each job of `jobs`, with
+/// `numThreads` threads (see above).
+BatchResult runBatch(const CompiledModule &module,
+                     const KernelSignature &kernel,
+                     llvm::ArrayRef<BatchJob> jobs, unsigned numThreads);
+
+/// Write the statistics of `result` as JSON: the throughput in jobs and bytes
+/// per second, and the latency percentiles of the jobs in milliseconds.
+void writeBatchJSON(llvm::raw_ostream &os, llvm::StringRef name,
+                    const BatchResult &result);
+
+} // namespace toy
+
+#endif // MLIR_TUTORIAL_TOY_BATCHRUNNER_H_
@@ -0,0 +1,57 @@
+//===- Benchmark.h - Benchmark harness of Toy programs ----------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares the benchmark harness of the Toy programs: the entry
+// point of a compiled program is run many times, each run is timed, and the
+// hardware counters of the runs are read where the host exposes them.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef MLIR_TUTORIAL_TOY_BENCHMARK_H_
+#define MLIR_TUTORIAL_TOY_BENCHMARK_H_
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/StringRef.h"
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace llvm {
+class raw_ostream;
+} // namespace llvm
+
+namespace toy {
+
+/// The measurements of the runs of a benchmark.
+struct BenchmarkResult {
+  /// The time of each run, in seconds, in the order they ran.
+  std::vector<double> seconds;
+  /// The total of each hardware counter over the runs, by name. Empty where
+  /// the counters aren't available, e.g. outside of Linux or in a container.
+  std::vector<std::pair<std::string, uint64_t>> counters;
+};
+
+/// Run `body` `numWarmups` times, then time `numRuns` runs of it.
+BenchmarkResult runBenchmark(llvm::function_ref<void()> body, unsigned numRuns,
+                             unsigned numWarmups);
+
+/// Return the `percentile`th percentile of the sorted `values`, by the nearest
+/// rank, or 0 if there are none.
+double getPercentile(llvm::ArrayRef<double> values, double percentile);
+
+/// Write the statistics of `result` as JSON: the latency percentiles in
+/// milliseconds, the throughput in runs per second, and the counters per run.
+void writeBenchmarkJSON(llvm::raw_ostream &os, llvm::StringRef name,
+                        const BenchmarkResult &result);
+
+} // namespace toy
+
+#endif // MLIR_TUTORIAL_TOY_BENCHMARK_H_
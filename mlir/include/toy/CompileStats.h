@@ -0,0 +1,127 @@
+//===- CompileStats.h - Compile-time telemetry of toyc ----------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares the compile-time telemetry of the Toy compiler: the time
+// spent in each stage of a compilation, the effect of each pass on the size of
+// the IR, the canonicalization patterns applied, and the peak memory use. The
+// report is written as JSON, laid out so that the reports of two compilations
+// can be diffed line by line.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef MLIR_TUTORIAL_TOY_COMPILESTATS_H_
+#define MLIR_TUTORIAL_TOY_COMPILESTATS_H_
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringRef.h"
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace llvm {
+class raw_ostream;
+} // namespace llvm
+
+namespace mlir {
+class Pass;
+class PassManager;
+} // namespace mlir
+
+namespace toy {
+
+/// The telemetry of a compilation. Stages and passes can be recorded
+/// concurrently from any thread.
+class CompileStats {
+public:
+  /// Measure the bytes of the textual form of the IR before and after each
+  /// pass if `measureIRBytes` is set. The IR is then printed twice per pass,
+  /// which slows the compilation down: the times of the stages, and of the
+  /// pass managers running the nested passes, include the printing.
+  explicit CompileStats(bool measureIRBytes = false)
+      : measureIRBytes(measureIRBytes) {}
+
+  /// Whose CPU time a stage counts: the whole process, including the threads
+  /// the stage runs work on, or only the thread timing it. A stage running
+  /// concurrently with others of the same name counts its thread, so that
+  /// their times don't each include the others'.
+  enum class CPUTimeScope { Process, Thread };
+
+  /// Time a stage of the compilation, from construction to destruction. The
+  /// times of the stages with the same name add up. Nothing is recorded when
+  /// `stats` is null, so that stages can be timed unconditionally.
+  class Stage {
+  public:
+    Stage(CompileStats *stats, llvm::StringRef name,
+          CPUTimeScope scope = CPUTimeScope::Process);
+    ~Stage();
+
+  private:
+    CompileStats *stats;
+    std::string name;
+    CPUTimeScope scope;
+    std::chrono::steady_clock::time_point wallStart;
+    std::chrono::nanoseconds cpuStart;
+  };
+
+  /// Record the time of each pass run by `pm`, and the IR before and after.
+  void instrument(mlir::PassManager &pm);
+
+  /// Write the report. The stages come in the order they first ran and the
+  /// passes in the order of the pipeline, which are the same from one
+  /// compilation of a program to the next.
+  void writeJSON(llvm::raw_ostream &os);
+
+private:
+  class Instrumentation;
+
+  struct StageStats {
+    std::string name;
+    unsigned runs = 0;
+    double wallSeconds = 0;
+    double cpuSeconds = 0;
+  };
+  /// The size of some IR: its operations, the bytes of its textual form if
+  /// measured, and the results whose shape is still unknown.
+  struct IRSize {
+    int64_t ops = 0;
+    int64_t bytes = 0;
+    int64_t unrankedResults = 0;
+  };
+  /// The runs of a pass. A nested pass runs once per operation, e.g. per
+  /// function, and the sizes are those of the operations it ran on.
+  struct PassStats {
+    std::string name;
+    std::string anchor;
+    unsigned runs = 0;
+    double wallSeconds = 0;
+    IRSize before;
+    IRSize after;
+  };
+
+  void recordStage(llvm::StringRef name, double wallSeconds,
+                   double cpuSeconds);
+  /// Return the index of `pass` in `passes`, adding it on its first run.
+  unsigned getPassId(const mlir::Pass *pass, llvm::StringRef anchor);
+  void recordPass(unsigned passId, double wallSeconds, const IRSize &before,
+                  const IRSize &after);
+
+  bool measureIRBytes;
+  std::mutex mutex;
+  std::vector<StageStats> stages;
+  std::vector<PassStats> passes;
+  /// The index of each pass in `passes`. The copies of a pass running on
+  /// other threads are identified with the original.
+  llvm::DenseMap<const mlir::Pass *, unsigned> passIds;
+};
+
+} // namespace toy
+
+#endif // MLIR_TUTORIAL_TOY_COMPILESTATS_H_
@@ -0,0 +1,76 @@
+//===- CostModel.h - Static cost model of Toy functions ---------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares the static cost model of the Toy functions. The cost of a
+// function is counted in floating point operations and bytes moved, from the
+// shapes of the Toy operations or from the trip counts of the affine loops.
+// Placed on the roofline of the host, it predicts whether the function is
+// bound by compute or by memory, and how long it runs.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef MLIR_TUTORIAL_TOY_COSTMODEL_H_
+#define MLIR_TUTORIAL_TOY_COSTMODEL_H_
+
+#include <cstdint>
+
+namespace mlir {
+class FuncOp;
+
+namespace toy {
+
+/// The work of some code: the floating point operations it performs and the
+/// bytes it loads and stores.
+struct Cost {
+  int64_t flops = 0;
+  int64_t bytes = 0;
+
+  /// Return the operations performed per byte moved.
+  double getIntensity() const {
+    return bytes ? static_cast<double>(flops) / bytes : 0.0;
+  }
+
+  Cost &operator+=(const Cost &other) {
+    flops += other.flops;
+    bytes += other.bytes;
+    return *this;
+  }
+};
+
+/// The roofline of a machine: its peak floating point throughput and its
+/// memory bandwidth.
+struct MachineModel {
+  double flopsPerSecond = 0;
+  double bytesPerSecond = 0;
+
+  /// Return the intensity above which code is bound by compute rather than by
+  /// memory.
+  double getRidgePoint() const { return flopsPerSecond / bytesPerSecond; }
+
+  /// Return whether code of the given cost is bound by compute.
+  bool isComputeBound(const Cost &cost) const {
+    return cost.getIntensity() >= getRidgePoint();
+  }
+
+  /// Return the time code of the given cost takes at best, in seconds.
+  double predictSeconds(const Cost &cost) const;
+};
+
+/// Return the roofline of a core of the host, measured by micro-benchmarks on
+/// the first call.
+const MachineModel &getHostMachineModel();
+
+/// Estimate the cost of a call of `function`, not counting the functions it
+/// calls. The Toy operations of unknown shape aren't counted, and the loops of
+/// unknown trip count are assumed to run once.
+Cost estimateCost(FuncOp function);
+
+} // namespace toy
+} // namespace mlir
+
+#endif // MLIR_TUTORIAL_TOY_COSTMODEL_H_
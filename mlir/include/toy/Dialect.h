@@ -70,6 +70,29 @@ public:
   /// Returns the number of element type held by this struct.
   size_t getNumElementTypes() { return getElementTypes().size(); }
 };
+
+//===----------------------------------------------------------------------===//
+// Toy Sparse Tensors
+//===----------------------------------------------------------------------===//
+
+/// Return whether `type` is a tensor with a sparse encoding: a value computed
+/// from sparse constants, most of whose elements are zeros.
+bool isSparseTensor(mlir::Type type);
+
+/// Return the ranked tensor type `type` with a sparse encoding if `sparse`, or
+/// without encoding otherwise.
+mlir::RankedTensorType getTensorType(mlir::RankedTensorType type, bool sparse);
+
+/// Return the type of the tensor constant `value`, sparse for a
+/// SparseElementsAttr.
+mlir::RankedTensorType getConstantTensorType(mlir::ElementsAttr value);
+
+/// Return whether a tensor of `numElements` elements, of which `numNonZeros`
+/// may be nonzero, is worth storing and computing sparse: at most a quarter of
+/// its elements are nonzero.
+inline bool isSparseEnough(int64_t numNonZeros, int64_t numElements) {
+  return 4 * numNonZeros <= numElements;
+}
 } // namespace toy
 } // namespace mlir
 
@@ -0,0 +1,54 @@
+//===- FrontEnd.h - Parallel front end for Toy files ------------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares the front end compiling several Toy files, and the files
+// they import, into a single MLIR module. The files are parsed and emitted in
+// parallel on the thread pool of the MLIRContext.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef MLIR_TUTORIAL_TOY_FRONTEND_H_
+#define MLIR_TUTORIAL_TOY_FRONTEND_H_
+
+#include "toy/AST.h"
+
+#include "mlir/IR/BuiltinOps.h"
+#include "mlir/Support/LogicalResult.h"
+#include "llvm/ADT/ArrayRef.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace toy {
+
+/// A parsed Toy file.
+struct ToyFile {
+  std::string path;
+  std::unique_ptr<ModuleAST> ast;
+
+  /// The indices of the files it imports.
+  std::vector<unsigned> imports;
+};
+
+/// Parse the files `filenames` and, transitively, the files they import into
+/// `files`, starting with `filenames` in order. An import is relative to the
+/// directory of the importing file, and each file is parsed only once.
+mlir::LogicalResult parseToyFiles(mlir::MLIRContext &context,
+                                  llvm::ArrayRef<std::string> filenames,
+                                  std::vector<ToyFile> &files);
+
+/// Emit a module for each file, once the modules of the files it imports are
+/// emitted, then merge them into a single module. Returns nullptr on failure,
+/// in particular for an import cycle or a function defined twice.
+mlir::OwningModuleRef mlirGenToyFiles(mlir::MLIRContext &context,
+                                      llvm::ArrayRef<ToyFile> files);
+
+} // namespace toy
+
+#endif // MLIR_TUTORIAL_TOY_FRONTEND_H_
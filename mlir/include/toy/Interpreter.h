@@ -0,0 +1,44 @@
+//===- Interpreter.h - Reference interpreter of the Toy dialect -*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares an interpreter of the Toy dialect, which runs the main
+// function of a module once its shapes are inferred, without lowering it. A
+// small program is interpreted faster than it is compiled by the JIT. The
+// interpreter prints the same output as the lowered code: the elements are
+// rounded the same way, and the elements of the values known to be zero (see
+// toy/Sparsity.h) are zeros.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef MLIR_TUTORIAL_TOY_INTERPRETER_H_
+#define MLIR_TUTORIAL_TOY_INTERPRETER_H_
+
+#include "mlir/Support/LogicalResult.h"
+#include "llvm/ADT/Optional.h"
+
+#include <cstdint>
+
+namespace mlir {
+class ModuleOp;
+
+namespace toy {
+
+/// Estimate the work of interpreting the main function of `module`: the
+/// elements it computes and copies, and the operations it runs, counting the
+/// functions it calls at each call. Return None if the module can't be
+/// interpreted, e.g. its shapes aren't all inferred.
+llvm::Optional<uint64_t> estimateInterpreterWork(ModuleOp module);
+
+/// Interpret the main function of `module`, which must be interpretable (see
+/// estimateInterpreterWork), printing to the standard output.
+LogicalResult interpretMain(ModuleOp module);
+
+} // namespace toy
+} // namespace mlir
+
+#endif // MLIR_TUTORIAL_TOY_INTERPRETER_H_
@@ -0,0 +1,46 @@
+//===- Layout.h - Physical layouts of the Toy matrices ----------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares the physical layouts of the matrices of the Toy code
+// lowered to buffers. A column-major matrix is stored as its transpose, so that
+// transposing a matrix into the other layout moves no data: the consumers of a
+// value index its buffer according to its layout. The layouts are chosen by the
+// layout propagation pass, and followed by the lowering to affine loops.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef MLIR_TUTORIAL_TOY_LAYOUT_H_
+#define MLIR_TUTORIAL_TOY_LAYOUT_H_
+
+#include "llvm/ADT/StringRef.h"
+
+namespace mlir {
+class Value;
+
+namespace toy {
+
+/// The order in which the elements of a matrix are stored.
+enum class Layout {
+  /// The elements of a row are contiguous, the default.
+  RowMajor,
+  /// The elements of a column are contiguous.
+  ColumnMajor,
+};
+
+/// Return the name of the attribute of the Toy operations giving the layout
+/// of their result, "row_major" or "col_major".
+inline llvm::StringRef getLayoutAttrName() { return "toy.layout"; }
+
+/// Return the layout of `value`, row-major unless its defining operation has a
+/// column-major layout attribute.
+Layout getLayout(Value value);
+
+} // namespace toy
+} // namespace mlir
+
+#endif // MLIR_TUTORIAL_TOY_LAYOUT_H_
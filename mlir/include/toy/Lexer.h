@@ -13,20 +13,17 @@
 #ifndef MLIR_TUTORIAL_TOY_LEXER_H_
 #define MLIR_TUTORIAL_TOY_LEXER_H_
 
+#include "toy/SourceManager.h"
+
+#include "llvm/ADT/SmallString.h"
 #include "llvm/ADT/StringRef.h"
 
-#include <memory>
-#include <string>
+#include <cassert>
+#include <cctype>
+#include <cstdlib>
 
 namespace toy {
 
-/// Structure definition a location in a file.
-struct Location {
-  std::shared_ptr<std::string> file; ///< filename.
-  int line;                          ///< line number.
-  int col;                           ///< column number.
-};
-
 // List of Token returned by the lexer.
 enum Token : int {
   tok_semicolon = ';',
@@ -44,26 +41,26 @@ enum Token : int {
   tok_var = -3,
   tok_def = -4,
   tok_struct = -5,
+  tok_import = -8,
+  tok_for = -10,
+  tok_in = -11,
 
   // primary
   tok_identifier = -6,
   tok_number = -7,
+  tok_string = -9,
 };
 
-/// The Lexer is an abstract base class providing all the facilities that the
-/// Parser expects. It goes through the stream one token at a time and keeps
-/// track of the location in the file for debugging purpose.
-/// It relies on a subclass to provide a `readNextLine()` method. The subclass
-/// can proceed by reading the next line from the standard input or from a
-/// memory mapped file.
+/// The Lexer goes through the buffer of a source one token at a time, and
+/// keeps track of the location of the current token for debugging purpose.
+/// Identifiers are returned as references into the buffer, which is owned by
+/// the SourceManager and outlives the lexer.
 class Lexer {
 public:
-  /// Create a lexer for the given filename. The filename is kept only for
-  /// debugging purpose (attaching a location to a Token).
-  Lexer(std::string filename)
-      : lastLocation(
-            {std::make_shared<std::string>(std::move(filename)), 0, 0}) {}
-  virtual ~Lexer() = default;
+  /// Create a lexer for the source `file` of the SourceManager.
+  Lexer(uint32_t file)
+      : buffer(SourceManager::get().getBuffer(file)), curPtr(buffer.begin()),
+        lastLocation({file, 0}) {}
 
   /// Look at the current token in the stream.
   Token getCurToken() { return curTok; }
@@ -90,145 +87,143 @@ public:
     return numVal;
   }
 
+  /// Return the contents of the current string, without the quotes (prereq:
+  /// getCurToken() == tok_string)
+  llvm::StringRef getString() {
+    assert(curTok == tok_string);
+    return identifierStr;
+  }
+
   /// Return the location for the beginning of the current token.
   Location getLastLocation() { return lastLocation; }
 
-  // Return the current line in the file.
-  int getLine() { return curLineNum; }
-
-  // Return the current column in the file.
-  int getCol() { return curCol; }
-
 private:
-  /// Delegate to a derived class fetching the next line. Returns an empty
-  /// string to signal end of file (EOF). Lines are expected to always finish
-  /// with "\n"
-  virtual llvm::StringRef readNextLine() = 0;
-
-  /// Return the next character from the stream. This manages the buffer for the
-  /// current line and request the next line buffer to the derived class as
-  /// needed.
-  int getNextChar() {
-    // The current line buffer should not be empty unless it is the end of file.
-    if (curLineBuffer.empty())
-      return EOF;
-    ++curCol;
-    auto nextchar = curLineBuffer.front();
-    curLineBuffer = curLineBuffer.drop_front();
-    if (curLineBuffer.empty())
-      curLineBuffer = readNextLine();
-    if (nextchar == '\n') {
-      ++curLineNum;
-      curCol = 0;
-    }
-    return nextchar;
-  }
-
-  ///  Return the next token from standard input.
+  /// Return the next token from the buffer.
   Token getTok() {
-    // Skip any whitespace.
-    while (isspace(lastChar))
-      lastChar = Token(getNextChar());
-
-    // Save the current location before reading the token characters.
-    lastLocation.line = curLineNum;
-    lastLocation.col = curCol;
-
-    // Identifier: [a-zA-Z][a-zA-Z0-9_]*
-    if (isalpha(lastChar)) {
-      identifierStr = (char)lastChar;
-      while (isalnum((lastChar = Token(getNextChar()))) || lastChar == '_')
-        identifierStr += (char)lastChar;
-
-      if (identifierStr == "return")
-        return tok_return;
-      if (identifierStr == "def")
-        return tok_def;
-      if (identifierStr == "struct")
-        return tok_struct;
-      if (identifierStr == "var")
-        return tok_var;
-      return tok_identifier;
-    }
-
-    // Number: [0-9] ([0-9.])*
-    if (isdigit(lastChar)) {
-      std::string numStr;
-      do {
-        numStr += lastChar;
-        lastChar = Token(getNextChar());
-      } while (isdigit(lastChar) || lastChar == '.');
-
-      numVal = strtod(numStr.c_str(), nullptr);
-      return tok_number;
+    const char *end = buffer.end();
+    while (true) {
+      // Skip any whitespace.
+      while (curPtr != end && isspace(*curPtr))
+        ++curPtr;
+
+      // Save the current location before reading the token characters.
+      const char *tokStart = curPtr;
+      lastLocation.offset = tokStart - buffer.begin();
+
+      // Check for end of file.
+      if (curPtr == end)
+        return tok_eof;
+      char curChar = *curPtr++;
+
+      // Identifier: [a-zA-Z][a-zA-Z0-9_]*
+      if (isalpha(curChar)) {
+        while (curPtr != end && (isalnum(*curPtr) || *curPtr == '_'))
+          ++curPtr;
+        identifierStr = llvm::StringRef(tokStart, curPtr - tokStart);
+
+        if (identifierStr == "return")
+          return tok_return;
+        if (identifierStr == "def")
+          return tok_def;
+        if (identifierStr == "struct")
+          return tok_struct;
+        if (identifierStr == "var")
+          return tok_var;
+        if (identifierStr == "import")
+          return tok_import;
+        if (identifierStr == "for")
+          return tok_for;
+        if (identifierStr == "in")
+          return tok_in;
+        return tok_identifier;
+      }
+
+      // Number: [0-9] ([0-9.])*, which stops before a range `..`.
+      if (isdigit(curChar)) {
+        while (curPtr != end &&
+               (isdigit(*curPtr) ||
+                (*curPtr == '.' && (curPtr + 1 == end || curPtr[1] != '.'))))
+          ++curPtr;
+
+        numVal = parseNumber(llvm::StringRef(tokStart, curPtr - tokStart));
+        return tok_number;
+      }
+
+      // String: "[^"\n]*"
+      if (curChar == '"') {
+        while (curPtr != end && *curPtr != '"' && *curPtr != '\n')
+          ++curPtr;
+        // An unterminated string is returned as a single quote.
+        if (curPtr == end || *curPtr != '"') {
+          curPtr = tokStart + 1;
+          return Token(curChar);
+        }
+        identifierStr = llvm::StringRef(tokStart + 1, curPtr - tokStart - 1);
+        ++curPtr;
+        return tok_string;
+      }
+
+      // Comment until end of line, then look for the next token.
+      if (curChar == '#') {
+        while (curPtr != end && *curPtr != '\n' && *curPtr != '\r')
+          ++curPtr;
+        continue;
+      }
+
+      // Otherwise, just return the character as its ascii value.
+      return Token(curChar);
     }
+  }
 
-    if (lastChar == '#') {
-      // Comment until end of line.
-      do {
-        lastChar = Token(getNextChar());
-      } while (lastChar != EOF && lastChar != '\n' && lastChar != '\r');
-
-      if (lastChar != EOF)
-        return getTok();
+  /// Return the value of the number `str`, as strtod would. Numbers with few
+  /// enough digits are exactly an integer divided by a power of ten, both
+  /// representable as a double, so a single correctly rounded division gives
+  /// the same result without going through the C library.
+  static double parseNumber(llvm::StringRef str) {
+    static const double powersOfTen[] = {
+        1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+    uint64_t mantissa = 0;
+    unsigned numDigits = 0, numFractionDigits = 0;
+    bool seenDot = false;
+    for (char c : str) {
+      if (c == '.') {
+        if (seenDot)
+          break;
+        seenDot = true;
+        continue;
+      }
+      mantissa = mantissa * 10 + (c - '0');
+      numFractionDigits += seenDot;
+      if (++numDigits > 19)
+        break;
     }
+    if (numDigits <= 19 && mantissa <= (uint64_t(1) << 53) &&
+        numFractionDigits <= 22)
+      return static_cast<double>(mantissa) / powersOfTen[numFractionDigits];
 
-    // Check for end of file.  Don't eat the EOF.
-    if (lastChar == EOF)
-      return tok_eof;
-
-    // Otherwise, just return the character as its ascii value.
-    Token thisChar = Token(lastChar);
-    lastChar = Token(getNextChar());
-    return thisChar;
+    // The buffer isn't null terminated, copy the digits for strtod.
+    llvm::SmallString<32> numStr(str);
+    return strtod(numStr.c_str(), nullptr);
   }
 
+  /// The buffer of the source, and the position of the next character to
+  /// read.
+  llvm::StringRef buffer;
+  const char *curPtr;
+
   /// The last token read from the input.
   Token curTok = tok_eof;
 
   /// Location for `curTok`.
   Location lastLocation;
 
-  /// If the current Token is an identifier, this string contains the value.
-  std::string identifierStr;
+  /// If the current Token is an identifier or a string, this refers to its
+  /// name or its contents.
+  llvm::StringRef identifierStr;
 
   /// If the current Token is a number, this contains the value.
   double numVal = 0;
-
-  /// The last value returned by getNextChar(). We need to keep it around as we
-  /// always need to read ahead one character to decide when to end a token and
-  /// we can't put it back in the stream after reading from it.
-  Token lastChar = Token(' ');
-
-  /// Keep track of the current line number in the input stream
-  int curLineNum = 0;
-
-  /// Keep track of the current column number in the input stream
-  int curCol = 0;
-
-  /// Buffer supplied by the derived class on calls to `readNextLine()`
-  llvm::StringRef curLineBuffer = "\n";
-};
-
-/// A lexer implementation operating on a buffer in memory.
-class LexerBuffer final : public Lexer {
-public:
-  LexerBuffer(const char *begin, const char *end, std::string filename)
-      : Lexer(std::move(filename)), current(begin), end(end) {}
-
-private:
-  /// Provide one line at a time to the Lexer, return an empty string when
-  /// reaching the end of the buffer.
-  llvm::StringRef readNextLine() override {
-    auto *begin = current;
-    while (current <= end && *current && *current != '\n')
-      ++current;
-    if (current <= end && *current)
-      ++current;
-    llvm::StringRef result{begin, static_cast<size_t>(current - begin)};
-    return result;
-  }
-  const char *current, *end;
 };
 } // namespace toy
 
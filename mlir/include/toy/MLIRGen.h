@@ -14,19 +14,65 @@
 #ifndef MLIR_TUTORIAL_TOY_MLIRGEN_H_
 #define MLIR_TUTORIAL_TOY_MLIRGEN_H_
 
-#include <memory>
+#include "mlir/IR/BuiltinOps.h"
+#include "mlir/Support/LogicalResult.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringRef.h"
 
-namespace mlir {
-class MLIRContext;
-class OwningModuleRef;
-} // namespace mlir
+#include <memory>
+#include <utility>
 
 namespace toy {
+class ExprAST;
 class ModuleAST;
+class RecordAST;
+class VarDeclExprAST;
+
+/// A module already emitted, whose definitions are visible to the modules
+/// importing it.
+struct ImportedModule {
+  ModuleAST *ast;
+  mlir::ModuleOp module;
+};
 
 /// Emit IR for the given Toy moduleAST, returns a newly created MLIR module
-/// or nullptr on failure.
-mlir::OwningModuleRef mlirGen(mlir::MLIRContext &context, ModuleAST &moduleAST);
+/// or nullptr on failure. The structs and the functions of the modules
+/// `imports` can be used: the functions are declared in the new module.
+mlir::OwningModuleRef mlirGen(mlir::MLIRContext &context, ModuleAST &moduleAST,
+                              llvm::ArrayRef<ImportedModule> imports = {});
+
+/// Return `loc` with the locations emitted for the Toy sources, which only hold
+/// the offset of their token, resolved to file, line and column locations.
+/// Diagnostics must be printed at the resolved location.
+mlir::Location resolveLocation(mlir::Location loc);
+
+/// Incremental IR generation for the interactive mode. Definitions are emitted
+/// once into a persistent module, and each top-level statement is emitted into
+/// a module of its own together with the definitions it calls.
+class MLIRGenSession {
+public:
+  /// A variable that lives across statements: its declaration and its shape.
+  using Variable = std::pair<VarDeclExprAST *, llvm::ArrayRef<int64_t>>;
+
+  explicit MLIRGenSession(mlir::MLIRContext &context);
+  ~MLIRGenSession();
+
+  /// Emit IR for a function or a struct definition, replacing any previous
+  /// definition with the same name. The record must outlive the session.
+  mlir::LogicalResult addRecord(RecordAST &record);
+
+  /// Emit the statement `stmt` as a public function named `name` in a new
+  /// module, or return nullptr on failure. The function takes the tensor
+  /// `variables` as arguments, in order. It returns the value of the variable
+  /// declared by the statement if any, and prints the value of an expression.
+  /// The AST of any variable declaration must outlive the session.
+  mlir::OwningModuleRef genStatement(ExprAST &stmt, llvm::StringRef name,
+                                     llvm::ArrayRef<Variable> variables);
+
+private:
+  class Impl;
+  std::unique_ptr<Impl> impl;
+};
 } // namespace toy
 
 #endif // MLIR_TUTORIAL_TOY_MLIRGEN_H_
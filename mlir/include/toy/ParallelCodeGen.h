@@ -0,0 +1,46 @@
+//===- ParallelCodeGen.h - Parallel LLVM code generation --------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares the LLVM backend stage of the Toy compiler, which splits
+// the LLVM module to optimize and compile the partitions in parallel.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef MLIR_TUTORIAL_TOY_PARALLELCODEGEN_H_
+#define MLIR_TUTORIAL_TOY_PARALLELCODEGEN_H_
+
+#include "llvm/Support/Error.h"
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace llvm {
+class MemoryBuffer;
+class Module;
+namespace orc {
+class JITTargetMachineBuilder;
+} // namespace orc
+} // namespace llvm
+
+namespace toy {
+
+/// Optimize `module` with `transformer`, then compile it to object files for
+/// the target of `jtmb`. The module is split into `numPartitions` partitions,
+/// each moved to an LLVMContext of its own and processed on one of up to
+/// `numThreads` threads (one per partition if zero). The objects only depend on
+/// the number of partitions, not on the number of threads.
+llvm::Expected<std::vector<std::unique_ptr<llvm::MemoryBuffer>>>
+generateObjects(std::unique_ptr<llvm::Module> module,
+                const llvm::orc::JITTargetMachineBuilder &jtmb,
+                unsigned numPartitions, unsigned numThreads,
+                const std::function<llvm::Error(llvm::Module *)> &transformer);
+
+} // namespace toy
+
+#endif // MLIR_TUTORIAL_TOY_PARALLELCODEGEN_H_
@@ -24,7 +24,6 @@
 
 #include <map>
 #include <utility>
-#include <vector>
 
 namespace toy {
 
@@ -32,96 +31,249 @@ namespace toy {
 /// formed AST from a stream of Token supplied by the Lexer. No semantic checks
 /// or symbol resolution is performed. For example, variables are referenced by
 /// string and the code could reference an undeclared variable and the parsing
-/// succeeds.
+/// succeeds. The nodes are allocated from the arena of the parser.
 class Parser {
 public:
   /// Create a Parser for the supplied lexer.
-  Parser(Lexer &lexer) : lexer(lexer) {}
+  Parser(Lexer &lexer) : lexer(lexer), arena(std::make_unique<ASTArena>()) {}
+
+  /// Return the arena of the nodes parsed so far, which must outlive them.
+  /// This is only needed for the nodes returned by parseRecord() and
+  /// parseStatement(), a module owns the arena of its nodes.
+  std::unique_ptr<ASTArena> takeArena() {
+    auto result = std::move(arena);
+    arena = std::make_unique<ASTArena>();
+    return result;
+  }
 
-  /// Parse a full Module. A module is a list of function definitions.
+  /// Parse a full Module. A module is a list of function definitions and
+  /// imports.
+  /// module ::= (record | import)*
   std::unique_ptr<ModuleAST> parseModule() {
     lexer.getNextToken(); // prime the lexer
 
-    // Parse functions and structs one at a time and accumulate in this vector.
-    std::vector<std::unique_ptr<RecordAST>> records;
-    while (true) {
-      std::unique_ptr<RecordAST> record;
-      switch (lexer.getCurToken()) {
-      case tok_eof:
-        break;
-      case tok_def:
-        record = parseDefinition();
-        break;
-      case tok_struct:
-        record = parseStruct();
-        break;
-      default:
-        return parseError<ModuleAST>("'def' or 'struct'",
-                                     "when parsing top level module records");
+    // Parse functions, structs and imports one at a time and accumulate in
+    // these vectors.
+    llvm::SmallVector<RecordAST *, 16> records;
+    llvm::SmallVector<ImportAST *, 4> imports;
+    while (lexer.getCurToken() != tok_eof) {
+      if (lexer.getCurToken() == tok_import) {
+        ImportAST *import = parseImport();
+        if (!import)
+          break;
+        imports.push_back(import);
+        continue;
       }
+      RecordAST *record = parseRecord();
       if (!record)
         break;
-      records.push_back(std::move(record));
+      records.push_back(record);
     }
 
     // If we didn't reach EOF, there was an error during parsing
-    if (lexer.getCurToken() != tok_eof)
-      return parseError<ModuleAST>("nothing", "at end of module");
+    if (lexer.getCurToken() != tok_eof) {
+      parseError<ModuleAST>("nothing", "at end of module");
+      return nullptr;
+    }
 
-    return std::make_unique<ModuleAST>(std::move(records));
+    llvm::ArrayRef<RecordAST *> recordList = copy<RecordAST *>(records);
+    llvm::ArrayRef<ImportAST *> importList = copy<ImportAST *>(imports);
+    return std::make_unique<ModuleAST>(takeArena(), recordList, importList);
+  }
+
+  /// Parse a top level record: a function or a struct definition.
+  /// record ::= definition | struct
+  RecordAST *parseRecord() {
+    switch (lexer.getCurToken()) {
+    case tok_def:
+      return parseDefinition();
+    case tok_struct:
+      return parseStruct();
+    default:
+      return parseError<RecordAST>("'def' or 'struct'",
+                                   "when parsing top level module records");
+    }
+  }
+
+  /// Parse a single statement, as found in a block or at the top level of an
+  /// interactive session. The terminating semicolon is left to the caller,
+  /// except after a loop, which ends with its block.
+  /// statement ::= decl | assignment | for | "return" | expr
+  ExprAST *parseStatement() {
+    switch (lexer.getCurToken()) {
+    case tok_identifier:
+      // Variable declaration, assignment or call
+      return parseDeclarationOrCallExpr();
+    case tok_for:
+      // Counted loop
+      return parseFor();
+    case tok_var:
+      // Variable declaration
+      return parseDeclaration(/*requiresInitializer=*/true);
+    case tok_return:
+      // Return statement
+      return parseReturn();
+    default:
+      // General expression
+      return parseExpression();
+    }
   }
 
 private:
   Lexer &lexer;
+  std::unique_ptr<ASTArena> arena;
+
+  /// Allocate a node in the arena.
+  template <typename T, typename... Args> T *create(Args &&...args) {
+    return arena->create<T>(std::forward<Args>(args)...);
+  }
+
+  /// Copy a list of children or of numbers into the arena.
+  template <typename T> llvm::ArrayRef<T> copy(llvm::ArrayRef<T> values) {
+    return arena->copy(values);
+  }
+
+  /// Parse the import of another file, whose path is relative to the directory
+  /// of the importing file.
+  /// import ::= import "path" ;
+  ImportAST *parseImport() {
+    auto loc = lexer.getLastLocation();
+    lexer.consume(tok_import);
+    if (lexer.getCurToken() != tok_string)
+      return parseError<ImportAST>("\"path\"", "in import");
+    llvm::StringRef path = lexer.getString();
+    lexer.consume(tok_string);
+    if (lexer.getCurToken() != ';')
+      return parseError<ImportAST>(";", "after import");
+    lexer.consume(Token(';'));
+    return create<ImportAST>(loc, path);
+  }
 
   /// Parse a return statement.
   /// return :== return ; | return expr ;
-  std::unique_ptr<ReturnExprAST> parseReturn() {
+  ReturnExprAST *parseReturn() {
     auto loc = lexer.getLastLocation();
     lexer.consume(tok_return);
 
     // return takes an optional argument
-    llvm::Optional<std::unique_ptr<ExprAST>> expr;
+    ExprAST *expr = nullptr;
     if (lexer.getCurToken() != ';') {
       expr = parseExpression();
       if (!expr)
         return nullptr;
     }
-    return std::make_unique<ReturnExprAST>(std::move(loc), std::move(expr));
+    return create<ReturnExprAST>(loc, expr);
+  }
+
+  /// Parse a counted loop, whose bounds are integer literals. The induction
+  /// variable goes from the lower bound up to the excluded upper bound.
+  /// for ::= for identifier in number .. number block
+  ForExprAST *parseFor() {
+    auto loc = lexer.getLastLocation();
+    lexer.consume(tok_for);
+
+    if (lexer.getCurToken() != tok_identifier)
+      return parseError<ForExprAST>("induction variable", "in loop");
+    llvm::StringRef inductionVar = lexer.getId();
+    lexer.consume(tok_identifier);
+
+    if (lexer.getCurToken() != tok_in)
+      return parseError<ForExprAST>("in", "after induction variable");
+    lexer.consume(tok_in);
+
+    auto lowerBound = parseLoopBound();
+    if (!lowerBound)
+      return nullptr;
+    for (int i = 0; i < 2; ++i) {
+      if (lexer.getCurToken() != '.')
+        return parseError<ForExprAST>("..", "in loop range");
+      lexer.consume(Token('.'));
+    }
+    auto upperBound = parseLoopBound();
+    if (!upperBound)
+      return nullptr;
+
+    auto body = parseBlock();
+    if (!body)
+      return nullptr;
+    return create<ForExprAST>(loc, inductionVar, *lowerBound, *upperBound,
+                              *body);
+  }
+
+  /// Parse the integer literal bound of a loop.
+  llvm::Optional<int64_t> parseLoopBound() {
+    if (lexer.getCurToken() != tok_number ||
+        lexer.getValue() != static_cast<int64_t>(lexer.getValue())) {
+      parseError<ExprAST>("integer", "in loop range");
+      return llvm::None;
+    }
+    int64_t bound = lexer.getValue();
+    lexer.consume(tok_number);
+    return bound;
   }
 
   /// Parse a literal number.
   /// numberexpr ::= number
-  std::unique_ptr<ExprAST> parseNumberExpr() {
+  ExprAST *parseNumberExpr() {
     auto loc = lexer.getLastLocation();
-    auto result =
-        std::make_unique<NumberExprAST>(std::move(loc), lexer.getValue());
+    auto *result = create<NumberExprAST>(loc, lexer.getValue());
     lexer.consume(tok_number);
-    return std::move(result);
+    return result;
   }
 
-  /// Parse a literal array expression.
+  /// Parse a literal array expression. The numbers are parsed straight into
+  /// a single row-major buffer, whatever the nesting, which the arena then
+  /// takes without copying it.
   /// tensorLiteral ::= [ literalList ] | number
   /// literalList ::= tensorLiteral | tensorLiteral, literalList
-  std::unique_ptr<ExprAST> parseTensorLiteralExpr() {
+  ExprAST *parseTensorLiteralExpr() {
     auto loc = lexer.getLastLocation();
+    GrowableBuffer<double> data;
+    llvm::SmallVector<int64_t, 4> dims;
+    int leafDepth = -1;
+    if (!parseLiteralList(/*depth=*/0, data, dims, leafDepth))
+      return nullptr;
+    llvm::ArrayRef<double> dataRef = arena->adopt(data);
+    return create<LiteralExprAST>(loc, dataRef, copy<int64_t>(dims));
+  }
+
+  /// Parse a list of a literal array expression at nesting level `depth`,
+  /// appending its numbers to `data`. The first list at each level sets the
+  /// dimension of the level in `dims`, and the other ones must match it. The
+  /// numbers are all at the same level `leafDepth`, set by the first one.
+  bool parseLiteralList(int depth, GrowableBuffer<double> &data,
+                        llvm::SmallVectorImpl<int64_t> &dims,
+                        int &leafDepth) {
+    auto literalError = [&](const char *expected, const char *context) {
+      parseError<ExprAST>(expected, context);
+      return false;
+    };
     lexer.consume(Token('['));
+    if (dims.size() <= static_cast<size_t>(depth))
+      dims.push_back(-1);
 
-    // Hold the list of values at this nesting level.
-    std::vector<std::unique_ptr<ExprAST>> values;
-    // Hold the dimensions for all the nesting inside this level.
-    std::vector<int64_t> dims;
+    // Count the values at this nesting level.
+    int64_t numValues = 0;
     do {
       // We can have either another nested array or a number literal.
       if (lexer.getCurToken() == '[') {
-        values.push_back(parseTensorLiteralExpr());
-        if (!values.back())
-          return nullptr; // parse error in the nested array.
+        if (leafDepth >= 0 && depth >= leafDepth)
+          return literalError("uniform well-nested dimensions",
+                              "inside literal expression");
+        if (!parseLiteralList(depth + 1, data, dims, leafDepth))
+          return false; // parse error in the nested array.
       } else {
         if (lexer.getCurToken() != tok_number)
-          return parseError<ExprAST>("<num> or [", "in literal expression");
-        values.push_back(parseNumberExpr());
+          return literalError("<num> or [", "in literal expression");
+        if (leafDepth < 0)
+          leafDepth = depth;
+        else if (leafDepth != depth)
+          return literalError("uniform well-nested dimensions",
+                              "inside literal expression");
+        data.push_back(lexer.getValue());
+        lexer.consume(tok_number);
       }
+      ++numValues;
 
       // End of this list on ']'
       if (lexer.getCurToken() == ']')
@@ -129,54 +281,29 @@ private:
 
       // Elements are separated by a comma.
       if (lexer.getCurToken() != ',')
-        return parseError<ExprAST>("] or ,", "in literal expression");
+        return literalError("] or ,", "in literal expression");
 
       lexer.getNextToken(); // eat ,
     } while (true);
-    if (values.empty())
-      return parseError<ExprAST>("<something>", "to fill literal expression");
     lexer.getNextToken(); // eat ]
 
-    /// Fill in the dimensions now. First the current nesting level:
-    dims.push_back(values.size());
-
-    /// If there is any nested array, process all of them and ensure that
-    /// dimensions are uniform.
-    if (llvm::any_of(values, [](std::unique_ptr<ExprAST> &expr) {
-          return llvm::isa<LiteralExprAST>(expr.get());
-        })) {
-      auto *firstLiteral = llvm::dyn_cast<LiteralExprAST>(values.front().get());
-      if (!firstLiteral)
-        return parseError<ExprAST>("uniform well-nested dimensions",
-                                   "inside literal expression");
-
-      // Append the nested dimensions to the current level
-      auto firstDims = firstLiteral->getDims();
-      dims.insert(dims.end(), firstDims.begin(), firstDims.end());
-
-      // Sanity check that shape is uniform across all elements of the list.
-      for (auto &expr : values) {
-        auto *exprLiteral = llvm::cast<LiteralExprAST>(expr.get());
-        if (!exprLiteral)
-          return parseError<ExprAST>("uniform well-nested dimensions",
-                                     "inside literal expression");
-        if (exprLiteral->getDims() != firstDims)
-          return parseError<ExprAST>("uniform well-nested dimensions",
-                                     "inside literal expression");
-      }
-    }
-    return std::make_unique<LiteralExprAST>(std::move(loc), std::move(values),
-                                            std::move(dims));
+    // The first list at this level sets its dimension, the others must match.
+    if (dims[depth] < 0)
+      dims[depth] = numValues;
+    else if (dims[depth] != numValues)
+      return literalError("uniform well-nested dimensions",
+                          "inside literal expression");
+    return true;
   }
 
   /// Parse a literal struct expression.
   /// structLiteral ::= { (structLiteral | tensorLiteral)+ }
-  std::unique_ptr<ExprAST> parseStructLiteralExpr() {
+  ExprAST *parseStructLiteralExpr() {
     auto loc = lexer.getLastLocation();
     lexer.consume(Token('{'));
 
     // Hold the list of values.
-    std::vector<std::unique_ptr<ExprAST>> values;
+    llvm::SmallVector<ExprAST *, 4> values;
     do {
       // We can have either another nested array or a number literal.
       if (lexer.getCurToken() == '[') {
@@ -209,12 +336,11 @@ private:
                                  "to fill struct literal expression");
     lexer.getNextToken(); // eat }
 
-    return std::make_unique<StructLiteralExprAST>(std::move(loc),
-                                                  std::move(values));
+    return create<StructLiteralExprAST>(loc, copy<ExprAST *>(values));
   }
 
   /// parenexpr ::= '(' expression ')'
-  std::unique_ptr<ExprAST> parseParenExpr() {
+  ExprAST *parseParenExpr() {
     lexer.getNextToken(); // eat (.
     auto v = parseExpression();
     if (!v)
@@ -227,14 +353,13 @@ private:
   }
 
   /// Parse a call expression.
-  std::unique_ptr<ExprAST> parseCallExpr(llvm::StringRef name,
-                                         const Location &loc) {
+  ExprAST *parseCallExpr(llvm::StringRef name, const Location &loc) {
     lexer.consume(Token('('));
-    std::vector<std::unique_ptr<ExprAST>> args;
+    llvm::SmallVector<ExprAST *, 4> args;
     if (lexer.getCurToken() != ')') {
       while (true) {
-        if (auto arg = parseExpression())
-          args.push_back(std::move(arg));
+        if (auto *arg = parseExpression())
+          args.push_back(arg);
         else
           return nullptr;
 
@@ -253,25 +378,24 @@ private:
       if (args.size() != 1)
         return parseError<ExprAST>("<single arg>", "as argument to print()");
 
-      return std::make_unique<PrintExprAST>(std::move(loc), std::move(args[0]));
+      return create<PrintExprAST>(loc, args[0]);
     }
 
     // Call to a user-defined function
-    return std::make_unique<CallExprAST>(std::move(loc), std::string(name),
-                                         std::move(args));
+    return create<CallExprAST>(loc, name, copy<ExprAST *>(args));
   }
 
   /// identifierexpr
   ///   ::= identifier
   ///   ::= identifier '(' expression ')'
-  std::unique_ptr<ExprAST> parseIdentifierExpr() {
-    std::string name(lexer.getId());
+  ExprAST *parseIdentifierExpr() {
+    llvm::StringRef name = lexer.getId();
 
     auto loc = lexer.getLastLocation();
     lexer.getNextToken(); // eat identifier.
 
     if (lexer.getCurToken() != '(') // Simple variable ref.
-      return std::make_unique<VariableExprAST>(std::move(loc), name);
+      return create<VariableExprAST>(loc, name);
 
     // This is a function call.
     return parseCallExpr(name, loc);
@@ -282,7 +406,7 @@ private:
   ///   ::= numberexpr
   ///   ::= parenexpr
   ///   ::= tensorliteral
-  std::unique_ptr<ExprAST> parsePrimary() {
+  ExprAST *parsePrimary() {
     switch (lexer.getCurToken()) {
     default:
       llvm::errs() << "unknown token '" << lexer.getCurToken()
@@ -309,8 +433,7 @@ private:
   /// argument indicates the precedence of the current binary operator.
   ///
   /// binoprhs ::= ('+' primary)*
-  std::unique_ptr<ExprAST> parseBinOpRHS(int exprPrec,
-                                         std::unique_ptr<ExprAST> lhs) {
+  ExprAST *parseBinOpRHS(int exprPrec, ExprAST *lhs) {
     // If this is a binop, find its precedence.
     while (true) {
       int tokPrec = getTokPrecedence();
@@ -326,7 +449,7 @@ private:
       auto loc = lexer.getLastLocation();
 
       // Parse the primary expression after the binary operator.
-      auto rhs = parsePrimary();
+      auto *rhs = parsePrimary();
       if (!rhs)
         return parseError<ExprAST>("expression", "to complete binary operator");
 
@@ -334,37 +457,35 @@ private:
       // the pending operator take rhs as its lhs.
       int nextPrec = getTokPrecedence();
       if (tokPrec < nextPrec) {
-        rhs = parseBinOpRHS(tokPrec + 1, std::move(rhs));
+        rhs = parseBinOpRHS(tokPrec + 1, rhs);
         if (!rhs)
           return nullptr;
       }
 
       // Merge lhs/RHS.
-      lhs = std::make_unique<BinaryExprAST>(std::move(loc), binOp,
-                                            std::move(lhs), std::move(rhs));
+      lhs = create<BinaryExprAST>(loc, binOp, lhs, rhs);
     }
   }
 
   /// expression::= primary binop rhs
-  std::unique_ptr<ExprAST> parseExpression() {
-    auto lhs = parsePrimary();
+  ExprAST *parseExpression() {
+    auto *lhs = parsePrimary();
     if (!lhs)
       return nullptr;
 
-    return parseBinOpRHS(0, std::move(lhs));
+    return parseBinOpRHS(0, lhs);
   }
 
   /// type ::= < shape_list >
   /// shape_list ::= num | num , shape_list
-  std::unique_ptr<VarType> parseType() {
+  VarType *parseType() {
     if (lexer.getCurToken() != '<')
       return parseError<VarType>("<", "to begin type");
     lexer.getNextToken(); // eat <
 
-    auto type = std::make_unique<VarType>();
-
+    llvm::SmallVector<int64_t, 4> shape;
     while (lexer.getCurToken() == tok_number) {
-      type->shape.push_back(lexer.getValue());
+      shape.push_back(lexer.getValue());
       lexer.getNextToken();
       if (lexer.getCurToken() == ',')
         lexer.getNextToken();
@@ -373,35 +494,48 @@ private:
     if (lexer.getCurToken() != '>')
       return parseError<VarType>(">", "to end type");
     lexer.getNextToken(); // eat >
+
+    auto *type = create<VarType>();
+    type->shape = copy<int64_t>(shape);
     return type;
   }
 
-  /// Parse either a variable declaration or a call expression.
-  std::unique_ptr<ExprAST> parseDeclarationOrCallExpr() {
+  /// Parse either a variable declaration, an assignment or a call expression.
+  /// assignment ::= identifier = expr
+  ExprAST *parseDeclarationOrCallExpr() {
     auto loc = lexer.getLastLocation();
-    std::string id(lexer.getId());
+    llvm::StringRef id = lexer.getId();
     lexer.consume(tok_identifier);
 
     // Check for a call expression.
     if (lexer.getCurToken() == '(')
       return parseCallExpr(id, loc);
 
+    // Check for an assignment to an existing variable.
+    if (lexer.getCurToken() == '=') {
+      lexer.consume(Token('='));
+      ExprAST *value = parseExpression();
+      if (!value)
+        return nullptr;
+      return create<AssignExprAST>(loc, id, value);
+    }
+
     // Otherwise, this is a variable declaration.
     return parseTypedDeclaration(id, /*requiresInitializer=*/true, loc);
   }
 
   /// Parse a typed variable declaration.
-  std::unique_ptr<VarDeclExprAST>
-  parseTypedDeclaration(llvm::StringRef typeName, bool requiresInitializer,
-                        const Location &loc) {
+  VarDeclExprAST *parseTypedDeclaration(llvm::StringRef typeName,
+                                        bool requiresInitializer,
+                                        const Location &loc) {
     // Parse the variable name.
     if (lexer.getCurToken() != tok_identifier)
       return parseError<VarDeclExprAST>("name", "in variable declaration");
-    std::string id(lexer.getId());
+    llvm::StringRef id = lexer.getId();
     lexer.getNextToken(); // eat id
 
     // Parse the initializer.
-    std::unique_ptr<ExprAST> expr;
+    ExprAST *expr = nullptr;
     if (requiresInitializer) {
       if (lexer.getCurToken() != '=')
         return parseError<VarDeclExprAST>("initializer",
@@ -411,16 +545,15 @@ private:
     }
 
     VarType type;
-    type.name = std::string(typeName);
-    return std::make_unique<VarDeclExprAST>(loc, std::move(id), std::move(type),
-                                            std::move(expr));
+    type.name = typeName;
+    return create<VarDeclExprAST>(loc, id, type, expr);
   }
 
   /// Parse a variable declaration, for either a tensor value or a struct value,
   /// with an optionally required initializer.
   /// decl ::= var identifier [ type ] (= expr)?
   /// decl ::= identifier identifier (= expr)?
-  std::unique_ptr<VarDeclExprAST> parseDeclaration(bool requiresInitializer) {
+  VarDeclExprAST *parseDeclaration(bool requiresInitializer) {
     // Check to see if this is a 'var' declaration.
     if (lexer.getCurToken() == tok_var)
       return parseVarDeclaration(requiresInitializer);
@@ -429,7 +562,7 @@ private:
     if (lexer.getCurToken() != tok_identifier)
       return parseError<VarDeclExprAST>("type name", "in variable declaration");
     auto loc = lexer.getLastLocation();
-    std::string typeName(lexer.getId());
+    llvm::StringRef typeName = lexer.getId();
     lexer.getNextToken(); // eat id
 
     // Parse the rest of the declaration.
@@ -440,8 +573,7 @@ private:
   /// and identifier and an optional type (shape specification) before the
   /// optionally required initializer.
   /// decl ::= var identifier [ type ] (= expr)?
-  std::unique_ptr<VarDeclExprAST>
-  parseVarDeclaration(bool requiresInitializer) {
+  VarDeclExprAST *parseVarDeclaration(bool requiresInitializer) {
     if (lexer.getCurToken() != tok_var)
       return parseError<VarDeclExprAST>("var", "to begin declaration");
     auto loc = lexer.getLastLocation();
@@ -450,73 +582,55 @@ private:
     if (lexer.getCurToken() != tok_identifier)
       return parseError<VarDeclExprAST>("identified",
                                         "after 'var' declaration");
-    std::string id(lexer.getId());
+    llvm::StringRef id = lexer.getId();
     lexer.getNextToken(); // eat id
 
-    std::unique_ptr<VarType> type; // Type is optional, it can be inferred
+    VarType type; // Type is optional, it can be inferred
     if (lexer.getCurToken() == '<') {
-      type = parseType();
-      if (!type)
+      VarType *parsedType = parseType();
+      if (!parsedType)
         return nullptr;
+      type = *parsedType;
     }
-    if (!type)
-      type = std::make_unique<VarType>();
 
-    std::unique_ptr<ExprAST> expr;
+    ExprAST *expr = nullptr;
     if (requiresInitializer) {
       lexer.consume(Token('='));
       expr = parseExpression();
     }
-    return std::make_unique<VarDeclExprAST>(std::move(loc), std::move(id),
-                                            std::move(*type), std::move(expr));
+    return create<VarDeclExprAST>(loc, id, type, expr);
   }
 
   /// Parse a block: a list of expression separated by semicolons and wrapped in
   /// curly braces.
   ///
   /// block ::= { expression_list }
-  /// expression_list ::= block_expr ; expression_list
-  /// block_expr ::= decl | "return" | expr
-  std::unique_ptr<ExprASTList> parseBlock() {
+  /// expression_list ::= statement ; expression_list | for expression_list
+  llvm::Optional<ExprASTList> parseBlock() {
+    auto blockError = [&](const char *expected, const char *context) {
+      parseError<ExprASTList>(expected, context);
+      return llvm::None;
+    };
     if (lexer.getCurToken() != '{')
-      return parseError<ExprASTList>("{", "to begin block");
+      return blockError("{", "to begin block");
     lexer.consume(Token('{'));
 
-    auto exprList = std::make_unique<ExprASTList>();
+    llvm::SmallVector<ExprAST *, 16> exprList;
 
     // Ignore empty expressions: swallow sequences of semicolons.
     while (lexer.getCurToken() == ';')
       lexer.consume(Token(';'));
 
     while (lexer.getCurToken() != '}' && lexer.getCurToken() != tok_eof) {
-      if (lexer.getCurToken() == tok_identifier) {
-        // Variable declaration or call
-        auto expr = parseDeclarationOrCallExpr();
-        if (!expr)
-          return nullptr;
-        exprList->push_back(std::move(expr));
-      } else if (lexer.getCurToken() == tok_var) {
-        // Variable declaration
-        auto varDecl = parseDeclaration(/*requiresInitializer=*/true);
-        if (!varDecl)
-          return nullptr;
-        exprList->push_back(std::move(varDecl));
-      } else if (lexer.getCurToken() == tok_return) {
-        // Return statement
-        auto ret = parseReturn();
-        if (!ret)
-          return nullptr;
-        exprList->push_back(std::move(ret));
-      } else {
-        // General expression
-        auto expr = parseExpression();
-        if (!expr)
-          return nullptr;
-        exprList->push_back(std::move(expr));
-      }
-      // Ensure that elements are separated by a semicolon.
-      if (lexer.getCurToken() != ';')
-        return parseError<ExprASTList>(";", "after expression");
+      auto *expr = parseStatement();
+      if (!expr)
+        return llvm::None;
+      exprList.push_back(expr);
+
+      // Ensure that elements are separated by a semicolon, a loop already
+      // ends with its block.
+      if (!llvm::isa<ForExprAST>(expr) && lexer.getCurToken() != ';')
+        return blockError(";", "after expression");
 
       // Ignore empty expressions: swallow sequences of semicolons.
       while (lexer.getCurToken() == ';')
@@ -524,15 +638,15 @@ private:
     }
 
     if (lexer.getCurToken() != '}')
-      return parseError<ExprASTList>("}", "to close block");
+      return blockError("}", "to close block");
 
     lexer.consume(Token('}'));
-    return exprList;
+    return copy<ExprAST *>(exprList);
   }
 
   /// prototype ::= def id '(' decl_list ')'
   /// decl_list ::= identifier | identifier, decl_list
-  std::unique_ptr<PrototypeAST> parsePrototype() {
+  PrototypeAST *parsePrototype() {
     auto loc = lexer.getLastLocation();
 
     if (lexer.getCurToken() != tok_def)
@@ -542,38 +656,37 @@ private:
     if (lexer.getCurToken() != tok_identifier)
       return parseError<PrototypeAST>("function name", "in prototype");
 
-    std::string fnName(lexer.getId());
+    llvm::StringRef fnName = lexer.getId();
     lexer.consume(tok_identifier);
 
     if (lexer.getCurToken() != '(')
       return parseError<PrototypeAST>("(", "in prototype");
     lexer.consume(Token('('));
 
-    std::vector<std::unique_ptr<VarDeclExprAST>> args;
+    llvm::SmallVector<VarDeclExprAST *, 4> args;
     if (lexer.getCurToken() != ')') {
       do {
         VarType type;
-        std::string name;
+        llvm::StringRef name;
 
         // Parse either the name of the variable, or its type.
-        std::string nameOrType(lexer.getId());
+        llvm::StringRef nameOrType = lexer.getId();
         auto loc = lexer.getLastLocation();
         lexer.consume(tok_identifier);
 
         // If the next token is an identifier, we just parsed the type.
         if (lexer.getCurToken() == tok_identifier) {
-          type.name = std::move(nameOrType);
+          type.name = nameOrType;
 
           // Parse the name.
-          name = std::string(lexer.getId());
+          name = lexer.getId();
           lexer.consume(tok_identifier);
         } else {
           // Otherwise, we just parsed the name.
-          name = std::move(nameOrType);
+          name = nameOrType;
         }
 
-        args.push_back(
-            std::make_unique<VarDeclExprAST>(std::move(loc), name, type));
+        args.push_back(create<VarDeclExprAST>(loc, name, type));
         if (lexer.getCurToken() != ',')
           break;
         lexer.consume(Token(','));
@@ -587,21 +700,20 @@ private:
 
     // success.
     lexer.consume(Token(')'));
-    return std::make_unique<PrototypeAST>(std::move(loc), fnName,
-                                          std::move(args));
+    return create<PrototypeAST>(loc, fnName, copy<VarDeclExprAST *>(args));
   }
 
   /// Parse a function definition, we expect a prototype initiated with the
   /// `def` keyword, followed by a block containing a list of expressions.
   ///
   /// definition ::= prototype block
-  std::unique_ptr<FunctionAST> parseDefinition() {
-    auto proto = parsePrototype();
+  FunctionAST *parseDefinition() {
+    auto *proto = parsePrototype();
     if (!proto)
       return nullptr;
 
     if (auto block = parseBlock())
-      return std::make_unique<FunctionAST>(std::move(proto), std::move(block));
+      return create<FunctionAST>(proto, *block);
     return nullptr;
   }
 
@@ -610,12 +722,12 @@ private:
   /// declarations.
   ///
   /// definition ::= `struct` identifier `{` decl+ `}`
-  std::unique_ptr<StructAST> parseStruct() {
+  StructAST *parseStruct() {
     auto loc = lexer.getLastLocation();
     lexer.consume(tok_struct);
     if (lexer.getCurToken() != tok_identifier)
       return parseError<StructAST>("name", "in struct definition");
-    std::string name(lexer.getId());
+    llvm::StringRef name = lexer.getId();
     lexer.consume(tok_identifier);
 
     // Parse: '{'
@@ -624,12 +736,12 @@ private:
     lexer.consume(Token('{'));
 
     // Parse: decl+
-    std::vector<std::unique_ptr<VarDeclExprAST>> decls;
+    llvm::SmallVector<VarDeclExprAST *, 4> decls;
     do {
-      auto decl = parseDeclaration(/*requiresInitializer=*/false);
+      auto *decl = parseDeclaration(/*requiresInitializer=*/false);
       if (!decl)
         return nullptr;
-      decls.push_back(std::move(decl));
+      decls.push_back(decl);
 
       if (lexer.getCurToken() != ';')
         return parseError<StructAST>(";",
@@ -639,7 +751,7 @@ private:
 
     // Parse: '}'
     lexer.consume(Token('}'));
-    return std::make_unique<StructAST>(loc, name, std::move(decls));
+    return create<StructAST>(loc, name, copy<VarDeclExprAST *>(decls));
   }
 
   /// Get the precedence of the pending binary operator token.
@@ -666,10 +778,11 @@ private:
   /// indicating the expected token and another argument giving more context.
   /// Location is retrieved from the lexer to enrich the error message.
   template <typename R, typename T, typename U = const char *>
-  std::unique_ptr<R> parseError(T &&expected, U &&context = "") {
+  R *parseError(T &&expected, U &&context = "") {
     auto curToken = lexer.getCurToken();
-    llvm::errs() << "Parse error (" << lexer.getLastLocation().line << ", "
-                 << lexer.getLastLocation().col << "): expected '" << expected
+    LineColumn loc = SourceManager::get().resolve(lexer.getLastLocation());
+    llvm::errs() << "Parse error (" << loc.line << ", " << loc.col
+                 << "): expected '" << expected
                  << "' " << context << " but has Token " << curToken;
     if (isprint(curToken))
       llvm::errs() << " '" << (char)curToken << "'";
@@ -13,22 +13,131 @@
 #ifndef MLIR_TUTORIAL_TOY_PASSES_H
 #define MLIR_TUTORIAL_TOY_PASSES_H
 
+#include <cstdint>
 #include <memory>
+#include <string>
+#include <utility>
+#include <vector>
 
 namespace mlir {
+class OpPassManager;
 class Pass;
 
 namespace toy {
+class TuningDatabase;
+
 std::unique_ptr<Pass> createShapeInferencePass();
 
+/// Create a pass applying the algebraic simplifications of the Toy operations
+/// that may change the results, e.g. reassociating the additions or fusing a
+/// multiplication and an addition into a `toy.fma` rounded once.
+std::unique_ptr<Pass> createFastMathCombinePass();
+
+/// Create a pass replacing the generic functions by specializations for the
+/// shapes of the arguments they are called with.
+std::unique_ptr<Pass> createSpecializeFunctionsPass();
+
+/// Create a pass inlining the specialized functions of at most `maxOperations`
+/// operations that call no other function.
+std::unique_ptr<Pass>
+createInlineLeafFunctionsPass(unsigned maxOperations = 16);
+
+/// Create a pass choosing the layout of each matrix, row-major or column-major,
+/// so that the lowered code copies the fewest matrices (see toy/Layout.h).
+std::unique_ptr<mlir::Pass> createLayoutPropagationPass();
+
 /// Create a pass for lowering to operations in the `Affine` and `Std` dialects,
-/// for a subset of the Toy IR (e.g. matmul).
-std::unique_ptr<mlir::Pass> createLowerToAffinePass();
+/// for a subset of the Toy IR (e.g. matmul). With `profile`, the code of each
+/// lowered operation is wrapped with probes timing it (see toy/Profiler.h).
+std::unique_ptr<mlir::Pass> createLowerToAffinePass(bool profile = false);
+
+/// Create a pass for lowering operations to the `Linalg` dialect on tensors,
+/// for a subset of the Toy IR.
+std::unique_ptr<mlir::Pass> createLowerToLinalgPass();
+
+/// Create a pass tiling the structured operations on tensors with `tileSizes`,
+/// and fusing their producers into the tile loops.
+std::unique_ptr<mlir::Pass>
+createLinalgTileAndFusePass(const std::vector<int64_t> &tileSizes);
+
+/// Create a pass reporting the allocations, the deallocations and the memory
+/// traffic of the lowered functions to the allocation tracker (see
+/// toy/AllocationTracker.h).
+std::unique_ptr<mlir::Pass> createTrackAllocationsPass();
+
+/// Create a pass printing the estimated cost of each function and its
+/// placement on the roofline of the host (see toy/CostModel.h). The report is
+/// titled with the `level` of the IR, e.g. "Toy" or "affine".
+std::unique_ptr<mlir::Pass> createPrintCostReportPass(std::string level);
+
+/// Create a pass explaining with remarks (see toy/Remarks.h) why the loop
+/// fusion and the scalar replacement left loop nests and loads behind.
+std::unique_ptr<mlir::Pass> createLoopRemarksPass();
+
+/// Create a pass tiling, vectorizing and unrolling the affine loop nests with
+/// their configuration in `database` (see toy/Tuning.h), which must outlive
+/// the pass.
+std::unique_ptr<mlir::Pass>
+createApplyTuningPass(const TuningDatabase &database);
 
 /// Create a pass for lowering operations the remaining `Toy` operations, as
 /// well as `Affine` and `Std`, to the LLVM dialect for codegen.
 std::unique_ptr<mlir::Pass> createLowerToLLVMPass();
 
+/// Return the number of times each canonicalization or fast-math pattern of
+/// the Toy operations rewrote the IR since the start of the process, sorted by
+/// pattern name.
+std::vector<std::pair<std::string, uint64_t>>
+getCanonicalizationPatternCounts();
+
+/// The path through which the Toy operations are lowered to loops.
+enum class LoweringPath {
+  /// Lower each operation to an affine loop nest over buffers.
+  Affine,
+  /// Lower to structured operations on tensors, which are fused and tiled
+  /// before the module is bufferized.
+  Linalg,
+};
+
+struct ToyPipelineOptions {
+  /// Run the optimizations, e.g. inlining the leaf functions and loop fusion.
+  bool enableOpt = false;
+  /// Apply the algebraic simplifications that may change the results.
+  bool fastMath = false;
+  /// Lower the Toy operations to affine loops.
+  bool isLoweringToAffine = false;
+  /// Lower the loops to the LLVM dialect.
+  bool isLoweringToLLVM = false;
+  LoweringPath loweringPath = LoweringPath::Affine;
+  /// The tile sizes of the Linalg path, the extra ones are ignored for
+  /// operations of lower rank.
+  std::vector<int64_t> tileSizes = {32, 32};
+  /// Wrap the loops of each operation with profiling probes, on the affine
+  /// path.
+  bool profile = false;
+  /// Report the allocations and the memory traffic of the lowered code to the
+  /// allocation tracker.
+  bool trackAllocations = false;
+  /// Print the roofline report of the functions, on the Toy IR once the shapes
+  /// are inferred and on the affine IR.
+  bool printCostReport = false;
+  /// Explain the missed affine optimizations with remarks.
+  bool emitRemarks = false;
+  /// The configurations of the affine loop nests, if any, which must outlive
+  /// the pass manager.
+  const TuningDatabase *tuningDatabase = nullptr;
+  /// Stop once the shapes are inferred, e.g. to interpret the module.
+  bool stopAfterShapeInference = false;
+  /// Skip the specialization and the shape inference, which already ran on
+  /// the module.
+  bool skipShapeInference = false;
+};
+
+/// Populate `pm` with the passes compiling a Toy module: specialization and
+/// shape inference, then optionally the lowering to affine loops and the
+/// lowering to the LLVM dialect.
+void buildToyPipeline(OpPassManager &pm, const ToyPipelineOptions &options);
+
 } // namespace toy
 } // namespace mlir
 
@@ -0,0 +1,125 @@
+//===- Profiler.h - Per-operation profiling of Toy programs -----*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares the profiler of the Toy programs. In profiling mode, the
+// lowering to affine loops wraps the loop nest of each operation with probes
+// reading the timestamp counter. The compiled code calls the runtime functions
+// below, which accumulate the time spent at each site, i.e. at each profiled
+// operation in the source.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef MLIR_TUTORIAL_TOY_PROFILER_H_
+#define MLIR_TUTORIAL_TOY_PROFILER_H_
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringRef.h"
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+namespace llvm {
+class raw_ostream;
+} // namespace llvm
+
+namespace toy {
+
+/// The profile of the process, accumulated from the measurements of the
+/// compiled code. Measurements can be recorded concurrently from any thread:
+/// each thread records into its own buffer without locking, and the buffers
+/// are merged by the report and the trace.
+class Profiler {
+public:
+  /// Return the profiler of the process.
+  static Profiler &get();
+
+  /// Clear the sites and their measurements, and start the clock of the
+  /// trace. No compiled code may run meanwhile.
+  void reset();
+
+  /// Record a run between the timestamps `start` and `end` of the operation
+  /// `opName` at `location`, touching `bytes` bytes. The strings are constants
+  /// of the compiled code. A site is an operation at a location touching a
+  /// number of bytes, so that the specializations of a function and the
+  /// operations rewritten from a single one are reported apart.
+  void record(const char *opName, const char *location, int64_t bytes,
+              uint64_t start, uint64_t end);
+
+  /// Print the sites that ran, by decreasing time. No compiled code may run
+  /// meanwhile.
+  void printReport(llvm::raw_ostream &os);
+
+  /// Write every run in the Chrome trace event format, which chrome://tracing
+  /// and Perfetto display as a timeline. No compiled code may run meanwhile.
+  void writeChromeTrace(llvm::raw_ostream &os);
+
+  /// Read the timestamp counter of the processor, or a monotonic clock in
+  /// nanoseconds where it isn't available.
+  static uint64_t readTimestamp();
+
+private:
+  struct Site {
+    std::string opName;
+    std::string location;
+    int64_t bytes;
+    uint64_t calls = 0;
+    uint64_t ticks = 0;
+  };
+  struct Event {
+    unsigned site;
+    uint64_t start;
+    uint64_t end;
+  };
+
+  /// The measurements of a thread. The sites are identified by the addresses
+  /// of their strings, and the events refer to the sites of the thread.
+  struct ThreadBuffer {
+    using SiteKey = std::tuple<const char *, const char *, int64_t>;
+
+    uint64_t thread;
+    std::vector<SiteKey> siteKeys;
+    std::vector<std::pair<uint64_t, uint64_t>> siteCallsAndTicks;
+    llvm::DenseMap<SiteKey, unsigned> siteIds;
+    std::vector<Event> events;
+    /// The number of runs that weren't kept in the trace, once it is full.
+    uint64_t droppedEvents = 0;
+  };
+
+  Profiler();
+
+  /// Return the buffer of the calling thread, created on its first run.
+  ThreadBuffer &getThreadBuffer();
+
+  /// Merge the sites of the threads, with the same strings and bytes, into
+  /// `sites`. Set `siteIds` to the merged site of each site of each thread.
+  void mergeSites(std::vector<Site> &sites,
+                  std::vector<std::vector<unsigned>> &siteIds);
+
+  /// Return the number of nanoseconds per tick of the timestamp counter,
+  /// measured since the last reset.
+  double getNanosecondsPerTick();
+
+  /// Guards the list of buffers, not their contents.
+  std::mutex mutex;
+  std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+  uint64_t startTimestamp;
+  uint64_t startNanoseconds;
+};
+
+/// Return the runtime functions called by the probes, by name, to make them
+/// visible to the compiled code.
+std::vector<std::pair<llvm::StringRef, void *>> getProfilerRuntimeSymbols();
+
+} // namespace toy
+
+#endif // MLIR_TUTORIAL_TOY_PROFILER_H_
@@ -0,0 +1,71 @@
+//===- Remarks.h - Optimization remarks of the Toy compiler -----*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares the optimization remarks of the Toy compiler. The Toy
+// passes, the checks explaining the affine optimizations, and the LLVM passes
+// all report what they did or failed to do to a single stream, written in the
+// YAML format of the LLVM remarks so that the usual tools (e.g. opt-viewer)
+// can aggregate them.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef MLIR_TUTORIAL_TOY_REMARKS_H_
+#define MLIR_TUTORIAL_TOY_REMARKS_H_
+
+#include "llvm/ADT/StringRef.h"
+
+namespace llvm {
+class LLVMContext;
+class raw_ostream;
+class Twine;
+} // namespace llvm
+
+namespace mlir {
+class Location;
+class Operation;
+
+namespace toy {
+
+/// The kinds of remarks, as in LLVM.
+enum class RemarkKind {
+  /// An optimization was applied.
+  Passed,
+  /// An optimization was attempted and failed, or wasn't profitable.
+  Missed,
+  /// A fact about the code that explains the optimizations.
+  Analysis,
+};
+
+/// Write the remarks of the process to `os`, until called again. No remarks
+/// are written while `os` is null, the default.
+void setRemarkStream(llvm::raw_ostream *os);
+
+/// Return whether remarks are written, so that the passes only look for
+/// remarks to make when they are.
+bool areRemarksEnabled();
+
+/// Emit a remark named `remarkName` of the pass `passName`, at `loc` in the
+/// function `functionName`. Remarks can be emitted from any thread.
+void emitOptimizationRemark(RemarkKind kind, llvm::StringRef passName,
+                            llvm::StringRef remarkName, Location loc,
+                            llvm::StringRef functionName,
+                            const llvm::Twine &message);
+
+/// Emit a remark about `op`, at its location and in the function around it.
+void emitOptimizationRemark(RemarkKind kind, llvm::StringRef passName,
+                            llvm::StringRef remarkName, Operation *op,
+                            const llvm::Twine &message);
+
+/// Forward the remarks of the LLVM passes running in `context` to the
+/// remark stream.
+void forwardLLVMRemarks(llvm::LLVMContext &context);
+
+} // namespace toy
+} // namespace mlir
+
+#endif // MLIR_TUTORIAL_TOY_REMARKS_H_
@@ -15,13 +15,33 @@
 #define MLIR_TUTORIAL_TOY_SHAPEINFERENCEINTERFACE_H_
 
 #include "mlir/IR/OpDefinition.h"
+#include "llvm/ADT/STLExtras.h"
 
 namespace mlir {
+class FuncOp;
+
 namespace toy {
+class GenericCallOp;
 
 /// Include the auto-generated declarations.
 #include "toy/ShapeInferenceOpInterfaces.h.inc"
 
+/// Return whether the shape of a value of type `type` is known: it is a ranked
+/// tensor, or a struct of such values.
+bool hasInferredShape(Type type);
+
+/// Infer the shapes of the operations in the function `f`, and refine its
+/// result types accordingly. A generic call doesn't know the shape of its
+/// result: `inferCall` is invoked on the calls once their operands are
+/// inferred, calls are an error if it is null.
+LogicalResult
+inferShapes(FuncOp f,
+            llvm::function_ref<LogicalResult(GenericCallOp)> inferCall = {});
+
+/// Return the number of operations whose result shapes inferShapes inferred
+/// since the start of the process.
+uint64_t getNumInferredShapes();
+
 } // namespace toy
 } // namespace mlir
 
@@ -0,0 +1,79 @@
+//===- ShardedRunner.h - Run a Toy kernel in worker processes ---*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares the sharded runner, which splits the tensors of a job of
+// a batch (see toy/BatchRunner.h) along their outer dimension, and computes
+// each shard in a worker process pinned to a NUMA node, so that the job uses
+// the memory bandwidth of every node. The tensors are shared with the workers
+// through POSIX shared memory, and each worker touches its shards first, so
+// that their pages are allocated on its node.
+//
+// Only elementwise kernels are split, as the Toy operations have no reduction:
+// the shards of the result are independent, and there is nothing to combine.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef MLIR_TUTORIAL_TOY_SHARDEDRUNNER_H_
+#define MLIR_TUTORIAL_TOY_SHARDEDRUNNER_H_
+
+#include "toy/BatchRunner.h"
+#include "toy/ToyCompiler.h"
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Error.h"
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace toy {
+
+/// A kernel compiled for the shards of its arguments.
+class ShardedKernel {
+public:
+  /// Compile the function `signature.name` of the Toy source `source` for the
+  /// shards of its arguments, split along their outer dimension among
+  /// `numWorkers` worker processes. The function must be elementwise (see
+  /// CompiledModule::isElementwise).
+  static llvm::Expected<std::unique_ptr<ShardedKernel>>
+  compile(ToyCompiler &compiler, llvm::StringRef source,
+          const KernelSignature &signature, unsigned numWorkers,
+          const CompileOptions &options = {});
+
+  /// Run the kernel on the arguments of `job` in the worker processes, and
+  /// write its result. Return the bytes read and written.
+  llvm::Expected<uint64_t> run(const BatchJob &job) const;
+
+private:
+  ShardedKernel() = default;
+
+  /// Return the rows of the outer dimension computed by the worker `worker`,
+  /// as the first row and the number of rows.
+  std::pair<int64_t, int64_t> getShardRows(unsigned worker) const;
+
+  /// Compute the shard of the worker `worker`, in the worker process.
+  llvm::Error runShard(const BatchJob &job, unsigned worker,
+                       llvm::ArrayRef<double *> args, double *result) const;
+
+  KernelSignature signature;
+  unsigned numWorkers = 1;
+
+  /// The CPUs of each NUMA node of the host, which the workers are spread
+  /// over, read once when the kernel is compiled.
+  std::vector<std::vector<unsigned>> numaNodes;
+
+  /// The kernel compiled for each number of rows of a shard: the rows are
+  /// split as evenly as possible, into shards of at most two sizes.
+  std::map<int64_t, std::unique_ptr<CompiledModule>> modules;
+};
+
+} // namespace toy
+
+#endif // MLIR_TUTORIAL_TOY_SHARDEDRUNNER_H_
@@ -0,0 +1,97 @@
+//===- SourceManager.h - Registry of the Toy sources ------------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares the registry owning the buffers of the Toy sources. The
+// lexer works directly on these buffers, and a location in the AST is just the
+// id of its source and an offset, resolved to a line and a column when it is
+// printed.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef MLIR_TUTORIAL_TOY_SOURCEMANAGER_H_
+#define MLIR_TUTORIAL_TOY_SOURCEMANAGER_H_
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/ErrorOr.h"
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace llvm {
+class MemoryBuffer;
+class raw_ostream;
+} // namespace llvm
+
+namespace toy {
+
+/// Structure definition a location in a file: the id of the source in the
+/// SourceManager and the offset in its buffer.
+struct Location {
+  uint32_t file;   ///< source id.
+  uint32_t offset; ///< offset in the buffer of the source.
+};
+
+/// A location resolved to a line and a column, both starting at 1.
+struct LineColumn {
+  llvm::StringRef filename;
+  unsigned line;
+  unsigned col;
+};
+
+/// The registry of the sources, which owns their buffers. A source is kept
+/// until it is removed: the tokens of the lexer and the locations refer to it.
+/// Sources can be added and locations resolved concurrently from any thread.
+class SourceManager {
+public:
+  /// Return the source manager of the process.
+  static SourceManager &get();
+
+  /// Add the file `filename`, or the standard input for "-". Large files are
+  /// memory mapped rather than read.
+  llvm::ErrorOr<uint32_t> addFile(llvm::StringRef filename);
+
+  /// Add a copy of `source`, named `name` in the locations.
+  uint32_t addBufferCopy(llvm::StringRef source, llvm::StringRef name);
+
+  /// Remove the source `file`, once nothing refers to it anymore. Its id is
+  /// reused by the next source added.
+  void removeSource(uint32_t file);
+
+  /// Return the contents of the source `file`.
+  llvm::StringRef getBuffer(uint32_t file);
+
+  /// Return the name of the source `file` in the locations.
+  llvm::StringRef getBufferIdentifier(uint32_t file);
+
+  /// Resolve the line and the column of `loc`. The offsets of the lines of a
+  /// source are computed the first time one of its locations is resolved.
+  LineColumn resolve(Location loc);
+
+private:
+  struct Source;
+
+  SourceManager();
+  ~SourceManager();
+  uint32_t addBuffer(std::unique_ptr<llvm::MemoryBuffer> buffer);
+  Source &getSource(uint32_t file);
+
+  std::mutex mutex;
+  std::vector<std::unique_ptr<Source>> sources;
+
+  /// The ids of the removed sources.
+  std::vector<uint32_t> freeIds;
+};
+
+/// Print `loc` as "file:line:col".
+llvm::raw_ostream &operator<<(llvm::raw_ostream &os, const LineColumn &loc);
+
+} // namespace toy
+
+#endif // MLIR_TUTORIAL_TOY_SOURCEMANAGER_H_
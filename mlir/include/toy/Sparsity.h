@@ -0,0 +1,61 @@
+//===- Sparsity.h - Sparsity of the Toy values ------------------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares the analysis of the elements that may be nonzero in the
+// tensors of a Toy function, known statically from the indices of its sparse
+// constants. The code lowered from the Toy operations only computes these
+// elements, and fills the others with zeros.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef MLIR_TUTORIAL_TOY_SPARSITY_H_
+#define MLIR_TUTORIAL_TOY_SPARSITY_H_
+
+#include "mlir/IR/BuiltinOps.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/SmallVector.h"
+
+#include <vector>
+
+namespace mlir {
+namespace toy {
+
+/// The indices of the elements of a tensor that may be nonzero, sorted in
+/// row-major order.
+using NonZeros = std::vector<llvm::SmallVector<int64_t, 2>>;
+
+/// The elements that may be nonzero in the tensors of a function computed from
+/// sparse constants, by elementwise operations and transposes. The result of
+/// an elementwise operation may be nonzero where any of its operands is: the
+/// elements skipped are zeros of every operand, so their dense computation
+/// gives +0 too, and both lowering paths print the same output. The other
+/// tensors, and the ones with too many such elements (see
+/// toy::isSparseEnough), are dense.
+class SparsityAnalysis {
+public:
+  SparsityAnalysis(FuncOp function);
+
+  /// Return the elements of `value` that may be nonzero, or null if it is
+  /// dense.
+  const NonZeros *lookup(Value value) const {
+    auto it = nonZeros.find(value);
+    return it == nonZeros.end() ? nullptr : &it->second;
+  }
+
+private:
+  /// Return the elements of the result of `op` that may be nonzero, if known.
+  llvm::Optional<NonZeros> getResultNonZeros(Operation *op) const;
+
+  llvm::DenseMap<Value, NonZeros> nonZeros;
+};
+
+} // namespace toy
+} // namespace mlir
+
+#endif // MLIR_TUTORIAL_TOY_SPARSITY_H_
@@ -0,0 +1,175 @@
+//===- ToyCompiler.h - Embedding API for the Toy compiler -------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares the API to embed the Toy compiler in an application: a
+// Toy source is compiled once into a set of kernels, which can then be invoked
+// any number of times on buffers owned by the application.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef MLIR_TUTORIAL_TOY_TOYCOMPILER_H_
+#define MLIR_TUTORIAL_TOY_TOYCOMPILER_H_
+
+#include "toy/Passes.h"
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Error.h"
+
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace mlir {
+class MLIRContext;
+} // namespace mlir
+
+namespace toy {
+class ToyJIT;
+
+/// Return an error with the message `message`, as returned by the embedding
+/// API and the runners built on it.
+llvm::Error makeError(const llvm::Twine &message);
+
+/// Return the number of elements of a buffer of shape `shape`.
+inline int64_t getNumElements(llvm::ArrayRef<int64_t> shape) {
+  int64_t numElements = 1;
+  for (int64_t size : shape)
+    numElements *= size;
+  return numElements;
+}
+
+/// A non-owning view of a contiguous row-major buffer of f64 elements.
+struct MemRefView {
+  MemRefView(double *data, llvm::ArrayRef<int64_t> shape)
+      : data(data), shape(shape) {}
+
+  double *data;
+  llvm::ArrayRef<int64_t> shape;
+};
+
+/// A contiguous row-major buffer returned by a kernel, which owns its data.
+class MemRefBuffer {
+public:
+  /// Create an empty buffer, returned by the kernels without a result.
+  MemRefBuffer() = default;
+
+  /// Take ownership of the malloc'ed buffer `allocated`, whose elements start
+  /// at `data`.
+  MemRefBuffer(double *allocated, double *data, llvm::ArrayRef<int64_t> shape)
+      : allocated(allocated), data(data), shape(shape.begin(), shape.end()) {}
+
+  bool empty() const { return !data; }
+  double *getData() const { return data; }
+  llvm::ArrayRef<int64_t> getShape() const { return shape; }
+  int64_t getNumElements() const { return toy::getNumElements(shape); }
+
+private:
+  struct FreeDeleter {
+    void operator()(double *ptr) const { std::free(ptr); }
+  };
+
+  std::unique_ptr<double, FreeDeleter> allocated;
+  double *data = nullptr;
+  std::vector<int64_t> shape;
+};
+
+/// A function to export from a Toy source. Toy functions are generic over the
+/// shapes of their arguments, so a kernel is specialized for fixed ones.
+struct KernelSignature {
+  std::string name;
+  std::vector<std::vector<int64_t>> argShapes;
+};
+
+struct CompileOptions {
+  /// Optimize the Toy IR and the generated code.
+  bool enableOpt = true;
+
+  /// Apply the algebraic simplifications that may change the rounding of the
+  /// results or the sign of their zeros.
+  bool fastMath = false;
+
+  /// The number of partitions of the LLVM module, which are optimized and
+  /// compiled to machine code in parallel.
+  unsigned numCodegenPartitions = 1;
+
+  /// The path through which the Toy operations are lowered to loops.
+  mlir::toy::LoweringPath loweringPath = mlir::toy::LoweringPath::Affine;
+
+  /// The kernels to export, in addition to `main` which is always exported
+  /// when it is defined.
+  std::vector<KernelSignature> kernels;
+};
+
+/// The code generated for a Toy source.
+class CompiledModule {
+public:
+  ~CompiledModule();
+
+  /// Invoke the kernel `name` on `args`, which must have the shapes the kernel
+  /// was compiled for. This neither compiles nor locks anything, and the
+  /// kernels never write their arguments, so a kernel can be invoked
+  /// concurrently from any number of threads, even on the same arguments. The
+  /// result is empty if the kernel doesn't return a value.
+  llvm::Expected<MemRefBuffer>
+  invoke(llvm::StringRef name,
+         llvm::ArrayRef<MemRefView> args = llvm::None) const;
+
+  template <typename... Views>
+  llvm::Expected<MemRefBuffer> invoke(llvm::StringRef name,
+                                      const MemRefView &arg,
+                                      const Views &...args) const {
+    MemRefView views[] = {arg, args...};
+    return invoke(name, llvm::makeArrayRef(views));
+  }
+
+  /// Return whether the kernel `name` is elementwise: its arguments and its
+  /// result have the same shape, and each element of its result only depends
+  /// on the elements of its arguments at the same indices. Such a kernel
+  /// computes any slice of its result from the same slice of its arguments.
+  bool isElementwise(llvm::StringRef name) const;
+
+private:
+  friend class ToyCompiler;
+  CompiledModule() = default;
+
+  /// A kernel is looked up once at compile time, invocations only go through
+  /// its packed interface (see addPackedInterface in ToyJIT.h).
+  struct Kernel {
+    void (*packedFunc)(void **) = nullptr;
+    std::vector<std::vector<int64_t>> argShapes;
+    llvm::Optional<unsigned> resultRank;
+    bool isElementwise = false;
+  };
+
+  std::unique_ptr<ToyJIT> jit;
+  llvm::StringMap<Kernel> kernels;
+};
+
+/// The entry point of the embedding API. A compiler can compile any number of
+/// sources, and the compiled modules are independent of it.
+class ToyCompiler {
+public:
+  ToyCompiler();
+  ~ToyCompiler();
+
+  /// Compile the Toy source `source`. The diagnostics are returned as the
+  /// error on failure.
+  llvm::Expected<std::unique_ptr<CompiledModule>>
+  compile(llvm::StringRef source, const CompileOptions &options = {});
+
+private:
+  std::unique_ptr<mlir::MLIRContext> context;
+};
+
+} // namespace toy
+
+#endif // MLIR_TUTORIAL_TOY_TOYCOMPILER_H_
@@ -0,0 +1,273 @@
+//===- ToyJIT.h - A persistent JIT for the Toy compiler ---------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file contains a simple ORC based JIT, modeled on the one used by the
+// Kaleidoscope tutorial. Unlike mlir::ExecutionEngine, which compiles a single
+// module, modules can be added to it incrementally and the code of previously
+// added modules stays resident. It also provides the helpers needed to invoke
+// the lowered Toy functions, which take and return memref descriptors.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef MLIR_TUTORIAL_TOY_TOYJIT_H_
+#define MLIR_TUTORIAL_TOY_TOYJIT_H_
+
+#include "toy/ParallelCodeGen.h"
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ExecutionEngine/JITSymbol.h"
+#include "llvm/ExecutionEngine/Orc/CompileUtils.h"
+#include "llvm/ExecutionEngine/Orc/Core.h"
+#include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
+#include "llvm/ExecutionEngine/Orc/ExecutorProcessControl.h"
+#include "llvm/ExecutionEngine/Orc/IRCompileLayer.h"
+#include "llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h"
+#include "llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h"
+#include "llvm/ExecutionEngine/Orc/ThreadSafeModule.h"
+#include "llvm/ExecutionEngine/SectionMemoryManager.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DataLayout.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+
+namespace toy {
+
+/// A JIT that keeps the code of all the modules added to it resident, until
+/// the resource tracker they were added with is removed.
+class ToyJIT {
+  std::unique_ptr<llvm::orc::ExecutionSession> session;
+
+  llvm::orc::JITTargetMachineBuilder jtmb;
+  llvm::DataLayout dataLayout;
+  llvm::orc::MangleAndInterner mangle;
+
+  llvm::orc::RTDyldObjectLinkingLayer objectLayer;
+  llvm::orc::IRCompileLayer compileLayer;
+
+  llvm::orc::JITDylib &mainJD;
+
+public:
+  ToyJIT(std::unique_ptr<llvm::orc::ExecutionSession> session,
+         llvm::orc::JITTargetMachineBuilder jtmb, llvm::DataLayout dataLayout)
+      : session(std::move(session)), jtmb(std::move(jtmb)),
+        dataLayout(std::move(dataLayout)),
+        mangle(*this->session, this->dataLayout),
+        objectLayer(*this->session,
+                    []() {
+                      return std::make_unique<llvm::SectionMemoryManager>();
+                    }),
+        compileLayer(*this->session, objectLayer,
+                     std::make_unique<llvm::orc::ConcurrentIRCompiler>(
+                         this->jtmb)),
+        mainJD(this->session->createBareJITDylib("<main>")) {
+    // The lowered code calls into the C library, e.g. `printf` and `malloc`.
+    mainJD.addGenerator(
+        llvm::cantFail(llvm::orc::DynamicLibrarySearchGenerator::
+                           GetForCurrentProcess(
+                               this->dataLayout.getGlobalPrefix())));
+  }
+
+  ~ToyJIT() {
+    if (auto err = session->endSession())
+      session->reportError(std::move(err));
+  }
+
+  /// Create a JIT for the host, generating code at the given optimization
+  /// level. A low level is preferable for interactive use, where the latency
+  /// of compiling each statement dominates.
+  static llvm::Expected<std::unique_ptr<ToyJIT>>
+  create(llvm::CodeGenOpt::Level optLevel = llvm::CodeGenOpt::Default) {
+    auto epc = llvm::orc::SelfExecutorProcessControl::Create();
+    if (!epc)
+      return epc.takeError();
+
+    auto session =
+        std::make_unique<llvm::orc::ExecutionSession>(std::move(*epc));
+
+    llvm::orc::JITTargetMachineBuilder jtmb(
+        session->getExecutorProcessControl().getTargetTriple());
+    jtmb.setCodeGenOptLevel(optLevel);
+
+    auto dataLayout = jtmb.getDefaultDataLayoutForTarget();
+    if (!dataLayout)
+      return dataLayout.takeError();
+
+    return std::make_unique<ToyJIT>(std::move(session), std::move(jtmb),
+                                    std::move(*dataLayout));
+  }
+
+  const llvm::DataLayout &getDataLayout() const { return dataLayout; }
+
+  llvm::orc::JITDylib &getMainJITDylib() { return mainJD; }
+
+  /// Add a module to the JIT. It is compiled on the first lookup of one of its
+  /// symbols, and released when `tracker` is removed.
+  llvm::Error addModule(llvm::orc::ThreadSafeModule module,
+                        llvm::orc::ResourceTrackerSP tracker = nullptr) {
+    if (!tracker)
+      tracker = mainJD.getDefaultResourceTracker();
+    return compileLayer.add(tracker, std::move(module));
+  }
+
+  /// Optimize `module` with `transformer` and compile it, splitting it into
+  /// `numPartitions` partitions compiled on up to `numThreads` threads (see
+  /// generateObjects). Unlike `addModule`, the code is generated eagerly.
+  llvm::Error addModuleInParallel(
+      std::unique_ptr<llvm::Module> module, unsigned numPartitions,
+      unsigned numThreads,
+      const std::function<llvm::Error(llvm::Module *)> &transformer,
+      llvm::orc::ResourceTrackerSP tracker = nullptr) {
+    auto objects = generateObjects(std::move(module), jtmb, numPartitions,
+                                   numThreads, transformer);
+    if (!objects)
+      return objects.takeError();
+    if (!tracker)
+      tracker = mainJD.getDefaultResourceTracker();
+    for (auto &object : *objects)
+      if (auto err = objectLayer.add(tracker, std::move(object)))
+        return err;
+    return llvm::Error::success();
+  }
+
+  /// Make the host functions `symbols` callable from the compiled code, by
+  /// name.
+  llvm::Error
+  addHostSymbols(llvm::ArrayRef<std::pair<llvm::StringRef, void *>> symbols) {
+    llvm::orc::SymbolMap symbolMap;
+    for (auto &symbol : symbols)
+      symbolMap[mangle(symbol.first)] = llvm::JITEvaluatedSymbol(
+          llvm::pointerToJITTargetAddress(symbol.second),
+          llvm::JITSymbolFlags::Exported | llvm::JITSymbolFlags::Callable);
+    return mainJD.define(llvm::orc::absoluteSymbols(std::move(symbolMap)));
+  }
+
+  llvm::Expected<llvm::JITEvaluatedSymbol> lookup(llvm::StringRef name) {
+    return session->lookup({&mainJD}, mangle(name.str()));
+  }
+};
+
+/// Return the name of the wrapper created by `addPackedInterface`.
+inline std::string getPackedFunctionName(llvm::StringRef name) {
+  return ("_mlir_" + name).str();
+}
+
+/// Define a wrapper `void _mlir_<name>(void **args)` around the function
+/// `name`. Each element of `args` points to one of the arguments of the
+/// function, and the last one to storage for its result if it has one. This is
+/// the calling convention of mlir::ExecutionEngine::invokePacked, it allows for
+/// calling functions with any signature from the host.
+inline llvm::Error addPackedInterface(llvm::Module &module,
+                                      llvm::StringRef name) {
+  llvm::Function *func = module.getFunction(name);
+  if (!func || func->isDeclaration())
+    return llvm::make_error<llvm::StringError>(
+        "no definition for '" + name + "' in the module",
+        llvm::inconvertibleErrorCode());
+
+  llvm::LLVMContext &ctx = module.getContext();
+  llvm::IRBuilder<> builder(ctx);
+  auto *packedType = llvm::FunctionType::get(
+      builder.getVoidTy(), builder.getInt8PtrTy()->getPointerTo(),
+      /*isVarArg=*/false);
+  auto *packedFunc = llvm::cast<llvm::Function>(
+      module.getOrInsertFunction(getPackedFunctionName(name), packedType)
+          .getCallee());
+
+  // Load each argument from the type-erased list, and cast it to its type.
+  builder.SetInsertPoint(llvm::BasicBlock::Create(ctx, "entry", packedFunc));
+  llvm::Value *argList = packedFunc->arg_begin();
+  auto getArgPtr = [&](unsigned index, llvm::Type *type) {
+    llvm::Value *argPtrPtr = builder.CreateGEP(
+        builder.getInt8PtrTy(), argList, builder.getInt64(index));
+    llvm::Value *argPtr = builder.CreateLoad(builder.getInt8PtrTy(), argPtrPtr);
+    return builder.CreateBitCast(argPtr, type->getPointerTo());
+  };
+  llvm::SmallVector<llvm::Value *, 8> args;
+  for (llvm::Argument &arg : func->args())
+    args.push_back(builder.CreateLoad(
+        arg.getType(), getArgPtr(arg.getArgNo(), arg.getType())));
+
+  // Call the function, and store its result in the last element of the list.
+  llvm::Value *result = builder.CreateCall(func, args);
+  if (!result->getType()->isVoidTy())
+    builder.CreateStore(result, getArgPtr(func->arg_size(), result->getType()));
+  builder.CreateRetVoid();
+  return llvm::Error::success();
+}
+
+/// A rank-erased version of the descriptor that the LLVM lowering uses for a
+/// `memref<...xf64>`: two pointers to the allocated and aligned data, an
+/// offset, then `rank` sizes followed by `rank` strides. Every field is 64-bit
+/// wide, which is what makes the descriptor storable as an array.
+class MemRefDescriptor {
+public:
+  /// Create an empty descriptor, used as storage for a returned memref.
+  explicit MemRefDescriptor(unsigned rank) : rank(rank), fields(3 + 2 * rank) {}
+
+  /// Create a descriptor for the contiguous row-major buffer `data`.
+  MemRefDescriptor(double *data, llvm::ArrayRef<int64_t> shape)
+      : MemRefDescriptor(shape.size()) {
+    setPointer(0, data);
+    setPointer(1, data);
+    int64_t stride = 1;
+    for (unsigned i = rank; i-- > 0;) {
+      fields[3 + i] = shape[i];
+      fields[3 + rank + i] = stride;
+      stride *= shape[i];
+    }
+  }
+
+  unsigned getRank() const { return rank; }
+  double *getAllocatedPtr() const { return getPointer(0); }
+  double *getData() const { return getPointer(1) + fields[2]; }
+  llvm::ArrayRef<int64_t> getSizes() const {
+    return llvm::makeArrayRef(fields).slice(3, rank);
+  }
+  int64_t getNumElements() const {
+    int64_t numElements = 1;
+    for (int64_t size : getSizes())
+      numElements *= size;
+    return numElements;
+  }
+
+  /// Storage for the descriptor when it is returned by a function.
+  void *getStorage() { return fields.data(); }
+
+  /// A memref argument is passed to the packed interface with one pointer per
+  /// field of its descriptor.
+  void appendPackedArguments(llvm::SmallVectorImpl<void *> &args) {
+    for (int64_t &field : fields)
+      args.push_back(&field);
+  }
+
+private:
+  double *getPointer(unsigned index) const {
+    double *ptr;
+    std::memcpy(&ptr, &fields[index], sizeof(ptr));
+    return ptr;
+  }
+  void setPointer(unsigned index, double *ptr) {
+    std::memcpy(&fields[index], &ptr, sizeof(ptr));
+  }
+
+  unsigned rank;
+  llvm::SmallVector<int64_t, 8> fields;
+};
+
+} // namespace toy
+
+#endif // MLIR_TUTORIAL_TOY_TOYJIT_H_
@@ -0,0 +1,132 @@
+//===- Tuning.h - Tuning of the Toy loop nests ------------------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares the tuning of the affine loop nests lowered from the Toy
+// operations. A nest is identified by the Toy operations it computes and the
+// trip counts of its loops, and is transformed by a configuration of tile size,
+// unroll factor and vector width. The best configurations, found empirically
+// by `toyc -autotune`, are kept in a database for each CPU model and read back
+// by the later compilations.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef MLIR_TUTORIAL_TOY_TUNING_H_
+#define MLIR_TUTORIAL_TOY_TUNING_H_
+
+#include "mlir/Support/LogicalResult.h"
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/StringRef.h"
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace mlir {
+class AffineForOp;
+class ModuleOp;
+
+namespace toy {
+
+/// The transformations of a loop nest. The default configuration leaves the
+/// nest untouched.
+struct TuningConfig {
+  /// The size of the tiles of every loop of the nest, 0 to leave it untiled.
+  unsigned tileSize = 0;
+  /// The unroll factor of the innermost loop.
+  unsigned unrollFactor = 1;
+  /// The number of elements processed at once by the innermost loop, 1 to
+  /// leave it scalar.
+  unsigned vectorWidth = 1;
+
+  bool operator==(const TuningConfig &other) const {
+    return tileSize == other.tileSize && unrollFactor == other.unrollFactor &&
+           vectorWidth == other.vectorWidth;
+  }
+};
+
+/// The identity of a loop nest, independent of the program it belongs to.
+struct TuningKey {
+  /// The Toy operations computed by the nest, e.g. "toy.add+toy.mul".
+  std::string opKind;
+  /// The trip counts of the perfectly nested loops, e.g. "64x64".
+  std::string shape;
+  /// The CPU model the configuration was measured on.
+  std::string cpu;
+
+  bool operator<(const TuningKey &other) const {
+    return std::tie(cpu, opKind, shape) <
+           std::tie(other.cpu, other.opKind, other.shape);
+  }
+};
+
+/// A loop nest of a module that may be tuned.
+struct TunableNest {
+  /// The key of the nest on the host.
+  TuningKey key;
+  /// The trip counts of the perfectly nested loops, outermost first.
+  std::vector<int64_t> tripCounts;
+  /// Whether the innermost loop accesses its buffers contiguously, and may
+  /// thus be vectorized.
+  bool isVectorizable = false;
+
+  /// Return the number of iterations of the nest per run of its function.
+  int64_t getNumIterations() const;
+
+  /// Return whether `config` applies to the nest: the tiles must divide the
+  /// loops, and the vectors the innermost tile.
+  bool isApplicable(const TuningConfig &config) const;
+};
+
+/// The best known configuration of the loop nests, by key.
+class TuningDatabase {
+public:
+  /// Load the configurations of the JSON file at `path`, which replace those
+  /// with the same key. Report and return a failure if it can't be read.
+  LogicalResult load(llvm::StringRef path);
+
+  /// Save all the configurations to the JSON file at `path`.
+  LogicalResult save(llvm::StringRef path) const;
+
+  /// Return the configuration of the nest of the given kind and shape on the
+  /// host, if any.
+  llvm::Optional<TuningConfig> lookup(llvm::StringRef opKind,
+                                      llvm::StringRef shape) const;
+
+  /// Set the configuration of `key`.
+  void insert(const TuningKey &key, const TuningConfig &config) {
+    configs[key] = config;
+  }
+
+  bool empty() const { return configs.empty(); }
+
+private:
+  std::map<TuningKey, TuningConfig> configs;
+};
+
+/// Return the name of the attribute of the stores of the lowered loop nests,
+/// naming the Toy operation they compute.
+inline llvm::StringRef getOpKindAttrName() { return "toy.op"; }
+
+/// Return the CPU model of the host, as named by LLVM.
+std::string getHostCPUName();
+
+/// Return the nest rooted at the outermost loop `root`, or None if it isn't
+/// tunable: its trip counts aren't constant, or it computes no Toy operation.
+llvm::Optional<TunableNest> getTunableNest(AffineForOp root);
+
+/// Return the loop nests of `module`, lowered to affine loops, that the tuning
+/// applies to: the outermost loops of constant trip counts, with the Toy
+/// operations they compute. The nests of the same key are returned once.
+std::vector<TunableNest> getTunableNests(ModuleOp module);
+
+} // namespace toy
+} // namespace mlir
+
+#endif // MLIR_TUTORIAL_TOY_TUNING_H_
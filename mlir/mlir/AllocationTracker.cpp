@@ -0,0 +1,118 @@
+//===- AllocationTracker.cpp - Allocation telemetry of Toy programs -------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements the allocation tracker of the Toy programs, and the
+// runtime functions called by the compiled code.
+//
+//===----------------------------------------------------------------------===//
+
+#include "toy/AllocationTracker.h"
+
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+
+using namespace toy;
+
+AllocationTracker &AllocationTracker::get() {
+  static AllocationTracker tracker;
+  return tracker;
+}
+
+void AllocationTracker::reset() {
+  std::lock_guard<std::mutex> lock(mutex);
+  sites.clear();
+  siteIds.clear();
+  liveBuffers.clear();
+  liveBytes = peakBytes = totalBytes = trafficBytes = 0;
+  allocations = deallocations = 0;
+}
+
+void AllocationTracker::recordAlloc(const void *ptr, int64_t bytes,
+                                    const char *location) {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto it = siteIds.try_emplace(location, sites.size());
+  if (it.second)
+    sites.push_back({location});
+  Site &site = sites[it.first->second];
+  site.allocations++;
+  site.bytes += bytes;
+
+  liveBuffers[ptr] = bytes;
+  liveBytes += bytes;
+  peakBytes = std::max(peakBytes, liveBytes);
+  totalBytes += bytes;
+  allocations++;
+}
+
+void AllocationTracker::recordDealloc(const void *ptr) {
+  std::lock_guard<std::mutex> lock(mutex);
+  // A buffer allocated before the last reset isn't live anymore.
+  auto it = liveBuffers.find(ptr);
+  if (it == liveBuffers.end())
+    return;
+  liveBytes -= it->second;
+  liveBuffers.erase(it);
+  deallocations++;
+}
+
+void AllocationTracker::recordTraffic(int64_t bytes) {
+  std::lock_guard<std::mutex> lock(mutex);
+  trafficBytes += bytes;
+}
+
+void AllocationTracker::printReport(llvm::raw_ostream &os, double seconds) {
+  std::lock_guard<std::mutex> lock(mutex);
+  std::vector<const Site *> sortedSites;
+  for (const Site &site : sites)
+    sortedSites.push_back(&site);
+  llvm::stable_sort(sortedSites, [](const Site *lhs, const Site *rhs) {
+    return lhs->bytes > rhs->bytes;
+  });
+
+  os << "===" << std::string(73, '-') << "===\n"
+     << "                          Toy Allocation Report\n"
+     << "===" << std::string(73, '-') << "===\n"
+     << llvm::format("  Execution Time: %.4f ms\n", seconds * 1e3)
+     << "  Allocations: " << allocations << " (" << totalBytes
+     << " bytes), deallocations: " << deallocations << "\n"
+     << "  Peak live bytes: " << peakBytes << "\n"
+     << "  Live bytes at exit: " << liveBytes << "\n"
+     << "  Estimated memory traffic: " << trafficBytes << " bytes"
+     << llvm::format(", %.2f GB/s\n\n", seconds ? trafficBytes / seconds * 1e-9
+                                                : 0.0)
+     << "       Bytes  Allocations  Location\n";
+  for (const Site *site : sortedSites)
+    os << llvm::format("  %10lld %12llu  ", static_cast<long long>(site->bytes),
+                       static_cast<unsigned long long>(site->allocations))
+       << site->location << "\n";
+}
+
+/// Called by the compiled code after allocating a buffer.
+static void trackAlloc(const void *ptr, int64_t bytes, const char *location) {
+  AllocationTracker::get().recordAlloc(ptr, bytes, location);
+}
+
+/// Called by the compiled code before deallocating a buffer.
+static void trackDealloc(const void *ptr) {
+  AllocationTracker::get().recordDealloc(ptr);
+}
+
+/// Called by the compiled code on entry to each function.
+static void trackTraffic(int64_t bytes) {
+  AllocationTracker::get().recordTraffic(bytes);
+}
+
+std::vector<std::pair<llvm::StringRef, void *>>
+toy::getAllocationTrackerRuntimeSymbols() {
+  return {{"toy_track_alloc", reinterpret_cast<void *>(&trackAlloc)},
+          {"toy_track_dealloc", reinterpret_cast<void *>(&trackDealloc)},
+          {"toy_track_traffic", reinterpret_cast<void *>(&trackTraffic)}};
+}
@@ -0,0 +1,126 @@
+//===- ApplyTuning.cpp - Apply the tuned configurations of loop nests -----===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements a Function level pass transforming each affine loop
+// nest lowered from the Toy operations with its configuration in a tuning
+// database (see toy/Tuning.h): the nest is tiled, then its innermost loop is
+// vectorized and unrolled.
+//
+//===----------------------------------------------------------------------===//
+
+#include "toy/Passes.h"
+#include "toy/Remarks.h"
+#include "toy/Tuning.h"
+
+#include "mlir/Dialect/Affine/IR/AffineOps.h"
+#include "mlir/Dialect/Affine/Utils.h"
+#include "mlir/Dialect/Vector/VectorOps.h"
+#include "mlir/Pass/Pass.h"
+#include "mlir/Transforms/LoopUtils.h"
+
+#include <algorithm>
+
+using namespace mlir;
+
+/// Transform the nest rooted at `root` with `config`, which must apply to it.
+static void applyConfig(AffineForOp root, const toy::TunableNest &nest,
+                        const toy::TuningConfig &config) {
+  SmallVector<AffineForOp, 4> band;
+  getPerfectlyNestedLoops(band, root);
+  AffineForOp innermost = band.back();
+
+  if (config.tileSize > 0) {
+    SmallVector<unsigned, 4> tileSizes;
+    for (int64_t tripCount : nest.tripCounts)
+      tileSizes.push_back(std::min<int64_t>(config.tileSize, tripCount));
+    SmallVector<AffineForOp, 8> tiledNest;
+    if (failed(tilePerfectlyNested(band, tileSizes, &tiledNest)))
+      return;
+    innermost = tiledNest.back();
+  }
+
+  if (config.vectorWidth > 1) {
+    // The vectorized loop replaces the innermost loop, in place.
+    Operation *next = innermost->getNextNode();
+    VectorizationStrategy strategy;
+    strategy.vectorSizes.push_back(config.vectorWidth);
+    strategy.loopToVectorDim[innermost] = 0;
+    std::vector<SmallVector<AffineForOp, 2>> loops = {{innermost}};
+    if (failed(vectorizeAffineLoopNest(loops, strategy)))
+      return;
+    innermost = cast<AffineForOp>(next->getPrevNode());
+  }
+
+  if (config.unrollFactor > 1)
+    (void)loopUnrollByFactor(innermost, config.unrollFactor);
+}
+
+/// Describe the transformations of `config`, e.g. "tiled by 32 and unrolled by
+/// 4".
+static std::string describeConfig(const toy::TuningConfig &config) {
+  SmallVector<std::string, 3> parts;
+  if (config.tileSize > 0)
+    parts.push_back("tiled by " + std::to_string(config.tileSize));
+  if (config.vectorWidth > 1)
+    parts.push_back("vectorized by " + std::to_string(config.vectorWidth));
+  if (config.unrollFactor > 1)
+    parts.push_back("unrolled by " + std::to_string(config.unrollFactor));
+  std::string description = parts.front();
+  for (unsigned i = 1, e = parts.size(); i < e; ++i)
+    description += (i + 1 == e ? " and " : ", ") + parts[i];
+  return description;
+}
+
+namespace {
+/// The ApplyTuningPass is a FunctionPass transforming the loop nests with the
+/// configurations of a tuning database for the host.
+struct ApplyTuningPass : public PassWrapper<ApplyTuningPass, FunctionPass> {
+  ApplyTuningPass(const toy::TuningDatabase &database) : database(database) {}
+
+  void getDependentDialects(DialectRegistry &registry) const override {
+    registry.insert<vector::VectorDialect>();
+  }
+
+  void runOnFunction() final {
+    FuncOp function = getFunction();
+    if (function.isDeclaration())
+      return markAllAnalysesPreserved();
+
+    // The nests are collected first, as the tiling wraps them in new loops.
+    SmallVector<AffineForOp, 8> roots(function.front().getOps<AffineForOp>());
+    for (AffineForOp root : roots) {
+      llvm::Optional<toy::TunableNest> nest = toy::getTunableNest(root);
+      if (!nest)
+        continue;
+      llvm::Optional<toy::TuningConfig> config =
+          database.lookup(nest->key.opKind, nest->key.shape);
+      if (!config || *config == toy::TuningConfig() ||
+          !nest->isApplicable(*config))
+        continue;
+
+      if (toy::areRemarksEnabled())
+        toy::emitOptimizationRemark(
+            toy::RemarkKind::Passed, "toy-apply-tuning", "Tuned", root,
+            "the " + nest->key.shape + " loop nest of " + nest->key.opKind +
+                " was " + describeConfig(*config) + ", as tuned for " +
+                nest->key.cpu);
+      applyConfig(root, *nest, *config);
+    }
+  }
+
+  /// The configurations, which outlive the pass.
+  const toy::TuningDatabase &database;
+};
+} // namespace
+
+/// Create a pass transforming the loop nests with their configuration in
+/// `database`.
+std::unique_ptr<Pass>
+mlir::toy::createApplyTuningPass(const TuningDatabase &database) {
+  return std::make_unique<ApplyTuningPass>(database);
+}
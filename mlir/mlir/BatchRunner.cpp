@@ -0,0 +1,229 @@
+//===- BatchRunner.cpp - Run a Toy kernel over many files -----------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements the batch runner of the Toy kernels.
+//
+//===----------------------------------------------------------------------===//
+
+#include "toy/BatchRunner.h"
+#include "toy/Benchmark.h"
+
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/ScopeExit.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/Twine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+
+using namespace toy;
+
+llvm::Expected<std::vector<BatchJob>>
+toy::parseBatchManifest(llvm::StringRef manifest, llvm::StringRef baseDir) {
+  auto resolve = [&](llvm::StringRef path) {
+    if (llvm::sys::path::is_absolute(path) || baseDir.empty())
+      return path.str();
+    llvm::SmallString<128> resolved(baseDir);
+    llvm::sys::path::append(resolved, path);
+    return std::string(resolved.str());
+  };
+
+  std::vector<BatchJob> jobs;
+  llvm::SmallVector<llvm::StringRef, 8> lines, fields;
+  manifest.split(lines, '\n');
+  for (llvm::StringRef line : lines) {
+    fields.clear();
+    llvm::SplitString(line.split('#').first, fields);
+    if (fields.empty())
+      continue;
+    BatchJob job;
+    job.outputFilename = resolve(fields.front());
+    for (llvm::StringRef field : llvm::drop_begin(fields))
+      job.inputFilenames.push_back(resolve(field));
+    jobs.push_back(std::move(job));
+  }
+  return jobs;
+}
+
+namespace {
+/// A read-only mapping of the file of an argument.
+class MappedInput {
+public:
+  /// Map `filename`, which must hold the `numBytes` bytes of an argument.
+  llvm::Error map(llvm::StringRef filename, uint64_t numBytes);
+
+  /// The elements of the argument. The kernels never write their arguments,
+  /// so the read-only pages are passed in place.
+  double *getData() const {
+    return reinterpret_cast<double *>(const_cast<char *>(region.const_data()));
+  }
+
+private:
+  llvm::sys::fs::mapped_file_region region;
+};
+} // namespace
+
+llvm::Error MappedInput::map(llvm::StringRef filename, uint64_t numBytes) {
+  llvm::Expected<llvm::sys::fs::file_t> file =
+      llvm::sys::fs::openNativeFileForRead(filename);
+  if (!file)
+    return file.takeError();
+  auto closeFile =
+      llvm::make_scope_exit([&] { llvm::sys::fs::closeFile(*file); });
+
+  llvm::sys::fs::file_status status;
+  if (std::error_code ec = llvm::sys::fs::status(*file, status))
+    return makeError("can't read '" + filename + "': " + ec.message());
+  if (status.getSize() != numBytes)
+    return makeError("'" + filename + "' has " +
+                     llvm::Twine(status.getSize()) + " bytes, but the " +
+                     "argument has " + llvm::Twine(numBytes));
+  // An empty argument has nothing to map.
+  if (!numBytes)
+    return llvm::Error::success();
+
+  std::error_code ec;
+  region = llvm::sys::fs::mapped_file_region(
+      *file, llvm::sys::fs::mapped_file_region::readonly, numBytes,
+      /*offset=*/0, ec);
+  if (ec)
+    return makeError("can't map '" + filename + "': " + ec.message());
+  return llvm::Error::success();
+}
+
+/// Run `kernel` on the arguments of `job`, write its result, and return the
+/// bytes read and written.
+static llvm::Expected<uint64_t> runKernelJob(const CompiledModule &module,
+                                             const KernelSignature &kernel,
+                                             const BatchJob &job) {
+  if (job.inputFilenames.size() != kernel.argShapes.size())
+    return makeError("expected " + llvm::Twine(kernel.argShapes.size()) +
+                     " input files, but got " +
+                     llvm::Twine(job.inputFilenames.size()));
+
+  uint64_t numBytes = 0;
+  std::vector<MappedInput> inputs(job.inputFilenames.size());
+  llvm::SmallVector<MemRefView, 4> args;
+  for (unsigned i = 0, e = inputs.size(); i != e; ++i) {
+    uint64_t argBytes =
+        getNumElements(kernel.argShapes[i]) * sizeof(double);
+    if (auto err = inputs[i].map(job.inputFilenames[i], argBytes))
+      return std::move(err);
+    args.emplace_back(inputs[i].getData(), kernel.argShapes[i]);
+    numBytes += argBytes;
+  }
+
+  llvm::Expected<MemRefBuffer> result = module.invoke(kernel.name, args);
+  if (!result)
+    return result.takeError();
+  if (result->empty())
+    return makeError("the kernel '" + kernel.name + "' returns no value");
+
+  std::error_code ec;
+  llvm::raw_fd_ostream os(job.outputFilename, ec);
+  if (ec)
+    return makeError("can't open '" + job.outputFilename +
+                     "': " + ec.message());
+  uint64_t resultBytes = result->getNumElements() * sizeof(double);
+  os.write(reinterpret_cast<const char *>(result->getData()), resultBytes);
+  os.close();
+  if (os.has_error())
+    return makeError("can't write '" + job.outputFilename +
+                     "': " + os.error().message());
+  return numBytes + resultBytes;
+}
+
+BatchResult toy::runBatch(llvm::ArrayRef<BatchJob> jobs, BatchJobFn runJob,
+                          unsigned numThreads) {
+  BatchResult result;
+  std::mutex mutex;
+  std::atomic<size_t> nextJob(0);
+  std::atomic<uint64_t> numBytes(0);
+  std::vector<double> seconds(jobs.size(), -1.0);
+
+  // Each thread runs the jobs it claims until there are none left, so that
+  // the slow jobs don't hold the others back.
+  auto work = [&] {
+    for (size_t i = nextJob++; i < jobs.size(); i = nextJob++) {
+      auto start = std::chrono::steady_clock::now();
+      llvm::Expected<uint64_t> jobBytes = runJob(jobs[i]);
+      std::chrono::duration<double> duration =
+          std::chrono::steady_clock::now() - start;
+      if (!jobBytes) {
+        std::string message = jobs[i].outputFilename + ": " +
+                              llvm::toString(jobBytes.takeError());
+        std::lock_guard<std::mutex> lock(mutex);
+        result.errors.push_back(std::move(message));
+        continue;
+      }
+      numBytes += *jobBytes;
+      seconds[i] = duration.count();
+    }
+  };
+
+  auto start = std::chrono::steady_clock::now();
+  {
+    llvm::ThreadPool threadPool(llvm::hardware_concurrency(numThreads));
+    for (unsigned i = 0, e = threadPool.getThreadCount(); i != e; ++i)
+      threadPool.async(work);
+    threadPool.wait();
+  }
+  std::chrono::duration<double> wallSeconds =
+      std::chrono::steady_clock::now() - start;
+
+  result.wallSeconds = wallSeconds.count();
+  result.numBytes = numBytes;
+  for (double jobSeconds : seconds)
+    if (jobSeconds >= 0)
+      result.seconds.push_back(jobSeconds);
+  return result;
+}
+
+BatchResult toy::runBatch(const CompiledModule &module,
+                          const KernelSignature &kernel,
+                          llvm::ArrayRef<BatchJob> jobs, unsigned numThreads) {
+  return runBatch(
+      jobs,
+      [&](const BatchJob &job) { return runKernelJob(module, kernel, job); },
+      numThreads);
+}
+
+void toy::writeBatchJSON(llvm::raw_ostream &os, llvm::StringRef name,
+                         const BatchResult &result) {
+  std::vector<double> sorted = result.seconds;
+  llvm::sort(sorted);
+  size_t numJobs = sorted.size();
+  double wallSeconds = result.wallSeconds;
+
+  llvm::json::OStream json(os, /*IndentSize=*/2);
+  json.object([&] {
+    json.attribute("batch", name);
+    json.attribute("jobs", static_cast<int64_t>(numJobs));
+    json.attribute("failed_jobs", static_cast<int64_t>(result.errors.size()));
+    json.attribute("wall_seconds", wallSeconds);
+    json.attribute("jobs_per_second",
+                   wallSeconds ? numJobs / wallSeconds : 0.0);
+    json.attribute("megabytes_per_second",
+                   wallSeconds ? result.numBytes / wallSeconds / 1e6 : 0.0);
+    json.attribute("min_ms", getPercentile(sorted, 0) * 1e3);
+    json.attribute("median_ms", getPercentile(sorted, 50) * 1e3);
+    json.attribute("p90_ms", getPercentile(sorted, 90) * 1e3);
+    json.attribute("p99_ms", getPercentile(sorted, 99) * 1e3);
+    json.attribute("max_ms", getPercentile(sorted, 100) * 1e3);
+  });
+  os << "\n";
+}
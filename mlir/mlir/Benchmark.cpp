@@ -0,0 +1,168 @@
+//===- Benchmark.cpp - Benchmark harness of Toy programs ------------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements the benchmark harness of the Toy programs.
+//
+//===----------------------------------------------------------------------===//
+
+#include "toy/Benchmark.h"
+
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <numeric>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace toy;
+
+namespace {
+/// The hardware counters of the calling thread, in user mode. The counters
+/// the host doesn't expose are left out.
+class HardwareCounters {
+public:
+  HardwareCounters();
+  ~HardwareCounters();
+
+  void start();
+  void stop();
+
+  /// Return the counts since the first start, by name.
+  std::vector<std::pair<std::string, uint64_t>> read();
+
+private:
+  std::vector<std::pair<const char *, int>> counters;
+};
+} // namespace
+
+#ifdef __linux__
+HardwareCounters::HardwareCounters() {
+  static const std::pair<const char *, uint64_t> events[] = {
+      {"cycles", PERF_COUNT_HW_CPU_CYCLES},
+      {"instructions", PERF_COUNT_HW_INSTRUCTIONS},
+      {"cache_misses", PERF_COUNT_HW_CACHE_MISSES},
+      {"branch_misses", PERF_COUNT_HW_BRANCH_MISSES},
+  };
+  for (auto &event : events) {
+    perf_event_attr attr = {};
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = event.second;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    int fd = syscall(SYS_perf_event_open, &attr, /*pid=*/0, /*cpu=*/-1,
+                     /*group_fd=*/-1, /*flags=*/0);
+    if (fd >= 0)
+      counters.emplace_back(event.first, fd);
+  }
+}
+
+HardwareCounters::~HardwareCounters() {
+  for (auto &counter : counters)
+    close(counter.second);
+}
+
+void HardwareCounters::start() {
+  for (auto &counter : counters)
+    ioctl(counter.second, PERF_EVENT_IOC_ENABLE, 0);
+}
+
+void HardwareCounters::stop() {
+  for (auto &counter : counters)
+    ioctl(counter.second, PERF_EVENT_IOC_DISABLE, 0);
+}
+
+std::vector<std::pair<std::string, uint64_t>> HardwareCounters::read() {
+  std::vector<std::pair<std::string, uint64_t>> counts;
+  for (auto &counter : counters) {
+    uint64_t count;
+    if (::read(counter.second, &count, sizeof(count)) == sizeof(count))
+      counts.emplace_back(counter.first, count);
+  }
+  return counts;
+}
+#else
+HardwareCounters::HardwareCounters() {}
+HardwareCounters::~HardwareCounters() {}
+void HardwareCounters::start() {}
+void HardwareCounters::stop() {}
+std::vector<std::pair<std::string, uint64_t>> HardwareCounters::read() {
+  return {};
+}
+#endif
+
+BenchmarkResult toy::runBenchmark(llvm::function_ref<void()> body,
+                                  unsigned numRuns, unsigned numWarmups) {
+  for (unsigned run = 0; run < numWarmups; ++run)
+    body();
+
+  BenchmarkResult result;
+  result.seconds.reserve(numRuns);
+  HardwareCounters counters;
+  for (unsigned run = 0; run < numRuns; ++run) {
+    auto start = std::chrono::steady_clock::now();
+    counters.start();
+    body();
+    counters.stop();
+    std::chrono::duration<double> seconds =
+        std::chrono::steady_clock::now() - start;
+    result.seconds.push_back(seconds.count());
+  }
+  result.counters = counters.read();
+  return result;
+}
+
+double toy::getPercentile(llvm::ArrayRef<double> values, double percentile) {
+  if (values.empty())
+    return 0;
+  size_t rank =
+      static_cast<size_t>(std::ceil(percentile / 100 * values.size()));
+  return values[std::max<size_t>(rank, 1) - 1];
+}
+
+/// Return `seconds` in milliseconds, rounded to the nanosecond.
+static double toMilliseconds(double seconds) {
+  return std::round(seconds * 1e9) / 1e6;
+}
+
+void toy::writeBenchmarkJSON(llvm::raw_ostream &os, llvm::StringRef name,
+                             const BenchmarkResult &result) {
+  std::vector<double> sorted = result.seconds;
+  llvm::sort(sorted);
+  size_t numRuns = sorted.size();
+  double total = std::accumulate(sorted.begin(), sorted.end(), 0.0);
+  double mean = numRuns ? total / numRuns : 0.0;
+
+  llvm::json::OStream json(os, /*IndentSize=*/2);
+  json.object([&] {
+    json.attribute("benchmark", name);
+    json.attribute("runs", static_cast<int64_t>(numRuns));
+    json.attribute("min_ms", toMilliseconds(getPercentile(sorted, 0)));
+    json.attribute("median_ms", toMilliseconds(getPercentile(sorted, 50)));
+    json.attribute("mean_ms", toMilliseconds(mean));
+    json.attribute("p99_ms", toMilliseconds(getPercentile(sorted, 99)));
+    json.attribute("max_ms", toMilliseconds(getPercentile(sorted, 100)));
+    json.attribute("runs_per_second", total ? numRuns / total : 0.0);
+    json.attributeObject("counters_per_run", [&] {
+      for (auto &counter : result.counters)
+        json.attribute(counter.first,
+                       numRuns ? static_cast<double>(counter.second) / numRuns
+                               : 0.0);
+    });
+  });
+  os << "\n";
+}
@@ -0,0 +1,272 @@
+//===- CompileStats.cpp - Compile-time telemetry of toyc ------------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements the compile-time telemetry of the Toy compiler. The
+// passes are observed by a pass instrumentation, which measures the IR each
+// pass runs on before and after it, outside of the time of the pass.
+//
+//===----------------------------------------------------------------------===//
+
+#include "toy/CompileStats.h"
+#include "toy/Dialect.h"
+#include "toy/Passes.h"
+
+#include "mlir/IR/BuiltinTypes.h"
+#include "mlir/IR/Operation.h"
+#include "mlir/Pass/Pass.h"
+#include "mlir/Pass/PassInstrumentation.h"
+#include "mlir/Pass/PassManager.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <cmath>
+#include <iterator>
+
+#ifdef LLVM_ON_UNIX
+#include <sys/resource.h>
+#include <time.h>
+#endif
+
+using namespace toy;
+
+/// Return the CPU time used so far by the process, or by the calling thread
+/// where it is measured, in user and system mode.
+static std::chrono::nanoseconds
+getCPUTime(CompileStats::CPUTimeScope scope) {
+#ifdef CLOCK_THREAD_CPUTIME_ID
+  struct timespec time;
+  if (scope == CompileStats::CPUTimeScope::Thread &&
+      clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time) == 0)
+    return std::chrono::seconds(time.tv_sec) +
+           std::chrono::nanoseconds(time.tv_nsec);
+#endif
+  llvm::sys::TimePoint<> elapsed;
+  std::chrono::nanoseconds user, system;
+  llvm::sys::Process::GetTimeUsage(elapsed, user, system);
+  return user + system;
+}
+
+/// Return the high-water mark of the resident memory of the process, in
+/// bytes, or 0 where it isn't available.
+static int64_t getPeakRSSBytes() {
+#ifdef LLVM_ON_UNIX
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#ifdef __APPLE__
+    return usage.ru_maxrss;
+#else
+    return static_cast<int64_t>(usage.ru_maxrss) * 1024;
+#endif
+  }
+#endif
+  return 0;
+}
+
+/// Return `seconds` in milliseconds, rounded to the microsecond.
+static double toMilliseconds(double seconds) {
+  return std::round(seconds * 1e6) / 1e3;
+}
+
+//===----------------------------------------------------------------------===//
+// CompileStats::Stage
+//===----------------------------------------------------------------------===//
+
+CompileStats::Stage::Stage(CompileStats *stats, llvm::StringRef name,
+                           CPUTimeScope scope)
+    : stats(stats), name(name.str()), scope(scope) {
+  if (!stats)
+    return;
+  wallStart = std::chrono::steady_clock::now();
+  cpuStart = getCPUTime(scope);
+}
+
+CompileStats::Stage::~Stage() {
+  if (!stats)
+    return;
+  std::chrono::duration<double> wall =
+      std::chrono::steady_clock::now() - wallStart;
+  std::chrono::duration<double> cpu = getCPUTime(scope) - cpuStart;
+  stats->recordStage(name, wall.count(), cpu.count());
+}
+
+//===----------------------------------------------------------------------===//
+// CompileStats::Instrumentation
+//===----------------------------------------------------------------------===//
+
+namespace {
+/// A stream counting the bytes written to it.
+class CountingOStream : public llvm::raw_ostream {
+public:
+  CountingOStream() : llvm::raw_ostream(/*unbuffered=*/true) {}
+
+private:
+  void write_impl(const char *ptr, size_t size) override { count += size; }
+  uint64_t current_pos() const override { return count; }
+
+  uint64_t count = 0;
+};
+} // namespace
+
+/// The pass instrumentation measuring each pass. The passes nested under the
+/// module run on several functions at once.
+class CompileStats::Instrumentation : public mlir::PassInstrumentation {
+public:
+  Instrumentation(CompileStats &stats) : stats(stats) {}
+
+  void runBeforePass(mlir::Pass *pass, mlir::Operation *op) override {
+    unsigned passId = stats.getPassId(pass, op->getName().getStringRef());
+    IRSize before = measure(op, stats.measureIRBytes);
+    std::lock_guard<std::mutex> lock(mutex);
+    runs[{pass, op}] = {passId, before, std::chrono::steady_clock::now()};
+  }
+
+  void runAfterPass(mlir::Pass *pass, mlir::Operation *op) override {
+    auto end = std::chrono::steady_clock::now();
+    Run run;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      run = runs.lookup({pass, op});
+      runs.erase({pass, op});
+    }
+    std::chrono::duration<double> wall = end - run.start;
+    stats.recordPass(run.passId, wall.count(), run.before,
+                     measure(op, stats.measureIRBytes));
+  }
+
+  void runAfterPassFailed(mlir::Pass *pass, mlir::Operation *op) override {
+    // The IR may be invalid, it isn't measured.
+    std::lock_guard<std::mutex> lock(mutex);
+    runs.erase({pass, op});
+  }
+
+private:
+  struct Run {
+    unsigned passId = 0;
+    IRSize before;
+    std::chrono::steady_clock::time_point start;
+  };
+
+  /// Return the size of `op`, printing it to count its bytes if `withBytes`.
+  static IRSize measure(mlir::Operation *op, bool withBytes) {
+    IRSize size;
+    op->walk([&](mlir::Operation *nested) {
+      size.ops++;
+      for (mlir::Type type : nested->getResultTypes())
+        size.unrankedResults +=
+            type.isa<mlir::TensorType, mlir::toy::StructType>() &&
+            !mlir::toy::hasInferredShape(type);
+    });
+    if (!withBytes)
+      return size;
+    CountingOStream os;
+    op->print(os, mlir::OpPrintingFlags().useLocalScope());
+    size.bytes = os.tell();
+    return size;
+  }
+
+  CompileStats &stats;
+  std::mutex mutex;
+  /// The runs in progress, by pass and operation.
+  llvm::DenseMap<std::pair<mlir::Pass *, mlir::Operation *>, Run> runs;
+};
+
+//===----------------------------------------------------------------------===//
+// CompileStats
+//===----------------------------------------------------------------------===//
+
+void CompileStats::instrument(mlir::PassManager &pm) {
+  pm.addInstrumentation(std::make_unique<Instrumentation>(*this));
+}
+
+void CompileStats::recordStage(llvm::StringRef name, double wallSeconds,
+                               double cpuSeconds) {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto it = llvm::find_if(
+      stages, [&](const StageStats &stage) { return stage.name == name; });
+  if (it == stages.end()) {
+    stages.push_back({name.str()});
+    it = std::prev(stages.end());
+  }
+  it->runs++;
+  it->wallSeconds += wallSeconds;
+  it->cpuSeconds += cpuSeconds;
+}
+
+unsigned CompileStats::getPassId(const mlir::Pass *pass,
+                                 llvm::StringRef anchor) {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto it = passIds.try_emplace(pass->getThreadingSiblingOrThis(),
+                                passes.size());
+  if (it.second) {
+    passes.emplace_back();
+    passes.back().name = pass->getName().str();
+    passes.back().anchor = anchor.str();
+  }
+  return it.first->second;
+}
+
+void CompileStats::recordPass(unsigned passId, double wallSeconds,
+                              const IRSize &before, const IRSize &after) {
+  std::lock_guard<std::mutex> lock(mutex);
+  PassStats &stats = passes[passId];
+  stats.runs++;
+  stats.wallSeconds += wallSeconds;
+  stats.before.ops += before.ops;
+  stats.before.bytes += before.bytes;
+  stats.before.unrankedResults += before.unrankedResults;
+  stats.after.ops += after.ops;
+  stats.after.bytes += after.bytes;
+  stats.after.unrankedResults += after.unrankedResults;
+}
+
+void CompileStats::writeJSON(llvm::raw_ostream &os) {
+  std::lock_guard<std::mutex> lock(mutex);
+
+  auto writeSize = [&](llvm::json::OStream &json, llvm::StringRef suffix,
+                       const IRSize &size) {
+    json.attribute(("ops_" + suffix).str(), size.ops);
+    if (measureIRBytes)
+      json.attribute(("ir_bytes_" + suffix).str(), size.bytes);
+    json.attribute(("unranked_results_" + suffix).str(), size.unrankedResults);
+  };
+
+  llvm::json::OStream json(os, /*IndentSize=*/2);
+  json.object([&] {
+    json.attributeArray("stages", [&] {
+      for (const StageStats &stage : stages)
+        json.object([&] {
+          json.attribute("name", stage.name);
+          json.attribute("runs", static_cast<int64_t>(stage.runs));
+          json.attribute("wall_ms", toMilliseconds(stage.wallSeconds));
+          json.attribute("cpu_ms", toMilliseconds(stage.cpuSeconds));
+        });
+    });
+    json.attributeArray("passes", [&] {
+      for (const PassStats &pass : passes)
+        json.object([&] {
+          json.attribute("name", pass.name);
+          json.attribute("anchor", pass.anchor);
+          json.attribute("runs", static_cast<int64_t>(pass.runs));
+          json.attribute("wall_ms", toMilliseconds(pass.wallSeconds));
+          writeSize(json, "before", pass.before);
+          writeSize(json, "after", pass.after);
+        });
+    });
+    json.attribute("shapes_inferred",
+                   static_cast<int64_t>(mlir::toy::getNumInferredShapes()));
+    json.attributeObject("patterns_applied", [&] {
+      for (auto &pattern : mlir::toy::getCanonicalizationPatternCounts())
+        json.attribute(pattern.first, static_cast<int64_t>(pattern.second));
+    });
+    json.attribute("peak_rss_bytes", getPeakRSSBytes());
+  });
+  os << "\n";
+}
@@ -0,0 +1,210 @@
+//===- CostModel.cpp - Static cost model of Toy functions -----------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements the static cost model of the Toy functions, and the
+// micro-benchmarks measuring the roofline of the host.
+//
+//===----------------------------------------------------------------------===//
+
+#include "toy/CostModel.h"
+#include "toy/Dialect.h"
+
+#include "mlir/Analysis/LoopAnalysis.h"
+#include "mlir/Dialect/Affine/IR/AffineOps.h"
+#include "mlir/Dialect/Arithmetic/IR/Arithmetic.h"
+#include "mlir/Dialect/Math/IR/Math.h"
+#include "mlir/Dialect/MemRef/IR/MemRef.h"
+#include "mlir/Dialect/SCF/SCF.h"
+#include "mlir/Dialect/Utils/StaticValueUtils.h"
+#include "llvm/ADT/TypeSwitch.h"
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+using namespace mlir;
+
+//===----------------------------------------------------------------------===//
+// Cost estimation
+//===----------------------------------------------------------------------===//
+
+/// Return the number of bytes of an element of the shaped value `value`.
+static int64_t getElementBytes(Value value) {
+  return value.getType().cast<ShapedType>().getElementTypeBitWidth() / 8;
+}
+
+/// Return the number of bytes of the shaped value `value`, or 0 if its shape
+/// is unknown.
+static int64_t getNumBytes(Value value) {
+  auto type = value.getType().cast<ShapedType>();
+  if (!type.hasStaticShape())
+    return 0;
+  return type.getNumElements() * getElementBytes(value);
+}
+
+/// Return the number of elements of the shaped value `value`, or 0 if its
+/// shape is unknown.
+static int64_t getNumElements(Value value) {
+  auto type = value.getType().cast<ShapedType>();
+  return type.hasStaticShape() ? type.getNumElements() : 0;
+}
+
+/// Return the constant trip count of `loop`, a loop of the Toy code.
+static Optional<uint64_t> getConstantTripCount(scf::ForOp loop) {
+  Optional<int64_t> lowerBound = getConstantIntValue(loop.lowerBound());
+  Optional<int64_t> upperBound = getConstantIntValue(loop.upperBound());
+  Optional<int64_t> step = getConstantIntValue(loop.step());
+  if (!lowerBound || !upperBound || !step || *step <= 0)
+    return llvm::None;
+  if (*upperBound <= *lowerBound)
+    return 0;
+  return llvm::divideCeil(*upperBound - *lowerBound, *step);
+}
+
+/// Return the number of times `op` runs per call of its function, from the
+/// constant trip counts of the affine loops and of the loops of the Toy code
+/// around it. A loop without a constant trip count is assumed to run once.
+static int64_t getNumRuns(Operation *op) {
+  int64_t numRuns = 1;
+  for (Operation *parent = op->getParentOp(); parent;
+       parent = parent->getParentOp()) {
+    Optional<uint64_t> tripCount;
+    if (auto loop = dyn_cast<AffineForOp>(parent))
+      tripCount = getConstantTripCount(loop);
+    else if (auto loop = dyn_cast<scf::ForOp>(parent))
+      tripCount = getConstantTripCount(loop);
+    if (tripCount)
+      numRuns *= *tripCount;
+  }
+  return numRuns;
+}
+
+/// Return the cost of a single run of `op`. The Toy operations are costed as
+/// their lowering runs them, and the lowered code by its loads, stores and
+/// floating point operations.
+static toy::Cost getOpCost(Operation *op) {
+  toy::Cost cost;
+  llvm::TypeSwitch<Operation *>(op)
+      // The elementwise operations read two tensors and write one.
+      .Case<toy::AddOp, toy::MulOp>([&](auto binaryOp) {
+        cost.flops = getNumElements(binaryOp.getResult());
+        cost.bytes = 3 * getNumBytes(binaryOp.getResult());
+      })
+      // The fused multiply-add reads three tensors and writes one.
+      .Case<toy::FmaOp>([&](toy::FmaOp fma) {
+        cost.flops = 2 * getNumElements(fma.getResult());
+        cost.bytes = 4 * getNumBytes(fma.getResult());
+      })
+      .Case<math::FmaOp>([&](math::FmaOp) { cost.flops = 2; })
+      .Case<toy::TransposeOp>([&](toy::TransposeOp transpose) {
+        cost.bytes = 2 * getNumBytes(transpose.getResult());
+      })
+      // A constant is stored element by element into its buffer.
+      .Case<toy::ConstantOp>([&](toy::ConstantOp constant) {
+        cost.bytes = getNumBytes(constant.getResult());
+      })
+      .Case<toy::PrintOp>(
+          [&](toy::PrintOp print) { cost.bytes = getNumBytes(print.input()); })
+      .Case<AffineLoadOp, AffineStoreOp, memref::LoadOp, memref::StoreOp>(
+          [&](auto access) {
+            cost.bytes = getElementBytes(access.getMemRef());
+          })
+      .Case<memref::CopyOp>([&](memref::CopyOp copy) {
+        cost.bytes = 2 * getNumBytes(copy.source());
+      })
+      .Default([&](Operation *op) {
+        // Any other arithmetic operation on a float, e.g. `arith.mulf`.
+        if (isa<arith::ArithmeticDialect>(op->getDialect()) &&
+            !isa<arith::ConstantOp>(op) && op->getNumResults() == 1 &&
+            op->getResult(0).getType().isa<FloatType>())
+          cost.flops = 1;
+      });
+  return cost;
+}
+
+mlir::toy::Cost mlir::toy::estimateCost(FuncOp function) {
+  Cost cost;
+  function.walk([&](Operation *op) {
+    Cost opCost = getOpCost(op);
+    if (!opCost.flops && !opCost.bytes)
+      return;
+    int64_t numRuns = getNumRuns(op);
+    cost.flops += numRuns * opCost.flops;
+    cost.bytes += numRuns * opCost.bytes;
+  });
+  return cost;
+}
+
+//===----------------------------------------------------------------------===//
+// Host roofline
+//===----------------------------------------------------------------------===//
+
+double mlir::toy::MachineModel::predictSeconds(const Cost &cost) const {
+  return std::max(cost.flops / flopsPerSecond, cost.bytes / bytesPerSecond);
+}
+
+/// Keeps the results of the micro-benchmarks alive.
+static volatile double benchmarkSink;
+
+/// Return the shortest time of `numRuns` runs of `kernel`, in seconds.
+template <typename KernelT>
+static double timeBestRun(unsigned numRuns, KernelT kernel) {
+  double best = 0;
+  for (unsigned run = 0; run < numRuns; ++run) {
+    auto start = std::chrono::steady_clock::now();
+    kernel();
+    std::chrono::duration<double> seconds =
+        std::chrono::steady_clock::now() - start;
+    if (!run || seconds.count() < best)
+      best = seconds.count();
+  }
+  return best;
+}
+
+/// Measure the bandwidth of the memory with a stream triad over arrays much
+/// larger than the caches.
+static double measureBytesPerSecond() {
+  constexpr size_t size = 1 << 22;
+  std::vector<double> a(size), b(size, 1.0), c(size, 2.0);
+  double seconds = timeBestRun(5, [&] {
+    for (size_t i = 0; i < size; ++i)
+      a[i] = b[i] + 3.0 * c[i];
+  });
+  benchmarkSink = a[size / 2];
+  return 3 * size * sizeof(double) / seconds;
+}
+
+/// Measure the floating point throughput with independent chains of
+/// multiply-adds, enough of them to hide the latency of each.
+static double measureFlopsPerSecond() {
+  constexpr unsigned numChains = 16;
+  constexpr unsigned numSteps = 1 << 20;
+  double chains[numChains];
+  for (unsigned chain = 0; chain < numChains; ++chain)
+    chains[chain] = chain;
+  double seconds = timeBestRun(5, [&] {
+    for (unsigned step = 0; step < numSteps; ++step)
+      for (unsigned chain = 0; chain < numChains; ++chain)
+        chains[chain] = chains[chain] * 0.999999 + 1e-6;
+  });
+  double sum = 0;
+  for (double value : chains)
+    sum += value;
+  benchmarkSink = sum;
+  return 2.0 * numChains * numSteps / seconds;
+}
+
+const mlir::toy::MachineModel &mlir::toy::getHostMachineModel() {
+  static const MachineModel model = [] {
+    MachineModel model;
+    model.flopsPerSecond = measureFlopsPerSecond();
+    model.bytesPerSecond = measureBytesPerSecond();
+    return model;
+  }();
+  return model;
+}
@@ -13,6 +13,9 @@
 
 #include "toy/Dialect.h"
 
+#include "mlir/Dialect/Arithmetic/IR/Arithmetic.h"
+#include "mlir/Dialect/SCF/SCF.h"
+#include "mlir/Dialect/SparseTensor/IR/SparseTensor.h"
 #include "mlir/IR/Builders.h"
 #include "mlir/IR/BuiltinTypes.h"
 #include "mlir/IR/DialectImplementation.h"
@@ -152,12 +155,12 @@ void ConstantOp::build(mlir::OpBuilder &builder, mlir::OperationState &state,
 /// similarly to the `build` methods described above.
 static mlir::ParseResult parseConstantOp(mlir::OpAsmParser &parser,
                                          mlir::OperationState &result) {
-  mlir::DenseElementsAttr value;
+  mlir::ElementsAttr value;
   if (parser.parseOptionalAttrDict(result.attributes) ||
       parser.parseAttribute(value, "value", result.attributes))
     return failure();
 
-  result.addTypes(value.getType());
+  result.addTypes(getConstantTensorType(value));
   return success();
 }
 
@@ -174,11 +177,14 @@ static mlir::LogicalResult verifyConstantForType(mlir::Type type,
                                                  mlir::Attribute opaqueValue,
                                                  mlir::Operation *op) {
   if (type.isa<mlir::TensorType>()) {
-    // Check that the value is an elements attribute.
-    auto attrValue = opaqueValue.dyn_cast<mlir::DenseFPElementsAttr>();
-    if (!attrValue)
+    // Check that the value is a dense or sparse elements attribute of f64.
+    auto attrValue = opaqueValue.dyn_cast<mlir::ElementsAttr>();
+    if (!attrValue ||
+        !attrValue.isa<mlir::DenseFPElementsAttr, mlir::SparseElementsAttr>() ||
+        !attrValue.getType().getElementType().isF64())
       return op->emitError("constant of TensorType must be initialized by "
-                           "a DenseFPElementsAttr, got ")
+                           "a DenseFPElementsAttr or a SparseElementsAttr of "
+                           "f64, got ")
              << opaqueValue;
 
     // If the return type of the constant is not an unranked tensor, the shape
@@ -235,9 +241,29 @@ static mlir::LogicalResult verify(StructConstantOp op) {
   return verifyConstantForType(op.getResult().getType(), op.value(), op);
 }
 
+/// Return the fully shaped type of the constant `value`: the type of a tensor
+/// literal, or the struct of the types of its fields.
+static mlir::Type getConstantType(mlir::Attribute value) {
+  auto fields = value.dyn_cast<ArrayAttr>();
+  if (!fields)
+    return getConstantTensorType(value.cast<mlir::ElementsAttr>());
+  SmallVector<mlir::Type, 4> fieldTypes;
+  for (mlir::Attribute field : fields)
+    fieldTypes.push_back(getConstantType(field));
+  return StructType::get(fieldTypes);
+}
+
+/// Infer the output shape of the StructConstantOp, this is required by the
+/// shape inference interface.
+void StructConstantOp::inferShapes() {
+  getResult().setType(getConstantType(value()));
+}
+
 /// Infer the output shape of the ConstantOp, this is required by the shape
 /// inference interface.
-void ConstantOp::inferShapes() { getResult().setType(value().getType()); }
+void ConstantOp::inferShapes() {
+  getResult().setType(getConstantTensorType(value()));
+}
 
 //===----------------------------------------------------------------------===//
 // AddOp
@@ -249,8 +275,13 @@ void AddOp::build(mlir::OpBuilder &builder, mlir::OperationState &state,
 }
 
 /// Infer the output shape of the AddOp, this is required by the shape inference
-/// interface.
-void AddOp::inferShapes() { getResult().setType(getOperand(0).getType()); }
+/// interface. A sum is sparse when both its operands are.
+void AddOp::inferShapes() {
+  getResult().setType(getTensorType(
+      getOperand(0).getType().cast<RankedTensorType>(),
+      isSparseTensor(getOperand(0).getType()) &&
+          isSparseTensor(getOperand(1).getType())));
+}
 
 //===----------------------------------------------------------------------===//
 // CastOp
@@ -270,8 +301,29 @@ bool CastOp::areCastCompatible(TypeRange inputs, TypeRange outputs) {
   TensorType output = outputs.front().dyn_cast<TensorType>();
   if (!input || !output || input.getElementType() != output.getElementType())
     return false;
-  // The shape is required to match if both types are ranked.
-  return !input.hasRank() || !output.hasRank() || input == output;
+  // The shape is required to match if both types are ranked, a dense tensor may
+  // be cast to a sparse one and conversely.
+  return !input.hasRank() || !output.hasRank() ||
+         input.getShape() == output.getShape();
+}
+
+//===----------------------------------------------------------------------===//
+// FmaOp
+
+void FmaOp::build(mlir::OpBuilder &builder, mlir::OperationState &state,
+                  mlir::Value lhs, mlir::Value rhs, mlir::Value acc) {
+  state.addTypes(UnrankedTensorType::get(builder.getF64Type()));
+  state.addOperands({lhs, rhs, acc});
+}
+
+/// Infer the output shape of the FmaOp, this is required by the shape inference
+/// interface. The result is sparse when all its operands are, as in the
+/// sparsity analysis (see toy/Sparsity.h).
+void FmaOp::inferShapes() {
+  getResult().setType(getTensorType(
+      lhs().getType().cast<RankedTensorType>(),
+      llvm::all_of(getOperandTypes(),
+                   [](Type type) { return isSparseTensor(type); })));
 }
 
 //===----------------------------------------------------------------------===//
@@ -306,8 +358,14 @@ void MulOp::build(mlir::OpBuilder &builder, mlir::OperationState &state,
 }
 
 /// Infer the output shape of the MulOp, this is required by the shape inference
-/// interface.
-void MulOp::inferShapes() { getResult().setType(getOperand(0).getType()); }
+/// interface. A product is sparse when both its operands are: the product of a
+/// zero and a NaN or an infinity isn't zero.
+void MulOp::inferShapes() {
+  getResult().setType(getTensorType(
+      getOperand(0).getType().cast<RankedTensorType>(),
+      isSparseTensor(getOperand(0).getType()) &&
+          isSparseTensor(getOperand(1).getType())));
+}
 
 //===----------------------------------------------------------------------===//
 // ReturnOp
@@ -349,30 +407,54 @@ static mlir::LogicalResult verify(ReturnOp op) {
 //===----------------------------------------------------------------------===//
 // StructAccessOp
 
+/// Return the type of the field `index` of a struct of type `type`, or null if
+/// there is no such field.
+static mlir::Type getFieldType(mlir::Type type, size_t index) {
+  StructType structTy = type.cast<StructType>();
+  if (index >= structTy.getNumElementTypes())
+    return mlir::Type();
+  return structTy.getElementTypes()[index];
+}
+
 void StructAccessOp::build(mlir::OpBuilder &b, mlir::OperationState &state,
                            mlir::Value input, size_t index) {
   // Extract the result type from the input type.
-  StructType structTy = input.getType().cast<StructType>();
-  assert(index < structTy.getNumElementTypes());
-  mlir::Type resultType = structTy.getElementTypes()[index];
+  mlir::Type resultType = getFieldType(input.getType(), index);
+  assert(resultType && "index out of the range of the struct");
 
   // Call into the auto-generated build method.
   build(b, state, resultType, input, b.getI64IntegerAttr(index));
 }
 
 static mlir::LogicalResult verify(StructAccessOp op) {
-  StructType structTy = op.input().getType().cast<StructType>();
-  size_t index = op.index();
-  if (index >= structTy.getNumElementTypes())
+  mlir::Type fieldType = getFieldType(op.input().getType(), op.index());
+  if (!fieldType)
     return op.emitOpError()
            << "index should be within the range of the input struct type";
   mlir::Type resultType = op.getResult().getType();
-  if (resultType != structTy.getElementTypes()[index])
+  if (resultType != fieldType)
     return op.emitOpError() << "must have the same result type as the struct "
                                "element referred to by the index";
   return mlir::success();
 }
 
+/// Infer the output shape of the StructAccessOp, this is required by the shape
+/// inference interface.
+void StructAccessOp::inferShapes() {
+  getResult().setType(getFieldType(input().getType(), index()));
+}
+
+//===----------------------------------------------------------------------===//
+// StructPackOp
+
+static mlir::LogicalResult verify(StructPackOp op) {
+  auto structTy = op.getType().cast<StructType>();
+  if (op.fields().getTypes() != structTy.getElementTypes())
+    return op.emitOpError() << "must have the types of the struct elements as "
+                               "operand types";
+  return mlir::success();
+}
+
 //===----------------------------------------------------------------------===//
 // TransposeOp
 
@@ -385,7 +467,8 @@ void TransposeOp::build(mlir::OpBuilder &builder, mlir::OperationState &state,
 void TransposeOp::inferShapes() {
   auto arrayTy = getOperand().getType().cast<RankedTensorType>();
   SmallVector<int64_t, 2> dims(llvm::reverse(arrayTy.getShape()));
-  getResult().setType(RankedTensorType::get(dims, arrayTy.getElementType()));
+  getResult().setType(RankedTensorType::get(dims, arrayTy.getElementType(),
+                                            arrayTy.getEncoding()));
 }
 
 static mlir::LogicalResult verify(TransposeOp op) {
@@ -483,6 +566,38 @@ llvm::ArrayRef<mlir::Type> StructType::getElementTypes() {
   return getImpl()->elementTypes;
 }
 
+//===----------------------------------------------------------------------===//
+// Toy Sparse Tensors
+//===----------------------------------------------------------------------===//
+
+bool mlir::toy::isSparseTensor(mlir::Type type) {
+  return static_cast<bool>(sparse_tensor::getSparseTensorEncoding(type));
+}
+
+mlir::RankedTensorType mlir::toy::getTensorType(mlir::RankedTensorType type,
+                                                bool sparse) {
+  // A scalar has no sparse encoding.
+  if (!sparse || type.getRank() == 0)
+    return RankedTensorType::get(type.getShape(), type.getElementType());
+
+  // All the dimensions are compressed: only the nonzeros are stored, as in
+  // the coordinate format of the sparse constants.
+  using DimLevelType = sparse_tensor::SparseTensorEncodingAttr::DimLevelType;
+  SmallVector<DimLevelType, 2> dimLevelTypes(type.getRank(),
+                                             DimLevelType::Compressed);
+  auto encoding = sparse_tensor::SparseTensorEncodingAttr::get(
+      type.getContext(), dimLevelTypes, AffineMap(), /*pointerBitWidth=*/0,
+      /*indexBitWidth=*/0);
+  return RankedTensorType::get(type.getShape(), type.getElementType(),
+                               encoding);
+}
+
+mlir::RankedTensorType
+mlir::toy::getConstantTensorType(mlir::ElementsAttr value) {
+  return getTensorType(value.getType().cast<RankedTensorType>(),
+                       value.isa<mlir::SparseElementsAttr>());
+}
+
 /// Parse an instance of a type registered to the toy dialect.
 mlir::Type ToyDialect::parseType(mlir::DialectAsmParser &parser) const {
   // Parse a struct type in the following form:
@@ -506,10 +621,12 @@ mlir::Type ToyDialect::parseType(mlir::DialectAsmParser &parser) const {
     if (parser.parseType(elementType))
       return nullptr;
 
-    // Check that the type is either a TensorType or another StructType.
-    if (!elementType.isa<mlir::TensorType, StructType>()) {
+    // Check that the type is either a TensorType or another StructType, or
+    // a MemRefType once lowered to buffers.
+    if (!elementType.isa<mlir::TensorType, mlir::MemRefType, StructType>()) {
       parser.emitError(typeLoc, "element type for a struct must either "
-                                "be a TensorType or a StructType, got: ")
+                                "be a TensorType, a MemRefType or a "
+                                "StructType, got: ")
           << elementType;
       return Type();
     }
@@ -566,5 +683,5 @@ mlir::Operation *ToyDialect::materializeConstant(mlir::OpBuilder &builder,
     return builder.create<StructConstantOp>(loc, type,
                                             value.cast<mlir::ArrayAttr>());
   return builder.create<ConstantOp>(loc, type,
-                                    value.cast<mlir::DenseElementsAttr>());
+                                    value.cast<mlir::ElementsAttr>());
 }
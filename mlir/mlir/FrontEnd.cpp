@@ -0,0 +1,216 @@
+//===- FrontEnd.cpp - Parallel front end for Toy files --------------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements the front end compiling several Toy files into a single
+// MLIR module. Files are parsed in rounds: the files of a round are parsed in
+// parallel, and their imports make the next round. Each file is then emitted to
+// its own module, in parallel with the files at the same depth in the import
+// graph, and the modules are merged with their symbols resolved.
+//
+//===----------------------------------------------------------------------===//
+
+#include "toy/FrontEnd.h"
+#include "toy/MLIRGen.h"
+#include "toy/Parser.h"
+
+#include "mlir/IR/MLIRContext.h"
+#include "mlir/IR/SymbolTable.h"
+#include "mlir/IR/Threading.h"
+#include "mlir/IR/Verifier.h"
+
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SetVector.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+
+using namespace toy;
+
+/// Parse the AST of `file`.
+static mlir::LogicalResult parseFile(ToyFile &file) {
+  llvm::ErrorOr<uint32_t> fileOrErr = SourceManager::get().addFile(file.path);
+  if (std::error_code ec = fileOrErr.getError()) {
+    llvm::errs() << "Could not open input file " << file.path << ": "
+                 << ec.message() << "\n";
+    return mlir::failure();
+  }
+  Lexer lexer(*fileOrErr);
+  Parser parser(lexer);
+  file.ast = parser.parseModule();
+  return mlir::success(file.ast != nullptr);
+}
+
+mlir::LogicalResult toy::parseToyFiles(mlir::MLIRContext &context,
+                                       llvm::ArrayRef<std::string> filenames,
+                                       std::vector<ToyFile> &files) {
+  // Files are identified by their real path, so that a file imported through
+  // different paths is parsed once.
+  llvm::StringMap<unsigned> fileIds;
+  auto getOrAddFile = [&](llvm::StringRef path) {
+    llvm::SmallString<128> realPath;
+    if (path == "-" || llvm::sys::fs::real_path(path, realPath))
+      realPath = path;
+    auto it = fileIds.try_emplace(realPath, files.size());
+    if (it.second)
+      files.push_back({path.str(), nullptr, {}});
+    return it.first->second;
+  };
+  for (const std::string &filename : filenames)
+    getOrAddFile(filename);
+
+  for (size_t begin = 0, end = files.size(); begin != end;
+       begin = end, end = files.size()) {
+    if (mlir::failed(mlir::failableParallelForEachN(
+            &context, begin, end,
+            [&](size_t i) { return parseFile(files[i]); })))
+      return mlir::failure();
+
+    // Resolve the imports of the files just parsed, which are parsed in the
+    // next round.
+    bool missingImport = false;
+    for (size_t i = begin; i != end; ++i) {
+      for (ImportAST *import : files[i].ast->getImports()) {
+        llvm::SmallString<128> path;
+        if (llvm::sys::path::is_relative(import->getPath()) &&
+            files[i].path != "-")
+          path = llvm::sys::path::parent_path(files[i].path);
+        llvm::sys::path::append(path, import->getPath());
+        if (!llvm::sys::fs::exists(path)) {
+          llvm::errs() << SourceManager::get().resolve(import->loc())
+                       << ": error: cannot find imported file '"
+                       << import->getPath() << "'\n";
+          missingImport = true;
+          continue;
+        }
+        unsigned id = getOrAddFile(path);
+        files[i].imports.push_back(id);
+      }
+    }
+    if (missingImport)
+      return mlir::failure();
+  }
+  return mlir::success();
+}
+
+namespace {
+/// The order in which the files are emitted: a file is emitted after all the
+/// files it imports, directly or not.
+struct ImportGraph {
+  ImportGraph(llvm::ArrayRef<ToyFile> files)
+      : files(files), depths(files.size()), transitiveImports(files.size()),
+        states(files.size(), Unvisited) {}
+
+  /// Compute the depth and the transitive imports of every file. Returns
+  /// failure on an import cycle.
+  mlir::LogicalResult compute() {
+    for (unsigned id = 0, e = files.size(); id != e; ++id)
+      if (mlir::failed(visit(id)))
+        return mlir::failure();
+    return mlir::success();
+  }
+
+  llvm::ArrayRef<ToyFile> files;
+
+  /// The depth of each file: 0 for the files that import nothing, and one
+  /// more than the deepest of its imports otherwise.
+  std::vector<unsigned> depths;
+
+  /// The files imported by each file, directly or not, where a file always
+  /// comes after the files it imports.
+  std::vector<llvm::SetVector<unsigned>> transitiveImports;
+
+private:
+  mlir::LogicalResult visit(unsigned id) {
+    if (states[id] == Visited)
+      return mlir::success();
+    if (states[id] == Visiting) {
+      llvm::errs() << "error: import cycle through '" << files[id].path
+                   << "'\n";
+      return mlir::failure();
+    }
+
+    states[id] = Visiting;
+    for (unsigned import : files[id].imports) {
+      if (mlir::failed(visit(import)))
+        return mlir::failure();
+      depths[id] = std::max(depths[id], depths[import] + 1);
+      transitiveImports[id].insert(transitiveImports[import].begin(),
+                                   transitiveImports[import].end());
+      transitiveImports[id].insert(import);
+    }
+    states[id] = Visited;
+    return mlir::success();
+  }
+
+  enum State { Unvisited, Visiting, Visited };
+  std::vector<State> states;
+};
+} // namespace
+
+mlir::OwningModuleRef toy::mlirGenToyFiles(mlir::MLIRContext &context,
+                                           llvm::ArrayRef<ToyFile> files) {
+  ImportGraph graph(files);
+  if (mlir::failed(graph.compute()))
+    return nullptr;
+
+  // The files at the same depth don't depend on each other, and are emitted in
+  // parallel once the files of the lower depths are.
+  std::vector<mlir::OwningModuleRef> modules(files.size());
+  unsigned maxDepth = *std::max_element(graph.depths.begin(),
+                                        graph.depths.end());
+  for (unsigned depth = 0; depth <= maxDepth; ++depth) {
+    llvm::SmallVector<unsigned, 8> ids;
+    for (unsigned id = 0, e = files.size(); id != e; ++id)
+      if (graph.depths[id] == depth)
+        ids.push_back(id);
+
+    auto emitFile = [&](unsigned id) {
+      llvm::SmallVector<ImportedModule, 4> imports;
+      for (unsigned import : graph.transitiveImports[id])
+        imports.push_back({files[import].ast.get(), *modules[import]});
+      modules[id] = mlirGen(context, *files[id].ast, imports);
+      return mlir::success(static_cast<bool>(modules[id]));
+    };
+    if (mlir::failed(mlir::failableParallelForEach(&context, ids.begin(),
+                                                   ids.end(), emitFile)))
+      return nullptr;
+  }
+
+  // Move the definitions into a single module. The imported functions are only
+  // declared in the modules importing them, and these declarations resolve to
+  // the definitions.
+  mlir::OwningModuleRef merged =
+      mlir::ModuleOp::create(mlir::UnknownLoc::get(&context));
+  mlir::SymbolTable symbolTable(*merged);
+  for (mlir::OwningModuleRef &module : modules) {
+    for (mlir::FuncOp func :
+         llvm::make_early_inc_range(module->getOps<mlir::FuncOp>())) {
+      if (func.isDeclaration())
+        continue;
+      if (mlir::Operation *previous = symbolTable.lookup(func.getName())) {
+        mlir::InFlightDiagnostic diag =
+            func.emitError("redefinition of function '") << func.getName()
+                                                          << "'";
+        diag.attachNote(previous->getLoc()) << "previous definition is here";
+        return nullptr;
+      }
+      func->remove();
+      symbolTable.insert(func);
+    }
+  }
+
+  if (mlir::failed(mlir::verify(*merged))) {
+    merged->emitError("module verification error");
+    return nullptr;
+  }
+  return merged;
+}
@@ -0,0 +1,96 @@
+//===- InlineLeafFunctions.cpp - Inline the small Toy leaf functions ------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements a Module level pass inlining the specialized functions
+// that are small and call no other function, so that their operations fuse
+// with those of their callers. The other functions are kept, and are still
+// optimized and lowered in parallel.
+//
+//===----------------------------------------------------------------------===//
+
+#include "mlir/IR/BuiltinOps.h"
+#include "mlir/IR/SymbolTable.h"
+#include "mlir/Pass/Pass.h"
+#include "mlir/Transforms/InliningUtils.h"
+#include "toy/Dialect.h"
+#include "toy/Passes.h"
+#include "toy/Remarks.h"
+#include "llvm/ADT/DenseMap.h"
+
+using namespace mlir;
+using namespace toy;
+
+/// Return whether `func` is a leaf function of at most `maxOperations`
+/// operations, the terminators excluded.
+static bool isSmallLeaf(FuncOp func, unsigned maxOperations) {
+  if (func.isDeclaration())
+    return false;
+  unsigned numOperations = 0;
+  WalkResult result = func.walk([&](Operation *op) {
+    if (op == func || op->hasTrait<OpTrait::IsTerminator>())
+      return WalkResult::advance();
+    if (isa<GenericCallOp>(op) || ++numOperations > maxOperations)
+      return WalkResult::interrupt();
+    return WalkResult::advance();
+  });
+  return !result.wasInterrupted();
+}
+
+namespace {
+/// The InlineLeafFunctionsPass inlines the calls to the small leaf functions,
+/// once the functions are specialized, then erases the functions no longer
+/// called.
+class InlineLeafFunctionsPass
+    : public PassWrapper<InlineLeafFunctionsPass, OperationPass<ModuleOp>> {
+public:
+  InlineLeafFunctionsPass(unsigned maxOperations)
+      : maxOperations(maxOperations) {}
+
+  void runOnOperation() override {
+    ModuleOp module = getOperation();
+    SymbolTable symbolTable(module);
+    InlinerInterface interface(&getContext());
+
+    llvm::DenseMap<Operation *, bool> isInlinable;
+    SmallVector<GenericCallOp, 16> calls;
+    module.walk([&](GenericCallOp call) { calls.push_back(call); });
+    for (GenericCallOp call : calls) {
+      auto callee = symbolTable.lookup<FuncOp>(call.callee());
+      if (!callee)
+        continue;
+      auto it = isInlinable.try_emplace(callee, false);
+      if (it.second)
+        it.first->second = isSmallLeaf(callee, maxOperations);
+      if (!it.first->second)
+        continue;
+      if (failed(inlineCall(interface, call, callee, &callee.getBody())))
+        continue;
+      toy::emitOptimizationRemark(toy::RemarkKind::Passed, "toy-inline",
+                                  "Inlined", call,
+                                  "inlined the leaf function '" +
+                                      call.callee() + "'");
+      call.erase();
+    }
+
+    // The private functions all of whose calls were inlined are dead.
+    for (FuncOp func : llvm::make_early_inc_range(module.getOps<FuncOp>()))
+      if (func.isPrivate() && isInlinable.lookup(func) &&
+          SymbolTable::symbolKnownUseEmpty(func, module))
+        func.erase();
+  }
+
+private:
+  unsigned maxOperations;
+};
+} // namespace
+
+/// Create a pass inlining the small leaf functions.
+std::unique_ptr<Pass>
+mlir::toy::createInlineLeafFunctionsPass(unsigned maxOperations) {
+  return std::make_unique<InlineLeafFunctionsPass>(maxOperations);
+}
@@ -0,0 +1,556 @@
+//===- Interpreter.cpp - Reference interpreter of the Toy dialect ---------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements the interpreter of the Toy dialect. Each tensor is held
+// in a host array in row-major order, computed by a kernel over the whole
+// array that the host compiler vectorizes. The tensors are never written once
+// computed, so that a reshape or a cast shares the elements of its operand.
+//
+//===----------------------------------------------------------------------===//
+
+#include "toy/Interpreter.h"
+#include "toy/Dialect.h"
+#include "toy/Sparsity.h"
+
+#include "mlir/Dialect/Arithmetic/IR/Arithmetic.h"
+#include "mlir/Dialect/SCF/SCF.h"
+#include "mlir/Dialect/Utils/StaticValueUtils.h"
+#include "mlir/IR/BuiltinOps.h"
+#include "mlir/IR/SymbolTable.h"
+#include "llvm/ADT/TypeSwitch.h"
+#include "llvm/Support/MathExtras.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+using namespace mlir;
+
+//===----------------------------------------------------------------------===//
+// Host kernels
+//===----------------------------------------------------------------------===//
+
+// The kernels run over contiguous arrays that don't alias their result, so
+// that the host compiler vectorizes their loops.
+
+static void addKernel(const double *__restrict lhs,
+                      const double *__restrict rhs, double *__restrict result,
+                      int64_t numElements) {
+  for (int64_t i = 0; i < numElements; ++i)
+    result[i] = lhs[i] + rhs[i];
+}
+
+static void mulKernel(const double *__restrict lhs,
+                      const double *__restrict rhs, double *__restrict result,
+                      int64_t numElements) {
+  for (int64_t i = 0; i < numElements; ++i)
+    result[i] = lhs[i] * rhs[i];
+}
+
+/// The multiply-add is rounded once, as `math.fma` in the lowered code.
+static void fmaKernel(const double *__restrict lhs,
+                      const double *__restrict rhs,
+                      const double *__restrict acc, double *__restrict result,
+                      int64_t numElements) {
+  for (int64_t i = 0; i < numElements; ++i)
+    result[i] = std::fma(lhs[i], rhs[i], acc[i]);
+}
+
+/// The side of the tiles of the matrix transpose, small enough that the rows
+/// of a tile of the input and of the result stay in the L1 cache.
+static const int64_t transposeTileSize = 32;
+
+/// Transpose the row-major `numRows` x `numColumns` matrix `input` into
+/// `result`, a tile at a time so that both are accessed with locality.
+static void transposeKernel(const double *__restrict input,
+                            double *__restrict result, int64_t numRows,
+                            int64_t numColumns) {
+  for (int64_t row = 0; row < numRows; row += transposeTileSize) {
+    int64_t rowEnd = std::min(row + transposeTileSize, numRows);
+    for (int64_t column = 0; column < numColumns;
+         column += transposeTileSize) {
+      int64_t columnEnd = std::min(column + transposeTileSize, numColumns);
+      for (int64_t i = row; i < rowEnd; ++i)
+        for (int64_t j = column; j < columnEnd; ++j)
+          result[j * numRows + i] = input[i * numColumns + j];
+    }
+  }
+}
+
+/// Transpose `input` of shape `shape`, of any rank, into `result`: the element
+/// at the indices (i0, ..., in) of the input is at (in, ..., i0).
+static void transposeAnyRankKernel(const double *__restrict input,
+                                   double *__restrict result,
+                                   ArrayRef<int64_t> shape) {
+  // The stride in the result of each dimension of the input.
+  int64_t rank = shape.size();
+  SmallVector<int64_t, 4> resultStrides(rank);
+  int64_t stride = 1;
+  for (int64_t dim = 0; dim < rank; ++dim) {
+    resultStrides[dim] = stride;
+    stride *= shape[dim];
+  }
+
+  // Walk the input in order, with the indices of the current element.
+  SmallVector<int64_t, 4> indices(rank, 0);
+  int64_t offset = 0;
+  for (int64_t i = 0, e = stride; i < e; ++i) {
+    result[offset] = input[i];
+    for (int64_t dim = rank - 1; dim >= 0; --dim) {
+      offset += resultStrides[dim];
+      if (++indices[dim] != shape[dim])
+        break;
+      offset -= resultStrides[dim] * shape[dim];
+      indices[dim] = 0;
+    }
+  }
+}
+
+//===----------------------------------------------------------------------===//
+// Runtime values
+//===----------------------------------------------------------------------===//
+
+namespace {
+/// A value of the interpreted code: a tensor, a struct or an index.
+struct RuntimeValue {
+  /// The shape of a tensor.
+  SmallVector<int64_t, 2> shape;
+  /// The elements of a tensor in row-major order, shared by the tensors
+  /// reshaped or cast from it.
+  std::shared_ptr<std::vector<double>> elements;
+  /// The fields of a struct.
+  std::vector<RuntimeValue> fields;
+  /// The value of an index.
+  int64_t index = 0;
+
+  const double *data() const { return elements->data(); }
+};
+} // namespace
+
+/// Return the shape of the tensor `value`, which must be static.
+static SmallVector<int64_t, 2> getShape(Value value) {
+  auto type = value.getType().cast<RankedTensorType>();
+  return llvm::to_vector<2>(type.getShape());
+}
+
+/// Return a tensor of shape `shape`, filled with zeros.
+static RuntimeValue createTensor(ArrayRef<int64_t> shape) {
+  RuntimeValue tensor;
+  tensor.shape.assign(shape.begin(), shape.end());
+  int64_t numElements = 1;
+  for (int64_t size : shape)
+    numElements *= size;
+  tensor.elements = std::make_shared<std::vector<double>>(numElements);
+  return tensor;
+}
+
+/// Return the row-major offset of the element at `indices` in a tensor of
+/// shape `shape`.
+static int64_t getOffset(ArrayRef<int64_t> shape, ArrayRef<int64_t> indices) {
+  int64_t offset = 0;
+  for (auto it : llvm::zip(shape, indices))
+    offset = offset * std::get<0>(it) + std::get<1>(it);
+  return offset;
+}
+
+/// Return the elements of the constant `value` in row-major order. A sparse
+/// constant is zeros but for its nonzeros, stored in order as the lowering
+/// does.
+static std::vector<double> getConstantElements(ElementsAttr value) {
+  ShapedType type = value.getType();
+  auto sparse = value.dyn_cast<SparseElementsAttr>();
+  if (!sparse) {
+    auto elements = value.cast<DenseElementsAttr>().getValues<double>();
+    return std::vector<double>(elements.begin(), elements.end());
+  }
+
+  std::vector<double> elements(type.getNumElements(), 0.0);
+  auto indexIt = sparse.getIndices().value_begin<int64_t>();
+  for (double element : sparse.getValues().getValues<double>()) {
+    int64_t offset = 0;
+    for (int64_t dim = 0, rank = type.getRank(); dim < rank; ++dim)
+      offset = offset * type.getDimSize(dim) + *indexIt++;
+    elements[offset] = element;
+  }
+  return elements;
+}
+
+/// Print the elements of `shape` starting at `elements` as the lowered
+/// `toy.print` does: each element with the format "%f ", and a newline after
+/// each row of the dimensions but the innermost. Return the elements past the
+/// printed ones.
+static const double *printElements(const double *elements,
+                                   ArrayRef<int64_t> shape) {
+  if (shape.empty()) {
+    printf("%f ", *elements);
+    return elements + 1;
+  }
+  for (int64_t i = 0, e = shape.front(); i != e; ++i) {
+    elements = printElements(elements, shape.drop_front());
+    if (shape.size() > 1)
+      printf("\n");
+  }
+  return elements;
+}
+
+//===----------------------------------------------------------------------===//
+// Interpreter
+//===----------------------------------------------------------------------===//
+
+namespace {
+/// The interpreter of the functions of a module.
+class Interpreter {
+public:
+  Interpreter(ModuleOp module) : symbolTable(module) {}
+
+  /// Call `function` with `args`, and return its results.
+  SmallVector<RuntimeValue, 1> call(FuncOp function,
+                                    ArrayRef<RuntimeValue> args);
+
+private:
+  /// The state of a call: the values computed so far, and the elements of the
+  /// tensors of the function that may be nonzero.
+  struct Frame {
+    const toy::SparsityAnalysis &sparsity;
+    llvm::DenseMap<Value, RuntimeValue> values;
+
+    /// Return the value of `value`, which must be computed.
+    const RuntimeValue &lookup(Value value) const {
+      return values.find(value)->second;
+    }
+  };
+
+  /// Run the operations of `block` but its terminator, and return the values
+  /// of the operands of the terminator.
+  SmallVector<RuntimeValue, 1> run(Block &block, Frame &frame);
+  void run(Operation *op, Frame &frame);
+  void runLoop(scf::ForOp loop, Frame &frame);
+
+  RuntimeValue runElementwise(Operation *op, Frame &frame);
+  RuntimeValue runTranspose(toy::TransposeOp op, Frame &frame);
+
+  /// Return the tensor of the constant `value`, converted on first use.
+  RuntimeValue getConstant(ElementsAttr value);
+  /// Return the struct of the constant `value`, whose fields are nested
+  /// arrays or tensor constants.
+  RuntimeValue getStructConstant(ArrayAttr value);
+
+  SymbolTable symbolTable;
+
+  /// The sparsity of the functions called so far.
+  llvm::DenseMap<Operation *, std::unique_ptr<toy::SparsityAnalysis>>
+      sparsities;
+
+  /// The elements of the constants run so far.
+  llvm::DenseMap<Attribute, std::shared_ptr<std::vector<double>>> constants;
+};
+} // namespace
+
+SmallVector<RuntimeValue, 1> Interpreter::call(FuncOp function,
+                                               ArrayRef<RuntimeValue> args) {
+  std::unique_ptr<toy::SparsityAnalysis> &sparsity = sparsities[function];
+  if (!sparsity)
+    sparsity = std::make_unique<toy::SparsityAnalysis>(function);
+
+  Frame frame{*sparsity, {}};
+  for (auto it : llvm::zip(function.getArguments(), args))
+    frame.values[std::get<0>(it)] = std::get<1>(it);
+  return run(function.front(), frame);
+}
+
+SmallVector<RuntimeValue, 1> Interpreter::run(Block &block, Frame &frame) {
+  for (Operation &op : block.without_terminator())
+    run(&op, frame);
+  SmallVector<RuntimeValue, 1> results;
+  for (Value operand : block.getTerminator()->getOperands())
+    results.push_back(frame.lookup(operand));
+  return results;
+}
+
+void Interpreter::run(Operation *op, Frame &frame) {
+  auto setResult = [&](RuntimeValue value) {
+    frame.values[op->getResult(0)] = std::move(value);
+  };
+  llvm::TypeSwitch<Operation *>(op)
+      .Case<toy::ConstantOp>([&](toy::ConstantOp constant) {
+        setResult(getConstant(constant.value()));
+      })
+      .Case<toy::StructConstantOp>([&](toy::StructConstantOp constant) {
+        setResult(getStructConstant(constant.value()));
+      })
+      .Case<toy::AddOp, toy::FmaOp, toy::MulOp>([&](auto elementwise) {
+        setResult(runElementwise(elementwise, frame));
+      })
+      .Case<toy::TransposeOp>([&](toy::TransposeOp transpose) {
+        setResult(runTranspose(transpose, frame));
+      })
+      // The elements are shared, only the shape changes.
+      .Case<toy::CastOp, toy::ReshapeOp>([&](auto reshape) {
+        RuntimeValue result = frame.lookup(reshape.input());
+        result.shape = getShape(reshape.getResult());
+        setResult(std::move(result));
+      })
+      .Case<toy::StructAccessOp>([&](toy::StructAccessOp access) {
+        setResult(frame.lookup(access.input()).fields[access.index()]);
+      })
+      .Case<toy::GenericCallOp>([&](toy::GenericCallOp genericCall) {
+        SmallVector<RuntimeValue, 4> args;
+        for (Value input : genericCall.inputs())
+          args.push_back(frame.lookup(input));
+        SmallVector<RuntimeValue, 1> results =
+            call(symbolTable.lookup<FuncOp>(genericCall.callee()), args);
+        for (auto it : llvm::zip(genericCall->getResults(), results))
+          frame.values[std::get<0>(it)] = std::move(std::get<1>(it));
+      })
+      .Case<toy::PrintOp>([&](toy::PrintOp print) {
+        const RuntimeValue &input = frame.lookup(print.input());
+        printElements(input.data(), input.shape);
+      })
+      .Case<arith::ConstantOp>([&](arith::ConstantOp constant) {
+        RuntimeValue index;
+        index.index = constant.getValue().cast<IntegerAttr>().getInt();
+        setResult(std::move(index));
+      })
+      .Case<scf::ForOp>([&](scf::ForOp loop) { runLoop(loop, frame); });
+}
+
+void Interpreter::runLoop(scf::ForOp loop, Frame &frame) {
+  int64_t lowerBound = frame.lookup(loop.lowerBound()).index;
+  int64_t upperBound = frame.lookup(loop.upperBound()).index;
+  int64_t step = frame.lookup(loop.step()).index;
+
+  SmallVector<RuntimeValue, 1> carried;
+  for (Value init : loop.getIterOperands())
+    carried.push_back(frame.lookup(init));
+  for (int64_t iv = lowerBound; iv < upperBound; iv += step) {
+    frame.values[loop.getInductionVar()].index = iv;
+    for (auto it : llvm::zip(loop.getRegionIterArgs(), carried))
+      frame.values[std::get<0>(it)] = std::move(std::get<1>(it));
+    carried = run(*loop.getBody(), frame);
+  }
+  for (auto it : llvm::zip(loop.getResults(), carried))
+    frame.values[std::get<0>(it)] = std::move(std::get<1>(it));
+}
+
+RuntimeValue Interpreter::runElementwise(Operation *op, Frame &frame) {
+  SmallVector<const double *, 3> operands;
+  for (Value operand : op->getOperands())
+    operands.push_back(frame.lookup(operand).data());
+  RuntimeValue result = createTensor(getShape(op->getResult(0)));
+  double *elements = result.elements->data();
+
+  // As in the lowered code, only the elements that may be nonzero are
+  // computed, the others stay zeros.
+  if (const toy::NonZeros *nonZeros =
+          frame.sparsity.lookup(op->getResult(0))) {
+    for (const auto &indices : *nonZeros) {
+      int64_t i = getOffset(result.shape, indices);
+      if (isa<toy::AddOp>(op))
+        elements[i] = operands[0][i] + operands[1][i];
+      else if (isa<toy::MulOp>(op))
+        elements[i] = operands[0][i] * operands[1][i];
+      else
+        elements[i] = std::fma(operands[0][i], operands[1][i], operands[2][i]);
+    }
+    return result;
+  }
+
+  int64_t numElements = result.elements->size();
+  if (isa<toy::AddOp>(op))
+    addKernel(operands[0], operands[1], elements, numElements);
+  else if (isa<toy::MulOp>(op))
+    mulKernel(operands[0], operands[1], elements, numElements);
+  else
+    fmaKernel(operands[0], operands[1], operands[2], elements, numElements);
+  return result;
+}
+
+RuntimeValue Interpreter::runTranspose(toy::TransposeOp op, Frame &frame) {
+  const RuntimeValue &input = frame.lookup(op.input());
+  ArrayRef<int64_t> shape = input.shape;
+  // A tensor of rank 0 or 1 is its own transpose.
+  if (shape.size() < 2)
+    return input;
+
+  RuntimeValue result = createTensor(getShape(op.getResult()));
+  double *elements = result.elements->data();
+  if (const toy::NonZeros *nonZeros =
+          frame.sparsity.lookup(op.getResult())) {
+    for (const auto &indices : *nonZeros) {
+      SmallVector<int64_t, 2> inputIndices(llvm::reverse(indices));
+      elements[getOffset(result.shape, indices)] =
+          input.data()[getOffset(shape, inputIndices)];
+    }
+  } else if (shape.size() == 2) {
+    transposeKernel(input.data(), elements, shape[0], shape[1]);
+  } else {
+    transposeAnyRankKernel(input.data(), elements, shape);
+  }
+  return result;
+}
+
+RuntimeValue Interpreter::getConstant(ElementsAttr value) {
+  std::shared_ptr<std::vector<double>> &elements = constants[value];
+  if (!elements)
+    elements =
+        std::make_shared<std::vector<double>>(getConstantElements(value));
+  RuntimeValue tensor;
+  auto shape = value.getType().getShape();
+  tensor.shape.assign(shape.begin(), shape.end());
+  tensor.elements = elements;
+  return tensor;
+}
+
+RuntimeValue Interpreter::getStructConstant(ArrayAttr value) {
+  RuntimeValue result;
+  for (Attribute field : value) {
+    if (auto array = field.dyn_cast<ArrayAttr>())
+      result.fields.push_back(getStructConstant(array));
+    else
+      result.fields.push_back(getConstant(field.cast<ElementsAttr>()));
+  }
+  return result;
+}
+
+//===----------------------------------------------------------------------===//
+// Work estimation
+//===----------------------------------------------------------------------===//
+
+/// The work of running an operation, besides its elements, counted in
+/// elements.
+static const uint64_t opOverhead = 16;
+
+/// Return whether `type` is a value the interpreter holds: a tensor of static
+/// shape, a struct of these, or an index.
+static bool isInterpretable(Type type) {
+  if (auto tensorType = type.dyn_cast<RankedTensorType>())
+    return tensorType.hasStaticShape();
+  if (auto structType = type.dyn_cast<toy::StructType>())
+    return llvm::all_of(structType.getElementTypes(),
+                        [](Type type) { return isInterpretable(type); });
+  return type.isa<IndexType>();
+}
+
+/// Return the number of elements of the tensor `value`, or 0 for any other
+/// value.
+static uint64_t getNumElements(Value value) {
+  auto type = value.getType().dyn_cast<RankedTensorType>();
+  return type ? type.getNumElements() : 0;
+}
+
+namespace {
+/// The estimate of the work of the functions of a module, with the functions
+/// they call.
+class WorkEstimator {
+public:
+  WorkEstimator(ModuleOp module) : symbolTable(module) {}
+
+  /// Return the work of a call of `function`, or None if it can't be
+  /// interpreted.
+  Optional<uint64_t> estimate(FuncOp function);
+
+private:
+  Optional<uint64_t> estimate(Block &block);
+  Optional<uint64_t> estimate(Operation *op);
+
+  SymbolTable symbolTable;
+
+  /// The work of the functions estimated so far.
+  llvm::DenseMap<Operation *, Optional<uint64_t>> works;
+  /// The functions being estimated. A recursive call never ends, it isn't
+  /// interpreted.
+  llvm::SmallPtrSet<Operation *, 8> active;
+};
+} // namespace
+
+Optional<uint64_t> WorkEstimator::estimate(FuncOp function) {
+  if (!function || function.isDeclaration() || !active.insert(function).second)
+    return llvm::None;
+  auto it = works.find(function);
+  if (it == works.end())
+    it = works.try_emplace(function, estimate(function.front())).first;
+  active.erase(function);
+  return it->second;
+}
+
+Optional<uint64_t> WorkEstimator::estimate(Block &block) {
+  uint64_t work = 0;
+  for (Operation &op : block) {
+    Optional<uint64_t> opWork = estimate(&op);
+    if (!opWork)
+      return llvm::None;
+    work = llvm::SaturatingAdd(work, *opWork);
+  }
+  return work;
+}
+
+Optional<uint64_t> WorkEstimator::estimate(Operation *op) {
+  auto isValue = [](Value value) { return isInterpretable(value.getType()); };
+  if (!llvm::all_of(op->getOperands(), isValue) ||
+      !llvm::all_of(op->getResults(), isValue))
+    return llvm::None;
+
+  return llvm::TypeSwitch<Operation *, Optional<uint64_t>>(op)
+      .Case<toy::AddOp, toy::ConstantOp, toy::FmaOp, toy::MulOp,
+            toy::TransposeOp>([&](Operation *op) {
+        return opOverhead + getNumElements(op->getResult(0));
+      })
+      .Case<toy::PrintOp>([&](toy::PrintOp print) {
+        return opOverhead + getNumElements(print.input());
+      })
+      .Case<toy::CastOp, toy::ReshapeOp, toy::ReturnOp, toy::StructAccessOp,
+            toy::StructConstantOp, scf::YieldOp>(
+          [&](Operation *) { return opOverhead; })
+      .Case<arith::ConstantOp>([&](arith::ConstantOp constant) {
+        return constant.getValue().isa<IntegerAttr>()
+                   ? Optional<uint64_t>(opOverhead)
+                   : llvm::None;
+      })
+      .Case<toy::GenericCallOp>(
+          [&](toy::GenericCallOp genericCall) -> Optional<uint64_t> {
+            Optional<uint64_t> work = estimate(
+                symbolTable.lookup<FuncOp>(genericCall.callee()));
+            if (!work)
+              return llvm::None;
+            return llvm::SaturatingAdd(opOverhead, *work);
+          })
+      .Case<scf::ForOp>([&](scf::ForOp loop) -> Optional<uint64_t> {
+        Optional<int64_t> lowerBound = getConstantIntValue(loop.lowerBound());
+        Optional<int64_t> upperBound = getConstantIntValue(loop.upperBound());
+        Optional<int64_t> step = getConstantIntValue(loop.step());
+        Optional<uint64_t> bodyWork = estimate(*loop.getBody());
+        if (!lowerBound || !upperBound || !step || *step <= 0 || !bodyWork)
+          return llvm::None;
+        uint64_t tripCount =
+            *upperBound <= *lowerBound
+                ? 0
+                : llvm::divideCeil(*upperBound - *lowerBound, *step);
+        return llvm::SaturatingAdd(
+            opOverhead, llvm::SaturatingMultiply(tripCount, *bodyWork));
+      })
+      .Default([](Operation *) { return llvm::None; });
+}
+
+//===----------------------------------------------------------------------===//
+// Entry points
+//===----------------------------------------------------------------------===//
+
+Optional<uint64_t> mlir::toy::estimateInterpreterWork(ModuleOp module) {
+  return WorkEstimator(module).estimate(module.lookupSymbol<FuncOp>("main"));
+}
+
+LogicalResult mlir::toy::interpretMain(ModuleOp module) {
+  auto main = module.lookupSymbol<FuncOp>("main");
+  if (!main || main.getNumArguments() != 0)
+    return module.emitError("expected a main function without arguments");
+  Interpreter(module).call(main, {});
+  fflush(stdout);
+  return success();
+}
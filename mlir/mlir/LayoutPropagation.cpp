@@ -0,0 +1,245 @@
+//===- LayoutPropagation.cpp - Choose the layouts of the Toy matrices -----===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements a Function level pass choosing the physical layout of
+// each matrix of the Toy code (see toy/Layout.h), to minimize the data moved by
+// the lowered code. A transpose between matrices of different layouts is free,
+// while one between matrices of the same layout copies its operand. An
+// elementwise operation runs in the layout of its result, and reads the
+// operands of the other layout with strides.
+//
+// Only the layouts of the matrices computed and used by elementwise operations
+// and transposes are chosen, the others stay row-major. Starting from
+// row-major, the layouts of sets of values are flipped while this lowers the
+// cost: first the sets of values connected by elementwise operations, which
+// keep their accesses contiguous, then the single values.
+//
+//===----------------------------------------------------------------------===//
+
+#include "toy/Dialect.h"
+#include "toy/Layout.h"
+#include "toy/Passes.h"
+#include "toy/Remarks.h"
+
+#include "mlir/Pass/Pass.h"
+#include "llvm/ADT/EquivalenceClasses.h"
+
+using namespace mlir;
+using namespace toy;
+
+/// The cost of copying a matrix, which reads and writes all of it.
+static const int copyCost = 2;
+/// The cost of reading an operand with strides.
+static const int stridedReadCost = 1;
+
+Layout toy::getLayout(Value value) {
+  Operation *op = value.getDefiningOp();
+  auto layout = op ? op->getAttrOfType<StringAttr>(getLayoutAttrName())
+                   : StringAttr();
+  return layout && layout.getValue() == "col_major" ? Layout::ColumnMajor
+                                                    : Layout::RowMajor;
+}
+
+/// Return whether `value` is a matrix.
+static bool isMatrix(Value value) {
+  auto type = value.getType().dyn_cast<RankedTensorType>();
+  return type && type.getRank() == 2;
+}
+
+/// Return whether the layout of `value` may be chosen: it is a matrix defined
+/// and used by operations lowered in any layout.
+static bool hasFlexibleLayout(Value value) {
+  if (!isMatrix(value) ||
+      !isa_and_nonnull<AddOp, ConstantOp, FmaOp, MulOp, TransposeOp>(
+          value.getDefiningOp()))
+    return false;
+  return llvm::all_of(value.getUsers(), [](Operation *user) {
+    return isa<AddOp, FmaOp, MulOp, TransposeOp>(user);
+  });
+}
+
+namespace {
+/// The choice of the layouts of the matrices of a function. The cost of the
+/// layouts is a sum over the edges between the values: an elementwise edge,
+/// from an operand to the result, costs when their layouts differ, and a
+/// transpose edge when they are the same.
+class LayoutProblem {
+public:
+  LayoutProblem(FuncOp function);
+
+  /// Choose the layouts, starting from row-major.
+  void solve();
+
+  /// Set the layout attribute of the operations defining the values.
+  void annotate();
+
+private:
+  /// The index of the row-major values whose layout is fixed.
+  static constexpr int fixed = -1;
+
+  struct Edge {
+    int from, to;
+    bool isTranspose;
+    int weight;
+  };
+
+  int getIndex(Value value) const {
+    auto it = indices.find(value);
+    return it == indices.end() ? fixed : it->second;
+  }
+
+  bool isColumnMajor(int index) const {
+    return index != fixed && columnMajor[index];
+  }
+
+  int getCost(const Edge &edge) const {
+    bool sameLayout = isColumnMajor(edge.from) == isColumnMajor(edge.to);
+    return sameLayout == edge.isTranspose ? edge.weight : 0;
+  }
+
+  /// Flip the layouts of `values` if this lowers the cost, and return whether
+  /// it did.
+  bool tryFlip(ArrayRef<int> values);
+
+  std::vector<Value> values;
+  llvm::DenseMap<Value, int> indices;
+  std::vector<bool> columnMajor;
+  std::vector<Edge> edges;
+  /// The edges of each value.
+  std::vector<SmallVector<unsigned, 4>> valueEdges;
+  /// The sets of values connected by elementwise edges.
+  std::vector<SmallVector<int, 4>> clusters;
+  /// Whether each value is in the set tried by `tryFlip`.
+  std::vector<bool> isFlipped;
+};
+} // namespace
+
+LayoutProblem::LayoutProblem(FuncOp function) {
+  function.walk([&](Operation *op) {
+    if (op->getNumResults() == 1 && hasFlexibleLayout(op->getResult(0))) {
+      indices[op->getResult(0)] = values.size();
+      values.push_back(op->getResult(0));
+    }
+  });
+  columnMajor.assign(values.size(), false);
+  isFlipped.assign(values.size(), false);
+  valueEdges.resize(values.size());
+
+  // The edges between fixed values have a constant cost, they are left out.
+  llvm::EquivalenceClasses<int> elementwiseClasses;
+  function.walk([&](Operation *op) {
+    if (!isa<AddOp, FmaOp, MulOp, TransposeOp>(op) ||
+        !isMatrix(op->getResult(0)))
+      return;
+    bool isTranspose = isa<TransposeOp>(op);
+    int to = getIndex(op->getResult(0));
+    for (Value operand : op->getOperands()) {
+      int from = getIndex(operand);
+      if (from == fixed && to == fixed)
+        continue;
+      for (int index : {from, to})
+        if (index != fixed)
+          valueEdges[index].push_back(edges.size());
+      edges.push_back({from, to, isTranspose,
+                       isTranspose ? copyCost : stridedReadCost});
+      if (!isTranspose && from != fixed && to != fixed)
+        elementwiseClasses.unionSets(from, to);
+    }
+  });
+
+  for (auto it = elementwiseClasses.begin(), e = elementwiseClasses.end();
+       it != e; ++it) {
+    if (!it->isLeader())
+      continue;
+    clusters.emplace_back(elementwiseClasses.member_begin(it),
+                          elementwiseClasses.member_end());
+  }
+}
+
+bool LayoutProblem::tryFlip(ArrayRef<int> flipped) {
+  for (int index : flipped)
+    isFlipped[index] = true;
+
+  // Only the edges leaving the set change cost, each is visited from its end
+  // in the set.
+  int delta = 0;
+  for (int index : flipped) {
+    for (unsigned edgeIndex : valueEdges[index]) {
+      const Edge &edge = edges[edgeIndex];
+      int other = edge.from == index ? edge.to : edge.from;
+      if (other != fixed && isFlipped[other])
+        continue;
+      int cost = getCost(edge);
+      columnMajor[index] = !columnMajor[index];
+      delta += getCost(edge) - cost;
+      columnMajor[index] = !columnMajor[index];
+    }
+  }
+
+  for (int index : flipped) {
+    isFlipped[index] = false;
+    if (delta < 0)
+      columnMajor[index] = !columnMajor[index];
+  }
+  return delta < 0;
+}
+
+void LayoutProblem::solve() {
+  // Each flip lowers the cost, which is bounded below, so this terminates.
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (auto &cluster : clusters)
+      changed |= tryFlip(cluster);
+    for (int index = 0, e = values.size(); index < e; ++index)
+      changed |= tryFlip(index);
+  }
+}
+
+void LayoutProblem::annotate() {
+  for (int index = 0, e = values.size(); index < e; ++index) {
+    Operation *op = values[index].getDefiningOp();
+    op->setAttr(getLayoutAttrName(),
+                StringAttr::get(op->getContext(), columnMajor[index]
+                                                      ? "col_major"
+                                                      : "row_major"));
+  }
+}
+
+namespace {
+/// The LayoutPropagationPass is a FunctionPass choosing the layouts of the
+/// matrices of the Toy functions before they are lowered to buffers.
+struct LayoutPropagationPass
+    : public PassWrapper<LayoutPropagationPass, FunctionPass> {
+  void runOnFunction() final {
+    FuncOp function = getFunction();
+    if (function.isDeclaration())
+      return;
+
+    LayoutProblem problem(function);
+    problem.solve();
+    problem.annotate();
+
+    if (!areRemarksEnabled())
+      return;
+    function.walk([](TransposeOp op) {
+      if (isMatrix(op.input()) &&
+          getLayout(op.input()) != getLayout(op.getResult()))
+        emitOptimizationRemark(RemarkKind::Passed, "toy-layout-propagation",
+                               "TransposeElided", op,
+                               "the transpose is a view of its operand in the "
+                               "other layout, it isn't copied");
+    });
+  }
+};
+} // namespace
+
+/// Create a pass choosing the layouts of the matrices.
+std::unique_ptr<Pass> mlir::toy::createLayoutPropagationPass() {
+  return std::make_unique<LayoutPropagationPass>();
+}
@@ -0,0 +1,90 @@
+//===- LinalgTileAndFuse.cpp - Tile the Toy structured operations and fuse ===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements the tiling of the structured operations on tensors that
+// the Toy code is lowered to, with their producers fused into the tile loops:
+// each tile of an intermediate tensor is computed right before it is read,
+// while it is still in cache, rather than the whole tensor beforehand.
+//
+//===----------------------------------------------------------------------===//
+
+#include "toy/Passes.h"
+
+#include "mlir/Dialect/Linalg/IR/LinalgOps.h"
+#include "mlir/Dialect/Linalg/Transforms/Transforms.h"
+#include "mlir/Dialect/SCF/SCF.h"
+#include "mlir/Dialect/Tensor/IR/Tensor.h"
+#include "mlir/Pass/Pass.h"
+#include "llvm/ADT/Sequence.h"
+
+#include <algorithm>
+
+using namespace mlir;
+
+namespace {
+/// The LinalgTileAndFusePass tiles the structured operations whose results no
+/// other structured operation reads, the roots of the fusion, and fuses their
+/// producers into the tile loops.
+struct LinalgTileAndFusePass
+    : public PassWrapper<LinalgTileAndFusePass, FunctionPass> {
+  LinalgTileAndFusePass(ArrayRef<int64_t> tileSizes)
+      : tileSizes(tileSizes.begin(), tileSizes.end()) {}
+
+  void getDependentDialects(DialectRegistry &registry) const override {
+    registry.insert<linalg::LinalgDialect, scf::SCFDialect,
+                    tensor::TensorDialect>();
+  }
+
+  void runOnFunction() override {
+    // The roots are collected first, the tiling creates new operations.
+    SmallVector<linalg::LinalgOp, 8> roots;
+    getFunction().walk([&](linalg::LinalgOp op) {
+      if (op.hasTensorSemantics() &&
+          llvm::none_of(op->getUsers(), [](Operation *user) {
+            return isa<linalg::LinalgOp>(user);
+          }))
+        roots.push_back(op);
+    });
+
+    OpBuilder builder(&getContext());
+    for (linalg::LinalgOp root : roots) {
+      // The extra tile sizes are ignored for the operations of lower rank, the
+      // missing ones leave their loop untiled.
+      unsigned numLoops = root.getNumLoops();
+      SmallVector<int64_t, 4> rootTileSizes(
+          tileSizes.begin(),
+          tileSizes.begin() + std::min<size_t>(numLoops, tileSizes.size()));
+      rootTileSizes.resize(numLoops, 0);
+      if (llvm::all_of(rootTileSizes, [](int64_t size) { return size == 0; }))
+        continue;
+      auto interchange =
+          llvm::to_vector<4>(llvm::seq<int64_t>(0, numLoops));
+
+      // A root that can't be tiled is left as is.
+      builder.setInsertionPoint(root);
+      FailureOr<linalg::TileLoopNest> loopNest =
+          linalg::tileConsumerAndFuseProducers(builder, root, rootTileSizes,
+                                               interchange);
+      if (failed(loopNest))
+        continue;
+      root->replaceAllUsesWith(loopNest->getRootOpReplacementResults());
+      root->erase();
+    }
+  }
+
+  /// The tile size of each loop, from the outermost.
+  SmallVector<int64_t, 4> tileSizes;
+};
+} // namespace
+
+/// Create a pass tiling the structured operations on tensors and fusing their
+/// producers into the tile loops.
+std::unique_ptr<Pass>
+mlir::toy::createLinalgTileAndFusePass(const std::vector<int64_t> &tileSizes) {
+  return std::make_unique<LinalgTileAndFusePass>(tileSizes);
+}
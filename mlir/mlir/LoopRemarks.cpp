@@ -0,0 +1,147 @@
+//===- LoopRemarks.cpp - Remarks explaining the affine optimizations ------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements a Function level pass explaining, with optimization
+// remarks (see toy/Remarks.h), what the loop fusion and the scalar replacement
+// passes left behind. It runs after them: each producer left in a loop nest of
+// its own is checked with the fusion utilities for the reason it wasn't fused
+// into its consumer, and each load of a value just stored is reported.
+//
+//===----------------------------------------------------------------------===//
+
+#include "toy/MLIRGen.h"
+#include "toy/Passes.h"
+#include "toy/Remarks.h"
+
+#include "mlir/Analysis/Utils.h"
+#include "mlir/Dialect/Affine/IR/AffineOps.h"
+#include "mlir/Pass/Pass.h"
+#include "mlir/Transforms/LoopFusionUtils.h"
+#include "mlir/Transforms/LoopUtils.h"
+#include "llvm/ADT/SmallPtrSet.h"
+
+using namespace mlir;
+
+/// Return the source line of `loc`, or 0 if it has none.
+static unsigned getLine(Location loc) {
+  unsigned line = 0;
+  ::toy::resolveLocation(loc)->walk([&](Location nested) {
+    auto fileLoc = nested.dyn_cast<FileLineColLoc>();
+    if (!fileLoc)
+      return WalkResult::advance();
+    line = fileLoc.getLine();
+    return WalkResult::interrupt();
+  });
+  return line;
+}
+
+/// Return why a producer couldn't be fused into its consumer.
+static StringRef getFusionFailureReason(FusionResult result) {
+  switch (result.value) {
+  case FusionResult::Success:
+    return "fusing them is legal, but the fusion pass didn't find it "
+           "profitable";
+  case FusionResult::FailPrecondition:
+    return "they aren't in the same block, or aren't affine loop nests";
+  case FusionResult::FailBlockDependence:
+    return "an operation between them depends on the producer, or the "
+           "consumer depends on it";
+  case FusionResult::FailFusionDependence:
+    return "fusing them would break a dependence between them";
+  case FusionResult::FailComputationSlice:
+    return "no slice of the producer can be computed at the depth of the "
+           "consumer";
+  case FusionResult::FailIncorrectSlice:
+    return "the slice of the producer computed at the depth of the consumer "
+           "isn't valid";
+  }
+  llvm_unreachable("unknown fusion result");
+}
+
+/// Explain each pair of loop nests of `function` in a producer-consumer
+/// relation: after fusion, each of them is a fusion that didn't happen.
+static void explainMissedFusions(FuncOp function) {
+  SmallVector<AffineForOp, 8> nests;
+  for (Operation &op : function.front())
+    if (auto nest = dyn_cast<AffineForOp>(op))
+      nests.push_back(nest);
+  toy::emitOptimizationRemark(toy::RemarkKind::Analysis, "affine-loop-fusion",
+                              "LoopNests", function,
+                              Twine(nests.size()) +
+                                  " loop nests are left after fusion");
+
+  for (unsigned dst = 1, e = nests.size(); dst < e; ++dst) {
+    llvm::SmallPtrSet<Value, 4> dstReads;
+    nests[dst].walk(
+        [&](AffineLoadOp load) { dstReads.insert(load.getMemRef()); });
+
+    // Fusion happens at the innermost common depth of the consumer.
+    SmallVector<AffineForOp, 4> dstBand;
+    getPerfectlyNestedLoops(dstBand, nests[dst]);
+
+    for (unsigned src = 0; src < dst; ++src) {
+      bool isProducer = false;
+      nests[src].walk([&](AffineStoreOp store) {
+        isProducer |= dstReads.count(store.getMemRef()) != 0;
+      });
+      if (!isProducer)
+        continue;
+
+      ComputationSliceState slice;
+      FusionResult result =
+          canFuseLoops(nests[src], nests[dst], dstBand.size(), &slice);
+      toy::emitOptimizationRemark(
+          toy::RemarkKind::Missed, "affine-loop-fusion", "NotFused",
+          nests[dst],
+          "the loop nest producing its input at line " +
+              Twine(getLine(nests[src].getLoc())) +
+              " wasn't fused into this one: " +
+              getFusionFailureReason(result));
+    }
+  }
+}
+
+/// Report the loads of `function` reading the value stored just before to
+/// the same element, which the scalar replacement failed to forward.
+static void explainMissedForwarding(FuncOp function) {
+  function.walk([&](AffineLoadOp load) {
+    for (Operation *op = load->getPrevNode(); op; op = op->getPrevNode()) {
+      auto store = dyn_cast<AffineStoreOp>(op);
+      if (!store || store.getMemRef() != load.getMemRef())
+        continue;
+      if (store.getAffineMap() == load.getAffineMap() &&
+          llvm::equal(store.getMapOperands(), load.getMapOperands()))
+        toy::emitOptimizationRemark(
+            toy::RemarkKind::Missed, "affine-scalrep", "LoadNotForwarded",
+            load,
+            "the value stored at line " + Twine(getLine(store.getLoc())) +
+                " is loaded again instead of being forwarded");
+      return;
+    }
+  });
+}
+
+namespace {
+/// The LoopRemarksPass is a FunctionPass explaining the missed affine
+/// optimizations with remarks. It doesn't change the IR.
+struct LoopRemarksPass : public PassWrapper<LoopRemarksPass, FunctionPass> {
+  void runOnFunction() final {
+    FuncOp function = getFunction();
+    if (!toy::areRemarksEnabled() || function.isDeclaration())
+      return markAllAnalysesPreserved();
+    explainMissedFusions(function);
+    explainMissedForwarding(function);
+    markAllAnalysesPreserved();
+  }
+};
+} // namespace
+
+/// Create a pass explaining the missed affine optimizations with remarks.
+std::unique_ptr<Pass> mlir::toy::createLoopRemarksPass() {
+  return std::make_unique<LoopRemarksPass>();
+}
@@ -8,22 +8,44 @@
 //
 // This file implements a partial lowering of Toy operations to a combination of
 // affine loops, memref operations and standard operations. This lowering
-// expects that all calls have been inlined, and all shapes have been resolved.
+// expects that all shapes have been resolved, and that the remaining calls
+// target functions with a fully shaped signature. These functions are lowered
+// too, their tensor arguments and result becoming buffers.
+//
+// The values computed from sparse constants keep dense buffers, but only their
+// elements that may be nonzero are computed, in a loop over a table of their
+// offsets: the others are filled with zeros once, when the buffer is allocated.
+// These elements are known statically, from the indices of the constants.
+//
+// The loops of the Toy code stay `scf.for` operations. The buffers of their
+// bodies are allocated once for all the iterations, and each value carried by
+// a loop lives in a buffer of its own, which the body overwrites with the value
+// of the next iteration.
 //
 //===----------------------------------------------------------------------===//
 
 #include "toy/Dialect.h"
+#include "toy/Layout.h"
 #include "toy/Passes.h"
+#include "toy/Sparsity.h"
+#include "toy/Tuning.h"
 
 #include "mlir/Dialect/Affine/IR/AffineOps.h"
 #include "mlir/Dialect/Arithmetic/IR/Arithmetic.h"
+#include "mlir/Dialect/Math/IR/Math.h"
 #include "mlir/Dialect/MemRef/IR/MemRef.h"
+#include "mlir/Dialect/SCF/SCF.h"
 #include "mlir/Dialect/StandardOps/IR/Ops.h"
 #include "mlir/Pass/Pass.h"
 #include "mlir/Transforms/DialectConversion.h"
 #include "llvm/ADT/Sequence.h"
 
+#include <algorithm>
+#include <map>
+
 using namespace mlir;
+using toy::NonZeros;
+using toy::SparsityAnalysis;
 
 //===----------------------------------------------------------------------===//
 // ToyToAffine RewritePatterns
@@ -35,55 +57,342 @@ static MemRefType convertTensorToMemRef(TensorType type) {
   return MemRefType::get(type.getShape(), type.getElementType());
 }
 
+/// Convert the given Toy type into the type of its buffers. A struct whose
+/// fields are tensors of a same shape is stored as a struct of arrays: a single
+/// buffer, whose leading dimension indexes the fields, which keeps them
+/// contiguous. Any other struct is a struct of the buffers of its fields.
+static Type convertToBufferType(Type type) {
+  if (auto tensorType = type.dyn_cast<RankedTensorType>())
+    return convertTensorToMemRef(tensorType);
+  auto structType = type.dyn_cast<toy::StructType>();
+  if (!structType)
+    return type;
+
+  ArrayRef<Type> elementTypes = structType.getElementTypes();
+  auto fieldType = elementTypes.front().dyn_cast<RankedTensorType>();
+  if (fieldType && llvm::is_splat(elementTypes)) {
+    SmallVector<int64_t, 4> shape = {static_cast<int64_t>(elementTypes.size())};
+    llvm::append_range(shape, fieldType.getShape());
+    return MemRefType::get(shape, fieldType.getElementType());
+  }
+  SmallVector<Type, 4> fieldTypes;
+  for (Type elementType : elementTypes)
+    fieldTypes.push_back(convertToBufferType(elementType));
+  return toy::StructType::get(fieldTypes);
+}
+
+/// Return the type of the buffer of the Toy value `value`: a column-major
+/// matrix is stored as its transpose (see toy/Layout.h).
+static MemRefType getBufferType(Value value) {
+  auto type = value.getType().cast<TensorType>();
+  if (toy::getLayout(value) == toy::Layout::RowMajor)
+    return convertTensorToMemRef(type);
+  SmallVector<int64_t, 2> shape(llvm::reverse(type.getShape()));
+  return MemRefType::get(shape, type.getElementType());
+}
+
+/// Return the indices in the buffer of the Toy value `value` of its element at
+/// `ivs`, or conversely.
+static SmallVector<Value, 2> getBufferIndices(Value value, ValueRange ivs) {
+  if (toy::getLayout(value) == toy::Layout::RowMajor)
+    return SmallVector<Value, 2>(ivs.begin(), ivs.end());
+  return SmallVector<Value, 2>(llvm::reverse(ivs));
+}
+
 /// Insert an allocation and deallocation for the given MemRefType.
 static Value insertAllocAndDealloc(MemRefType type, Location loc,
                                    PatternRewriter &rewriter) {
   auto alloc = rewriter.create<memref::AllocOp>(loc, type);
 
-  // Make sure to allocate at the beginning of the block.
-  auto *parentBlock = alloc->getBlock();
-  alloc->moveBefore(&parentBlock->front());
+  // Make sure to allocate at the beginning of the function, even from the
+  // body of a loop: all its iterations reuse the buffer.
+  auto *entryBlock = &alloc->getParentOfType<FuncOp>().front();
+  alloc->moveBefore(&entryBlock->front());
 
-  // Make sure to deallocate this alloc at the end of the block. This is fine
-  // as toy functions have no control flow.
+  // Make sure to deallocate this alloc at the end of the function. This is
+  // fine as the only control flow of the toy functions is their loops, which
+  // are nested in the entry block.
   auto dealloc = rewriter.create<memref::DeallocOp>(loc, alloc);
-  dealloc->moveBefore(&parentBlock->back());
+  dealloc->moveBefore(&entryBlock->back());
   return alloc;
 }
 
+/// Return the field `index` of `value`, a struct of buffers or a struct of
+/// arrays. The field of a struct of arrays is a view of its slice of the
+/// buffer, whose layout has the offset of the field.
+static Value getStructField(Value value, unsigned index, Location loc,
+                            OpBuilder &builder) {
+  if (auto memRefType = value.getType().dyn_cast<MemRefType>()) {
+    int64_t rank = memRefType.getRank();
+    SmallVector<int64_t, 4> offsets(rank, 0), strides(rank, 1);
+    SmallVector<int64_t, 4> sizes(memRefType.getShape().begin(),
+                                  memRefType.getShape().end());
+    offsets.front() = index;
+    sizes.front() = 1;
+    auto fieldType = memref::SubViewOp::inferRankReducedResultType(
+                         rank - 1, memRefType, offsets, sizes, strides)
+                         .cast<MemRefType>();
+    return builder.create<memref::SubViewOp>(loc, fieldType, value, offsets,
+                                             sizes, strides);
+  }
+  if (auto pack = value.getDefiningOp<toy::StructPackOp>())
+    return pack.fields()[index];
+  return builder.create<toy::StructAccessOp>(loc, value, index);
+}
+
+/// Return `buffer`, or a copy of it if it is a view with another layout than
+/// the identity, e.g. a field of a struct of arrays: the signatures of the
+/// functions only take buffers with the identity layout.
+static Value getIdentityLayoutBuffer(Value buffer, Location loc,
+                                     PatternRewriter &rewriter) {
+  auto type = buffer.getType().dyn_cast<MemRefType>();
+  if (!type || type.getLayout().isIdentity())
+    return buffer;
+  Value copy = insertAllocAndDealloc(
+      MemRefType::get(type.getShape(), type.getElementType()), loc, rewriter);
+  rewriter.create<memref::CopyOp>(loc, buffer, copy);
+  return copy;
+}
+
+/// Set the insertion point of `builder` before the deallocations ending the
+/// block of `terminator`, where the buffers they release can still be read.
+static void setInsertionPointBeforeDeallocs(Operation *terminator,
+                                            OpBuilder &builder) {
+  Operation *insertionPoint = terminator;
+  while (isa_and_nonnull<memref::DeallocOp>(insertionPoint->getPrevNode()))
+    insertionPoint = insertionPoint->getPrevNode();
+  builder.setInsertionPoint(insertionPoint);
+}
+
+/// Call `fn` on each buffer of `value`, a buffer or a struct of buffers.
+static void forEachBuffer(Value value, Location loc, OpBuilder &builder,
+                          function_ref<void(Value)> fn) {
+  auto structType = value.getType().dyn_cast<toy::StructType>();
+  if (!structType)
+    return fn(value);
+  for (unsigned i = 0, e = structType.getNumElementTypes(); i != e; ++i)
+    forEachBuffer(getStructField(value, i, loc, builder), loc, builder, fn);
+}
+
+/// This defines the function type returning the indices in a buffer of the
+/// element of a tensor at the given indices.
+using BufferIndicesFn = function_ref<SmallVector<Value, 2>(ValueRange)>;
+
+/// Return the constant indices from 0 up to the largest dimension of `shape`,
+/// or the index 0 for a tensor of rank 0. They are created up-front to avoid
+/// large amounts of redundant operations.
+static SmallVector<Value, 8> createConstantIndices(ArrayRef<int64_t> shape,
+                                                   Location loc,
+                                                   OpBuilder &builder) {
+  SmallVector<Value, 8> constantIndices;
+  int64_t end =
+      shape.empty() ? 1 : *std::max_element(shape.begin(), shape.end());
+  for (auto i : llvm::seq<int64_t>(0, end))
+    constantIndices.push_back(builder.create<arith::ConstantIndexOp>(loc, i));
+  return constantIndices;
+}
+
+/// Store zeros into the elements of `buffer` holding a tensor of shape
+/// `shape`: the element at the indices `indices` is stored at
+/// `getIndices(indices)`. This is the fill of the elements of a sparse tensor
+/// that are known to be zeros.
+static void storeZeros(ArrayRef<int64_t> shape, Value buffer,
+                       BufferIndicesFn getIndices, Location loc,
+                       OpBuilder &builder) {
+  Value zero =
+      builder.create<arith::ConstantOp>(loc, builder.getF64FloatAttr(0));
+  SmallVector<int64_t, 4> lowerBounds(shape.size(), /*Value=*/0);
+  SmallVector<int64_t, 4> steps(shape.size(), /*Value=*/1);
+  buildAffineLoopNest(
+      builder, loc, lowerBounds, shape, steps,
+      [&](OpBuilder &nestedBuilder, Location loc, ValueRange ivs) {
+        nestedBuilder.create<AffineStoreOp>(loc, zero, buffer,
+                                            getIndices(ivs));
+      });
+}
+
+/// Load the element of `buffer` at `indices`: an affine load from the loop
+/// nests, a plain load at the indices read from a table of nonzeros.
+static Value loadElement(OpBuilder &builder, Location loc, Value buffer,
+                         ValueRange indices) {
+  if (llvm::all_of(indices, [](Value index) { return isValidDim(index); }))
+    return builder.create<AffineLoadOp>(loc, buffer, indices);
+  return builder.create<memref::LoadOp>(loc, buffer, indices);
+}
+
+namespace {
+/// The lowering of the sparse values of a function (see toy/Sparsity.h). The
+/// row-major offsets of the elements of a value that may be nonzero are stored
+/// into a table at the entry of the function, shared by all the values with
+/// the same offsets, which the code computing the value loops over.
+class SparseLowering {
+public:
+  SparseLowering(FuncOp function) : analysis(function) {}
+
+  /// Return the elements of `value` that may be nonzero, or null if it is
+  /// dense.
+  const NonZeros *lookup(Value value) const { return analysis.lookup(value); }
+
+  /// Return the table of the offsets of the elements `nonZeros` of a tensor of
+  /// shape `shape`.
+  Value getTable(const NonZeros &nonZeros, ArrayRef<int64_t> shape,
+                 Location loc, PatternRewriter &rewriter) {
+    std::vector<int64_t> offsets;
+    for (const auto &indices : nonZeros) {
+      int64_t offset = 0;
+      for (auto it : llvm::zip(indices, shape))
+        offset = offset * std::get<1>(it) + std::get<0>(it);
+      offsets.push_back(offset);
+    }
+    Value &table = tables[offsets];
+    if (table)
+      return table;
+
+    auto tableType = MemRefType::get({static_cast<int64_t>(offsets.size())},
+                                     rewriter.getIndexType());
+    table = insertAllocAndDealloc(tableType, loc, rewriter);
+    OpBuilder::InsertionGuard guard(rewriter);
+    rewriter.setInsertionPointAfter(table.getDefiningOp());
+    for (auto offset : llvm::enumerate(offsets)) {
+      Value position =
+          rewriter.create<arith::ConstantIndexOp>(loc, offset.index());
+      rewriter.create<AffineStoreOp>(
+          loc, rewriter.create<arith::ConstantIndexOp>(loc, offset.value()),
+          table, position);
+    }
+    return table;
+  }
+
+private:
+  SparsityAnalysis analysis;
+  /// The tables created, by their offsets.
+  std::map<std::vector<int64_t>, Value> tables;
+};
+} // namespace
+
+/// Return the number of bytes of the tensors and buffers used or defined by
+/// `op`, as an estimate of the memory it touches.
+static int64_t getNumBytesTouched(Operation *op) {
+  int64_t bytes = 0;
+  auto addBytes = [&](Type type) {
+    auto shapedType = type.dyn_cast<ShapedType>();
+    if (shapedType && shapedType.hasStaticShape())
+      bytes += shapedType.getNumElements() *
+               shapedType.getElementTypeBitWidth() / 8;
+  };
+  llvm::for_each(op->getOperandTypes(), addBytes);
+  llvm::for_each(op->getResultTypes(), addBytes);
+  return bytes;
+}
+
+/// Emit the lowering of `op` with `emitLowering`, between probes measuring it
+/// when `profile` is set. The probes keep the location of `op`, which
+/// identifies it in the profile.
+static void emitProfiled(Operation *op, bool profile, PatternRewriter &rewriter,
+                         function_ref<void()> emitLowering) {
+  if (!profile)
+    return emitLowering();
+
+  auto start = rewriter.create<toy::ProfileBeginOp>(op->getLoc());
+  emitLowering();
+  rewriter.create<toy::ProfileEndOp>(
+      op->getLoc(), start, rewriter.getStringAttr(op->getName().getStringRef()),
+      rewriter.getI64IntegerAttr(getNumBytesTouched(op)));
+}
+
 /// This defines the function type used to process an iteration of a lowered
 /// loop. It takes as input an OpBuilder, an range of memRefOperands
 /// corresponding to the operands of the input operation, and the range of loop
-/// induction variables for the iteration. It returns a value to store at the
-/// current index of the iteration.
+/// induction variables for the iteration, the indices of the element of the
+/// result. It returns a value to store at the current index of the iteration.
 using LoopIterationFn = function_ref<Value(
     OpBuilder &rewriter, ValueRange memRefOperands, ValueRange loopIvs)>;
 
+/// Lower `op` to loops computing each element of its result with
+/// `processIteration`. When only some elements of the result may be nonzero
+/// (see SparseLowering), the others are zeros, stored once next to the
+/// allocation: the buffer of the result is only written by `op`, at the same
+/// elements each time. Only these elements are computed, by a loop over their
+/// table.
 static void lowerOpToLoops(Operation *op, ValueRange operands,
-                           PatternRewriter &rewriter,
+                           PatternRewriter &rewriter, bool profile,
+                           SparseLowering &sparsity,
                            LoopIterationFn processIteration) {
-  auto tensorType = (*op->result_type_begin()).cast<TensorType>();
+  Value result = op->getResult(0);
   auto loc = op->getLoc();
 
   // Insert an allocation and deallocation for the result of this operation.
-  auto memRefType = convertTensorToMemRef(tensorType);
+  auto memRefType = getBufferType(result);
   auto alloc = insertAllocAndDealloc(memRefType, loc, rewriter);
 
+  if (const NonZeros *nonZeros = sparsity.lookup(result)) {
+    auto shape = result.getType().cast<RankedTensorType>().getShape();
+    auto getIndices = [&](ValueRange indices) {
+      return getBufferIndices(result, indices);
+    };
+    {
+      OpBuilder::InsertionGuard guard(rewriter);
+      rewriter.setInsertionPointAfter(alloc.getDefiningOp());
+      storeZeros(shape, alloc, getIndices, loc, rewriter);
+    }
+    Value table = sparsity.getTable(*nonZeros, shape, loc, rewriter);
+
+    emitProfiled(op, profile, rewriter, [&] {
+      Value lowerBound = rewriter.create<arith::ConstantIndexOp>(loc, 0);
+      Value upperBound =
+          rewriter.create<arith::ConstantIndexOp>(loc, nonZeros->size());
+      Value step = rewriter.create<arith::ConstantIndexOp>(loc, 1);
+      rewriter.create<scf::ForOp>(
+          loc, lowerBound, upperBound, step, llvm::None,
+          [&](OpBuilder &nestedBuilder, Location loc, Value iv, ValueRange) {
+            // Split the offset of the element into its indices.
+            Value offset = nestedBuilder.create<memref::LoadOp>(loc, table, iv);
+            SmallVector<Value, 2> indices(shape.size());
+            for (int64_t dim = shape.size() - 1; dim > 0; --dim) {
+              Value size =
+                  nestedBuilder.create<arith::ConstantIndexOp>(loc, shape[dim]);
+              indices[dim] =
+                  nestedBuilder.create<arith::RemUIOp>(loc, offset, size);
+              offset = nestedBuilder.create<arith::DivUIOp>(loc, offset, size);
+            }
+            indices.front() = offset;
+
+            Value valueToStore =
+                processIteration(nestedBuilder, operands, indices);
+            nestedBuilder.create<memref::StoreOp>(loc, valueToStore, alloc,
+                                                  getIndices(indices));
+            nestedBuilder.create<scf::YieldOp>(loc);
+          });
+    });
+    rewriter.replaceOp(op, alloc);
+    return;
+  }
+
   // Create a nest of affine loops, with one loop per dimension of the shape.
   // The buildAffineLoopNest function takes a callback that is used to construct
   // the body of the innermost loop given a builder, a location and a range of
-  // loop induction variables.
-  SmallVector<int64_t, 4> lowerBounds(tensorType.getRank(), /*Value=*/0);
-  SmallVector<int64_t, 4> steps(tensorType.getRank(), /*Value=*/1);
-  buildAffineLoopNest(
-      rewriter, loc, lowerBounds, tensorType.getShape(), steps,
-      [&](OpBuilder &nestedBuilder, Location loc, ValueRange ivs) {
-        // Call the processing function with the rewriter, the memref operands,
-        // and the loop induction variables. This function will return the value
-        // to store at the current index.
-        Value valueToStore = processIteration(nestedBuilder, operands, ivs);
-        nestedBuilder.create<AffineStoreOp>(loc, valueToStore, alloc, ivs);
-      });
+  // loop induction variables. The loops follow the layout of the result, so
+  // that it is written contiguously.
+  SmallVector<int64_t, 4> lowerBounds(memRefType.getRank(), /*Value=*/0);
+  SmallVector<int64_t, 4> steps(memRefType.getRank(), /*Value=*/1);
+  emitProfiled(op, profile, rewriter, [&] {
+    buildAffineLoopNest(
+        rewriter, loc, lowerBounds, memRefType.getShape(), steps,
+        [&](OpBuilder &nestedBuilder, Location loc, ValueRange ivs) {
+          // Call the processing function with the rewriter, the memref
+          // operands, and the loop induction variables. This function will
+          // return the value to store at the current index. The store names
+          // the operation it computes, which identifies the nest even once
+          // fused (see toy/Tuning.h).
+          Value valueToStore = processIteration(
+              nestedBuilder, operands, getBufferIndices(result, ivs));
+          auto store = nestedBuilder.create<AffineStoreOp>(loc, valueToStore,
+                                                           alloc, ivs);
+          store->setAttr(toy::getOpKindAttrName(),
+                         nestedBuilder.getStringAttr(
+                             op->getName().getStringRef()));
+        });
+  });
 
   // Replace this operation with the generated alloc.
   rewriter.replaceOp(op, alloc);
@@ -96,103 +405,365 @@ namespace {
 
 template <typename BinaryOp, typename LoweredBinaryOp>
 struct BinaryOpLowering : public ConversionPattern {
-  BinaryOpLowering(MLIRContext *ctx)
-      : ConversionPattern(BinaryOp::getOperationName(), 1, ctx) {}
+  BinaryOpLowering(MLIRContext *ctx, bool profile,
+                   SparseLowering &sparsity)
+      : ConversionPattern(BinaryOp::getOperationName(), 1, ctx),
+        profile(profile), sparsity(sparsity) {}
 
   LogicalResult
   matchAndRewrite(Operation *op, ArrayRef<Value> operands,
                   ConversionPatternRewriter &rewriter) const final {
     auto loc = op->getLoc();
     lowerOpToLoops(
-        op, operands, rewriter,
-        [loc](OpBuilder &builder, ValueRange memRefOperands,
-              ValueRange loopIvs) {
+        op, operands, rewriter, profile, sparsity,
+        [loc, op](OpBuilder &builder, ValueRange memRefOperands,
+                  ValueRange loopIvs) {
           // Generate an adaptor for the remapped operands of the BinaryOp. This
           // allows for using the nice named accessors that are generated by the
           // ODS.
           typename BinaryOp::Adaptor binaryAdaptor(memRefOperands);
 
           // Generate loads for the element of 'lhs' and 'rhs' at the inner
-          // loop.
+          // loop, in the layout of each operand.
           auto loadedLhs =
-              builder.create<AffineLoadOp>(loc, binaryAdaptor.lhs(), loopIvs);
+              loadElement(builder, loc, binaryAdaptor.lhs(),
+                          getBufferIndices(op->getOperand(0), loopIvs));
           auto loadedRhs =
-              builder.create<AffineLoadOp>(loc, binaryAdaptor.rhs(), loopIvs);
+              loadElement(builder, loc, binaryAdaptor.rhs(),
+                          getBufferIndices(op->getOperand(1), loopIvs));
 
           // Create the binary operation performed on the loaded values.
           return builder.create<LoweredBinaryOp>(loc, loadedLhs, loadedRhs);
         });
     return success();
   }
+
+  /// Whether to wrap the loop nest with profiling probes.
+  bool profile;
+  /// The elements of the results that may be nonzero.
+  SparseLowering &sparsity;
 };
 using AddOpLowering = BinaryOpLowering<toy::AddOp, arith::AddFOp>;
 using MulOpLowering = BinaryOpLowering<toy::MulOp, arith::MulFOp>;
 
+//===----------------------------------------------------------------------===//
+// ToyToAffine RewritePatterns: Fma operations
+//===----------------------------------------------------------------------===//
+
+struct FmaOpLowering : public ConversionPattern {
+  FmaOpLowering(MLIRContext *ctx, bool profile,
+                SparseLowering &sparsity)
+      : ConversionPattern(toy::FmaOp::getOperationName(), 1, ctx),
+        profile(profile), sparsity(sparsity) {}
+
+  LogicalResult
+  matchAndRewrite(Operation *op, ArrayRef<Value> operands,
+                  ConversionPatternRewriter &rewriter) const final {
+    auto loc = op->getLoc();
+    lowerOpToLoops(op, operands, rewriter, profile, sparsity,
+                   [loc, op](OpBuilder &builder, ValueRange memRefOperands,
+                             ValueRange loopIvs) {
+                     // Load the element of each operand, in its layout.
+                     SmallVector<Value, 3> loaded;
+                     for (auto it : llvm::enumerate(memRefOperands))
+                       loaded.push_back(loadElement(
+                           builder, loc, it.value(),
+                           getBufferIndices(op->getOperand(it.index()),
+                                            loopIvs)));
+
+                     // The multiply-add is rounded once, as in `toy.fma`.
+                     return builder.create<math::FmaOp>(loc, loaded[0],
+                                                        loaded[1], loaded[2]);
+                   });
+    return success();
+  }
+
+  /// Whether to wrap the loop nest with profiling probes.
+  bool profile;
+  /// The elements of the results that may be nonzero.
+  SparseLowering &sparsity;
+};
+
 //===----------------------------------------------------------------------===//
 // ToyToAffine RewritePatterns: Constant operations
 //===----------------------------------------------------------------------===//
 
+/// Store the elements of the constant `value` into `buffer`: the element at
+/// the indices `indices` of the constant is stored at `getIndices(indices)`.
+/// A sparse constant is stored as zeros, then its nonzeros.
+static void storeConstantElements(ElementsAttr value, Value buffer,
+                                  BufferIndicesFn getIndices, Location loc,
+                                  PatternRewriter &rewriter) {
+  // We will be generating constant indices up-to the largest dimension.
+  auto valueShape = value.getType().getShape();
+  SmallVector<Value, 8> constantIndices =
+      createConstantIndices(valueShape, loc, rewriter);
+
+  if (auto sparse = value.dyn_cast<SparseElementsAttr>()) {
+    storeZeros(valueShape, buffer, getIndices, loc, rewriter);
+    SmallVector<Value, 2> indices;
+    auto valueIt = sparse.getValues().value_begin<FloatAttr>();
+    for (const APInt &index : sparse.getIndices().getValues<APInt>()) {
+      indices.push_back(constantIndices[index.getSExtValue()]);
+      if (indices.size() != valueShape.size())
+        continue;
+      rewriter.create<AffineStoreOp>(
+          loc, rewriter.create<arith::ConstantOp>(loc, *valueIt++), buffer,
+          getIndices(indices));
+      indices.clear();
+    }
+    return;
+  }
+
+  // The constant operation represents a multi-dimensional constant, so we
+  // will need to generate a store for each of the elements. The following
+  // functor recursively walks the dimensions of the constant shape,
+  // generating a store when the recursion hits the base case.
+  SmallVector<Value, 2> indices;
+  auto valueIt = value.cast<DenseElementsAttr>().value_begin<FloatAttr>();
+  std::function<void(uint64_t)> storeElements = [&](uint64_t dimension) {
+    // The last dimension is the base case of the recursion, at this point
+    // we store the element at the given index.
+    if (dimension == valueShape.size()) {
+      rewriter.create<AffineStoreOp>(
+          loc, rewriter.create<arith::ConstantOp>(loc, *valueIt++), buffer,
+          getIndices(indices));
+      return;
+    }
+
+    // Otherwise, iterate over the current dimension and add the indices to
+    // the list.
+    for (uint64_t i = 0, e = valueShape[dimension]; i != e; ++i) {
+      indices.push_back(constantIndices[i]);
+      storeElements(dimension + 1);
+      indices.pop_back();
+    }
+  };
+
+  // Start the element storing recursion from the first dimension.
+  storeElements(/*dimension=*/0);
+}
+
 struct ConstantOpLowering : public OpRewritePattern<toy::ConstantOp> {
-  using OpRewritePattern<toy::ConstantOp>::OpRewritePattern;
+  ConstantOpLowering(MLIRContext *ctx, bool profile)
+      : OpRewritePattern<toy::ConstantOp>(ctx), profile(profile) {}
 
   LogicalResult matchAndRewrite(toy::ConstantOp op,
                                 PatternRewriter &rewriter) const final {
-    DenseElementsAttr constantValue = op.value();
-    Location loc = op.getLoc();
-
     // When lowering the constant operation, we allocate and assign the constant
-    // values to a corresponding memref allocation.
-    auto tensorType = op.getType().cast<TensorType>();
-    auto memRefType = convertTensorToMemRef(tensorType);
+    // values to a corresponding memref allocation, in the layout of the
+    // constant.
+    auto alloc =
+        insertAllocAndDealloc(getBufferType(op), op.getLoc(), rewriter);
+    emitProfiled(op, profile, rewriter, [&] {
+      storeConstantElements(
+          op.value(), alloc,
+          [&](ValueRange indices) { return getBufferIndices(op, indices); },
+          op.getLoc(), rewriter);
+    });
+
+    // Replace this operation with the generated alloc.
+    rewriter.replaceOp(op, alloc);
+    return success();
+  }
+
+  /// Whether to wrap the stores with profiling probes.
+  bool profile;
+};
+
+/// Lower the struct constant `value` to buffers of type `type`: a struct of
+/// arrays, or a struct of the buffers of its fields.
+static Value lowerStructConstant(ArrayAttr value, Type type, Location loc,
+                                 PatternRewriter &rewriter) {
+  if (auto memRefType = type.dyn_cast<MemRefType>()) {
+    // The field `i` is stored at the leading index `i`.
     auto alloc = insertAllocAndDealloc(memRefType, loc, rewriter);
+    for (auto field : llvm::enumerate(value)) {
+      Value fieldIndex =
+          rewriter.create<arith::ConstantIndexOp>(loc, field.index());
+      storeConstantElements(
+          field.value().cast<ElementsAttr>(), alloc,
+          [&](ValueRange indices) {
+            SmallVector<Value, 2> bufferIndices = {fieldIndex};
+            bufferIndices.append(indices.begin(), indices.end());
+            return bufferIndices;
+          },
+          loc, rewriter);
+    }
+    return alloc;
+  }
 
-    // We will be generating constant indices up-to the largest dimension.
-    // Create these constants up-front to avoid large amounts of redundant
-    // operations.
-    auto valueShape = memRefType.getShape();
-    SmallVector<Value, 8> constantIndices;
-
-    if (!valueShape.empty()) {
-      for (auto i : llvm::seq<int64_t>(
-               0, *std::max_element(valueShape.begin(), valueShape.end())))
-        constantIndices.push_back(
-            rewriter.create<arith::ConstantIndexOp>(loc, i));
-    } else {
-      // This is the case of a tensor of rank 0.
-      constantIndices.push_back(
-          rewriter.create<arith::ConstantIndexOp>(loc, 0));
+  auto structType = type.cast<toy::StructType>();
+  SmallVector<Value, 4> fields;
+  for (auto field : llvm::zip(value, structType.getElementTypes())) {
+    Attribute fieldValue = std::get<0>(field);
+    Type fieldType = std::get<1>(field);
+    if (auto fieldStruct = fieldValue.dyn_cast<ArrayAttr>()) {
+      fields.push_back(lowerStructConstant(fieldStruct, fieldType, loc,
+                                           rewriter));
+      continue;
     }
+    auto alloc =
+        insertAllocAndDealloc(fieldType.cast<MemRefType>(), loc, rewriter);
+    storeConstantElements(
+        fieldValue.cast<ElementsAttr>(), alloc,
+        [](ValueRange indices) {
+          return SmallVector<Value, 2>(indices.begin(), indices.end());
+        },
+        loc, rewriter);
+    fields.push_back(alloc);
+  }
+  return rewriter.create<toy::StructPackOp>(loc, structType, fields);
+}
 
-    // The constant operation represents a multi-dimensional constant, so we
-    // will need to generate a store for each of the elements. The following
-    // functor recursively walks the dimensions of the constant shape,
-    // generating a store when the recursion hits the base case.
-    SmallVector<Value, 2> indices;
-    auto valueIt = constantValue.value_begin<FloatAttr>();
-    std::function<void(uint64_t)> storeElements = [&](uint64_t dimension) {
-      // The last dimension is the base case of the recursion, at this point
-      // we store the element at the given index.
-      if (dimension == valueShape.size()) {
-        rewriter.create<AffineStoreOp>(
-            loc, rewriter.create<arith::ConstantOp>(loc, *valueIt++), alloc,
-            llvm::makeArrayRef(indices));
-        return;
-      }
-
-      // Otherwise, iterate over the current dimension and add the indices to
-      // the list.
-      for (uint64_t i = 0, e = valueShape[dimension]; i != e; ++i) {
-        indices.push_back(constantIndices[i]);
-        storeElements(dimension + 1);
-        indices.pop_back();
-      }
-    };
+struct StructConstantOpLowering
+    : public OpRewritePattern<toy::StructConstantOp> {
+  StructConstantOpLowering(MLIRContext *ctx, bool profile)
+      : OpRewritePattern<toy::StructConstantOp>(ctx), profile(profile) {}
 
-    // Start the element storing recursion from the first dimension.
-    storeElements(/*dimension=*/0);
+  LogicalResult matchAndRewrite(toy::StructConstantOp op,
+                                PatternRewriter &rewriter) const final {
+    // The fields are stored into buffers, packed without copies.
+    Value buffers;
+    emitProfiled(op, profile, rewriter, [&] {
+      buffers = lowerStructConstant(
+          op.value(), convertToBufferType(op.getType()), op.getLoc(), rewriter);
+    });
+    rewriter.replaceOp(op, buffers);
+    return success();
+  }
 
-    // Replace this operation with the generated alloc.
-    rewriter.replaceOp(op, alloc);
+  /// Whether to wrap the stores with profiling probes.
+  bool profile;
+};
+
+//===----------------------------------------------------------------------===//
+// ToyToAffine RewritePatterns: Call operations
+//===----------------------------------------------------------------------===//
+
+struct GenericCallOpLowering : public OpConversionPattern<toy::GenericCallOp> {
+  using OpConversionPattern<toy::GenericCallOp>::OpConversionPattern;
+
+  LogicalResult
+  matchAndRewrite(toy::GenericCallOp op, OpAdaptor adaptor,
+                  ConversionPatternRewriter &rewriter) const final {
+    // The callee may be lowered concurrently by another thread, the type of
+    // the result is taken from the call itself.
+    if (!toy::hasInferredShape(op.getType()))
+      return failure();
+
+    // We lower "toy.generic_call" to "std.call". The views of the fields of
+    // the structs of arrays are passed as copies.
+    SmallVector<Value, 4> operands;
+    for (Value operand : adaptor.getOperands())
+      operands.push_back(
+          getIdentityLayoutBuffer(operand, op.getLoc(), rewriter));
+    auto call = rewriter.replaceOpWithNewOp<CallOp>(
+        op, op.callee(), convertToBufferType(op.getType()), operands);
+
+    // The returned buffers are owned by the caller, deallocate them at the end
+    // of the block.
+    forEachBuffer(call.getResult(0), op.getLoc(), rewriter, [&](Value buffer) {
+      auto dealloc = rewriter.create<memref::DeallocOp>(op.getLoc(), buffer);
+      dealloc->moveBefore(&call->getBlock()->back());
+    });
+    return success();
+  }
+};
+
+//===----------------------------------------------------------------------===//
+// ToyToAffine RewritePatterns: Cast operations
+//===----------------------------------------------------------------------===//
+
+struct CastOpLowering : public OpConversionPattern<toy::CastOp> {
+  using OpConversionPattern<toy::CastOp>::OpConversionPattern;
+
+  LogicalResult
+  matchAndRewrite(toy::CastOp op, OpAdaptor adaptor,
+                  ConversionPatternRewriter &rewriter) const final {
+    // The shapes are inferred, a cast only changes the sparse encoding: the
+    // buffers are dense, the result is the buffer of the input.
+    rewriter.replaceOp(op, adaptor.input());
+    return success();
+  }
+};
+
+//===----------------------------------------------------------------------===//
+// ToyToAffine RewritePatterns: Loop operations
+//===----------------------------------------------------------------------===//
+
+/// Lower a loop carrying tensors to a loop carrying their buffers. Each carried
+/// value lives in a buffer of its own, allocated once for all the iterations:
+/// the initial value is copied into it before the loop, and the body overwrites
+/// it with the value of the next iteration (see YieldOpLowering). The loop
+/// carries the buffers themselves, unchanged, so that its body can find them.
+struct ForOpLowering : public OpConversionPattern<scf::ForOp> {
+  using OpConversionPattern<scf::ForOp>::OpConversionPattern;
+
+  LogicalResult
+  matchAndRewrite(scf::ForOp op, OpAdaptor adaptor,
+                  ConversionPatternRewriter &rewriter) const final {
+    auto loc = op.getLoc();
+    SmallVector<Value, 4> buffers;
+    auto initValues =
+        adaptor.getOperands().drop_front(op.getNumControlOperands());
+    for (auto it : llvm::zip(op.getResults(), initValues)) {
+      Value buffer = insertAllocAndDealloc(getBufferType(std::get<0>(it)), loc,
+                                           rewriter);
+      rewriter.create<memref::CopyOp>(loc, std::get<1>(it), buffer);
+      buffers.push_back(buffer);
+    }
+
+    // The body is moved to the new loop, the old terminator is lowered with
+    // the operations of the body.
+    auto loop = rewriter.create<scf::ForOp>(loc, op.lowerBound(),
+                                            op.upperBound(), op.step(),
+                                            buffers);
+    rewriter.mergeBlocks(op.getBody(), loop.getBody(),
+                         loop.getBody()->getArguments());
+    rewriter.replaceOp(op, buffers);
+    return success();
+  }
+};
+
+/// Lower the terminator of a loop carrying tensors, once moved to the loop
+/// carrying their buffers: the values of the next iteration are copied into
+/// the buffers.
+struct YieldOpLowering : public OpConversionPattern<scf::YieldOp> {
+  using OpConversionPattern<scf::YieldOp>::OpConversionPattern;
+
+  LogicalResult
+  matchAndRewrite(scf::YieldOp op, OpAdaptor adaptor,
+                  ConversionPatternRewriter &rewriter) const final {
+    auto loop = dyn_cast<scf::ForOp>(op->getParentOp());
+    if (!loop)
+      return failure();
+    auto loc = op.getLoc();
+    ValueRange buffers = loop.getRegionIterArgs();
+
+    // The buffers returned by the calls of the iteration are deallocated at the
+    // end of the body, the values are copied before.
+    setInsertionPointBeforeDeallocs(op, rewriter);
+
+    // A value carried from the previous iteration into another buffer than its
+    // own may be overwritten by the copies: it is staged in a buffer first.
+    SmallVector<Value, 4> values(adaptor.getOperands());
+    for (unsigned i = 0, e = values.size(); i != e; ++i) {
+      auto it = llvm::find(buffers, values[i]);
+      if (it == buffers.end() || it == buffers.begin() + i)
+        continue;
+      Value staged = insertAllocAndDealloc(
+          values[i].getType().cast<MemRefType>(), loc, rewriter);
+      rewriter.create<memref::CopyOp>(loc, values[i], staged);
+      values[i] = staged;
+    }
+    for (auto it : llvm::zip(values, buffers))
+      if (std::get<0>(it) != std::get<1>(it))
+        rewriter.create<memref::CopyOp>(loc, std::get<0>(it), std::get<1>(it));
+
+    // The new terminator must follow the deallocations.
+    rewriter.setInsertionPointToEnd(op->getBlock());
+    rewriter.replaceOpWithNewOp<scf::YieldOp>(op, buffers);
     return success();
   }
 };
@@ -219,18 +790,91 @@ struct PrintOpLowering : public OpConversionPattern<toy::PrintOp> {
 // ToyToAffine RewritePatterns: Return operations
 //===----------------------------------------------------------------------===//
 
-struct ReturnOpLowering : public OpRewritePattern<toy::ReturnOp> {
-  using OpRewritePattern<toy::ReturnOp>::OpRewritePattern;
+/// Return the field `index` of the struct `value`. The fields of a struct
+/// returned by a call are deallocated through the accesses that follow the
+/// call (see GenericCallOpLowering): such an access is reused, so that the
+/// ownership of the field is passed on with it.
+static Value getOwnedStructField(Value value, unsigned index, Location loc,
+                                 PatternRewriter &rewriter) {
+  Block *block = rewriter.getInsertionBlock();
+  Block::iterator insertionPoint = rewriter.getInsertionPoint();
+  for (Operation *user : value.getUsers()) {
+    auto access = dyn_cast<toy::StructAccessOp>(user);
+    if (access && access.index() == index && access->getBlock() == block &&
+        (insertionPoint == block->end() ||
+         access->isBeforeInBlock(&*insertionPoint)))
+      return access;
+  }
+  return getStructField(value, index, loc, rewriter);
+}
 
-  LogicalResult matchAndRewrite(toy::ReturnOp op,
-                                PatternRewriter &rewriter) const final {
-    // During this lowering, we expect that all function calls have been
-    // inlined.
-    if (op.hasOperand())
-      return failure();
+/// Return `value`, a buffer or a struct of buffers, as owned by the caller of
+/// the function. A returned buffer escapes the function, so it must not be
+/// deallocated at the end of the block. The caller always owns it: a buffer
+/// that the function doesn't own, like one of its arguments or a field of a
+/// struct of arrays, is copied.
+static Value transferToCaller(Value value, Location loc,
+                              PatternRewriter &rewriter) {
+  if (auto structType = value.getType().dyn_cast<toy::StructType>()) {
+    SmallVector<Value, 4> fields;
+    for (unsigned i = 0, e = structType.getNumElementTypes(); i != e; ++i)
+      fields.push_back(transferToCaller(
+          getOwnedStructField(value, i, loc, rewriter), loc, rewriter));
+    return rewriter.create<toy::StructPackOp>(loc, structType, fields);
+  }
+
+  // The buffers owned by the function, allocated or returned by a call, are
+  // deallocated at the end of the block.
+  auto isDealloc = [](Operation *user) { return isa<memref::DeallocOp>(user); };
+  if (!isa_and_nonnull<memref::AllocOp, CallOp>(value.getDefiningOp()) &&
+      llvm::none_of(value.getUsers(), isDealloc)) {
+    auto type = value.getType().cast<MemRefType>();
+    Value copy = rewriter.create<memref::AllocOp>(
+        loc, MemRefType::get(type.getShape(), type.getElementType()));
+    rewriter.create<memref::CopyOp>(loc, value, copy);
+    value = copy;
+  }
+  for (Operation *user : llvm::make_early_inc_range(value.getUsers()))
+    if (isDealloc(user))
+      rewriter.eraseOp(user);
+  return value;
+}
 
-    // We lower "toy.return" directly to "std.return".
-    rewriter.replaceOpWithNewOp<ReturnOp>(op);
+struct ReturnOpLowering : public OpConversionPattern<toy::ReturnOp> {
+  using OpConversionPattern<toy::ReturnOp>::OpConversionPattern;
+
+  LogicalResult
+  matchAndRewrite(toy::ReturnOp op, OpAdaptor adaptor,
+                  ConversionPatternRewriter &rewriter) const final {
+    // The returned buffers are copied before the deallocations at the end of
+    // the block, which may release the buffers they are copied from.
+    setInsertionPointBeforeDeallocs(op, rewriter);
+    SmallVector<Value, 1> results;
+    for (Value operand : adaptor.getOperands())
+      results.push_back(transferToCaller(operand, op.getLoc(), rewriter));
+
+    // We lower "toy.return" directly to "std.return", which ends the block.
+    rewriter.setInsertionPoint(op);
+    rewriter.replaceOpWithNewOp<ReturnOp>(op, results);
+    return success();
+  }
+};
+
+//===----------------------------------------------------------------------===//
+// ToyToAffine RewritePatterns: Struct access operations
+//===----------------------------------------------------------------------===//
+
+struct StructAccessOpLowering
+    : public OpConversionPattern<toy::StructAccessOp> {
+  using OpConversionPattern<toy::StructAccessOp>::OpConversionPattern;
+
+  LogicalResult
+  matchAndRewrite(toy::StructAccessOp op, OpAdaptor adaptor,
+                  ConversionPatternRewriter &rewriter) const final {
+    // The field is the buffer of the field in the struct of buffers, or a
+    // subview of the struct of arrays.
+    rewriter.replaceOp(op, getStructField(adaptor.input(), op.index(),
+                                          op.getLoc(), rewriter));
     return success();
   }
 };
@@ -240,30 +884,44 @@ struct ReturnOpLowering : public OpRewritePattern<toy::ReturnOp> {
 //===----------------------------------------------------------------------===//
 
 struct TransposeOpLowering : public ConversionPattern {
-  TransposeOpLowering(MLIRContext *ctx)
-      : ConversionPattern(toy::TransposeOp::getOperationName(), 1, ctx) {}
+  TransposeOpLowering(MLIRContext *ctx, bool profile,
+                      SparseLowering &sparsity)
+      : ConversionPattern(toy::TransposeOp::getOperationName(), 1, ctx),
+        profile(profile), sparsity(sparsity) {}
 
   LogicalResult
   matchAndRewrite(Operation *op, ArrayRef<Value> operands,
                   ConversionPatternRewriter &rewriter) const final {
+    // A matrix transposed into the other layout has the same buffer.
+    Value input = op->getOperand(0);
+    if (toy::getLayout(input) != toy::getLayout(op->getResult(0))) {
+      rewriter.replaceOp(op, operands.front());
+      return success();
+    }
+
     auto loc = op->getLoc();
-    lowerOpToLoops(op, operands, rewriter,
-                   [loc](OpBuilder &builder, ValueRange memRefOperands,
-                         ValueRange loopIvs) {
+    lowerOpToLoops(op, operands, rewriter, profile, sparsity,
+                   [loc, input](OpBuilder &builder, ValueRange memRefOperands,
+                                ValueRange loopIvs) {
                      // Generate an adaptor for the remapped operands of the
                      // TransposeOp. This allows for using the nice named
                      // accessors that are generated by the ODS.
                      toy::TransposeOpAdaptor transposeAdaptor(memRefOperands);
-                     Value input = transposeAdaptor.input();
 
                      // Transpose the elements by generating a load from the
-                     // reverse indices.
+                     // reverse indices, in the layout of the input.
                      SmallVector<Value, 2> reverseIvs(llvm::reverse(loopIvs));
-                     return builder.create<AffineLoadOp>(loc, input,
-                                                         reverseIvs);
+                     return loadElement(builder, loc,
+                                        transposeAdaptor.input(),
+                                        getBufferIndices(input, reverseIvs));
                    });
     return success();
   }
+
+  /// Whether to wrap the loop nest with profiling probes.
+  bool profile;
+  /// The elements of the results that may be nonzero.
+  SparseLowering &sparsity;
 };
 
 } // namespace
@@ -278,23 +936,34 @@ struct TransposeOpLowering : public ConversionPattern {
 namespace {
 struct ToyToAffineLoweringPass
     : public PassWrapper<ToyToAffineLoweringPass, FunctionPass> {
+  ToyToAffineLoweringPass(bool profile) : profile(profile) {}
+
   void getDependentDialects(DialectRegistry &registry) const override {
-    registry.insert<AffineDialect, memref::MemRefDialect, StandardOpsDialect>();
+    registry.insert<AffineDialect, math::MathDialect, memref::MemRefDialect,
+                    scf::SCFDialect, StandardOpsDialect>();
   }
   void runOnFunction() final;
+
+  /// Whether to wrap the lowered operations with profiling probes.
+  bool profile;
 };
 } // namespace
 
 void ToyToAffineLoweringPass::runOnFunction() {
   auto function = getFunction();
 
-  // We only lower the main function as we expect that all other functions have
-  // been inlined.
-  if (function.getName() != "main")
+  // Functions with unshaped arguments or results are generic: we expect them to
+  // have been inlined or specialized. Any other function is lowered, its tensor
+  // arguments and results becoming buffers. The calls between the functions
+  // only rely on their own types, so the functions can be lowered in parallel.
+  auto isUnshaped = [](Type type) { return !toy::hasInferredShape(type); };
+  if (llvm::any_of(function.getType().getInputs(), isUnshaped) ||
+      llvm::any_of(function.getType().getResults(), isUnshaped))
     return;
 
   // Verify that the given main has no inputs and results.
-  if (function.getNumArguments() || function.getType().getNumResults()) {
+  if (function.getName() == "main" &&
+      (function.getNumArguments() || function.getType().getNumResults())) {
     function.emitError("expected 'main' to have 0 inputs and 0 results");
     return signalPassFailure();
   }
@@ -305,9 +974,10 @@ void ToyToAffineLoweringPass::runOnFunction() {
 
   // We define the specific operations, or dialects, that are legal targets for
   // this lowering. In our case, we are lowering to a combination of the
-  // `Affine`, `Arithmetic`, `MemRef`, and `Standard` dialects.
+  // `Affine`, `Arithmetic`, `Math`, `MemRef`, `SCF` and `Standard` dialects.
   target.addLegalDialect<AffineDialect, arith::ArithmeticDialect,
-                         memref::MemRefDialect, StandardOpsDialect>();
+                         math::MathDialect, memref::MemRefDialect,
+                         scf::SCFDialect, StandardOpsDialect>();
 
   // We also define the Toy dialect as Illegal so that the conversion will fail
   // if any of these operations are *not* converted. Given that we actually want
@@ -320,13 +990,40 @@ void ToyToAffineLoweringPass::runOnFunction() {
     return llvm::none_of(op->getOperandTypes(),
                          [](Type type) { return type.isa<TensorType>(); });
   });
+  // The profiling probes are lowered along with `toy.print`.
+  target.addLegalOp<toy::ProfileBeginOp, toy::ProfileEndOp>();
+
+  // The signature of the function is converted from tensors and structs to the
+  // corresponding buffers, the function is legal once this is done. So are the
+  // struct operations and the loops, once they operate on buffers.
+  TypeConverter typeConverter;
+  typeConverter.addConversion([](Type type) { return type; });
+  typeConverter.addConversion([](RankedTensorType type) -> Type {
+    return convertTensorToMemRef(type);
+  });
+  typeConverter.addConversion(
+      [](toy::StructType type) { return convertToBufferType(type); });
+  target.addDynamicallyLegalOp<FuncOp>([&](FuncOp op) {
+    return typeConverter.isSignatureLegal(op.getType());
+  });
+  target.addDynamicallyLegalOp<toy::StructAccessOp, toy::StructPackOp,
+                               scf::ForOp, scf::YieldOp>(
+      [&](Operation *op) { return typeConverter.isLegal(op); });
 
   // Now that the conversion target has been defined, we just need to provide
   // the set of patterns that will lower the Toy operations.
+  // The sparsity of the values is analyzed on the Toy code, before it is
+  // lowered.
+  SparseLowering sparsity(function);
   RewritePatternSet patterns(&getContext());
-  patterns.add<AddOpLowering, ConstantOpLowering, MulOpLowering,
-               PrintOpLowering, ReturnOpLowering, TransposeOpLowering>(
-      &getContext());
+  patterns.add<AddOpLowering, FmaOpLowering, MulOpLowering,
+               TransposeOpLowering>(&getContext(), profile, sparsity);
+  patterns.add<ConstantOpLowering, StructConstantOpLowering>(&getContext(),
+                                                             profile);
+  patterns.add<CastOpLowering, ForOpLowering, GenericCallOpLowering,
+               PrintOpLowering, ReturnOpLowering, StructAccessOpLowering,
+               YieldOpLowering>(&getContext());
+  populateFuncOpTypeConversionPattern(patterns, typeConverter);
 
   // With the target and rewrite patterns defined, we can now attempt the
   // conversion. The conversion will signal failure if any of our `illegal`
@@ -338,6 +1035,6 @@ void ToyToAffineLoweringPass::runOnFunction() {
 
 /// Create a pass for lowering operations in the `Affine` and `Std` dialects,
 /// for a subset of the Toy IR (e.g. matmul).
-std::unique_ptr<Pass> mlir::toy::createLowerToAffinePass() {
-  return std::make_unique<ToyToAffineLoweringPass>();
+std::unique_ptr<Pass> mlir::toy::createLowerToAffinePass(bool profile) {
+  return std::make_unique<ToyToAffineLoweringPass>(profile);
 }
@@ -8,8 +8,11 @@
 //
 // This file implements full lowering of Toy operations to LLVM MLIR dialect.
 // 'toy.print' is lowered to a loop nest that calls `printf` on each element of
-// the input array. The file also sets up the ToyToLLVMLoweringPass. This pass
-// lowers the combination of Affine + SCF + Standard dialects to the LLVM one:
+// the input array, and the profiling probes and the allocation telemetry to
+// calls to their runtimes. The structs of buffers become LLVM structs of
+// memref descriptors. The file also sets up the ToyToLLVMLoweringPass.
+// This pass lowers the combination of Affine + SCF + Standard dialects to the
+// LLVM one:
 //
 //                         Affine --
 //                                  |
@@ -22,16 +25,21 @@
 //===----------------------------------------------------------------------===//
 
 #include "toy/Dialect.h"
+#include "toy/MLIRGen.h"
 #include "toy/Passes.h"
 
 #include "mlir/Conversion/AffineToStandard/AffineToStandard.h"
 #include "mlir/Conversion/ArithmeticToLLVM/ArithmeticToLLVM.h"
 #include "mlir/Conversion/LLVMCommon/ConversionTarget.h"
+#include "mlir/Conversion/LLVMCommon/MemRefBuilder.h"
+#include "mlir/Conversion/LLVMCommon/Pattern.h"
 #include "mlir/Conversion/LLVMCommon/TypeConverter.h"
+#include "mlir/Conversion/MathToLLVM/MathToLLVM.h"
 #include "mlir/Conversion/MemRefToLLVM/MemRefToLLVM.h"
 #include "mlir/Conversion/SCFToStandard/SCFToStandard.h"
 #include "mlir/Conversion/StandardToLLVM/ConvertStandardToLLVM.h"
 #include "mlir/Conversion/StandardToLLVM/ConvertStandardToLLVMPass.h"
+#include "mlir/Conversion/VectorToLLVM/ConvertVectorToLLVM.h"
 #include "mlir/Dialect/Affine/IR/AffineOps.h"
 #include "mlir/Dialect/Arithmetic/IR/Arithmetic.h"
 #include "mlir/Dialect/LLVMIR/LLVMDialect.h"
@@ -40,7 +48,12 @@
 #include "mlir/Dialect/StandardOps/IR/Ops.h"
 #include "mlir/Pass/Pass.h"
 #include "mlir/Transforms/DialectConversion.h"
+#include "llvm/ADT/Hashing.h"
 #include "llvm/ADT/Sequence.h"
+#include "llvm/ADT/StringExtras.h"
+
+#include <algorithm>
+#include <type_traits>
 
 using namespace mlir;
 
@@ -48,6 +61,66 @@ using namespace mlir;
 // ToyToLLVM RewritePatterns
 //===----------------------------------------------------------------------===//
 
+/// Return a value representing an access into a global string with the given
+/// name, creating the string if necessary.
+static Value getOrCreateGlobalString(Location loc, OpBuilder &builder,
+                                     StringRef name, StringRef value,
+                                     ModuleOp module) {
+  // Create the global at the entry of the module.
+  LLVM::GlobalOp global;
+  if (!(global = module.lookupSymbol<LLVM::GlobalOp>(name))) {
+    OpBuilder::InsertionGuard insertGuard(builder);
+    builder.setInsertionPointToStart(module.getBody());
+    auto type = LLVM::LLVMArrayType::get(
+        IntegerType::get(builder.getContext(), 8), value.size());
+    global = builder.create<LLVM::GlobalOp>(loc, type, /*isConstant=*/true,
+                                            LLVM::Linkage::Internal, name,
+                                            builder.getStringAttr(value),
+                                            /*alignment=*/0);
+  }
+
+  // Get the pointer to the first character in the global string.
+  Value globalPtr = builder.create<LLVM::AddressOfOp>(loc, global);
+  Value cst0 = builder.create<LLVM::ConstantOp>(
+      loc, IntegerType::get(builder.getContext(), 64),
+      builder.getIntegerAttr(builder.getIndexType(), 0));
+  return builder.create<LLVM::GEPOp>(
+      loc,
+      LLVM::LLVMPointerType::get(IntegerType::get(builder.getContext(), 8)),
+      globalPtr, ArrayRef<Value>({cst0, cst0}));
+}
+
+/// Return a constant string naming `loc` as "file:line:col", shared by the
+/// uses of the same location in the module.
+static Value getOrCreateLocationString(Location loc, OpBuilder &builder,
+                                       ModuleOp module) {
+  std::string location;
+  llvm::raw_string_ostream os(location);
+  Location resolvedLoc = ::toy::resolveLocation(loc);
+  if (auto fileLoc = resolvedLoc.dyn_cast<FileLineColLoc>())
+    os << fileLoc.getFilename().getValue() << ":" << fileLoc.getLine() << ":"
+       << fileLoc.getColumn();
+  else
+    os << resolvedLoc;
+  os << '\0';
+  std::string name = "loc_" + llvm::utohexstr(llvm::hash_value(os.str()));
+  return getOrCreateGlobalString(loc, builder, name, os.str(), module);
+}
+
+/// Return a symbol reference to the runtime function `name`, declaring it in
+/// the module with the type `type` if necessary.
+static FlatSymbolRefAttr getOrInsertFunction(PatternRewriter &rewriter,
+                                             ModuleOp module, StringRef name,
+                                             LLVM::LLVMFunctionType type) {
+  auto *context = module.getContext();
+  if (!module.lookupSymbol<LLVM::LLVMFuncOp>(name)) {
+    PatternRewriter::InsertionGuard insertGuard(rewriter);
+    rewriter.setInsertionPointToStart(module.getBody());
+    rewriter.create<LLVM::LLVMFuncOp>(module.getLoc(), name, type);
+  }
+  return SymbolRefAttr::get(context, name);
+}
+
 namespace {
 /// Lowers `toy.print` to a loop nest calling `printf` on each of the individual
 /// elements of the array.
@@ -130,34 +203,168 @@ private:
     rewriter.create<LLVM::LLVMFuncOp>(module.getLoc(), "printf", llvmFnType);
     return SymbolRefAttr::get(context, "printf");
   }
+};
+} // namespace
 
-  /// Return a value representing an access into a global string with the given
-  /// name, creating the string if necessary.
-  static Value getOrCreateGlobalString(Location loc, OpBuilder &builder,
-                                       StringRef name, StringRef value,
-                                       ModuleOp module) {
-    // Create the global at the entry of the module.
-    LLVM::GlobalOp global;
-    if (!(global = module.lookupSymbol<LLVM::GlobalOp>(name))) {
-      OpBuilder::InsertionGuard insertGuard(builder);
-      builder.setInsertionPointToStart(module.getBody());
-      auto type = LLVM::LLVMArrayType::get(
-          IntegerType::get(builder.getContext(), 8), value.size());
-      global = builder.create<LLVM::GlobalOp>(loc, type, /*isConstant=*/true,
-                                              LLVM::Linkage::Internal, name,
-                                              builder.getStringAttr(value),
-                                              /*alignment=*/0);
+/// Lowers `toy.profile_begin` to a call to the runtime of the profiler, which
+/// returns the timestamp counter.
+class ProfileBeginOpLowering
+    : public OpConversionPattern<toy::ProfileBeginOp> {
+public:
+  using OpConversionPattern<toy::ProfileBeginOp>::OpConversionPattern;
+
+  LogicalResult
+  matchAndRewrite(toy::ProfileBeginOp op, OpAdaptor adaptor,
+                  ConversionPatternRewriter &rewriter) const override {
+    ModuleOp parentModule = op->getParentOfType<ModuleOp>();
+    auto i64Type = rewriter.getI64Type();
+    auto beginRef = getOrInsertFunction(
+        rewriter, parentModule, "toy_profile_begin",
+        LLVM::LLVMFunctionType::get(i64Type, llvm::None));
+    rewriter.replaceOpWithNewOp<CallOp>(op, beginRef, i64Type, ValueRange());
+    return success();
+  }
+};
+
+/// Lowers `toy.profile_end` to a call to the runtime of the profiler, passing
+/// the description of the site as constant strings.
+class ProfileEndOpLowering : public OpConversionPattern<toy::ProfileEndOp> {
+public:
+  using OpConversionPattern<toy::ProfileEndOp>::OpConversionPattern;
+
+  LogicalResult
+  matchAndRewrite(toy::ProfileEndOp op, OpAdaptor adaptor,
+                  ConversionPatternRewriter &rewriter) const override {
+    ModuleOp parentModule = op->getParentOfType<ModuleOp>();
+    auto loc = op.getLoc();
+    auto i64Type = rewriter.getI64Type();
+    auto i8PtrType = LLVM::LLVMPointerType::get(rewriter.getIntegerType(8));
+    auto endRef = getOrInsertFunction(
+        rewriter, parentModule, "toy_profile_end",
+        LLVM::LLVMFunctionType::get(
+            LLVM::LLVMVoidType::get(rewriter.getContext()),
+            {i64Type, i8PtrType, i8PtrType, i64Type}));
+
+    // The site is identified by the address of its location string, which is
+    // shared by the probes of the same location.
+    std::string opNameSymbol = ("op_" + op.name()).str();
+    std::replace(opNameSymbol.begin(), opNameSymbol.end(), '.', '_');
+    Value opName = getOrCreateGlobalString(
+        loc, rewriter, opNameSymbol, (op.name() + llvm::Twine('\0')).str(),
+        parentModule);
+    Value siteLoc = getOrCreateLocationString(loc, rewriter, parentModule);
+    Value bytes = rewriter.create<LLVM::ConstantOp>(
+        loc, i64Type, rewriter.getI64IntegerAttr(op.bytes()));
+    rewriter.replaceOpWithNewOp<CallOp>(
+        op, endRef, TypeRange(),
+        ValueRange({adaptor.start(), opName, siteLoc, bytes}));
+    return success();
+  }
+};
+
+/// Lowers `toy.track_alloc` and `toy.track_dealloc` to calls to the runtime of
+/// the allocation tracker, passing the allocated pointer of the buffer. An
+/// allocation also passes its size and its location.
+template <typename TrackOp>
+class TrackAllocOpLowering : public ConvertOpToLLVMPattern<TrackOp> {
+public:
+  using ConvertOpToLLVMPattern<TrackOp>::ConvertOpToLLVMPattern;
+  using OpAdaptor = typename TrackOp::Adaptor;
+
+  LogicalResult
+  matchAndRewrite(TrackOp op, OpAdaptor adaptor,
+                  ConversionPatternRewriter &rewriter) const override {
+    ModuleOp parentModule = op->template getParentOfType<ModuleOp>();
+    auto loc = op.getLoc();
+    auto i64Type = rewriter.getI64Type();
+    auto i8PtrType = LLVM::LLVMPointerType::get(rewriter.getIntegerType(8));
+    Value ptr = rewriter.create<LLVM::BitcastOp>(
+        loc, i8PtrType,
+        MemRefDescriptor(adaptor.buffer()).allocatedPtr(rewriter, loc));
+    auto voidType = LLVM::LLVMVoidType::get(rewriter.getContext());
+
+    if (std::is_same<TrackOp, toy::TrackDeallocOp>::value) {
+      auto deallocRef =
+          getOrInsertFunction(rewriter, parentModule, "toy_track_dealloc",
+                              LLVM::LLVMFunctionType::get(voidType, i8PtrType));
+      rewriter.replaceOpWithNewOp<CallOp>(op, deallocRef, TypeRange(), ptr);
+      return success();
     }
 
-    // Get the pointer to the first character in the global string.
-    Value globalPtr = builder.create<LLVM::AddressOfOp>(loc, global);
-    Value cst0 = builder.create<LLVM::ConstantOp>(
-        loc, IntegerType::get(builder.getContext(), 64),
-        builder.getIntegerAttr(builder.getIndexType(), 0));
-    return builder.create<LLVM::GEPOp>(
-        loc,
-        LLVM::LLVMPointerType::get(IntegerType::get(builder.getContext(), 8)),
-        globalPtr, ArrayRef<Value>({cst0, cst0}));
+    auto allocRef = getOrInsertFunction(
+        rewriter, parentModule, "toy_track_alloc",
+        LLVM::LLVMFunctionType::get(voidType,
+                                    {i8PtrType, i64Type, i8PtrType}));
+    auto memRefType = op.buffer().getType().template cast<MemRefType>();
+    Value bytes = rewriter.create<LLVM::ConstantOp>(
+        loc, i64Type,
+        rewriter.getI64IntegerAttr(memRefType.getNumElements() *
+                                   memRefType.getElementTypeBitWidth() / 8));
+    Value location = getOrCreateLocationString(loc, rewriter, parentModule);
+    rewriter.replaceOpWithNewOp<CallOp>(op, allocRef, TypeRange(),
+                                        ValueRange({ptr, bytes, location}));
+    return success();
+  }
+};
+
+/// Lowers `toy.struct_pack` to an LLVM struct of the descriptors of the fields.
+class StructPackOpLowering : public ConvertOpToLLVMPattern<toy::StructPackOp> {
+public:
+  using ConvertOpToLLVMPattern<toy::StructPackOp>::ConvertOpToLLVMPattern;
+
+  LogicalResult
+  matchAndRewrite(toy::StructPackOp op, OpAdaptor adaptor,
+                  ConversionPatternRewriter &rewriter) const override {
+    auto loc = op.getLoc();
+    Value result = rewriter.create<LLVM::UndefOp>(
+        loc, getTypeConverter()->convertType(op.getType()));
+    for (auto field : llvm::enumerate(adaptor.fields()))
+      result = rewriter.create<LLVM::InsertValueOp>(
+          loc, result, field.value(),
+          rewriter.getI64ArrayAttr(static_cast<int64_t>(field.index())));
+    rewriter.replaceOp(op, result);
+    return success();
+  }
+};
+
+/// Lowers `toy.struct_access` to the extraction of the descriptor of the field
+/// from an LLVM struct. The fields of the structs of arrays are subviews,
+/// lowered with the other memref operations.
+class StructAccessOpLowering
+    : public ConvertOpToLLVMPattern<toy::StructAccessOp> {
+public:
+  using ConvertOpToLLVMPattern<toy::StructAccessOp>::ConvertOpToLLVMPattern;
+
+  LogicalResult
+  matchAndRewrite(toy::StructAccessOp op, OpAdaptor adaptor,
+                  ConversionPatternRewriter &rewriter) const override {
+    rewriter.replaceOpWithNewOp<LLVM::ExtractValueOp>(
+        op, getTypeConverter()->convertType(op.getType()), adaptor.input(),
+        rewriter.getI64ArrayAttr(static_cast<int64_t>(op.index())));
+    return success();
+  }
+};
+
+/// Lowers `toy.track_traffic` to a call to the runtime of the allocation
+/// tracker.
+class TrackTrafficOpLowering
+    : public OpConversionPattern<toy::TrackTrafficOp> {
+public:
+  using OpConversionPattern<toy::TrackTrafficOp>::OpConversionPattern;
+
+  LogicalResult
+  matchAndRewrite(toy::TrackTrafficOp op, OpAdaptor adaptor,
+                  ConversionPatternRewriter &rewriter) const override {
+    ModuleOp parentModule = op->getParentOfType<ModuleOp>();
+    auto i64Type = rewriter.getI64Type();
+    auto trafficRef = getOrInsertFunction(
+        rewriter, parentModule, "toy_track_traffic",
+        LLVM::LLVMFunctionType::get(
+            LLVM::LLVMVoidType::get(rewriter.getContext()), i64Type));
+    Value bytes = rewriter.create<LLVM::ConstantOp>(
+        op.getLoc(), i64Type, rewriter.getI64IntegerAttr(op.bytes()));
+    rewriter.replaceOpWithNewOp<CallOp>(op, trafficRef, TypeRange(), bytes);
+    return success();
   }
 };
 } // namespace
@@ -190,6 +397,19 @@ void ToyToLLVMLoweringPass::runOnOperation() {
   // doing more complicated lowerings, involving loop region arguments.
   LLVMTypeConverter typeConverter(&getContext());
 
+  // A struct of buffers is passed as an LLVM struct of their descriptors,
+  // without copying the buffers.
+  typeConverter.addConversion([&](toy::StructType type) -> Optional<Type> {
+    SmallVector<Type, 4> fieldTypes;
+    for (Type elementType : type.getElementTypes()) {
+      Type fieldType = typeConverter.convertType(elementType);
+      if (!fieldType)
+        return llvm::None;
+      fieldTypes.push_back(fieldType);
+    }
+    return LLVM::LLVMStructType::getLiteral(&getContext(), fieldTypes);
+  });
+
   // Now that the conversion target has been defined, we need to provide the
   // patterns used for lowering. At this point of the compilation process, we
   // have a combination of `toy`, `affine`, and `std` operations. Luckily, there
@@ -203,12 +423,23 @@ void ToyToLLVMLoweringPass::runOnOperation() {
   populateLoopToStdConversionPatterns(patterns);
   mlir::arith::populateArithmeticToLLVMConversionPatterns(typeConverter,
                                                           patterns);
+  // `toy.fma` is lowered to `math.fma`.
+  populateMathToLLVMConversionPatterns(typeConverter, patterns);
   populateMemRefToLLVMConversionPatterns(typeConverter, patterns);
   populateStdToLLVMConversionPatterns(typeConverter, patterns);
+  // The loops vectorized by the tuning (see toy/Tuning.h) transfer vectors to
+  // and from the buffers.
+  populateVectorToLLVMConversionPatterns(typeConverter, patterns);
 
-  // The only remaining operation to lower from the `toy` dialect, is the
-  // PrintOp.
-  patterns.add<PrintOpLowering>(&getContext());
+  // The only remaining operations to lower from the `toy` dialect are the
+  // PrintOp, the struct operations, the profiling probes and the allocation
+  // telemetry.
+  patterns.add<PrintOpLowering, ProfileBeginOpLowering, ProfileEndOpLowering>(
+      &getContext());
+  patterns.add<StructAccessOpLowering, StructPackOpLowering,
+               TrackAllocOpLowering<toy::TrackAllocOp>,
+               TrackAllocOpLowering<toy::TrackDeallocOp>>(typeConverter);
+  patterns.add<TrackTrafficOpLowering>(&getContext());
 
   // We want to completely lower to LLVM, so we use a `FullConversion`. This
   // ensures that only legal operations will remain after the conversion.
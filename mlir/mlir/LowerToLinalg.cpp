@@ -0,0 +1,350 @@
+//====- LowerToLinalg.cpp - Partial lowering from Toy to Linalg -----------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements a partial lowering of Toy operations to structured
+// operations of the Linalg dialect on tensors. Unlike the lowering to affine
+// loops, it keeps value semantics: the transformations on structured
+// operations (fusion, tiling) apply before the module is bufferized. This
+// lowering expects that all shapes have been resolved. The loops of the Toy
+// code stay `scf.for` operations carrying dense tensors.
+//
+//===----------------------------------------------------------------------===//
+
+#include "toy/Dialect.h"
+#include "toy/Passes.h"
+
+#include "mlir/Dialect/Arithmetic/IR/Arithmetic.h"
+#include "mlir/Dialect/Bufferization/IR/Bufferization.h"
+#include "mlir/Dialect/Linalg/IR/LinalgOps.h"
+#include "mlir/Dialect/Math/IR/Math.h"
+#include "mlir/Dialect/MemRef/IR/MemRef.h"
+#include "mlir/Dialect/SCF/SCF.h"
+#include "mlir/Dialect/SCF/Transforms.h"
+#include "mlir/Dialect/StandardOps/IR/Ops.h"
+#include "mlir/Dialect/Utils/StructuredOpsUtils.h"
+#include "mlir/Pass/Pass.h"
+#include "mlir/Transforms/DialectConversion.h"
+
+using namespace mlir;
+
+//===----------------------------------------------------------------------===//
+// ToyToLinalg RewritePatterns
+//===----------------------------------------------------------------------===//
+
+/// Replace `op` with a parallel linalg.generic computing its result from
+/// `inputs`, which are read through `inputMaps`. The result is written with
+/// the identity map. The structured operations run on dense tensors: the
+/// sparse encoding of the result is dropped.
+static void
+replaceWithParallelGeneric(Operation *op, ValueRange inputs,
+                           ArrayRef<AffineMap> inputMaps,
+                           ConversionPatternRewriter &rewriter,
+                           function_ref<Value(OpBuilder &, Location,
+                                              ValueRange)> bodyBuilder) {
+  auto tensorType = toy::getTensorType(
+      (*op->result_type_begin()).cast<RankedTensorType>(), /*sparse=*/false);
+  Location loc = op->getLoc();
+
+  // The result is written into a new tensor, whose contents are undefined.
+  Value init = rewriter.create<linalg::InitTensorOp>(
+      loc, tensorType.getShape(), tensorType.getElementType());
+
+  SmallVector<AffineMap, 3> indexingMaps(inputMaps.begin(), inputMaps.end());
+  indexingMaps.push_back(
+      rewriter.getMultiDimIdentityMap(tensorType.getRank()));
+  SmallVector<StringRef, 4> iteratorTypes(tensorType.getRank(),
+                                          getParallelIteratorTypeName());
+  rewriter.replaceOpWithNewOp<linalg::GenericOp>(
+      op, tensorType, inputs, init, indexingMaps, iteratorTypes,
+      [&](OpBuilder &builder, Location loc, ValueRange args) {
+        builder.create<linalg::YieldOp>(loc, bodyBuilder(builder, loc, args));
+      });
+}
+
+namespace {
+//===----------------------------------------------------------------------===//
+// ToyToLinalg RewritePatterns: Binary operations
+//===----------------------------------------------------------------------===//
+
+template <typename BinaryOp, typename LoweredBinaryOp>
+struct BinaryOpLowering : public OpConversionPattern<BinaryOp> {
+  using OpConversionPattern<BinaryOp>::OpConversionPattern;
+  using OpAdaptor = typename OpConversionPattern<BinaryOp>::OpAdaptor;
+
+  LogicalResult
+  matchAndRewrite(BinaryOp op, OpAdaptor adaptor,
+                  ConversionPatternRewriter &rewriter) const final {
+    // Both operands are read at the index of the element being computed.
+    AffineMap identity = rewriter.getMultiDimIdentityMap(
+        op.getType().template cast<RankedTensorType>().getRank());
+    replaceWithParallelGeneric(
+        op, adaptor.getOperands(), {identity, identity}, rewriter,
+        [](OpBuilder &builder, Location loc, ValueRange args) -> Value {
+          return builder.create<LoweredBinaryOp>(loc, args[0], args[1]);
+        });
+    return success();
+  }
+};
+using AddOpLowering = BinaryOpLowering<toy::AddOp, arith::AddFOp>;
+using MulOpLowering = BinaryOpLowering<toy::MulOp, arith::MulFOp>;
+
+//===----------------------------------------------------------------------===//
+// ToyToLinalg RewritePatterns: Fma operations
+//===----------------------------------------------------------------------===//
+
+struct FmaOpLowering : public OpConversionPattern<toy::FmaOp> {
+  using OpConversionPattern<toy::FmaOp>::OpConversionPattern;
+
+  LogicalResult
+  matchAndRewrite(toy::FmaOp op, OpAdaptor adaptor,
+                  ConversionPatternRewriter &rewriter) const final {
+    // The three operands are read at the index of the element being computed.
+    AffineMap identity = rewriter.getMultiDimIdentityMap(
+        op.getType().cast<RankedTensorType>().getRank());
+    replaceWithParallelGeneric(
+        op, adaptor.getOperands(), {identity, identity, identity}, rewriter,
+        [](OpBuilder &builder, Location loc, ValueRange args) -> Value {
+          return builder.create<math::FmaOp>(loc, args[0], args[1], args[2]);
+        });
+    return success();
+  }
+};
+
+//===----------------------------------------------------------------------===//
+// ToyToLinalg RewritePatterns: Transpose operations
+//===----------------------------------------------------------------------===//
+
+struct TransposeOpLowering : public OpConversionPattern<toy::TransposeOp> {
+  using OpConversionPattern<toy::TransposeOp>::OpConversionPattern;
+
+  LogicalResult
+  matchAndRewrite(toy::TransposeOp op, OpAdaptor adaptor,
+                  ConversionPatternRewriter &rewriter) const final {
+    // The input is read at the reverse indices.
+    unsigned rank = op.getType().cast<RankedTensorType>().getRank();
+    SmallVector<unsigned, 4> permutation;
+    for (unsigned i = rank; i-- > 0;)
+      permutation.push_back(i);
+    AffineMap inputMap =
+        AffineMap::getPermutationMap(permutation, rewriter.getContext());
+    replaceWithParallelGeneric(
+        op, adaptor.getOperands(), inputMap, rewriter,
+        [](OpBuilder &, Location, ValueRange args) { return args[0]; });
+    return success();
+  }
+};
+
+//===----------------------------------------------------------------------===//
+// ToyToLinalg RewritePatterns: Cast operations
+//===----------------------------------------------------------------------===//
+
+struct CastOpLowering : public OpConversionPattern<toy::CastOp> {
+  using OpConversionPattern<toy::CastOp>::OpConversionPattern;
+
+  LogicalResult
+  matchAndRewrite(toy::CastOp op, OpAdaptor adaptor,
+                  ConversionPatternRewriter &rewriter) const final {
+    // The shapes are inferred, a cast only changes the sparse encoding, which
+    // the structured operations drop.
+    rewriter.replaceOp(op, adaptor.input());
+    return success();
+  }
+};
+
+//===----------------------------------------------------------------------===//
+// ToyToLinalg RewritePatterns: Constant operations
+//===----------------------------------------------------------------------===//
+
+struct ConstantOpLowering : public OpConversionPattern<toy::ConstantOp> {
+  using OpConversionPattern<toy::ConstantOp>::OpConversionPattern;
+
+  LogicalResult
+  matchAndRewrite(toy::ConstantOp op, OpAdaptor adaptor,
+                  ConversionPatternRewriter &rewriter) const final {
+    // A constant tensor is bufferized into a global memref. A sparse constant
+    // is expanded, as the structured operations run on dense tensors.
+    ElementsAttr value = op.value();
+    if (auto sparse = value.dyn_cast<SparseElementsAttr>())
+      value = DenseElementsAttr::get(
+          toy::getTensorType(sparse.getType().cast<RankedTensorType>(),
+                             /*sparse=*/false),
+          llvm::to_vector<16>(sparse.getValues<APFloat>()));
+    rewriter.replaceOpWithNewOp<arith::ConstantOp>(op, value);
+    return success();
+  }
+};
+
+//===----------------------------------------------------------------------===//
+// ToyToLinalg RewritePatterns: Call operations
+//===----------------------------------------------------------------------===//
+
+struct GenericCallOpLowering : public OpConversionPattern<toy::GenericCallOp> {
+  using OpConversionPattern<toy::GenericCallOp>::OpConversionPattern;
+
+  LogicalResult
+  matchAndRewrite(toy::GenericCallOp op, OpAdaptor adaptor,
+                  ConversionPatternRewriter &rewriter) const final {
+    if (!op.getType().isa<RankedTensorType>())
+      return failure();
+
+    // We lower "toy.generic_call" to "std.call", on tensors.
+    rewriter.replaceOpWithNewOp<CallOp>(op, op.callee(), op.getType(),
+                                        adaptor.getOperands());
+    return success();
+  }
+};
+
+//===----------------------------------------------------------------------===//
+// ToyToLinalg RewritePatterns: Print operations
+//===----------------------------------------------------------------------===//
+
+struct PrintOpLowering : public OpConversionPattern<toy::PrintOp> {
+  using OpConversionPattern<toy::PrintOp>::OpConversionPattern;
+
+  LogicalResult
+  matchAndRewrite(toy::PrintOp op, OpAdaptor adaptor,
+                  ConversionPatternRewriter &rewriter) const final {
+    // We don't lower "toy.print" in this pass, but it reads the buffer of its
+    // operand.
+    auto tensorType = op.input().getType().cast<RankedTensorType>();
+    Value buffer = rewriter.create<bufferization::ToMemrefOp>(
+        op.getLoc(),
+        MemRefType::get(tensorType.getShape(), tensorType.getElementType()),
+        adaptor.input());
+    rewriter.updateRootInPlace(op, [&] { op->setOperands(buffer); });
+    return success();
+  }
+};
+
+//===----------------------------------------------------------------------===//
+// ToyToLinalg RewritePatterns: Return operations
+//===----------------------------------------------------------------------===//
+
+struct ReturnOpLowering : public OpConversionPattern<toy::ReturnOp> {
+  using OpConversionPattern<toy::ReturnOp>::OpConversionPattern;
+
+  LogicalResult
+  matchAndRewrite(toy::ReturnOp op, OpAdaptor adaptor,
+                  ConversionPatternRewriter &rewriter) const final {
+    // We lower "toy.return" directly to "std.return".
+    rewriter.replaceOpWithNewOp<ReturnOp>(op, adaptor.getOperands());
+    return success();
+  }
+};
+
+} // namespace
+
+/// Make each value yielded by the body of `loop` a copy into the tensor of the
+/// iteration argument, unless it is this tensor already. The bufferization
+/// then finds the value of the next iteration in the buffer of the argument,
+/// which all the iterations reuse.
+static void copyIntoIterArgs(scf::ForOp loop) {
+  Operation *yield = loop.getBody()->getTerminator();
+  OpBuilder builder(yield);
+  for (auto it : llvm::zip(yield->getOpOperands(), loop.getRegionIterArgs())) {
+    OpOperand &operand = std::get<0>(it);
+    Value iterArg = std::get<1>(it);
+    if (operand.get() == iterArg)
+      continue;
+    auto tensorType = iterArg.getType().cast<RankedTensorType>();
+    AffineMap identity = builder.getMultiDimIdentityMap(tensorType.getRank());
+    SmallVector<StringRef, 4> iteratorTypes(tensorType.getRank(),
+                                            getParallelIteratorTypeName());
+    auto copy = builder.create<linalg::GenericOp>(
+        yield->getLoc(), tensorType, operand.get(), iterArg,
+        ArrayRef<AffineMap>{identity, identity}, iteratorTypes,
+        [](OpBuilder &builder, Location loc, ValueRange args) {
+          builder.create<linalg::YieldOp>(loc, args.front());
+        });
+    operand.set(copy.getResult(0));
+  }
+}
+
+//===----------------------------------------------------------------------===//
+// ToyToLinalgLoweringPass
+//===----------------------------------------------------------------------===//
+
+/// This is a partial lowering to linalg operations of the toy operations that
+/// are computationally intensive, keeping `toy.print` in the Toy dialect.
+namespace {
+struct ToyToLinalgLoweringPass
+    : public PassWrapper<ToyToLinalgLoweringPass, FunctionPass> {
+  void getDependentDialects(DialectRegistry &registry) const override {
+    registry.insert<arith::ArithmeticDialect,
+                    bufferization::BufferizationDialect, linalg::LinalgDialect,
+                    math::MathDialect, memref::MemRefDialect,
+                    scf::SCFDialect, StandardOpsDialect>();
+  }
+  void runOnFunction() final;
+};
+} // namespace
+
+void ToyToLinalgLoweringPass::runOnFunction() {
+  // Functions with unshaped arguments or results are generic: we expect them to
+  // have been inlined or specialized.
+  FuncOp function = getFunction();
+  auto isUnshaped = [](Type type) { return type.isa<UnrankedTensorType>(); };
+  if (llvm::any_of(function.getType().getInputs(), isUnshaped) ||
+      llvm::any_of(function.getType().getResults(), isUnshaped))
+    return;
+
+  // Verify that the given main has no inputs and results.
+  if (function.getName() == "main" &&
+      (function.getNumArguments() || function.getType().getNumResults())) {
+    function.emitError("expected 'main' to have 0 inputs and 0 results");
+    return signalPassFailure();
+  }
+
+  // The target is a combination of the `Arithmetic`, `Bufferization`,
+  // `Linalg`, `Math`, `SCF` and `Standard` dialects, on tensors. `toy.print` is
+  // kept, and legal once it reads a buffer.
+  ConversionTarget target(getContext());
+  target.addLegalDialect<arith::ArithmeticDialect,
+                         bufferization::BufferizationDialect,
+                         linalg::LinalgDialect, math::MathDialect,
+                         StandardOpsDialect>();
+  target.addIllegalDialect<toy::ToyDialect>();
+  target.addDynamicallyLegalOp<toy::PrintOp>([](toy::PrintOp op) {
+    return llvm::none_of(op->getOperandTypes(),
+                         [](Type type) { return type.isa<TensorType>(); });
+  });
+
+  RewritePatternSet patterns(&getContext());
+  patterns.add<AddOpLowering, CastOpLowering, ConstantOpLowering,
+               FmaOpLowering, GenericCallOpLowering, MulOpLowering,
+               PrintOpLowering, ReturnOpLowering, TransposeOpLowering>(
+      &getContext());
+
+  // The loops carry the dense tensors of the structured operations, their
+  // types drop the sparse encoding.
+  TypeConverter typeConverter;
+  typeConverter.addConversion([](Type type) { return type; });
+  typeConverter.addConversion([](RankedTensorType type) -> Type {
+    return toy::getTensorType(type, /*sparse=*/false);
+  });
+  scf::populateSCFStructuralTypeConversionsAndLegality(typeConverter,
+                                                       patterns, target);
+
+  if (failed(applyPartialConversion(function, target, std::move(patterns))))
+    return signalPassFailure();
+  function.walk([](scf::ForOp loop) { copyIntoIterArgs(loop); });
+
+  // The buffers of the arguments belong to the caller, which may share them
+  // between concurrent invocations (see toy::CompiledModule::invoke): the
+  // bufferization copies an argument before writing it, e.g. as the value
+  // carried by a loop, rather than writing it in place.
+  for (unsigned i = 0, e = function.getNumArguments(); i != e; ++i)
+    function.setArgAttr(i, "linalg.inplaceable",
+                        BoolAttr::get(&getContext(), false));
+}
+
+/// Create a pass for lowering operations to the `Linalg` dialect on tensors,
+/// for a subset of the Toy IR.
+std::unique_ptr<Pass> mlir::toy::createLowerToLinalgPass() {
+  return std::make_unique<ToyToLinalgLoweringPass>();
+}
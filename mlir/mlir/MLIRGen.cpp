@@ -15,6 +15,8 @@
 #include "toy/AST.h"
 #include "toy/Dialect.h"
 
+#include "mlir/Dialect/Arithmetic/IR/Arithmetic.h"
+#include "mlir/Dialect/SCF/SCF.h"
 #include "mlir/IR/Attributes.h"
 #include "mlir/IR/Builders.h"
 #include "mlir/IR/BuiltinOps.h"
@@ -22,10 +24,13 @@
 #include "mlir/IR/MLIRContext.h"
 #include "mlir/IR/Verifier.h"
 
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/STLExtras.h"
 #include "llvm/ADT/ScopedHashTable.h"
+#include "llvm/ADT/SetVector.h"
+#include "llvm/ADT/StringSet.h"
 #include "llvm/Support/raw_ostream.h"
-#include <numeric>
+#include <cmath>
 
 using namespace mlir::toy;
 using namespace toy;
@@ -40,6 +45,19 @@ using llvm::SmallVector;
 using llvm::StringRef;
 using llvm::Twine;
 
+static_assert(sizeof(uintptr_t) >= sizeof(uint64_t),
+              "a Toy location is packed in a pointer-sized integer");
+
+/// Pack `loc` in the integer held by an opaque location.
+static uintptr_t packLocation(Location loc) {
+  return static_cast<uintptr_t>(loc.file) << 32 | loc.offset;
+}
+
+/// Unpack the location packed by packLocation.
+static Location unpackLocation(uintptr_t packed) {
+  return {static_cast<uint32_t>(packed >> 32), static_cast<uint32_t>(packed)};
+}
+
 namespace {
 
 /// Implementation of a simple MLIR emission from the Toy AST.
@@ -52,21 +70,29 @@ public:
   MLIRGenImpl(mlir::MLIRContext &context) : builder(&context) {}
 
   /// Public API: convert the AST for a Toy module (source file) to an MLIR
-  /// Module operation.
-  mlir::ModuleOp mlirGen(ModuleAST &moduleAST) {
+  /// Module operation, using the definitions of the modules it imports.
+  mlir::ModuleOp mlirGen(ModuleAST &moduleAST,
+                         ArrayRef<ImportedModule> imports) {
     // We create an empty MLIR module and codegen functions one at a time and
     // add them to the module.
     theModule = mlir::ModuleOp::create(builder.getUnknownLoc());
 
-    for (auto &record : moduleAST) {
-      if (FunctionAST *funcAST = llvm::dyn_cast<FunctionAST>(record.get())) {
+    for (const ImportedModule &import : imports) {
+      if (failed(declareImport(import))) {
+        theModule.erase();
+        return nullptr;
+      }
+    }
+
+    for (auto *record : moduleAST) {
+      if (FunctionAST *funcAST = llvm::dyn_cast<FunctionAST>(record)) {
         auto func = mlirGen(*funcAST);
         if (!func)
           return nullptr;
 
         theModule.push_back(func);
         functionMap.insert({func.getName(), func});
-      } else if (StructAST *str = llvm::dyn_cast<StructAST>(record.get())) {
+      } else if (StructAST *str = llvm::dyn_cast<StructAST>(record)) {
         if (failed(mlirGen(*str)))
           return nullptr;
       } else {
@@ -85,6 +111,81 @@ public:
     return theModule;
   }
 
+  /// Public API for the interactive mode: emit a function or a struct
+  /// definition into the persistent module `definitions`. A function replaces
+  /// any previous definition with the same name.
+  mlir::LogicalResult mlirGenDefinition(RecordAST &record,
+                                        mlir::ModuleOp definitions) {
+    theModule = definitions;
+    if (StructAST *str = llvm::dyn_cast<StructAST>(&record))
+      return mlirGen(*str);
+
+    auto func = mlirGen(llvm::cast<FunctionAST>(record));
+    if (!func)
+      return mlir::failure();
+    if (mlir::FuncOp previous = functionMap.lookup(func.getName()))
+      previous.erase();
+    theModule.push_back(func);
+    functionMap[func.getName()] = func;
+    return mlir::success();
+  }
+
+  /// Public API for the interactive mode: emit a top-level statement as a new
+  /// module, see MLIRGenSession::genStatement for details.
+  mlir::ModuleOp
+  mlirGenStatement(ExprAST &stmt, StringRef name,
+                   ArrayRef<MLIRGenSession::Variable> variables) {
+    // Create a scope in the symbol table to hold the variables.
+    SymbolTableScopeT varScope(symbolTable);
+
+    // The live variables are the arguments of the function.
+    auto location = loc(stmt.loc());
+    llvm::SmallVector<mlir::Type, 4> argTypes;
+    argTypes.reserve(variables.size());
+    for (const auto &variable : variables)
+      argTypes.push_back(getType(variable.second));
+    auto function = mlir::FuncOp::create(
+        location, name, builder.getFunctionType(argTypes, llvm::None));
+
+    theModule = mlir::ModuleOp::create(builder.getUnknownLoc());
+    theModule.push_back(function);
+
+    auto &entryBlock = *function.addEntryBlock();
+    for (const auto nameValue : llvm::zip(variables, entryBlock.getArguments()))
+      if (failed(declare(*std::get<0>(nameValue).first,
+                         std::get<1>(nameValue)))) {
+        theModule.erase();
+        return nullptr;
+      }
+    builder.setInsertionPointToStart(&entryBlock);
+
+    if (failed(mlirGenStatement(stmt, function))) {
+      theModule.erase();
+      return nullptr;
+    }
+
+    // Copy in the definitions that the statement transitively calls, they are
+    // inlined and dropped by the compilation pipeline.
+    llvm::SmallVector<mlir::FuncOp, 8> worklist{function};
+    llvm::StringSet<> copied;
+    while (!worklist.empty()) {
+      worklist.pop_back_val().walk([&](GenericCallOp call) {
+        if (!copied.insert(call.callee()).second)
+          return;
+        mlir::FuncOp callee = functionMap.lookup(call.callee()).clone();
+        theModule.push_back(callee);
+        worklist.push_back(callee);
+      });
+    }
+
+    if (failed(mlir::verify(theModule))) {
+      theModule.emitError("module verification error");
+      theModule.erase();
+      return nullptr;
+    }
+    return theModule;
+  }
+
 private:
   /// A "module" matches a Toy source file: containing a list of functions.
   mlir::ModuleOp theModule;
@@ -111,10 +212,44 @@ private:
   /// original AST node.
   llvm::StringMap<std::pair<mlir::Type, StructAST *>> structMap;
 
-  /// Helper conversion for a Toy AST location to an MLIR location.
+  /// The name of each source, the fallback of its locations.
+  llvm::DenseMap<uint32_t, mlir::StringAttr> sourceNames;
+
+  /// Helper conversion for a Toy AST location to an MLIR location. It only
+  /// holds the source and the offset, the line and the column are computed by
+  /// resolveLocation when the location is printed.
   mlir::Location loc(Location loc) {
-    return mlir::FileLineColLoc::get(builder.getStringAttr(*loc.file), loc.line,
-                                     loc.col);
+    mlir::StringAttr &name = sourceNames[loc.file];
+    if (!name)
+      name = builder.getStringAttr(
+          SourceManager::get().getBufferIdentifier(loc.file));
+    return mlir::OpaqueLoc::get(packLocation(loc),
+                                mlir::TypeID::get<Location>(),
+                                mlir::NameLoc::get(name));
+  }
+
+  /// Make the definitions of an imported module visible: its structs are
+  /// emitted again, and its functions are declared.
+  mlir::LogicalResult declareImport(const ImportedModule &import) {
+    for (auto *record : *import.ast) {
+      auto *str = llvm::dyn_cast<StructAST>(record);
+      if (str && failed(mlirGen(*str)))
+        return mlir::failure();
+    }
+
+    // The functions declared by the imported module are defined by its own
+    // imports, which are declared separately.
+    mlir::ModuleOp module = import.module;
+    for (mlir::FuncOp func : module.getOps<mlir::FuncOp>()) {
+      if (func.isDeclaration())
+        continue;
+      auto decl = mlir::FuncOp::create(func.getLoc(), func.getName(),
+                                       func.getType());
+      decl.setPrivate();
+      theModule.push_back(decl);
+      functionMap.insert({decl.getName(), decl});
+    }
+    return mlir::success();
   }
 
   /// Declare a variable in the current scope, return success if the variable
@@ -202,7 +337,7 @@ private:
     builder.setInsertionPointToStart(&entryBlock);
 
     // Emit the body of the function.
-    if (mlir::failed(mlirGen(*funcAST.getBody()))) {
+    if (mlir::failed(mlirGen(funcAST.getBody()))) {
       function.erase();
       return nullptr;
     }
@@ -253,7 +388,7 @@ private:
       VarDeclExprAST *decl = nullptr;
       for (auto &var : parentStruct->getVariables()) {
         if (var->getName() == name->getName()) {
-          decl = var.get();
+          decl = var;
           break;
         }
       }
@@ -355,6 +490,8 @@ private:
   /// Emit a return operation. This will return failure if any generation fails.
   mlir::LogicalResult mlirGen(ReturnExprAST &ret) {
     auto location = loc(ret.loc());
+    if (isa<mlir::scf::ForOp>(builder.getInsertionBlock()->getParentOp()))
+      return emitError(location, "return is not valid within a loop");
 
     // 'return' takes an optional expression, handle that case here.
     mlir::Value expr = nullptr;
@@ -387,22 +524,64 @@ private:
   ///     [[1.000000e+00, 2.000000e+00, 3.000000e+00],
   ///      [4.000000e+00, 5.000000e+00, 6.000000e+00]]>} : () -> tensor<2x3xf64>
   ///
-  mlir::DenseElementsAttr getConstantAttr(LiteralExprAST &lit) {
-    // The attribute is a vector with a floating point value per element
-    // (number) in the array, see `collectData()` below for more details.
-    std::vector<double> data;
-    data.reserve(std::accumulate(lit.getDims().begin(), lit.getDims().end(), 1,
-                                 std::multiplies<int>()));
-    collectData(lit, data);
-
+  mlir::ElementsAttr getConstantAttr(LiteralExprAST &lit) {
     // The type of this attribute is tensor of 64-bit floating-point with the
     // shape of the literal.
     mlir::Type elementType = builder.getF64Type();
     auto dataType = mlir::RankedTensorType::get(lit.getDims(), elementType);
 
     // This is the actual attribute that holds the list of values for this
-    // tensor literal.
-    return mlir::DenseElementsAttr::get(dataType, llvm::makeArrayRef(data));
+    // tensor literal: the parser already flattened them in a buffer, with a
+    // floating point value per element. A splat is stored as a single value.
+    llvm::ArrayRef<double> data = lit.getData();
+    if (lit.isSplat())
+      data = data.take_front();
+    else if (auto sparse = getSparseConstantAttr(dataType, data))
+      return sparse;
+    return mlir::DenseElementsAttr::get(dataType, data);
+  }
+
+  /// Return the literal `data` of type `dataType` as a sparse attribute, which
+  /// only holds the indices and values of its nonzeros, or null if too many of
+  /// its elements are nonzero (see toy::isSparseEnough). A negative zero is
+  /// kept as a nonzero, so that the sparse literal has the same elements.
+  mlir::SparseElementsAttr
+  getSparseConstantAttr(mlir::RankedTensorType dataType,
+                        llvm::ArrayRef<double> data) {
+    auto isNonZero = [](double value) {
+      return value != 0 || std::signbit(value);
+    };
+    int64_t numNonZeros = llvm::count_if(data, isNonZero);
+    if (dataType.getRank() == 0 ||
+        !isSparseEnough(numNonZeros, dataType.getNumElements()))
+      return nullptr;
+
+    // The indices of the nonzeros are delinearized from their position in the
+    // flattened data.
+    llvm::SmallVector<int64_t, 16> indices;
+    llvm::SmallVector<double, 8> values;
+    llvm::SmallVector<int64_t, 2> index(dataType.getRank());
+    for (auto it : llvm::enumerate(data)) {
+      if (!isNonZero(it.value()))
+        continue;
+      int64_t position = it.index();
+      for (int64_t dim = dataType.getRank() - 1; dim >= 0; --dim) {
+        index[dim] = position % dataType.getDimSize(dim);
+        position /= dataType.getDimSize(dim);
+      }
+      indices.append(index.begin(), index.end());
+      values.push_back(it.value());
+    }
+
+    auto indicesType = mlir::RankedTensorType::get(
+        {numNonZeros, dataType.getRank()}, builder.getI64Type());
+    auto valuesType = mlir::RankedTensorType::get({numNonZeros},
+                                                  dataType.getElementType());
+    return mlir::SparseElementsAttr::get(
+        dataType,
+        mlir::DenseElementsAttr::get(indicesType, llvm::makeArrayRef(indices))
+            .cast<mlir::DenseIntElementsAttr>(),
+        mlir::DenseElementsAttr::get(valuesType, llvm::makeArrayRef(values)));
   }
   mlir::DenseElementsAttr getConstantAttr(NumberExprAST &lit) {
     // The type of this attribute is tensor of 64-bit floating-point with no
@@ -425,14 +604,14 @@ private:
     std::vector<mlir::Type> typeElements;
 
     for (auto &var : lit.getValues()) {
-      if (auto *number = llvm::dyn_cast<NumberExprAST>(var.get())) {
+      if (auto *number = llvm::dyn_cast<NumberExprAST>(var)) {
         attrElements.push_back(getConstantAttr(*number));
         typeElements.push_back(getType(llvm::None));
-      } else if (auto *lit = llvm::dyn_cast<LiteralExprAST>(var.get())) {
+      } else if (auto *lit = llvm::dyn_cast<LiteralExprAST>(var)) {
         attrElements.push_back(getConstantAttr(*lit));
         typeElements.push_back(getType(llvm::None));
       } else {
-        auto *structLit = llvm::cast<StructLiteralExprAST>(var.get());
+        auto *structLit = llvm::cast<StructLiteralExprAST>(var);
         auto attrTypePair = getConstantAttr(*structLit);
         attrElements.push_back(attrTypePair.first);
         typeElements.push_back(attrTypePair.second);
@@ -446,7 +625,11 @@ private:
   /// Emit an array literal.
   mlir::Value mlirGen(LiteralExprAST &lit) {
     mlir::Type type = getType(lit.getDims());
-    mlir::DenseElementsAttr dataAttribute = getConstantAttr(lit);
+    mlir::ElementsAttr dataAttribute = getConstantAttr(lit);
+
+    // A sparse literal is a sparse tensor.
+    if (dataAttribute.isa<mlir::SparseElementsAttr>())
+      type = getConstantTensorType(dataAttribute);
 
     // Build the MLIR op `toy.constant`. This invokes the `ConstantOp::build`
     // method.
@@ -466,25 +649,6 @@ private:
     return builder.create<StructConstantOp>(loc(lit.loc()), dataType, dataAttr);
   }
 
-  /// Recursive helper function to accumulate the data that compose an array
-  /// literal. It flattens the nested structure in the supplied vector. For
-  /// example with this array:
-  ///  [[1, 2], [3, 4]]
-  /// we will generate:
-  ///  [ 1, 2, 3, 4 ]
-  /// Individual numbers are represented as doubles.
-  /// Attributes are the way MLIR attaches constant to operations.
-  void collectData(ExprAST &expr, std::vector<double> &data) {
-    if (auto *lit = dyn_cast<LiteralExprAST>(&expr)) {
-      for (auto &value : lit->getValues())
-        collectData(*value, data);
-      return;
-    }
-
-    assert(isa<NumberExprAST>(expr) && "expected literal or number expr");
-    data.push_back(cast<NumberExprAST>(expr).getValue());
-  }
-
   /// Emit a call expression. It emits specific operations for the `transpose`
   /// builtin. Other identifiers are assumed to be user-defined functions.
   mlir::Value mlirGen(CallExprAST &call) {
@@ -520,6 +684,11 @@ private:
       return nullptr;
     }
     mlir::FuncOp calledFunc = calledFuncIt->second;
+    if (calledFunc.getType().getNumResults() != 1) {
+      emitError(location) << "function '" << callee
+                          << "' does not return a value";
+      return nullptr;
+    }
     return builder.create<GenericCallOp>(
         location, calledFunc.getType().getResult(0),
         mlir::SymbolRefAttr::get(builder.getContext(), callee), operands);
@@ -569,6 +738,19 @@ private:
   /// Future expressions will be able to reference this variable through symbol
   /// table lookup.
   mlir::Value mlirGen(VarDeclExprAST &vardecl) {
+    mlir::Value value = mlirGenInitializer(vardecl);
+    if (!value)
+      return nullptr;
+
+    // Register the value in the symbol table.
+    if (failed(declare(vardecl, value)))
+      return nullptr;
+    return value;
+  }
+
+  /// Codegen the initializer of a variable declaration, reshaped or checked
+  /// against the declared type of the variable.
+  mlir::Value mlirGenInitializer(VarDeclExprAST &vardecl) {
     auto *init = vardecl.getInitVal();
     if (!init) {
       emitError(loc(vardecl.loc()),
@@ -603,28 +785,179 @@ private:
       value = builder.create<ReshapeOp>(loc(vardecl.loc()),
                                         getType(varType.shape), value);
     }
-
-    // Register the value in the symbol table.
-    if (failed(declare(vardecl, value)))
-      return nullptr;
     return value;
   }
 
+  /// Emit an assignment: the variable is bound to the new value in the current
+  /// scope. Only the tensor variables can be assigned, the new value is
+  /// reshaped to the declared shape of the variable, if any.
+  mlir::LogicalResult mlirGen(AssignExprAST &assign) {
+    auto location = loc(assign.loc());
+    VarDeclExprAST *vardecl = symbolTable.lookup(assign.getName()).second;
+    if (!vardecl)
+      return emitError(location, "error: unknown variable '")
+             << assign.getName() << "'";
+    if (!vardecl->getType().name.empty())
+      return emitError(location, "error: struct variable '")
+             << assign.getName() << "' cannot be assigned";
+
+    mlir::Value value = mlirGen(*assign.getValue());
+    if (!value)
+      return mlir::failure();
+    if (!value.getType().isa<mlir::TensorType>())
+      return emitError(location, "error: cannot assign a struct to tensor "
+                                 "variable '")
+             << assign.getName() << "'";
+    if (!vardecl->getType().shape.empty())
+      value = builder.create<ReshapeOp>(
+          location, getType(vardecl->getType().shape), value);
+
+    symbolTable.insert(assign.getName(), {value, vardecl});
+    return mlir::success();
+  }
+
+  /// Collect the names of the variables assigned in `blockAST`, including in
+  /// its nested loops.
+  static void collectAssignedVariables(ExprASTList blockAST,
+                                       llvm::SetVector<StringRef> &names) {
+    for (auto *expr : blockAST) {
+      if (auto *assign = dyn_cast<AssignExprAST>(expr))
+        names.insert(assign->getName());
+      else if (auto *loop = dyn_cast<ForExprAST>(expr))
+        collectAssignedVariables(loop->getBody(), names);
+    }
+  }
+
+  /// Return `value` as an unranked tensor, the type of the values carried by
+  /// a loop until the shapes are inferred.
+  mlir::Value castToUnranked(mlir::Value value, mlir::Location location) {
+    if (value.getType().isa<mlir::UnrankedTensorType>())
+      return value;
+    return builder.create<CastOp>(location, getType(llvm::None), value);
+  }
+
+  /// Emit a loop as an `scf.for` operation, whose body is emitted once
+  /// whatever the number of iterations. The tensor variables of the enclosing
+  /// scopes that the body assigns are carried across the iterations, and are
+  /// bound to the results of the loop after it. The variables declared in the
+  /// body are local to an iteration.
+  mlir::LogicalResult mlirGen(ForExprAST &forAST) {
+    auto location = loc(forAST.loc());
+    llvm::SetVector<StringRef> assigned;
+    collectAssignedVariables(forAST.getBody(), assigned);
+
+    // The assignments of the other variables are checked with the body.
+    SmallVector<StringRef, 4> carried;
+    SmallVector<mlir::Value, 4> initValues;
+    for (StringRef name : assigned) {
+      mlir::Value value = symbolTable.lookup(name).first;
+      if (!value || !value.getType().isa<mlir::TensorType>())
+        continue;
+      carried.push_back(name);
+      initValues.push_back(castToUnranked(value, location));
+    }
+
+    auto lowerBound = builder.create<mlir::arith::ConstantIndexOp>(
+        location, forAST.getLowerBound());
+    auto upperBound = builder.create<mlir::arith::ConstantIndexOp>(
+        location, forAST.getUpperBound());
+    auto step = builder.create<mlir::arith::ConstantIndexOp>(location, 1);
+    auto forOp = builder.create<mlir::scf::ForOp>(location, lowerBound,
+                                                  upperBound, step, initValues);
+    {
+      // The body binds the carried variables to the iteration arguments. The
+      // loop has a terminator already only if it carries no value.
+      mlir::OpBuilder::InsertionGuard guard(builder);
+      builder.setInsertionPointToStart(forOp.getBody());
+      SymbolTableScopeT bodyScope(symbolTable);
+      for (auto nameArg : llvm::zip(carried, forOp.getRegionIterArgs())) {
+        StringRef name = std::get<0>(nameArg);
+        symbolTable.insert(
+            name, {std::get<1>(nameArg), symbolTable.lookup(name).second});
+      }
+      if (failed(mlirGenStatements(forAST.getBody())))
+        return mlir::failure();
+
+      if (!carried.empty()) {
+        SmallVector<mlir::Value, 4> yielded;
+        for (StringRef name : carried)
+          yielded.push_back(
+              castToUnranked(symbolTable.lookup(name).first, location));
+        builder.create<mlir::scf::YieldOp>(location, yielded);
+      }
+    }
+
+    for (auto nameResult : llvm::zip(carried, forOp.getResults())) {
+      StringRef name = std::get<0>(nameResult);
+      symbolTable.insert(
+          name, {std::get<1>(nameResult), symbolTable.lookup(name).second});
+    }
+    return mlir::success();
+  }
+
+  /// Emit the body of the function created for a top-level statement of an
+  /// interactive session.
+  mlir::LogicalResult mlirGenStatement(ExprAST &stmt, mlir::FuncOp function) {
+    auto location = loc(stmt.loc());
+    if (isa<ReturnExprAST>(stmt))
+      return emitError(location, "return is only valid within a function");
+    if (isa<AssignExprAST, ForExprAST>(stmt))
+      return emitError(location, "assignments and loops are only valid within "
+                                 "a function");
+    if (auto *print = dyn_cast<PrintExprAST>(&stmt))
+      return mlirGen(*print);
+
+    // A variable declaration returns the value of the variable, so that it
+    // can be passed to the next statements. The value of any other expression
+    // is printed.
+    auto *vardecl = dyn_cast<VarDeclExprAST>(&stmt);
+    mlir::Value value = vardecl ? mlirGenInitializer(*vardecl) : mlirGen(stmt);
+    if (!value)
+      return mlir::failure();
+    if (!value.getType().isa<mlir::TensorType>())
+      return emitError(location, "only tensor values are supported at the top "
+                                 "level of an interactive session");
+    if (!vardecl) {
+      builder.create<PrintOp>(location, value);
+      builder.create<ReturnOp>(location);
+      return mlir::success();
+    }
+    builder.create<ReturnOp>(location, makeArrayRef(value));
+    function.setType(builder.getFunctionType(function.getType().getInputs(),
+                                             value.getType()));
+    return mlir::success();
+  }
+
   /// Codegen a list of expression, return failure if one of them hit an error.
-  mlir::LogicalResult mlirGen(ExprASTList &blockAST) {
+  mlir::LogicalResult mlirGen(ExprASTList blockAST) {
     SymbolTableScopeT varScope(symbolTable);
+    return mlirGenStatements(blockAST);
+  }
+
+  /// Codegen a list of expression in the current scope.
+  mlir::LogicalResult mlirGenStatements(ExprASTList blockAST) {
     for (auto &expr : blockAST) {
-      // Specific handling for variable declarations, return statement, and
-      // print. These can only appear in block list and not in nested
-      // expressions.
-      if (auto *vardecl = dyn_cast<VarDeclExprAST>(expr.get())) {
+      // Specific handling for variable declarations, return statement,
+      // assignments, loops and print. These can only appear in block list and
+      // not in nested expressions.
+      if (auto *vardecl = dyn_cast<VarDeclExprAST>(expr)) {
         if (!mlirGen(*vardecl))
           return mlir::failure();
         continue;
       }
-      if (auto *ret = dyn_cast<ReturnExprAST>(expr.get()))
+      if (auto *ret = dyn_cast<ReturnExprAST>(expr))
         return mlirGen(*ret);
-      if (auto *print = dyn_cast<PrintExprAST>(expr.get())) {
+      if (auto *assign = dyn_cast<AssignExprAST>(expr)) {
+        if (mlir::failed(mlirGen(*assign)))
+          return mlir::failure();
+        continue;
+      }
+      if (auto *loop = dyn_cast<ForExprAST>(expr)) {
+        if (mlir::failed(mlirGen(*loop)))
+          return mlir::failure();
+        continue;
+      }
+      if (auto *print = dyn_cast<PrintExprAST>(expr)) {
         if (mlir::failed(mlirGen(*print)))
           return mlir::success();
         continue;
@@ -668,10 +1001,62 @@ private:
 
 namespace toy {
 
+mlir::Location resolveLocation(mlir::Location loc) {
+  mlir::MLIRContext *context = loc->getContext();
+  if (auto opaqueLoc = loc.dyn_cast<mlir::OpaqueLoc>()) {
+    if (opaqueLoc.getUnderlyingTypeID() != mlir::TypeID::get<Location>())
+      return loc;
+    LineColumn lineColumn = SourceManager::get().resolve(
+        unpackLocation(opaqueLoc.getUnderlyingLocation()));
+    return mlir::FileLineColLoc::get(context, lineColumn.filename,
+                                     lineColumn.line, lineColumn.col);
+  }
+  if (auto nameLoc = loc.dyn_cast<mlir::NameLoc>())
+    return mlir::NameLoc::get(nameLoc.getName(),
+                              resolveLocation(nameLoc.getChildLoc()));
+  if (auto callSiteLoc = loc.dyn_cast<mlir::CallSiteLoc>())
+    return mlir::CallSiteLoc::get(resolveLocation(callSiteLoc.getCallee()),
+                                  resolveLocation(callSiteLoc.getCaller()));
+  if (auto fusedLoc = loc.dyn_cast<mlir::FusedLoc>()) {
+    SmallVector<mlir::Location, 4> locs;
+    for (mlir::Location nested : fusedLoc.getLocations())
+      locs.push_back(resolveLocation(nested));
+    return mlir::FusedLoc::get(context, locs, fusedLoc.getMetadata());
+  }
+  return loc;
+}
+
 // The public API for codegen.
-mlir::OwningModuleRef mlirGen(mlir::MLIRContext &context,
-                              ModuleAST &moduleAST) {
-  return MLIRGenImpl(context).mlirGen(moduleAST);
+mlir::OwningModuleRef mlirGen(mlir::MLIRContext &context, ModuleAST &moduleAST,
+                              llvm::ArrayRef<ImportedModule> imports) {
+  return MLIRGenImpl(context).mlirGen(moduleAST, imports);
+}
+
+/// The state of an interactive session: the generator keeps the symbols of
+/// the definitions, and the module holds their IR.
+class MLIRGenSession::Impl {
+public:
+  Impl(mlir::MLIRContext &context)
+      : generator(context),
+        definitions(mlir::ModuleOp::create(mlir::UnknownLoc::get(&context))) {}
+
+  MLIRGenImpl generator;
+  mlir::OwningModuleRef definitions;
+};
+
+MLIRGenSession::MLIRGenSession(mlir::MLIRContext &context)
+    : impl(std::make_unique<Impl>(context)) {}
+
+MLIRGenSession::~MLIRGenSession() = default;
+
+mlir::LogicalResult MLIRGenSession::addRecord(RecordAST &record) {
+  return impl->generator.mlirGenDefinition(record, *impl->definitions);
+}
+
+mlir::OwningModuleRef
+MLIRGenSession::genStatement(ExprAST &stmt, llvm::StringRef name,
+                             llvm::ArrayRef<Variable> variables) {
+  return impl->generator.mlirGenStatement(stmt, name, variables);
 }
 
 } // namespace toy
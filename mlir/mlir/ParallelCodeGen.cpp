@@ -0,0 +1,126 @@
+//===- ParallelCodeGen.cpp - Parallel LLVM code generation ----------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements the LLVM backend stage of the Toy compiler. Like the
+// parallel code generation of LTO, the module is split with SplitModule and
+// every partition is round-tripped through bitcode into a context of its own,
+// since an LLVMContext can't be used from multiple threads.
+//
+//===----------------------------------------------------------------------===//
+
+#include "toy/ParallelCodeGen.h"
+
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/Twine.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/SmallVectorMemoryBuffer.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Transforms/Utils/SplitModule.h"
+
+#include <algorithm>
+
+using namespace toy;
+
+/// Optimize a module and compile it to an object file in memory.
+static llvm::Expected<std::unique_ptr<llvm::MemoryBuffer>>
+compileModule(llvm::Module &module, llvm::orc::JITTargetMachineBuilder jtmb,
+              const std::function<llvm::Error(llvm::Module *)> &transformer) {
+  auto targetMachine = jtmb.createTargetMachine();
+  if (!targetMachine)
+    return targetMachine.takeError();
+  module.setDataLayout((*targetMachine)->createDataLayout());
+  module.setTargetTriple((*targetMachine)->getTargetTriple().str());
+
+  if (transformer)
+    if (auto err = transformer(&module))
+      return std::move(err);
+
+  llvm::SmallVector<char, 0> object;
+  llvm::raw_svector_ostream os(object);
+  llvm::legacy::PassManager pm;
+  if ((*targetMachine)
+          ->addPassesToEmitFile(pm, os, /*DwoOut=*/nullptr,
+                                llvm::CGFT_ObjectFile))
+    return llvm::make_error<llvm::StringError>(
+        "the target can't emit an object file",
+        llvm::inconvertibleErrorCode());
+  pm.run(module);
+  return std::make_unique<llvm::SmallVectorMemoryBuffer>(
+      std::move(object), module.getModuleIdentifier(),
+      /*RequiresNullTerminator=*/false);
+}
+
+llvm::Expected<std::vector<std::unique_ptr<llvm::MemoryBuffer>>>
+toy::generateObjects(
+    std::unique_ptr<llvm::Module> module,
+    const llvm::orc::JITTargetMachineBuilder &jtmb, unsigned numPartitions,
+    unsigned numThreads,
+    const std::function<llvm::Error(llvm::Module *)> &transformer) {
+  std::vector<std::unique_ptr<llvm::MemoryBuffer>> objects;
+  if (numPartitions <= 1) {
+    auto object = compileModule(*module, jtmb, transformer);
+    if (!object)
+      return object.takeError();
+    objects.push_back(std::move(*object));
+    return std::move(objects);
+  }
+
+  // The partitioning only depends on the module and the number of partitions.
+  std::vector<llvm::SmallString<0>> bitcodes;
+  llvm::SplitModule(*module, numPartitions,
+                    [&](std::unique_ptr<llvm::Module> partition) {
+                      bitcodes.emplace_back();
+                      llvm::raw_svector_ostream os(bitcodes.back());
+                      llvm::WriteBitcodeToFile(*partition, os);
+                    });
+  std::string name = module->getModuleIdentifier();
+  module.reset();
+
+  std::vector<llvm::Optional<
+      llvm::Expected<std::unique_ptr<llvm::MemoryBuffer>>>>
+      results(bitcodes.size());
+  if (!numThreads || numThreads > bitcodes.size())
+    numThreads = bitcodes.size();
+  llvm::ThreadPool pool(llvm::hardware_concurrency(numThreads));
+  for (unsigned i = 0, e = bitcodes.size(); i != e; ++i) {
+    pool.async([&, i] {
+      llvm::LLVMContext context;
+      auto partition = llvm::parseBitcodeFile(
+          llvm::MemoryBufferRef(bitcodes[i],
+                                (name + ".part" + llvm::Twine(i)).str()),
+          context);
+      if (!partition) {
+        results[i].emplace(partition.takeError());
+        return;
+      }
+      results[i].emplace(compileModule(**partition, jtmb, transformer));
+    });
+  }
+  pool.wait();
+
+  // Report the errors in the order of the partitions.
+  llvm::Error error = llvm::Error::success();
+  for (auto &result : results) {
+    if (*result)
+      objects.push_back(std::move(**result));
+    else
+      error = llvm::joinErrors(std::move(error), result->takeError());
+  }
+  if (error)
+    return std::move(error);
+  return std::move(objects);
+}
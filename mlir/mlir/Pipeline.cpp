@@ -0,0 +1,116 @@
+//===- Pipeline.cpp - The Toy compilation pipeline ------------------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements the pass pipeline that compiles the Toy dialect down to
+// the LLVM dialect, shared by the compiler driver and the embedding API.
+//
+//===----------------------------------------------------------------------===//
+
+#include "toy/Passes.h"
+
+#include "mlir/Dialect/Affine/Passes.h"
+#include "mlir/Dialect/Linalg/Passes.h"
+#include "mlir/IR/BuiltinOps.h"
+#include "mlir/Pass/PassManager.h"
+#include "mlir/Transforms/Passes.h"
+
+void mlir::toy::buildToyPipeline(OpPassManager &pm,
+                                 const ToyPipelineOptions &options) {
+  bool enableOpt = options.enableOpt;
+  bool isLoweringToAffine = options.isLoweringToAffine;
+  bool isLoweringToLinalg =
+      isLoweringToAffine && options.loweringPath == LoweringPath::Linalg;
+
+  if ((enableOpt || isLoweringToAffine) && !options.skipShapeInference) {
+    // Inline all functions into main when lowering through linalg, so that
+    // the structured operations fuse across calls. Otherwise the generic
+    // functions are specialized, and the functions are compiled in parallel.
+    // When optimizing, the small leaf functions are still inlined so that
+    // their loops fuse with those of their callers.
+    if (isLoweringToLinalg)
+      pm.addPass(mlir::createInlinerPass());
+    pm.addPass(mlir::toy::createSpecializeFunctionsPass());
+    if (enableOpt && !isLoweringToLinalg)
+      pm.addPass(mlir::toy::createInlineLeafFunctionsPass());
+
+    // Now that every function has a shaped signature, we can infer the shapes
+    // of each of the operations.
+    mlir::OpPassManager &optPM = pm.nest<mlir::FuncOp>();
+    optPM.addPass(mlir::createCanonicalizerPass());
+    optPM.addPass(mlir::toy::createShapeInferencePass());
+    optPM.addPass(mlir::createCanonicalizerPass());
+    if (options.fastMath)
+      optPM.addPass(mlir::toy::createFastMathCombinePass());
+    optPM.addPass(mlir::createCSEPass());
+
+    if (options.printCostReport)
+      pm.addPass(mlir::toy::createPrintCostReportPass("Toy"));
+  }
+  if (options.stopAfterShapeInference)
+    return;
+
+  if (isLoweringToLinalg) {
+    // Partially lower the toy dialect to structured operations on tensors and
+    // merge the elementwise operations with their producers. The operations
+    // left are tiled, with the producers of each tile fused into its loops.
+    mlir::OpPassManager &linalgPM = pm.nest<mlir::FuncOp>();
+    linalgPM.addPass(mlir::toy::createLowerToLinalgPass());
+    linalgPM.addPass(mlir::createLinalgElementwiseOpFusionPass());
+    linalgPM.addPass(mlir::createCanonicalizerPass());
+    linalgPM.addPass(mlir::toy::createLinalgTileAndFusePass(options.tileSizes));
+    linalgPM.addPass(mlir::createCanonicalizerPass());
+
+    // Bufferize the whole module at once, the in-place analysis reuses the
+    // buffers of the tensors that are no longer read.
+    pm.addPass(mlir::createLinalgComprehensiveModuleBufferizePass());
+  }
+
+  if (isLoweringToAffine) {
+    mlir::OpPassManager &optPM = pm.nest<mlir::FuncOp>();
+
+    // Partially lower the toy dialect, or the bufferized structured
+    // operations, with a few cleanups afterwards.
+    if (isLoweringToLinalg) {
+      optPM.addPass(mlir::createConvertLinalgToAffineLoopsPass());
+    } else {
+      // When optimizing, choose the layouts of the matrices that elide the
+      // most transposes.
+      if (enableOpt)
+        optPM.addPass(mlir::toy::createLayoutPropagationPass());
+      optPM.addPass(mlir::toy::createLowerToAffinePass(options.profile));
+    }
+    optPM.addPass(mlir::createCanonicalizerPass());
+    optPM.addPass(mlir::createCSEPass());
+
+    // Add optimizations if enabled.
+    if (enableOpt) {
+      optPM.addPass(mlir::createLoopFusionPass());
+      optPM.addPass(mlir::createAffineScalarReplacementPass());
+      if (options.emitRemarks)
+        optPM.addPass(mlir::toy::createLoopRemarksPass());
+    }
+
+    // Instrument the final loops and buffers.
+    if (options.trackAllocations)
+      optPM.addPass(mlir::toy::createTrackAllocationsPass());
+
+    if (options.printCostReport)
+      pm.addPass(mlir::toy::createPrintCostReportPass("affine"));
+
+    // Tile, vectorize and unroll the nests tuned for the host, last so that
+    // the analyses above see the loops as lowered.
+    if (options.tuningDatabase)
+      pm.nest<mlir::FuncOp>().addPass(
+          mlir::toy::createApplyTuningPass(*options.tuningDatabase));
+  }
+
+  if (options.isLoweringToLLVM) {
+    // Finish lowering the toy IR to the LLVM dialect.
+    pm.addPass(mlir::toy::createLowerToLLVMPass());
+  }
+}
@@ -0,0 +1,82 @@
+//===- PrintCostReport.cpp - Roofline report of the Toy functions ---------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements a Module level pass printing the estimated cost of each
+// function, and its placement on the roofline of the host (see
+// toy/CostModel.h). It runs on the Toy IR once the shapes are inferred, and on
+// the affine IR once lowered.
+//
+//===----------------------------------------------------------------------===//
+
+#include "toy/CostModel.h"
+#include "toy/Passes.h"
+
+#include "mlir/IR/BuiltinOps.h"
+#include "mlir/Pass/Pass.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace mlir;
+
+/// Print the cost and the predicted time of the given function or total.
+static void printCostLine(llvm::raw_ostream &os,
+                          const toy::MachineModel &machine,
+                          const toy::Cost &cost, StringRef name) {
+  os << llvm::format("  %12lld %14lld %8.3f %14.4f  %-7s  ",
+                     static_cast<long long>(cost.flops),
+                     static_cast<long long>(cost.bytes), cost.getIntensity(),
+                     machine.predictSeconds(cost) * 1e3,
+                     machine.isComputeBound(cost) ? "compute" : "memory")
+     << name << "\n";
+}
+
+namespace {
+/// The PrintCostReportPass is a ModulePass printing the roofline report of the
+/// functions of the module, in order.
+struct PrintCostReportPass
+    : public PassWrapper<PrintCostReportPass, OperationPass<ModuleOp>> {
+  PrintCostReportPass(std::string level) : level(std::move(level)) {}
+
+  void runOnOperation() final {
+    const toy::MachineModel &machine = toy::getHostMachineModel();
+    llvm::raw_ostream &os = llvm::errs();
+
+    std::string title = "Toy Roofline Report (" + level + " IR)";
+    os << "===" << std::string(73, '-') << "===\n"
+       << std::string((79 - title.size()) / 2, ' ') << title << "\n"
+       << "===" << std::string(73, '-') << "===\n"
+       << llvm::format("  Peak: %.2f GFLOP/s, bandwidth: %.2f GB/s, ridge "
+                       "point: %.3f FLOP/byte\n\n",
+                       machine.flopsPerSecond * 1e-9,
+                       machine.bytesPerSecond * 1e-9, machine.getRidgePoint())
+       << "         FLOPs          Bytes   FLOP/B Predicted (ms)  Bound    "
+          "Function\n";
+
+    // The cost of a function doesn't include the functions it calls.
+    toy::Cost total;
+    for (FuncOp function : getOperation().getOps<FuncOp>()) {
+      if (function.isDeclaration())
+        continue;
+      toy::Cost cost = toy::estimateCost(function);
+      printCostLine(os, machine, cost, function.getName());
+      total += cost;
+    }
+    printCostLine(os, machine, total, "Total");
+    markAllAnalysesPreserved();
+  }
+
+  std::string level;
+};
+} // namespace
+
+/// Create a pass printing the estimated cost of each function on the roofline
+/// of the host.
+std::unique_ptr<Pass>
+mlir::toy::createPrintCostReportPass(std::string level) {
+  return std::make_unique<PrintCostReportPass>(std::move(level));
+}
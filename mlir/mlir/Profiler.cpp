@@ -0,0 +1,235 @@
+//===- Profiler.cpp - Per-operation profiling of Toy programs -------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements the profiler of the Toy programs, and the runtime
+// functions called by the probes.
+//
+//===----------------------------------------------------------------------===//
+
+#include "toy/Profiler.h"
+
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <chrono>
+#include <map>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <x86intrin.h>
+#define TOY_HAS_RDTSC 1
+#endif
+
+using namespace toy;
+
+/// The maximum number of runs kept for the trace by each thread, about 24MB
+/// of events.
+static constexpr size_t maxEvents = 1 << 20;
+
+static uint64_t getSteadyNanoseconds() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+uint64_t Profiler::readTimestamp() {
+#ifdef TOY_HAS_RDTSC
+  return __rdtsc();
+#else
+  return getSteadyNanoseconds();
+#endif
+}
+
+Profiler::Profiler() { reset(); }
+
+Profiler &Profiler::get() {
+  static Profiler profiler;
+  return profiler;
+}
+
+void Profiler::reset() {
+  std::lock_guard<std::mutex> lock(mutex);
+  // The threads keep their buffers, which are only emptied.
+  for (std::unique_ptr<ThreadBuffer> &buffer : buffers) {
+    buffer->siteKeys.clear();
+    buffer->siteCallsAndTicks.clear();
+    buffer->siteIds.clear();
+    buffer->events.clear();
+    buffer->droppedEvents = 0;
+  }
+  startTimestamp = readTimestamp();
+  startNanoseconds = getSteadyNanoseconds();
+}
+
+Profiler::ThreadBuffer &Profiler::getThreadBuffer() {
+  // The buffers outlive their threads, e.g. those of a thread pool, until the
+  // profile is reported.
+  thread_local ThreadBuffer *threadBuffer = nullptr;
+  if (!threadBuffer) {
+    std::lock_guard<std::mutex> lock(mutex);
+    buffers.push_back(std::make_unique<ThreadBuffer>());
+    threadBuffer = buffers.back().get();
+    threadBuffer->thread = llvm::get_threadid();
+  }
+  return *threadBuffer;
+}
+
+void Profiler::record(const char *opName, const char *location,
+                      int64_t bytes, uint64_t start, uint64_t end) {
+  ThreadBuffer &buffer = getThreadBuffer();
+  ThreadBuffer::SiteKey key(opName, location, bytes);
+  auto it = buffer.siteIds.try_emplace(key, buffer.siteKeys.size());
+  if (it.second) {
+    buffer.siteKeys.push_back(key);
+    buffer.siteCallsAndTicks.emplace_back(0, 0);
+  }
+  unsigned site = it.first->second;
+  buffer.siteCallsAndTicks[site].first++;
+  buffer.siteCallsAndTicks[site].second += end - start;
+  if (buffer.events.size() == maxEvents) {
+    buffer.droppedEvents++;
+    return;
+  }
+  buffer.events.push_back({site, start, end});
+}
+
+void Profiler::mergeSites(std::vector<Site> &sites,
+                          std::vector<std::vector<unsigned>> &siteIds) {
+  // The same strings may have different addresses, e.g. in different
+  // compiled modules, so the sites are merged by their contents.
+  std::map<std::tuple<llvm::StringRef, llvm::StringRef, int64_t>, unsigned>
+      mergedIds;
+  siteIds.assign(buffers.size(), {});
+  for (unsigned i = 0, e = buffers.size(); i != e; ++i) {
+    const ThreadBuffer &buffer = *buffers[i];
+    for (unsigned site = 0, numSites = buffer.siteKeys.size();
+         site != numSites; ++site) {
+      const char *opName, *location;
+      int64_t bytes;
+      std::tie(opName, location, bytes) = buffer.siteKeys[site];
+      auto it = mergedIds.try_emplace(
+          std::make_tuple(llvm::StringRef(opName), llvm::StringRef(location),
+                          bytes),
+          sites.size());
+      if (it.second)
+        sites.push_back({opName, location, bytes});
+      Site &merged = sites[it.first->second];
+      merged.calls += buffer.siteCallsAndTicks[site].first;
+      merged.ticks += buffer.siteCallsAndTicks[site].second;
+      siteIds[i].push_back(it.first->second);
+    }
+  }
+}
+
+double Profiler::getNanosecondsPerTick() {
+#ifdef TOY_HAS_RDTSC
+  // The frequency of the counter is constant on the processors we target, it
+  // is calibrated against the steady clock over the whole run.
+  uint64_t ticks = readTimestamp() - startTimestamp;
+  uint64_t nanoseconds = getSteadyNanoseconds() - startNanoseconds;
+  return ticks ? static_cast<double>(nanoseconds) / ticks : 1.0;
+#else
+  return 1.0;
+#endif
+}
+
+void Profiler::printReport(llvm::raw_ostream &os) {
+  double nsPerTick = getNanosecondsPerTick();
+  std::lock_guard<std::mutex> lock(mutex);
+  std::vector<Site> sites;
+  std::vector<std::vector<unsigned>> siteIds;
+  mergeSites(sites, siteIds);
+  uint64_t droppedEvents = 0;
+  for (const std::unique_ptr<ThreadBuffer> &buffer : buffers)
+    droppedEvents += buffer->droppedEvents;
+
+  std::vector<const Site *> ranSites;
+  uint64_t totalTicks = 0;
+  for (const Site &site : sites) {
+    if (!site.calls)
+      continue;
+    ranSites.push_back(&site);
+    totalTicks += site.ticks;
+  }
+  llvm::stable_sort(ranSites, [](const Site *lhs, const Site *rhs) {
+    return lhs->ticks > rhs->ticks;
+  });
+
+  double totalNs = totalTicks * nsPerTick;
+  os << "===" << std::string(73, '-') << "===\n"
+     << "                          Toy Operation Profile\n"
+     << "===" << std::string(73, '-') << "===\n"
+     << llvm::format("  Total Execution Time: %.4f ms\n\n", totalNs * 1e-6)
+     << "   ---Time (ms)---    Calls      Bytes     GB/s  Operation         "
+        "Location\n";
+  for (const Site *site : ranSites) {
+    double ns = site->ticks * nsPerTick;
+    double bytes = static_cast<double>(site->bytes) * site->calls;
+    os << llvm::format("  %10.4f (%5.1f%%) %8llu %10.0f %8.2f  ", ns * 1e-6,
+                       totalNs ? 100.0 * ns / totalNs : 0.0,
+                       static_cast<unsigned long long>(site->calls), bytes,
+                       ns ? bytes / ns : 0.0)
+       << llvm::left_justify(site->opName, 16) << "  " << site->location
+       << "\n";
+  }
+  if (droppedEvents)
+    os << "  (" << droppedEvents << " runs were left out of the trace)\n";
+}
+
+void Profiler::writeChromeTrace(llvm::raw_ostream &os) {
+  double nsPerTick = getNanosecondsPerTick();
+  std::lock_guard<std::mutex> lock(mutex);
+  std::vector<Site> sites;
+  std::vector<std::vector<unsigned>> siteIds;
+  mergeSites(sites, siteIds);
+
+  // The timestamps of the trace are in microseconds since the last reset.
+  llvm::json::OStream json(os);
+  auto writeEvent = [&](const Event &event, const Site &site,
+                        uint64_t thread) {
+    json.object([&] {
+      json.attribute("name", site.opName);
+      json.attribute("cat", "toy");
+      json.attribute("ph", "X");
+      json.attribute("ts", (event.start - startTimestamp) * nsPerTick * 1e-3);
+      json.attribute("dur", (event.end - event.start) * nsPerTick * 1e-3);
+      json.attribute("pid", 0);
+      json.attribute("tid", static_cast<int64_t>(thread));
+      json.attributeObject("args", [&] {
+        json.attribute("location", site.location);
+        json.attribute("bytes", site.bytes);
+      });
+    });
+  };
+  json.object([&] {
+    json.attributeArray("traceEvents", [&] {
+      for (unsigned i = 0, e = buffers.size(); i != e; ++i)
+        for (const Event &event : buffers[i]->events)
+          writeEvent(event, sites[siteIds[i][event.site]], buffers[i]->thread);
+    });
+    json.attribute("displayTimeUnit", "ns");
+  });
+}
+
+/// Start the measurement of a site, called by the `toy.profile_begin` probes.
+static uint64_t profileBegin() { return Profiler::readTimestamp(); }
+
+/// End the measurement of a site, called by the `toy.profile_end` probes.
+static void profileEnd(uint64_t start, const char *opName,
+                       const char *location, int64_t bytes) {
+  uint64_t end = Profiler::readTimestamp();
+  Profiler::get().record(opName, location, bytes, start, end);
+}
+
+std::vector<std::pair<llvm::StringRef, void *>>
+toy::getProfilerRuntimeSymbols() {
+  return {{"toy_profile_begin", reinterpret_cast<void *>(&profileBegin)},
+          {"toy_profile_end", reinterpret_cast<void *>(&profileEnd)}};
+}
@@ -0,0 +1,175 @@
+//===- Remarks.cpp - Optimization remarks of the Toy compiler -------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements the stream of the optimization remarks, and the
+// forwarding of the remarks of the LLVM passes to it.
+//
+//===----------------------------------------------------------------------===//
+
+#include "toy/Remarks.h"
+#include "toy/MLIRGen.h"
+
+#include "mlir/IR/BuiltinOps.h"
+#include "mlir/IR/Location.h"
+#include "llvm/IR/DiagnosticHandler.h"
+#include "llvm/IR/DiagnosticInfo.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/Remarks/Remark.h"
+#include "llvm/Remarks/RemarkSerializer.h"
+
+#include <atomic>
+#include <mutex>
+
+using namespace mlir;
+
+namespace {
+/// The remark stream of the process.
+struct RemarkStream {
+  std::mutex mutex;
+  std::unique_ptr<llvm::remarks::RemarkSerializer> serializer;
+  std::atomic<bool> enabled{false};
+};
+} // namespace
+
+static RemarkStream &getRemarkStream() {
+  static RemarkStream stream;
+  return stream;
+}
+
+void mlir::toy::setRemarkStream(llvm::raw_ostream *os) {
+  RemarkStream &stream = getRemarkStream();
+  std::lock_guard<std::mutex> lock(stream.mutex);
+  stream.serializer.reset();
+  if (os)
+    stream.serializer = llvm::cantFail(llvm::remarks::createRemarkSerializer(
+        llvm::remarks::Format::YAML, llvm::remarks::SerializerMode::Separate,
+        *os));
+  stream.enabled = os != nullptr;
+}
+
+bool mlir::toy::areRemarksEnabled() { return getRemarkStream().enabled; }
+
+/// Write `remark` to the remark stream.
+static void emitRemark(const llvm::remarks::Remark &remark) {
+  RemarkStream &stream = getRemarkStream();
+  std::lock_guard<std::mutex> lock(stream.mutex);
+  if (stream.serializer)
+    stream.serializer->emit(remark);
+}
+
+static llvm::remarks::Type getRemarkType(toy::RemarkKind kind) {
+  switch (kind) {
+  case toy::RemarkKind::Passed:
+    return llvm::remarks::Type::Passed;
+  case toy::RemarkKind::Missed:
+    return llvm::remarks::Type::Missed;
+  case toy::RemarkKind::Analysis:
+    return llvm::remarks::Type::Analysis;
+  }
+  llvm_unreachable("unknown remark kind");
+}
+
+void mlir::toy::emitOptimizationRemark(RemarkKind kind, StringRef passName,
+                                       StringRef remarkName, Location loc,
+                                       StringRef functionName,
+                                       const Twine &message) {
+  if (!areRemarksEnabled())
+    return;
+
+  llvm::remarks::Remark remark;
+  remark.RemarkType = getRemarkType(kind);
+  remark.PassName = passName;
+  remark.RemarkName = remarkName;
+  remark.FunctionName = functionName;
+
+  // The first file location of a fused or named location is the one in the
+  // source.
+  ::toy::resolveLocation(loc)->walk([&](Location nested) {
+    auto fileLoc = nested.dyn_cast<FileLineColLoc>();
+    if (!fileLoc)
+      return WalkResult::advance();
+    remark.Loc = llvm::remarks::RemarkLocation{
+        fileLoc.getFilename().getValue(), fileLoc.getLine(),
+        fileLoc.getColumn()};
+    return WalkResult::interrupt();
+  });
+
+  std::string text = message.str();
+  remark.Args.push_back({"String", text});
+  emitRemark(remark);
+}
+
+void mlir::toy::emitOptimizationRemark(RemarkKind kind, StringRef passName,
+                                       StringRef remarkName, Operation *op,
+                                       const Twine &message) {
+  if (!areRemarksEnabled())
+    return;
+  auto function = dyn_cast<FuncOp>(op);
+  if (!function)
+    function = op->getParentOfType<FuncOp>();
+  emitOptimizationRemark(kind, passName, remarkName, op->getLoc(),
+                         function ? function.getName() : StringRef(),
+                         message);
+}
+
+namespace {
+/// A diagnostic handler enabling the remarks of every LLVM pass, and writing
+/// them to the remark stream. The other diagnostics are left to the default
+/// handling.
+struct LLVMRemarkForwarder : public llvm::DiagnosticHandler {
+  bool handleDiagnostics(const llvm::DiagnosticInfo &info) override {
+    auto *optRemark = dyn_cast<llvm::DiagnosticInfoOptimizationBase>(&info);
+    if (!optRemark)
+      return false;
+
+    llvm::remarks::Remark remark;
+    if (optRemark->isPassed())
+      remark.RemarkType = llvm::remarks::Type::Passed;
+    else if (optRemark->isMissed())
+      remark.RemarkType = llvm::remarks::Type::Missed;
+    else if (optRemark->isAnalysis())
+      remark.RemarkType = llvm::remarks::Type::Analysis;
+    else
+      remark.RemarkType = llvm::remarks::Type::Failure;
+    remark.PassName = optRemark->getPassName();
+    remark.RemarkName = optRemark->getRemarkName();
+    remark.FunctionName = llvm::GlobalValue::dropLLVMManglingEscape(
+        optRemark->getFunction().getName());
+
+    std::string path;
+    if (optRemark->isLocationAvailable()) {
+      llvm::DiagnosticLocation loc = optRemark->getLocation();
+      path = loc.getRelativePath().str();
+      remark.Loc = llvm::remarks::RemarkLocation{path, loc.getLine(),
+                                                 loc.getColumn()};
+    }
+    for (const llvm::DiagnosticInfoOptimizationBase::Argument &arg :
+         optRemark->getArgs())
+      remark.Args.push_back({arg.Key, arg.Val});
+    emitRemark(remark);
+    return true;
+  }
+
+  bool isAnalysisRemarkEnabled(StringRef passName) const override {
+    return true;
+  }
+  bool isMissedOptRemarkEnabled(StringRef passName) const override {
+    return true;
+  }
+  bool isPassedOptRemarkEnabled(StringRef passName) const override {
+    return true;
+  }
+  bool isAnyRemarkEnabled() const override { return true; }
+};
+} // namespace
+
+void mlir::toy::forwardLLVMRemarks(llvm::LLVMContext &context) {
+  if (areRemarksEnabled())
+    context.setDiagnosticHandler(std::make_unique<LLVMRemarkForwarder>());
+}
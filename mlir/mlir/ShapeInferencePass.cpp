@@ -11,6 +11,7 @@
 //
 //===----------------------------------------------------------------------===//
 
+#include "mlir/Dialect/SCF/SCF.h"
 #include "mlir/Pass/Pass.h"
 #include "toy/Dialect.h"
 #include "toy/Passes.h"
@@ -19,6 +20,8 @@
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/raw_ostream.h"
 
+#include <atomic>
+
 #define DEBUG_TYPE "shape-inference"
 
 using namespace mlir;
@@ -27,82 +30,160 @@ using namespace toy;
 /// Include the auto-generated definitions for the shape inference interfaces.
 #include "toy/ShapeInferenceOpInterfaces.cpp.inc"
 
-namespace {
-/// The ShapeInferencePass is a FunctionPass that performs intra-procedural
-/// shape inference.
+/// The number of operations inferred, incremented concurrently by the passes
+/// running on different functions.
+static std::atomic<uint64_t> numInferredShapes{0};
+
+uint64_t mlir::toy::getNumInferredShapes() { return numInferredShapes; }
+
+bool mlir::toy::hasInferredShape(Type type) {
+  if (auto structType = type.dyn_cast<StructType>())
+    return llvm::all_of(structType.getElementTypes(), hasInferredShape);
+  return type.isa<RankedTensorType>();
+}
+
+/// Return whether the shape of a value of type `type` is known or irrelevant:
+/// the values other than tensors and structs, like the bounds of the loops,
+/// have no shape to infer.
+static bool isInferred(Type type) {
+  return !type.isa<TensorType, StructType>() || hasInferredShape(type);
+}
+
+/// A utility method that returns if the given operation has all of its
+/// operands inferred.
+static bool allOperandsInferred(Operation *op) {
+  return llvm::all_of(op->getOperandTypes(), isInferred);
+}
+
+/// A utility method that returns if the given operation has a dynamically
+/// shaped result.
+static bool returnsDynamicShape(Operation *op) {
+  return !llvm::all_of(op->getResultTypes(), isInferred);
+}
+
+/// Infer the types of the values carried by `forOp` from their initial values:
+/// a carried value keeps its type across the iterations, which is checked once
+/// the body is inferred.
+static void inferLoopShapes(scf::ForOp forOp) {
+  for (auto it : llvm::zip(forOp.getIterOperands(), forOp.getRegionIterArgs(),
+                           forOp.getResults())) {
+    Type type = std::get<0>(it).getType();
+    std::get<1>(it).setType(type);
+    std::get<2>(it).setType(type);
+  }
+}
+
+/// Check that the values yielded by the body of `forOp` have the types of the
+/// values it carries. A value that only differs by its sparse encoding is cast.
+static LogicalResult verifyLoopShapes(scf::ForOp forOp) {
+  Operation *yield = forOp.getBody()->getTerminator();
+  OpBuilder builder(yield);
+  for (auto it : llvm::zip(yield->getOpOperands(), forOp.getRegionIterArgs())) {
+    OpOperand &operand = std::get<0>(it);
+    Type type = std::get<1>(it).getType();
+    if (operand.get().getType() == type)
+      continue;
+    if (!CastOp::areCastCompatible(operand.get().getType(), type))
+      return yield->emitError("the shape of a loop-carried variable changes "
+                              "across iterations");
+    operand.set(builder.create<CastOp>(yield->getLoc(), type, operand.get()));
+  }
+  return success();
+}
+
+/// Infer the shapes of the operations of a function with an intra-procedural
+/// worklist algorithm.
 ///
 ///    Algorithm:
 ///
 ///   1) Build a worklist containing all the operations that return a
-///      dynamically shaped tensor: these are the operations that need shape
-///      inference.
+///      dynamically shaped tensor, or a struct of such tensors: these are the
+///      operations that need shape inference.
 ///   2) Iterate on the worklist:
 ///     a) find an operation to process: the next ready operation in the
 ///        worklist has all of its arguments non-generic,
 ///     b) if no operation is found, break out of the loop,
 ///     c) remove the operation from the worklist,
-///     d) infer the shape of its output from the argument types.
-///   3) If the worklist is empty, the algorithm succeeded.
+///     d) infer the shape of its output from the argument types. A loop
+///        infers the types of the values it carries from their initial
+///        values, which makes the operations of its body ready.
+///   3) If the worklist is empty, the algorithm succeeded once the types
+///      yielded by the loops are checked.
 ///
-class ShapeInferencePass
-    : public mlir::PassWrapper<ShapeInferencePass, FunctionPass> {
-public:
-  void runOnFunction() override {
-    auto f = getFunction();
-
-    // Populate the worklist with the operations that need shape inference:
-    // these are operations that return a dynamic shape.
-    llvm::SmallPtrSet<mlir::Operation *, 16> opWorklist;
-    f.walk([&](mlir::Operation *op) {
-      if (returnsDynamicShape(op))
-        opWorklist.insert(op);
-    });
-
-    // Iterate on the operations in the worklist until all operations have been
-    // inferred or no change happened (fix point).
-    while (!opWorklist.empty()) {
-      // Find the next operation ready for inference, that is an operation
-      // with all operands already resolved (non-generic).
-      auto nextop = llvm::find_if(opWorklist, allOperandsInferred);
-      if (nextop == opWorklist.end())
-        break;
-
-      Operation *op = *nextop;
-      opWorklist.erase(op);
-
-      // Ask the operation to infer its output shapes.
-      LLVM_DEBUG(llvm::dbgs() << "Inferring shape for: " << *op << "\n");
-      if (auto shapeOp = dyn_cast<ShapeInference>(op)) {
-        shapeOp.inferShapes();
-      } else {
-        op->emitError("unable to infer shape of operation without shape "
-                      "inference interface");
-        return signalPassFailure();
-      }
-    }
+LogicalResult
+mlir::toy::inferShapes(FuncOp f,
+                       function_ref<LogicalResult(GenericCallOp)> inferCall) {
+  // Populate the worklist with the operations that need shape inference:
+  // these are operations that return a dynamic shape.
+  llvm::SmallPtrSet<mlir::Operation *, 16> opWorklist;
+  f.walk([&](mlir::Operation *op) {
+    if (returnsDynamicShape(op))
+      opWorklist.insert(op);
+  });
 
-    // If the operation worklist isn't empty, this indicates a failure.
-    if (!opWorklist.empty()) {
-      f.emitError("Shape inference failed, ")
-          << opWorklist.size() << " operations couldn't be inferred\n";
-      signalPassFailure();
+  // Iterate on the operations in the worklist until all operations have been
+  // inferred or no change happened (fix point).
+  uint64_t numInferred = 0;
+  while (!opWorklist.empty()) {
+    // Find the next operation ready for inference, that is an operation
+    // with all operands already resolved (non-generic).
+    auto nextop = llvm::find_if(opWorklist, allOperandsInferred);
+    if (nextop == opWorklist.end())
+      break;
+
+    Operation *op = *nextop;
+    opWorklist.erase(op);
+
+    // Ask the operation to infer its output shapes.
+    LLVM_DEBUG(llvm::dbgs() << "Inferring shape for: " << *op << "\n");
+    if (auto shapeOp = dyn_cast<ShapeInference>(op)) {
+      shapeOp.inferShapes();
+    } else if (auto forOp = dyn_cast<scf::ForOp>(op)) {
+      inferLoopShapes(forOp);
+    } else if (auto call = dyn_cast<GenericCallOp>(op)) {
+      if (!inferCall)
+        return call.emitError("unable to infer the shape of a call to a "
+                              "generic function");
+      if (failed(inferCall(call)))
+        return failure();
+    } else {
+      return op->emitError("unable to infer shape of operation without "
+                           "shape inference interface");
     }
+    ++numInferred;
   }
+  numInferredShapes += numInferred;
 
-  /// A utility method that returns if the given operation has all of its
-  /// operands inferred.
-  static bool allOperandsInferred(Operation *op) {
-    return llvm::all_of(op->getOperandTypes(), [](Type operandType) {
-      return operandType.isa<RankedTensorType>();
-    });
-  }
+  // If the operation worklist isn't empty, this indicates a failure.
+  if (!opWorklist.empty())
+    return f.emitError("Shape inference failed, ")
+           << opWorklist.size() << " operations couldn't be inferred\n";
+
+  WalkResult loopsResult = f.walk([](scf::ForOp forOp) {
+    return failed(verifyLoopShapes(forOp)) ? WalkResult::interrupt()
+                                           : WalkResult::advance();
+  });
+  if (loopsResult.wasInterrupted())
+    return failure();
 
-  /// A utility method that returns if the given operation has a dynamically
-  /// shaped result.
-  static bool returnsDynamicShape(Operation *op) {
-    return llvm::any_of(op->getResultTypes(), [](Type resultType) {
-      return !resultType.isa<RankedTensorType>();
-    });
+  // Refine the result types of the function to the inferred types of the
+  // values it returns, so that it can be lowered without being inlined.
+  f.walk([&](toy::ReturnOp returnOp) {
+    f.setType(FunctionType::get(f.getContext(), f.getType().getInputs(),
+                                returnOp.getOperandTypes()));
+  });
+  return success();
+}
+
+namespace {
+/// The ShapeInferencePass is a FunctionPass that performs intra-procedural
+/// shape inference.
+class ShapeInferencePass
+    : public mlir::PassWrapper<ShapeInferencePass, FunctionPass> {
+public:
+  void runOnFunction() override {
+    if (failed(inferShapes(getFunction())))
+      signalPassFailure();
   }
 };
 } // namespace
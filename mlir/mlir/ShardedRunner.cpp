@@ -0,0 +1,383 @@
+//===- ShardedRunner.cpp - Run a Toy kernel in worker processes -----------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements the sharded runner of the Toy kernels.
+//
+//===----------------------------------------------------------------------===//
+
+#include "toy/ShardedRunner.h"
+
+#include "llvm/ADT/ScopeExit.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Twine.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#ifdef LLVM_ON_UNIX
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+using namespace toy;
+
+//===----------------------------------------------------------------------===//
+// NUMA topology
+//===----------------------------------------------------------------------===//
+
+/// Parse a list of the kernel such as "0-3,8-11", as in the CPU and node lists
+/// of sysfs.
+static std::vector<unsigned> parseList(llvm::StringRef list) {
+  std::vector<unsigned> values;
+  llvm::SmallVector<llvm::StringRef, 8> ranges;
+  list.trim().split(ranges, ',', /*MaxSplit=*/-1, /*KeepEmpty=*/false);
+  for (llvm::StringRef range : ranges) {
+    auto bounds = range.split('-');
+    unsigned first, last;
+    if (bounds.first.getAsInteger(10, first))
+      continue;
+    if (bounds.second.empty())
+      last = first;
+    else if (bounds.second.getAsInteger(10, last))
+      continue;
+    for (unsigned value = first; value <= last; ++value)
+      values.push_back(value);
+  }
+  return values;
+}
+
+/// Read the first line of the file `filename`, or an empty string.
+static std::string readLine(const std::string &filename) {
+  std::ifstream file(filename);
+  std::string line;
+  std::getline(file, line);
+  return line;
+}
+
+/// Return the CPUs of each online NUMA node of the host, or nothing if the
+/// host doesn't expose its topology.
+static std::vector<std::vector<unsigned>> getNumaNodes() {
+  std::vector<std::vector<unsigned>> nodes;
+#ifdef __linux__
+  const std::string nodeDir = "/sys/devices/system/node/";
+  for (unsigned node : parseList(readLine(nodeDir + "online"))) {
+    std::vector<unsigned> cpus = parseList(
+        readLine(nodeDir + "node" + std::to_string(node) + "/cpulist"));
+    // A node of memory only has no CPU to run a worker on.
+    if (!cpus.empty())
+      nodes.push_back(std::move(cpus));
+  }
+#endif
+  return nodes;
+}
+
+/// Pin the calling process to the CPUs `cpus`. The pages it touches first are
+/// then allocated on their node.
+static void pinToCpus(llvm::ArrayRef<unsigned> cpus) {
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (unsigned cpu : cpus)
+    if (cpu < CPU_SETSIZE)
+      CPU_SET(cpu, &set);
+  // The worker still computes its shard unpinned if the host refuses.
+  sched_setaffinity(/*pid=*/0, sizeof(set), &set);
+#endif
+}
+
+//===----------------------------------------------------------------------===//
+// Shared memory
+//===----------------------------------------------------------------------===//
+
+namespace {
+/// A segment of POSIX shared memory, mapped by the parent before the workers
+/// are forked, so that they all map it at the same address. The parent never
+/// touches its pages before the workers do.
+class SharedSegment {
+public:
+  SharedSegment() = default;
+  SharedSegment(const SharedSegment &) = delete;
+  SharedSegment &operator=(const SharedSegment &) = delete;
+  ~SharedSegment();
+
+  /// Create and map a segment of `numBytes` bytes.
+  llvm::Error create(uint64_t numBytes);
+
+  double *getData() const { return static_cast<double *>(data); }
+
+private:
+  void *data = nullptr;
+  uint64_t numBytes = 0;
+};
+} // namespace
+
+llvm::Error SharedSegment::create(uint64_t size) {
+#ifdef LLVM_ON_UNIX
+  // An empty tensor has nothing to share.
+  if (!size)
+    return llvm::Error::success();
+
+  // The name is unlinked as soon as the segment is mapped: the mappings keep
+  // it alive, and nothing is left behind if the process is killed.
+  static std::atomic<unsigned> counter(0);
+  std::string name = "/toy-shard-" + std::to_string(::getpid()) + "-" +
+                     std::to_string(counter++);
+  int fd = ::shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd < 0)
+    return makeError("can't create the shared memory segment '" + name +
+                     "': " + std::strerror(errno));
+  ::shm_unlink(name.c_str());
+  auto closeFd = llvm::make_scope_exit([&] { ::close(fd); });
+
+  if (::ftruncate(fd, size) != 0)
+    return makeError("can't resize the shared memory segment '" + name +
+                     "': " + std::strerror(errno));
+  void *mapping =
+      ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (mapping == MAP_FAILED)
+    return makeError("can't map the shared memory segment '" + name +
+                     "': " + std::strerror(errno));
+  data = mapping;
+  numBytes = size;
+  return llvm::Error::success();
+#else
+  return makeError("sharded execution needs POSIX shared memory");
+#endif
+}
+
+SharedSegment::~SharedSegment() {
+#ifdef LLVM_ON_UNIX
+  if (data)
+    ::munmap(data, numBytes);
+#endif
+}
+
+//===----------------------------------------------------------------------===//
+// ShardedKernel
+//===----------------------------------------------------------------------===//
+
+/// Read the bytes of the file `filename` at `offset` into `buffer`.
+static llvm::Error readFileSlice(llvm::StringRef filename,
+                                 llvm::MutableArrayRef<char> buffer,
+                                 uint64_t offset) {
+  llvm::Expected<llvm::sys::fs::file_t> file =
+      llvm::sys::fs::openNativeFileForRead(filename);
+  if (!file)
+    return file.takeError();
+  auto closeFile =
+      llvm::make_scope_exit([&] { llvm::sys::fs::closeFile(*file); });
+
+  while (!buffer.empty()) {
+    llvm::Expected<size_t> numRead =
+        llvm::sys::fs::readNativeFileSlice(*file, buffer, offset);
+    if (!numRead)
+      return numRead.takeError();
+    if (!*numRead)
+      return makeError("unexpected end of '" + filename + "'");
+    buffer = buffer.drop_front(*numRead);
+    offset += *numRead;
+  }
+  return llvm::Error::success();
+}
+
+llvm::Expected<std::unique_ptr<ShardedKernel>>
+ShardedKernel::compile(ToyCompiler &compiler, llvm::StringRef source,
+                       const KernelSignature &signature, unsigned numWorkers,
+                       const CompileOptions &options) {
+  if (signature.argShapes.empty())
+    return makeError("the kernel '" + signature.name +
+                     "' has no argument to split");
+  const std::vector<int64_t> &shape = signature.argShapes.front();
+  if (shape.empty())
+    return makeError("the arguments of the kernel '" + signature.name +
+                     "' have no outer dimension to split");
+  for (const std::vector<int64_t> &argShape : signature.argShapes)
+    if (argShape != shape)
+      return makeError("the arguments of the kernel '" + signature.name +
+                       "' don't all have the same shape");
+
+  std::unique_ptr<ShardedKernel> kernel(new ShardedKernel());
+  kernel->signature = signature;
+  // Each worker computes at least a row.
+  kernel->numWorkers =
+      std::max<int64_t>(1, std::min<int64_t>(numWorkers, shape.front()));
+  kernel->numaNodes = getNumaNodes();
+
+  for (unsigned worker = 0; worker != kernel->numWorkers; ++worker) {
+    int64_t numRows = kernel->getShardRows(worker).second;
+    std::unique_ptr<CompiledModule> &module = kernel->modules[numRows];
+    if (!numRows || module)
+      continue;
+
+    KernelSignature shardSignature = signature;
+    for (std::vector<int64_t> &argShape : shardSignature.argShapes)
+      argShape.front() = numRows;
+    CompileOptions shardOptions = options;
+    shardOptions.kernels.assign(1, shardSignature);
+    auto compiled = compiler.compile(source, shardOptions);
+    if (!compiled)
+      return compiled.takeError();
+    if (!(*compiled)->isElementwise(signature.name))
+      return makeError("the kernel '" + signature.name +
+                       "' isn't elementwise, so its arguments can't be split");
+    module = std::move(*compiled);
+  }
+  return std::move(kernel);
+}
+
+std::pair<int64_t, int64_t>
+ShardedKernel::getShardRows(unsigned worker) const {
+  int64_t numRows = signature.argShapes.front().front();
+  int64_t firstRow = numRows * worker / numWorkers;
+  int64_t lastRow = numRows * (worker + 1) / numWorkers;
+  return {firstRow, lastRow - firstRow};
+}
+
+llvm::Error ShardedKernel::runShard(const BatchJob &job, unsigned worker,
+                                    llvm::ArrayRef<double *> args,
+                                    double *result) const {
+  int64_t firstRow, numRows;
+  std::tie(firstRow, numRows) = getShardRows(worker);
+  if (!numRows)
+    return llvm::Error::success();
+
+  llvm::ArrayRef<int64_t> shape = signature.argShapes.front();
+  int64_t rowElements = getNumElements(shape.drop_front());
+  int64_t offset = firstRow * rowElements;
+  int64_t numElements = numRows * rowElements;
+  llvm::SmallVector<int64_t, 4> shardShape(shape.begin(), shape.end());
+  shardShape.front() = numRows;
+
+  // The worker reads its shards of the arguments itself, so that their pages
+  // are allocated on its node.
+  llvm::SmallVector<MemRefView, 4> views;
+  for (unsigned i = 0, e = args.size(); i != e; ++i) {
+    llvm::MutableArrayRef<char> shard(
+        reinterpret_cast<char *>(args[i] + offset),
+        numElements * sizeof(double));
+    if (auto err = readFileSlice(job.inputFilenames[i], shard,
+                                 offset * sizeof(double)))
+      return err;
+    views.emplace_back(args[i] + offset, shardShape);
+  }
+
+  const CompiledModule &module = *modules.find(numRows)->second;
+  llvm::Expected<MemRefBuffer> shardResult =
+      module.invoke(signature.name, views);
+  if (!shardResult)
+    return shardResult.takeError();
+  if (shardResult->getNumElements() != numElements)
+    return makeError("the kernel '" + signature.name +
+                     "' returns a shard of an unexpected shape");
+  std::copy_n(shardResult->getData(), numElements, result + offset);
+  return llvm::Error::success();
+}
+
+llvm::Expected<uint64_t> ShardedKernel::run(const BatchJob &job) const {
+#ifdef LLVM_ON_UNIX
+  if (job.inputFilenames.size() != signature.argShapes.size())
+    return makeError("expected " + llvm::Twine(signature.argShapes.size()) +
+                     " input files, but got " +
+                     llvm::Twine(job.inputFilenames.size()));
+
+  // The arguments and the result all have the same shape.
+  uint64_t numBytes =
+      getNumElements(signature.argShapes.front()) * sizeof(double);
+  for (const std::string &filename : job.inputFilenames) {
+    uint64_t size;
+    if (std::error_code ec = llvm::sys::fs::file_size(filename, size))
+      return makeError("can't read '" + filename + "': " + ec.message());
+    if (size != numBytes)
+      return makeError("'" + filename + "' has " + llvm::Twine(size) +
+                       " bytes, but the argument has " +
+                       llvm::Twine(numBytes));
+  }
+
+  std::vector<SharedSegment> segments(job.inputFilenames.size() + 1);
+  for (SharedSegment &segment : segments)
+    if (auto err = segment.create(numBytes))
+      return std::move(err);
+  llvm::SmallVector<double *, 4> args;
+  for (unsigned i = 0, e = job.inputFilenames.size(); i != e; ++i)
+    args.push_back(segments[i].getData());
+  double *result = segments.back().getData();
+
+  // The workers inherit the buffered output, which would be printed again.
+  std::fflush(nullptr);
+  llvm::outs().flush();
+
+  llvm::SmallVector<pid_t, 16> workers;
+  std::string forkError;
+  for (unsigned worker = 0; worker != numWorkers; ++worker) {
+    pid_t pid = ::fork();
+    if (pid < 0) {
+      forkError = std::strerror(errno);
+      break;
+    }
+    if (pid == 0) {
+      // The workers are spread over the nodes in turn. A worker exits without
+      // running the destructors of the state it shares with the parent.
+      if (!numaNodes.empty())
+        pinToCpus(numaNodes[worker % numaNodes.size()]);
+      if (llvm::Error err = runShard(job, worker, args, result)) {
+        llvm::errs() << job.outputFilename << ": worker " << worker << ": "
+                     << llvm::toString(std::move(err)) << "\n";
+        ::_exit(1);
+      }
+      ::_exit(0);
+    }
+    workers.push_back(pid);
+  }
+
+  unsigned numFailed = 0;
+  for (pid_t pid : workers) {
+    int status;
+    pid_t waited;
+    do
+      waited = ::waitpid(pid, &status, 0);
+    while (waited < 0 && errno == EINTR);
+    if (waited < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+      ++numFailed;
+  }
+  if (!forkError.empty())
+    return makeError("can't start a worker process: " + forkError);
+  if (numFailed)
+    return makeError(llvm::Twine(numFailed) + " of " +
+                     llvm::Twine(numWorkers) + " worker processes failed");
+
+  std::error_code ec;
+  llvm::raw_fd_ostream os(job.outputFilename, ec);
+  if (ec)
+    return makeError("can't open '" + job.outputFilename +
+                     "': " + ec.message());
+  os.write(reinterpret_cast<const char *>(result), numBytes);
+  os.close();
+  if (os.has_error())
+    return makeError("can't write '" + job.outputFilename +
+                     "': " + os.error().message());
+  return numBytes * segments.size();
+#else
+  return makeError("sharded execution needs POSIX shared memory");
+#endif
+}
@@ -0,0 +1,97 @@
+//===- Sparsity.cpp - Sparsity of the Toy values --------------------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements the analysis of the elements that may be nonzero in the
+// tensors of a Toy function, shared by the lowering to affine loops and by the
+// interpreter.
+//
+//===----------------------------------------------------------------------===//
+
+#include "toy/Sparsity.h"
+#include "toy/Dialect.h"
+
+#include <algorithm>
+#include <iterator>
+
+using namespace mlir;
+using toy::NonZeros;
+
+/// Return the indices of the nonzeros stored in the sparse constant `value`.
+static NonZeros getNonZeros(SparseElementsAttr value) {
+  NonZeros nonZeros;
+  SmallVector<int64_t, 2> indices;
+  for (const APInt &index : value.getIndices().getValues<APInt>()) {
+    indices.push_back(index.getSExtValue());
+    if (static_cast<int64_t>(indices.size()) != value.getType().getRank())
+      continue;
+    nonZeros.push_back(indices);
+    indices.clear();
+  }
+  llvm::sort(nonZeros);
+  nonZeros.erase(std::unique(nonZeros.begin(), nonZeros.end()),
+                 nonZeros.end());
+  return nonZeros;
+}
+
+/// Return the union of the sorted `lhs` and `rhs`.
+static NonZeros getUnion(const NonZeros &lhs, const NonZeros &rhs) {
+  NonZeros result;
+  std::set_union(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(),
+                 std::back_inserter(result));
+  return result;
+}
+
+toy::SparsityAnalysis::SparsityAnalysis(FuncOp function) {
+  // The operands of an operation are visited before it. The values carried by
+  // the loops are dense.
+  function.walk([&](Operation *op) {
+    if (op->getNumResults() != 1)
+      return;
+    auto type = op->getResult(0).getType().dyn_cast<RankedTensorType>();
+    if (!type)
+      return;
+    Optional<NonZeros> elements = getResultNonZeros(op);
+    if (elements &&
+        toy::isSparseEnough(elements->size(), type.getNumElements()))
+      nonZeros[op->getResult(0)] = std::move(*elements);
+  });
+}
+
+Optional<NonZeros>
+toy::SparsityAnalysis::getResultNonZeros(Operation *op) const {
+  if (auto constant = dyn_cast<toy::ConstantOp>(op)) {
+    auto value = constant.value().dyn_cast<SparseElementsAttr>();
+    if (!value || value.getType().getRank() == 0)
+      return llvm::None;
+    return getNonZeros(value);
+  }
+
+  if (auto transpose = dyn_cast<toy::TransposeOp>(op)) {
+    const NonZeros *input = lookup(transpose.input());
+    if (!input)
+      return llvm::None;
+    NonZeros result;
+    for (const auto &indices : *input)
+      result.emplace_back(llvm::reverse(indices));
+    llvm::sort(result);
+    return result;
+  }
+
+  if (!isa<toy::AddOp, toy::FmaOp, toy::MulOp>(op))
+    return llvm::None;
+  // Even a product is only known to be zero where all its operands are: the
+  // product of a zero and an infinity or a NaN is a NaN.
+  NonZeros result;
+  for (Value operand : op->getOperands()) {
+    const NonZeros *operandNonZeros = lookup(operand);
+    if (!operandNonZeros)
+      return llvm::None;
+    result = getUnion(result, *operandNonZeros);
+  }
+  return result;
+}
@@ -0,0 +1,151 @@
+//===- SpecializeFunctions.cpp - Specialize Toy functions -----------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements a Module level pass specializing the generic Toy
+// functions for the shapes of the arguments they are called with, including
+// the shapes of the fields of the structs they are passed. Every function then
+// has a fully shaped signature, so that it can be optimized and lowered on its
+// own, in parallel with the others, instead of being inlined.
+//
+//===----------------------------------------------------------------------===//
+
+#include "mlir/IR/BuiltinOps.h"
+#include "mlir/IR/SymbolTable.h"
+#include "mlir/Pass/Pass.h"
+#include "toy/Dialect.h"
+#include "toy/Passes.h"
+#include "toy/Remarks.h"
+#include "toy/ShapeInferenceInterface.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace mlir;
+using namespace toy;
+
+namespace {
+/// The state of the specialization of a module.
+class FunctionSpecializer {
+public:
+  FunctionSpecializer(ModuleOp module) : symbolTable(module) {}
+
+  /// Infer the shapes in `func`, specializing the functions it calls.
+  LogicalResult specialize(FuncOp func);
+
+private:
+  /// Return the specialization of the callee of `call` for the types of its
+  /// operands, or nullptr on failure.
+  FuncOp getOrCreateSpecialization(GenericCallOp call);
+
+  SymbolTable symbolTable;
+
+  /// The specializations created so far, by mangled name.
+  llvm::StringMap<FuncOp> specializations;
+};
+} // namespace
+
+LogicalResult FunctionSpecializer::specialize(FuncOp func) {
+  return inferShapes(func, [&](GenericCallOp call) -> LogicalResult {
+    FuncOp callee = getOrCreateSpecialization(call);
+    if (!callee)
+      return failure();
+    Type resultType = callee.getType().getResult(0);
+    if (!hasInferredShape(resultType))
+      return call.emitError("unable to infer the shape of the result of a "
+                            "recursive call");
+    call->setAttr("callee", SymbolRefAttr::get(callee));
+    call.getResult().setType(resultType);
+    return success();
+  });
+}
+
+/// Print the shape of `type` for a mangled name, e.g. `2x3`, `2x3sparse` for a
+/// sparse tensor, or `s2x3_3e` for a struct of a 2x3 matrix and a vector of 3.
+static void mangleShape(Type type, raw_ostream &os) {
+  if (auto structType = type.dyn_cast<StructType>()) {
+    os << 's';
+    llvm::interleave(
+        structType.getElementTypes(), os,
+        [&](Type elementType) { mangleShape(elementType, os); }, "_");
+    os << 'e';
+    return;
+  }
+  llvm::interleave(type.cast<RankedTensorType>().getShape(), os, "x");
+  if (isSparseTensor(type))
+    os << "sparse";
+}
+
+FuncOp FunctionSpecializer::getOrCreateSpecialization(GenericCallOp call) {
+  // A specialization is named after the shapes of its arguments, e.g.
+  // `multiply_transpose_2x3_2x3`.
+  std::string name = call.callee().str();
+  llvm::raw_string_ostream os(name);
+  for (Type type : call.getOperandTypes()) {
+    os << '_';
+    mangleShape(type, os);
+  }
+  os.flush();
+
+  auto it = specializations.find(name);
+  if (it != specializations.end())
+    return it->second;
+
+  auto generic = symbolTable.lookup<FuncOp>(call.callee());
+  if (!generic) {
+    call.emitError("no function named '") << call.callee() << "'";
+    return nullptr;
+  }
+  FuncOp specialization = generic.clone();
+  specialization.setName(name);
+  for (auto argType :
+       llvm::zip(specialization.getArguments(), call.getOperandTypes()))
+    std::get<0>(argType).setType(std::get<1>(argType));
+  specialization.setType(FunctionType::get(call.getContext(),
+                                           call.getOperandTypes(),
+                                           generic.getType().getResults()));
+
+  // The symbol table renames the specialization if a function already has its
+  // name, the cache keeps the mangled one.
+  symbolTable.insert(specialization);
+  specializations[name] = specialization;
+  toy::emitOptimizationRemark(toy::RemarkKind::Passed, "toy-specialize",
+                              "Specialized", call,
+                              "specialized '" + call.callee() + "' as '" +
+                                  specialization.getName() + "'");
+  if (failed(specialize(specialization)))
+    return nullptr;
+  return specialization;
+}
+
+namespace {
+/// The SpecializeFunctionsPass replaces the generic functions of the module by
+/// their specializations, starting from the public functions.
+class SpecializeFunctionsPass
+    : public PassWrapper<SpecializeFunctionsPass, OperationPass<ModuleOp>> {
+public:
+  void runOnOperation() override {
+    ModuleOp module = getOperation();
+    SmallVector<FuncOp, 8> generics, roots;
+    for (FuncOp func : module.getOps<FuncOp>())
+      (func.isPrivate() ? generics : roots).push_back(func);
+
+    FunctionSpecializer specializer(module);
+    for (FuncOp func : roots)
+      if (failed(specializer.specialize(func)))
+        return signalPassFailure();
+
+    // The generic functions are no longer called.
+    for (FuncOp generic : generics)
+      generic.erase();
+  }
+};
+} // namespace
+
+/// Create a pass specializing the generic functions.
+std::unique_ptr<Pass> mlir::toy::createSpecializeFunctionsPass() {
+  return std::make_unique<SpecializeFunctionsPass>();
+}
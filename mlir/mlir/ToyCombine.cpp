@@ -13,16 +13,146 @@
 
 #include "mlir/IR/Matchers.h"
 #include "mlir/IR/PatternMatch.h"
+#include "mlir/Pass/Pass.h"
+#include "mlir/Transforms/GreedyPatternRewriteDriver.h"
 #include "toy/Dialect.h"
+#include "toy/Passes.h"
+#include "toy/Remarks.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/TypeName.h"
+#include <atomic>
+#include <mutex>
 #include <numeric>
 using namespace mlir;
 using namespace toy;
 
+/// Return whether `attr` is a tensor whose elements are all `value`, e.g. the
+/// value of the constant in `x * 1`.
+static bool isSplatOf(Attribute attr, double value) {
+  auto elements = attr.dyn_cast_or_null<DenseElementsAttr>();
+  return elements && elements.isSplat() &&
+         elements.getSplatValue<APFloat>().convertToDouble() == value;
+}
+
+/// Return the constant `value` reshaped to the type of `result`. The indices of
+/// the nonzeros of a sparse constant are linearized in its shape, then
+/// delinearized in the new one.
+static ElementsAttr reshapeConstant(ElementsAttr value, Value result) {
+  auto type = result.getType().cast<ShapedType>();
+  auto sparse = value.dyn_cast<SparseElementsAttr>();
+  if (!sparse)
+    return value.cast<DenseElementsAttr>().reshape(type);
+  ArrayRef<int64_t> shape = sparse.getType().getShape();
+  if (shape.empty() || type.getRank() == 0)
+    return DenseElementsAttr::get(
+        type, llvm::to_vector<1>(sparse.getValues<APFloat>()));
+
+  SmallVector<int64_t, 16> indices;
+  int64_t position = 0;
+  unsigned dim = 0;
+  for (const APInt &index : sparse.getIndices().getValues<APInt>()) {
+    position = position * shape[dim] + index.getSExtValue();
+    if (++dim != shape.size())
+      continue;
+    size_t begin = indices.size();
+    indices.resize(begin + type.getRank());
+    for (int64_t newDim = type.getRank() - 1; newDim >= 0; --newDim) {
+      indices[begin + newDim] = position % type.getDimSize(newDim);
+      position /= type.getDimSize(newDim);
+    }
+    position = 0;
+    dim = 0;
+  }
+
+  auto indicesType = RankedTensorType::get(
+      {sparse.getValues().getNumElements(), type.getRank()},
+      IntegerType::get(type.getContext(), 64));
+  return SparseElementsAttr::get(
+      RankedTensorType::get(type.getShape(), type.getElementType()),
+      DenseElementsAttr::get(indicesType, makeArrayRef(indices))
+          .cast<DenseIntElementsAttr>(),
+      sparse.getValues());
+}
+
 namespace {
 /// Include the patterns defined in the Declarative Rewrite framework.
 #include "ToyCombine.inc"
 } // namespace
 
+namespace {
+/// The number of successful applications of each canonicalization pattern,
+/// by name. The counters are created when the patterns are, then incremented
+/// concurrently by the passes running on different functions.
+struct PatternCounters {
+  std::mutex mutex;
+  llvm::StringMap<std::atomic<uint64_t>> counts;
+};
+
+/// A pattern counting the successful applications of the pattern it wraps, and
+/// reporting them as remarks.
+class CountedPattern : public RewritePattern {
+public:
+  CountedPattern(std::unique_ptr<RewritePattern> pattern, StringRef name,
+                 std::atomic<uint64_t> &counter)
+      : RewritePattern(pattern->getRootKind()->getStringRef(),
+                       pattern->getBenefit(), pattern->getContext()),
+        pattern(std::move(pattern)), counter(counter) {
+    setDebugName(name);
+  }
+
+  LogicalResult matchAndRewrite(Operation *op,
+                                PatternRewriter &rewriter) const override {
+    // The operation may be erased by the rewrite.
+    Location loc = op->getLoc();
+    auto function = op->getParentOfType<FuncOp>();
+    if (failed(pattern->matchAndRewrite(op, rewriter)))
+      return failure();
+    ++counter;
+    toy::emitOptimizationRemark(toy::RemarkKind::Passed, "canonicalize",
+                                getDebugName(), loc,
+                                function ? function.getName() : StringRef(),
+                                "applied " + getDebugName());
+    return success();
+  }
+
+private:
+  std::unique_ptr<RewritePattern> pattern;
+  std::atomic<uint64_t> &counter;
+};
+} // namespace
+
+static PatternCounters &getPatternCounters() {
+  static PatternCounters counters;
+  return counters;
+}
+
+/// Add the pattern `PatternT` to `results`, counting its applications under
+/// the name of its class.
+template <typename PatternT>
+static void addCountedPattern(RewritePatternSet &results,
+                              MLIRContext *context) {
+  StringRef name = llvm::getTypeName<PatternT>();
+  size_t scopeEnd = name.rfind("::");
+  if (scopeEnd != StringRef::npos)
+    name = name.drop_front(scopeEnd + 2);
+
+  PatternCounters &counters = getPatternCounters();
+  std::lock_guard<std::mutex> lock(counters.mutex);
+  results.add(std::make_unique<CountedPattern>(
+      RewritePattern::create<PatternT>(context), name, counters.counts[name]));
+}
+
+std::vector<std::pair<std::string, uint64_t>>
+mlir::toy::getCanonicalizationPatternCounts() {
+  PatternCounters &counters = getPatternCounters();
+  std::lock_guard<std::mutex> lock(counters.mutex);
+  std::vector<std::pair<std::string, uint64_t>> counts;
+  for (auto &entry : counters.counts)
+    counts.emplace_back(entry.getKey().str(), entry.getValue().load());
+  llvm::sort(counts);
+  return counts;
+}
+
 /// Fold constants.
 OpFoldResult ConstantOp::fold(ArrayRef<Attribute> operands) { return value(); }
 
@@ -31,8 +161,12 @@ OpFoldResult StructConstantOp::fold(ArrayRef<Attribute> operands) {
   return value();
 }
 
-/// Fold simple struct access operations that access into a constant.
+/// Fold simple struct access operations that access into a constant, or into
+/// a struct packed from buffers.
 OpFoldResult StructAccessOp::fold(ArrayRef<Attribute> operands) {
+  if (auto pack = input().getDefiningOp<StructPackOp>())
+    return pack.fields()[index()];
+
   auto structAttr = operands.front().dyn_cast_or_null<mlir::ArrayAttr>();
   if (!structAttr)
     return nullptr;
@@ -74,13 +208,66 @@ struct SimplifyRedundantTranspose : public mlir::OpRewritePattern<TransposeOp> {
 /// that they can be picked up by the Canonicalization framework.
 void TransposeOp::getCanonicalizationPatterns(RewritePatternSet &results,
                                               MLIRContext *context) {
-  results.add<SimplifyRedundantTranspose>(context);
+  addCountedPattern<SimplifyRedundantTranspose>(results, context);
+}
+
+/// Register the exact algebraic simplifications rooted at an AddOp as
+/// "canonicalization" patterns.
+void AddOp::getCanonicalizationPatterns(RewritePatternSet &results,
+                                        MLIRContext *context) {
+  addCountedPattern<PushTransposeThroughAddOptPattern>(results, context);
+}
+
+/// Register the algebraic simplifications rooted at a MulOp as
+/// "canonicalization" patterns.
+void MulOp::getCanonicalizationPatterns(RewritePatternSet &results,
+                                        MLIRContext *context) {
+  addCountedPattern<MulOneLhsOptPattern>(results, context);
+  addCountedPattern<MulOneRhsOptPattern>(results, context);
+  addCountedPattern<PushTransposeThroughMulOptPattern>(results, context);
 }
 
 /// Register our patterns as "canonicalization" patterns on the ReshapeOp so
 /// that they can be picked up by the Canonicalization framework.
 void ReshapeOp::getCanonicalizationPatterns(RewritePatternSet &results,
                                             MLIRContext *context) {
-  results.add<ReshapeReshapeOptPattern, RedundantReshapeOptPattern,
-              FoldConstantReshapeOptPattern>(context);
+  addCountedPattern<ReshapeReshapeOptPattern>(results, context);
+  addCountedPattern<RedundantReshapeOptPattern>(results, context);
+  addCountedPattern<FoldConstantReshapeOptPattern>(results, context);
+}
+
+namespace {
+/// The FastMathCombinePass applies the algebraic simplifications that change
+/// the rounding or the sign of zero, by decreasing benefit, along with the
+/// canonicalizations.
+struct FastMathCombinePass
+    : public PassWrapper<FastMathCombinePass, FunctionPass> {
+  LogicalResult initialize(MLIRContext *context) override {
+    RewritePatternSet patterns(context);
+    addCountedPattern<AddZeroLhsOptPattern>(patterns, context);
+    addCountedPattern<AddZeroRhsOptPattern>(patterns, context);
+    addCountedPattern<FactorLhsLhsOptPattern>(patterns, context);
+    addCountedPattern<FactorLhsRhsOptPattern>(patterns, context);
+    addCountedPattern<FactorRhsLhsOptPattern>(patterns, context);
+    addCountedPattern<FactorRhsRhsOptPattern>(patterns, context);
+    addCountedPattern<FuseMulAddLhsOptPattern>(patterns, context);
+    addCountedPattern<FuseMulAddRhsOptPattern>(patterns, context);
+    AddOp::getCanonicalizationPatterns(patterns, context);
+    MulOp::getCanonicalizationPatterns(patterns, context);
+    TransposeOp::getCanonicalizationPatterns(patterns, context);
+    frozenPatterns = FrozenRewritePatternSet(std::move(patterns));
+    return success();
+  }
+
+  void runOnFunction() override {
+    (void)applyPatternsAndFoldGreedily(getFunction(), frozenPatterns);
+  }
+
+  FrozenRewritePatternSet frozenPatterns;
+};
+} // namespace
+
+/// Create a pass applying the algebraic simplifications that aren't exact.
+std::unique_ptr<Pass> mlir::toy::createFastMathCombinePass() {
+  return std::make_unique<FastMathCombinePass>();
 }
@@ -0,0 +1,310 @@
+//===- ToyCompiler.cpp - Embedding API for the Toy compiler ---------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements the API to compile a Toy source once, and invoke the
+// generated kernels from the host.
+//
+//===----------------------------------------------------------------------===//
+
+#include "toy/ToyCompiler.h"
+#include "toy/Dialect.h"
+#include "toy/MLIRGen.h"
+#include "toy/Parser.h"
+#include "toy/Passes.h"
+#include "toy/ToyJIT.h"
+
+#include "mlir/Dialect/LLVMIR/LLVMDialect.h"
+#include "mlir/ExecutionEngine/OptUtils.h"
+#include "mlir/IR/BuiltinOps.h"
+#include "mlir/IR/Diagnostics.h"
+#include "mlir/IR/MLIRContext.h"
+#include "mlir/IR/SymbolTable.h"
+#include "mlir/Pass/PassManager.h"
+#include "mlir/Target/LLVMIR/Dialect/LLVMIR/LLVMToLLVMIRTranslation.h"
+#include "mlir/Target/LLVMIR/Export.h"
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/ScopeExit.h"
+#include "llvm/ADT/StringSet.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+
+using namespace toy;
+
+llvm::Error toy::makeError(const llvm::Twine &message) {
+  return llvm::make_error<llvm::StringError>(message,
+                                             llvm::inconvertibleErrorCode());
+}
+
+/// Export the function `signature.name` as a public kernel, specialized for
+/// the given argument shapes. The generic function is renamed and stays
+/// private, so that the other functions keep calling it.
+static mlir::LogicalResult specializeKernel(mlir::ModuleOp module,
+                                            const KernelSignature &signature) {
+  auto generic = module.lookupSymbol<mlir::FuncOp>(signature.name);
+  if (!generic)
+    return module.emitError("no function named '") << signature.name << "'";
+  if (generic.getNumArguments() != signature.argShapes.size())
+    return generic.emitError("expected ")
+           << generic.getNumArguments() << " argument shapes, but got "
+           << signature.argShapes.size();
+
+  mlir::MLIRContext *context = module.getContext();
+  auto genericName =
+      mlir::StringAttr::get(context, signature.name + ".generic");
+  if (mlir::failed(mlir::SymbolTable::replaceAllSymbolUses(
+          generic, genericName, module)))
+    return mlir::failure();
+  mlir::FuncOp kernel = generic.clone();
+  generic.setName(genericName.getValue());
+  kernel.setPublic();
+
+  // Shape inference refines the result types from the argument types.
+  llvm::SmallVector<mlir::Type, 4> argTypes;
+  for (auto argShape : llvm::zip(kernel.getArguments(), signature.argShapes)) {
+    auto type = mlir::RankedTensorType::get(std::get<1>(argShape),
+                                            mlir::Float64Type::get(context));
+    std::get<0>(argShape).setType(type);
+    argTypes.push_back(type);
+  }
+  kernel.setType(mlir::FunctionType::get(context, argTypes,
+                                         kernel.getType().getResults()));
+  module.push_back(kernel);
+  return mlir::success();
+}
+
+/// Return whether `function`, once its shapes are inferred, is elementwise (see
+/// CompiledModule::isElementwise): it only adds, multiplies and casts tensors
+/// of the shape of its arguments, or calls elementwise functions on them.
+static bool isElementwise(mlir::FuncOp function,
+                          llvm::DenseMap<mlir::Operation *, bool> &cache) {
+  if (!function || function.isDeclaration() ||
+      function.getNumArguments() == 0)
+    return false;
+  // A recursive call is taken as not elementwise.
+  auto it = cache.find(function);
+  if (it != cache.end())
+    return it->second;
+  cache[function] = false;
+
+  auto argType =
+      function.getArgument(0).getType().dyn_cast<mlir::RankedTensorType>();
+  auto hasArgShape = [&](mlir::Type type) {
+    auto tensorType = type.dyn_cast<mlir::RankedTensorType>();
+    return argType && tensorType &&
+           tensorType.getShape() == argType.getShape();
+  };
+  auto isElementwiseOp = [&](mlir::Operation &op) {
+    if (!llvm::all_of(op.getOperandTypes(), hasArgShape) ||
+        !llvm::all_of(op.getResultTypes(), hasArgShape))
+      return false;
+    if (auto call = llvm::dyn_cast<mlir::toy::GenericCallOp>(&op))
+      return isElementwise(
+          mlir::SymbolTable::lookupNearestSymbolFrom<mlir::FuncOp>(
+              call, call.calleeAttr()),
+          cache);
+    return llvm::isa<mlir::toy::AddOp, mlir::toy::CastOp, mlir::toy::FmaOp,
+                     mlir::toy::MulOp, mlir::toy::ReturnOp>(&op);
+  };
+  bool result = llvm::all_of(function.getType().getInputs(), hasArgShape) &&
+                llvm::all_of(function.getType().getResults(), hasArgShape) &&
+                llvm::all_of(function.front(), isElementwiseOp);
+  cache[function] = result;
+  return result;
+}
+
+ToyCompiler::ToyCompiler() : context(std::make_unique<mlir::MLIRContext>()) {
+  context->getOrLoadDialect<mlir::toy::ToyDialect>();
+
+  // Register the translation from MLIR to LLVM IR, which must happen before we
+  // can JIT-compile.
+  mlir::registerLLVMDialectTranslation(*context);
+
+  // Initialize LLVM targets.
+  llvm::InitializeNativeTarget();
+  llvm::InitializeNativeTargetAsmPrinter();
+}
+
+ToyCompiler::~ToyCompiler() = default;
+
+llvm::Expected<std::unique_ptr<CompiledModule>>
+ToyCompiler::compile(llvm::StringRef source, const CompileOptions &options) {
+  // Collect the diagnostics, to return them as the error.
+  std::string diagnostics;
+  llvm::raw_string_ostream os(diagnostics);
+  mlir::ScopedDiagnosticHandler handler(
+      context.get(), [&](mlir::Diagnostic &diag) {
+        os << resolveLocation(diag.getLocation()) << ": " << diag << "\n";
+        for (mlir::Diagnostic &note : diag.getNotes())
+          os << resolveLocation(note.getLocation()) << ": note: " << note
+             << "\n";
+        return mlir::success();
+      });
+
+  // The locations refer to the source, which is copied in the SourceManager
+  // for the duration of the compilation.
+  uint32_t file = SourceManager::get().addBufferCopy(source, "<source>");
+  auto removeSource =
+      llvm::make_scope_exit([&] { SourceManager::get().removeSource(file); });
+  Lexer lexer(file);
+  Parser parser(lexer);
+  auto moduleAST = parser.parseModule();
+  if (!moduleAST)
+    return makeError("failed to parse the Toy source");
+
+  mlir::OwningModuleRef module = mlirGen(*context, *moduleAST);
+  if (!module)
+    return makeError(os.str());
+  for (const KernelSignature &signature : options.kernels)
+    if (mlir::failed(specializeKernel(*module, signature)))
+      return makeError(os.str());
+
+  // Stop once the shapes are inferred, to find the elementwise kernels, then
+  // lower the module.
+  mlir::toy::ToyPipelineOptions pipelineOptions;
+  pipelineOptions.enableOpt = options.enableOpt;
+  pipelineOptions.fastMath = options.fastMath;
+  pipelineOptions.isLoweringToAffine = true;
+  pipelineOptions.isLoweringToLLVM = true;
+  pipelineOptions.loweringPath = options.loweringPath;
+  pipelineOptions.stopAfterShapeInference = true;
+  mlir::PassManager shapePM(context.get());
+  mlir::toy::buildToyPipeline(shapePM, pipelineOptions);
+  if (mlir::failed(shapePM.run(*module)))
+    return makeError(os.str());
+
+  llvm::StringSet<> elementwiseKernels;
+  llvm::DenseMap<mlir::Operation *, bool> elementwiseCache;
+  for (const KernelSignature &signature : options.kernels)
+    if (isElementwise(module->lookupSymbol<mlir::FuncOp>(signature.name),
+                      elementwiseCache))
+      elementwiseKernels.insert(signature.name);
+
+  pipelineOptions.stopAfterShapeInference = false;
+  pipelineOptions.skipShapeInference = true;
+  mlir::PassManager pm(context.get());
+  mlir::toy::buildToyPipeline(pm, pipelineOptions);
+  if (mlir::failed(pm.run(*module)))
+    return makeError(os.str());
+
+  // Record the rank of the result of each kernel, from the descriptor it
+  // returns: two pointers and an offset, then arrays of sizes and strides.
+  std::unique_ptr<CompiledModule> compiled(new CompiledModule());
+  auto addKernel = [&](llvm::StringRef name,
+                       std::vector<std::vector<int64_t>> argShapes) {
+    auto func = module->lookupSymbol<mlir::LLVM::LLVMFuncOp>(name);
+    CompiledModule::Kernel &kernel = compiled->kernels[name];
+    kernel.argShapes = std::move(argShapes);
+    kernel.isElementwise = elementwiseKernels.count(name);
+    if (auto resultType = func.getType()
+                              .getReturnType()
+                              .dyn_cast<mlir::LLVM::LLVMStructType>()) {
+      llvm::ArrayRef<mlir::Type> body = resultType.getBody();
+      kernel.resultRank =
+          body.size() == 3
+              ? 0
+              : body[3].cast<mlir::LLVM::LLVMArrayType>().getNumElements();
+    }
+  };
+  if (module->lookupSymbol<mlir::LLVM::LLVMFuncOp>("main"))
+    addKernel("main", {});
+  for (const KernelSignature &signature : options.kernels)
+    addKernel(signature.name, signature.argShapes);
+
+  auto maybeJIT = ToyJIT::create();
+  if (!maybeJIT)
+    return maybeJIT.takeError();
+  compiled->jit = std::move(*maybeJIT);
+
+  // Convert the module to LLVM IR, with a wrapper to invoke each kernel.
+  llvm::LLVMContext llvmContext;
+  auto llvmModule = mlir::translateModuleToLLVMIR(*module, llvmContext);
+  if (!llvmModule)
+    return makeError(os.str());
+  llvmModule->setDataLayout(compiled->jit->getDataLayout());
+  for (auto &kernel : compiled->kernels)
+    if (auto err = addPackedInterface(*llvmModule, kernel.getKey()))
+      return std::move(err);
+
+  // An optimization pipeline to run on each partition of the module.
+  auto optPipeline = mlir::makeOptimizingTransformer(
+      /*optLevel=*/options.enableOpt ? 3 : 0, /*sizeLevel=*/0,
+      /*targetMachine=*/nullptr);
+  if (auto err = compiled->jit->addModuleInParallel(
+          std::move(llvmModule), options.numCodegenPartitions,
+          /*numThreads=*/0, optPipeline))
+    return std::move(err);
+
+  // Look the kernels up once, so that invoking them never enters the JIT.
+  for (auto &kernel : compiled->kernels) {
+    auto symbol =
+        compiled->jit->lookup(getPackedFunctionName(kernel.getKey()));
+    if (!symbol)
+      return symbol.takeError();
+    kernel.getValue().packedFunc =
+        reinterpret_cast<void (*)(void **)>(symbol->getAddress());
+  }
+  return std::move(compiled);
+}
+
+CompiledModule::~CompiledModule() = default;
+
+bool CompiledModule::isElementwise(llvm::StringRef name) const {
+  auto it = kernels.find(name);
+  return it != kernels.end() && it->getValue().isElementwise;
+}
+
+llvm::Expected<MemRefBuffer>
+CompiledModule::invoke(llvm::StringRef name,
+                       llvm::ArrayRef<MemRefView> args) const {
+  auto it = kernels.find(name);
+  if (it == kernels.end())
+    return makeError("no kernel named '" + name + "'");
+  const Kernel &kernel = it->getValue();
+  if (args.size() != kernel.argShapes.size())
+    return makeError("kernel '" + name + "' expects " +
+                     llvm::Twine(kernel.argShapes.size()) + " arguments");
+  for (unsigned i = 0, e = args.size(); i != e; ++i)
+    if (args[i].shape != llvm::makeArrayRef(kernel.argShapes[i]))
+      return makeError("argument #" + llvm::Twine(i) + " of kernel '" + name +
+                       "' doesn't have the shape it was compiled for");
+
+  // Pass the arguments, then storage for the result. The descriptors live on
+  // the stack of the calling thread.
+  llvm::SmallVector<MemRefDescriptor, 4> descriptors;
+  descriptors.reserve(args.size());
+  llvm::SmallVector<void *, 32> packedArgs;
+  for (const MemRefView &arg : args) {
+    descriptors.emplace_back(arg.data, arg.shape);
+    descriptors.back().appendPackedArguments(packedArgs);
+  }
+  llvm::Optional<MemRefDescriptor> result;
+  if (kernel.resultRank) {
+    result.emplace(*kernel.resultRank);
+    packedArgs.push_back(result->getStorage());
+  }
+  kernel.packedFunc(packedArgs.data());
+  if (!result)
+    return MemRefBuffer();
+
+  // A kernel may return one of its arguments, which isn't ours to give away.
+  double *allocatedPtr = result->getAllocatedPtr();
+  if (llvm::any_of(args, [&](const MemRefView &arg) {
+        return arg.data == allocatedPtr;
+      })) {
+    int64_t numElements = result->getNumElements();
+    allocatedPtr =
+        static_cast<double *>(std::malloc(numElements * sizeof(double)));
+    std::copy_n(result->getData(), numElements, allocatedPtr);
+    return MemRefBuffer(allocatedPtr, allocatedPtr, result->getSizes());
+  }
+  return MemRefBuffer(allocatedPtr, result->getData(), result->getSizes());
+}
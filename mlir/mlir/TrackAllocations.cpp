@@ -0,0 +1,59 @@
+//===- TrackAllocations.cpp - Allocation and memory traffic telemetry -----===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements a Function level pass instrumenting the lowered Toy
+// functions for the allocation tracker (see toy/AllocationTracker.h). Each
+// allocation and deallocation of a buffer is reported to the tracker, and each
+// call reports the bytes the function loads and stores, estimated by the cost
+// model (see toy/CostModel.h).
+//
+//===----------------------------------------------------------------------===//
+
+#include "toy/CostModel.h"
+#include "toy/Dialect.h"
+#include "toy/Passes.h"
+
+#include "mlir/Dialect/MemRef/IR/MemRef.h"
+#include "mlir/Pass/Pass.h"
+
+using namespace mlir;
+
+namespace {
+/// The TrackAllocationsPass is a FunctionPass that reports the allocations,
+/// the deallocations and the estimated memory traffic of the lowered functions
+/// to the allocation tracker.
+struct TrackAllocationsPass
+    : public PassWrapper<TrackAllocationsPass, FunctionPass> {
+  void runOnFunction() final {
+    FuncOp function = getFunction();
+    if (function.isDeclaration())
+      return;
+
+    OpBuilder builder(function.getContext());
+    function.walk([&](memref::AllocOp alloc) {
+      builder.setInsertionPointAfter(alloc);
+      builder.create<toy::TrackAllocOp>(alloc.getLoc(), alloc);
+    });
+    function.walk([&](memref::DeallocOp dealloc) {
+      builder.setInsertionPoint(dealloc);
+      builder.create<toy::TrackDeallocOp>(dealloc.getLoc(), dealloc.memref());
+    });
+
+    int64_t traffic = toy::estimateCost(function).bytes;
+    builder.setInsertionPointToStart(&function.front());
+    builder.create<toy::TrackTrafficOp>(function.getLoc(),
+                                        builder.getI64IntegerAttr(traffic));
+  }
+};
+} // namespace
+
+/// Create a pass reporting the allocations and the memory traffic of the
+/// lowered functions to the allocation tracker.
+std::unique_ptr<Pass> mlir::toy::createTrackAllocationsPass() {
+  return std::make_unique<TrackAllocationsPass>();
+}
@@ -0,0 +1,244 @@
+//===- Tuning.cpp - Tuning of the Toy loop nests --------------------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements the database of the tuned configurations of the loop
+// nests, and the identification of the nests they apply to.
+//
+//===----------------------------------------------------------------------===//
+
+#include "toy/Tuning.h"
+
+#include "mlir/Analysis/LoopAnalysis.h"
+#include "mlir/Dialect/Affine/IR/AffineOps.h"
+#include "mlir/IR/BuiltinOps.h"
+#include "mlir/Interfaces/SideEffectInterfaces.h"
+#include "mlir/Transforms/LoopUtils.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <set>
+
+using namespace mlir;
+
+//===----------------------------------------------------------------------===//
+// TuningDatabase
+//===----------------------------------------------------------------------===//
+
+LogicalResult toy::TuningDatabase::load(llvm::StringRef path) {
+  auto reportError = [&](const llvm::Twine &message) {
+    llvm::errs() << "Could not read the tuning database " << path << ": "
+                 << message << "\n";
+    return failure();
+  };
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> fileOrErr =
+      llvm::MemoryBuffer::getFile(path);
+  if (std::error_code ec = fileOrErr.getError())
+    return reportError(ec.message());
+  llvm::Expected<llvm::json::Value> json =
+      llvm::json::parse((*fileOrErr)->getBuffer());
+  if (!json)
+    return reportError(llvm::toString(json.takeError()));
+
+  const llvm::json::Object *root = json->getAsObject();
+  const llvm::json::Array *entries =
+      root ? root->getArray("configurations") : nullptr;
+  if (!entries)
+    return reportError("expected an object with a 'configurations' array");
+  for (const llvm::json::Value &value : *entries) {
+    const llvm::json::Object *entry = value.getAsObject();
+    llvm::Optional<llvm::StringRef> cpu, opKind, shape;
+    llvm::Optional<int64_t> tileSize, unrollFactor, vectorWidth;
+    if (entry) {
+      cpu = entry->getString("cpu");
+      opKind = entry->getString("op");
+      shape = entry->getString("shape");
+      tileSize = entry->getInteger("tile");
+      unrollFactor = entry->getInteger("unroll");
+      vectorWidth = entry->getInteger("vector");
+    }
+    if (!cpu || !opKind || !shape || !tileSize || !unrollFactor ||
+        !vectorWidth || *tileSize < 0 || *unrollFactor < 1 ||
+        *vectorWidth < 1)
+      return reportError("expected each configuration to have a 'cpu', an "
+                         "'op', a 'shape', a 'tile', an 'unroll' and a "
+                         "'vector'");
+
+    TuningConfig config;
+    config.tileSize = *tileSize;
+    config.unrollFactor = *unrollFactor;
+    config.vectorWidth = *vectorWidth;
+    insert({opKind->str(), shape->str(), cpu->str()}, config);
+  }
+  return success();
+}
+
+LogicalResult toy::TuningDatabase::save(llvm::StringRef path) const {
+  std::error_code ec;
+  llvm::raw_fd_ostream os(path, ec);
+  if (ec) {
+    llvm::errs() << "Could not write the tuning database " << path << ": "
+                 << ec.message() << "\n";
+    return failure();
+  }
+
+  llvm::json::OStream json(os, /*IndentSize=*/2);
+  json.object([&] {
+    json.attributeArray("configurations", [&] {
+      for (auto &entry : configs) {
+        json.object([&] {
+          json.attribute("cpu", entry.first.cpu);
+          json.attribute("op", entry.first.opKind);
+          json.attribute("shape", entry.first.shape);
+          json.attribute("tile", static_cast<int64_t>(entry.second.tileSize));
+          json.attribute("unroll",
+                         static_cast<int64_t>(entry.second.unrollFactor));
+          json.attribute("vector",
+                         static_cast<int64_t>(entry.second.vectorWidth));
+        });
+      }
+    });
+  });
+  os << "\n";
+  return success();
+}
+
+llvm::Optional<toy::TuningConfig>
+toy::TuningDatabase::lookup(llvm::StringRef opKind,
+                            llvm::StringRef shape) const {
+  auto it = configs.find({opKind.str(), shape.str(), getHostCPUName()});
+  if (it == configs.end())
+    return llvm::None;
+  return it->second;
+}
+
+std::string toy::getHostCPUName() {
+  static const std::string name = llvm::sys::getHostCPUName().str();
+  return name;
+}
+
+//===----------------------------------------------------------------------===//
+// TunableNest
+//===----------------------------------------------------------------------===//
+
+int64_t toy::TunableNest::getNumIterations() const {
+  int64_t numIterations = 1;
+  for (int64_t tripCount : tripCounts)
+    numIterations *= tripCount;
+  return numIterations;
+}
+
+bool toy::TunableNest::isApplicable(const TuningConfig &config) const {
+  if (config.unrollFactor < 1 || config.vectorWidth < 1)
+    return false;
+
+  // The tiles are clamped to the loops shorter than them.
+  int64_t innermost = tripCounts.back();
+  if (config.tileSize > 0) {
+    for (int64_t tripCount : tripCounts)
+      if (tripCount % std::min<int64_t>(config.tileSize, tripCount))
+        return false;
+    innermost = std::min<int64_t>(config.tileSize, innermost);
+  }
+  if (config.vectorWidth > 1) {
+    if (!isVectorizable || innermost % config.vectorWidth)
+      return false;
+    innermost /= config.vectorWidth;
+  }
+  return config.unrollFactor <= innermost;
+}
+
+/// Return whether the access of the affine `map` of `operands` is contiguous
+/// along the induction variable `iv`: only the last dimension of the buffer
+/// follows it, one to one. An access independent of `iv` is contiguous for a
+/// load, which is then broadcast, but not for a store.
+static bool isContiguousAccess(Value iv, AffineMap map, ValueRange operands,
+                               bool isStore) {
+  auto it = llvm::find(operands, iv);
+  if (it == operands.end())
+    return !isStore;
+  unsigned position = it - operands.begin();
+  ArrayRef<AffineExpr> results = map.getResults();
+  if (position >= map.getNumDims() || results.empty() ||
+      results.back() != getAffineDimExpr(position, map.getContext()))
+    return false;
+  return llvm::none_of(results.drop_back(), [&](AffineExpr expr) {
+    return expr.isFunctionOfDim(position);
+  });
+}
+
+/// Return whether the body of `loop` is straight line arithmetic on the
+/// elements of buffers accessed contiguously along its induction variable.
+static bool isVectorizableLoop(AffineForOp loop) {
+  Value iv = loop.getInductionVar();
+  for (Operation &op : loop.getBody()->without_terminator()) {
+    if (auto load = dyn_cast<AffineLoadOp>(op)) {
+      if (!isContiguousAccess(iv, load.getAffineMap(), load.getMapOperands(),
+                              /*isStore=*/false))
+        return false;
+    } else if (auto store = dyn_cast<AffineStoreOp>(op)) {
+      if (!isContiguousAccess(iv, store.getAffineMap(),
+                              store.getMapOperands(), /*isStore=*/true))
+        return false;
+    } else if (op.getNumRegions() ||
+               !MemoryEffectOpInterface::hasNoEffect(&op)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+llvm::Optional<toy::TunableNest> toy::getTunableNest(AffineForOp root) {
+  SmallVector<AffineForOp, 4> band;
+  getPerfectlyNestedLoops(band, root);
+
+  TunableNest nest;
+  for (AffineForOp loop : band) {
+    llvm::Optional<uint64_t> tripCount = getConstantTripCount(loop);
+    if (!tripCount || !*tripCount || loop.getStep() != 1)
+      return llvm::None;
+    nest.tripCounts.push_back(*tripCount);
+  }
+
+  // The stores of the lowered operations name them, a fused nest computes
+  // several of them.
+  std::set<std::string> opKinds;
+  root.walk([&](AffineStoreOp store) {
+    if (auto opKind = store->getAttrOfType<StringAttr>(getOpKindAttrName()))
+      opKinds.insert(opKind.getValue().str());
+  });
+  if (opKinds.empty())
+    return llvm::None;
+
+  nest.key.opKind = llvm::join(opKinds, "+");
+  llvm::raw_string_ostream shape(nest.key.shape);
+  llvm::interleave(nest.tripCounts, shape, "x");
+  shape.flush();
+  nest.key.cpu = getHostCPUName();
+  nest.isVectorizable = isVectorizableLoop(band.back());
+  return nest;
+}
+
+std::vector<toy::TunableNest> toy::getTunableNests(ModuleOp module) {
+  std::vector<TunableNest> nests;
+  std::set<TuningKey> keys;
+  for (FuncOp function : module.getOps<FuncOp>()) {
+    if (function.isDeclaration())
+      continue;
+    for (AffineForOp root : function.front().getOps<AffineForOp>()) {
+      llvm::Optional<TunableNest> nest = getTunableNest(root);
+      if (nest && keys.insert(nest->key).second)
+        nests.push_back(std::move(*nest));
+    }
+  }
+  return nests;
+}
@@ -12,6 +12,7 @@
 
 #include "toy/AST.h"
 
+#include "llvm/ADT/Sequence.h"
 #include "llvm/ADT/Twine.h"
 #include "llvm/ADT/TypeSwitch.h"
 #include "llvm/Support/raw_ostream.h"
@@ -38,7 +39,7 @@ private:
   void dump(const VarType &type);
   void dump(VarDeclExprAST *varDecl);
   void dump(ExprAST *expr);
-  void dump(ExprASTList *exprList);
+  void dump(ExprASTList exprList);
   void dump(NumberExprAST *num);
   void dump(LiteralExprAST *node);
   void dump(StructLiteralExprAST *node);
@@ -47,6 +48,8 @@ private:
   void dump(BinaryExprAST *node);
   void dump(CallExprAST *node);
   void dump(PrintExprAST *node);
+  void dump(AssignExprAST *node);
+  void dump(ForExprAST *node);
   void dump(PrototypeAST *node);
   void dump(FunctionAST *node);
   void dump(StructAST *node);
@@ -63,8 +66,8 @@ private:
 
 /// Return a formatted string for the location of any node
 template <typename T> static std::string loc(T *node) {
-  const auto &loc = node->loc();
-  return (llvm::Twine("@") + *loc.file + ":" + llvm::Twine(loc.line) + ":" +
+  LineColumn loc = SourceManager::get().resolve(node->loc());
+  return (llvm::Twine("@") + loc.filename + ":" + llvm::Twine(loc.line) + ":" +
           llvm::Twine(loc.col))
       .str();
 }
@@ -78,9 +81,10 @@ template <typename T> static std::string loc(T *node) {
 /// Dispatch to a generic expressions to the appropriate subclass using RTTI
 void ASTDumper::dump(ExprAST *expr) {
   llvm::TypeSwitch<ExprAST *>(expr)
-      .Case<BinaryExprAST, CallExprAST, LiteralExprAST, NumberExprAST,
-            PrintExprAST, ReturnExprAST, StructLiteralExprAST, VarDeclExprAST,
-            VariableExprAST>([&](auto *node) { this->dump(node); })
+      .Case<AssignExprAST, BinaryExprAST, CallExprAST, ForExprAST,
+            LiteralExprAST, NumberExprAST, PrintExprAST, ReturnExprAST,
+            StructLiteralExprAST, VarDeclExprAST, VariableExprAST>(
+          [&](auto *node) { this->dump(node); })
       .Default([&](ExprAST *) {
         // No match, fallback to a generic message
         INDENT();
@@ -100,11 +104,11 @@ void ASTDumper::dump(VarDeclExprAST *varDecl) {
 }
 
 /// A "block", or a list of expression
-void ASTDumper::dump(ExprASTList *exprList) {
+void ASTDumper::dump(ExprASTList exprList) {
   INDENT();
   llvm::errs() << "Block {\n";
-  for (auto &expr : *exprList)
-    dump(expr.get());
+  for (auto *expr : exprList)
+    dump(expr);
   indent();
   llvm::errs() << "} // Block\n";
 }
@@ -119,23 +123,23 @@ void ASTDumper::dump(NumberExprAST *num) {
 ///    [ [ 1, 2 ], [ 3, 4 ] ]
 /// We print out such array with the dimensions spelled out at every level:
 ///    <2,2>[<2>[ 1, 2 ], <2>[ 3, 4 ] ]
-void printLitHelper(ExprAST *litOrNum) {
-  // Inside a literal expression we can have either a number or another literal
-  if (auto *num = llvm::dyn_cast<NumberExprAST>(litOrNum)) {
-    llvm::errs() << num->getValue();
-    return;
-  }
-  auto *literal = llvm::cast<LiteralExprAST>(litOrNum);
-
+/// The numbers are consumed from the front of `data`.
+static void printLitHelper(llvm::ArrayRef<int64_t> dims,
+                           llvm::ArrayRef<double> &data) {
   // Print the dimension for this literal first
   llvm::errs() << "<";
-  llvm::interleaveComma(literal->getDims(), llvm::errs());
+  llvm::interleaveComma(dims, llvm::errs());
   llvm::errs() << ">";
 
   // Now print the content, recursing on every element of the list
   llvm::errs() << "[ ";
-  llvm::interleaveComma(literal->getValues(), llvm::errs(),
-                        [&](auto &elt) { printLitHelper(elt.get()); });
+  llvm::interleaveComma(llvm::seq<int64_t>(0, dims.front()), llvm::errs(),
+                        [&](int64_t) {
+                          if (dims.size() > 1)
+                            return printLitHelper(dims.drop_front(), data);
+                          llvm::errs() << data.front();
+                          data = data.drop_front();
+                        });
   llvm::errs() << "]";
 }
 
@@ -143,7 +147,8 @@ void printLitHelper(ExprAST *litOrNum) {
 void ASTDumper::dump(LiteralExprAST *node) {
   INDENT();
   llvm::errs() << "Literal: ";
-  printLitHelper(node);
+  llvm::ArrayRef<double> data = node->getData();
+  printLitHelper(node->getDims(), data);
   llvm::errs() << " " << loc(node) << "\n";
 }
 
@@ -151,8 +156,8 @@ void ASTDumper::dump(LiteralExprAST *node) {
 void ASTDumper::dump(StructLiteralExprAST *node) {
   INDENT();
   llvm::errs() << "Struct Literal: ";
-  for (auto &value : node->getValues())
-    dump(value.get());
+  for (auto *value : node->getValues())
+    dump(value);
   indent();
   llvm::errs() << " " << loc(node) << "\n";
 }
@@ -188,8 +193,8 @@ void ASTDumper::dump(BinaryExprAST *node) {
 void ASTDumper::dump(CallExprAST *node) {
   INDENT();
   llvm::errs() << "Call '" << node->getCallee() << "' [ " << loc(node) << "\n";
-  for (auto &arg : node->getArgs())
-    dump(arg.get());
+  for (auto *arg : node->getArgs())
+    dump(arg);
   indent();
   llvm::errs() << "]\n";
 }
@@ -203,6 +208,22 @@ void ASTDumper::dump(PrintExprAST *node) {
   llvm::errs() << "]\n";
 }
 
+/// Print an assignment, first the assigned variable and then the new value.
+void ASTDumper::dump(AssignExprAST *node) {
+  INDENT();
+  llvm::errs() << "Assign " << node->getName() << " " << loc(node) << "\n";
+  dump(node->getValue());
+}
+
+/// Print a loop, first the induction variable and the bounds, then the body.
+void ASTDumper::dump(ForExprAST *node) {
+  INDENT();
+  llvm::errs() << "For " << node->getInductionVar() << " in "
+               << node->getLowerBound() << ".." << node->getUpperBound() << " "
+               << loc(node) << "\n";
+  dump(node->getBody());
+}
+
 /// Print type: only the shape is printed in between '<' and '>'
 void ASTDumper::dump(const VarType &type) {
   llvm::errs() << "<";
@@ -241,8 +262,8 @@ void ASTDumper::dump(StructAST *node) {
   {
     INDENT();
     llvm::errs() << "Variables: [\n";
-    for (auto &variable : node->getVariables())
-      dump(variable.get());
+    for (auto *variable : node->getVariables())
+      dump(variable);
     indent();
     llvm::errs() << "]\n";
   }
@@ -252,10 +273,15 @@ void ASTDumper::dump(StructAST *node) {
 void ASTDumper::dump(ModuleAST *node) {
   INDENT();
   llvm::errs() << "Module:\n";
-  for (auto &record : *node) {
-    if (FunctionAST *function = llvm::dyn_cast<FunctionAST>(record.get()))
+  for (auto *import : node->getImports()) {
+    INDENT();
+    llvm::errs() << "Import '" << import->getPath() << "' " << loc(import)
+                 << "\n";
+  }
+  for (auto *record : *node) {
+    if (FunctionAST *function = llvm::dyn_cast<FunctionAST>(record))
       dump(function);
-    else if (StructAST *str = llvm::dyn_cast<StructAST>(record.get()))
+    else if (StructAST *str = llvm::dyn_cast<StructAST>(record))
       dump(str);
     else
       llvm::errs() << "<unknown Record, kind " << record->getKind() << ">\n";
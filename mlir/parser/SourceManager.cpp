@@ -0,0 +1,122 @@
+//===- SourceManager.cpp - Registry of the Toy sources --------------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements the registry of the Toy sources.
+//
+//===----------------------------------------------------------------------===//
+
+#include "toy/SourceManager.h"
+
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <cassert>
+#include <iterator>
+#include <limits>
+
+using namespace toy;
+
+struct SourceManager::Source {
+  Source(std::unique_ptr<llvm::MemoryBuffer> buffer)
+      : buffer(std::move(buffer)) {}
+
+  std::unique_ptr<llvm::MemoryBuffer> buffer;
+
+  /// The offsets at which the lines start, computed on first use.
+  std::once_flag lineStartsFlag;
+  std::vector<uint32_t> lineStarts;
+};
+
+SourceManager::SourceManager() = default;
+SourceManager::~SourceManager() = default;
+
+SourceManager &SourceManager::get() {
+  static SourceManager manager;
+  return manager;
+}
+
+llvm::ErrorOr<uint32_t> SourceManager::addFile(llvm::StringRef filename) {
+  // The lexer stops at the end of the buffer, so it doesn't need to be null
+  // terminated, which lets large files be memory mapped.
+  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> fileOrErr =
+      llvm::MemoryBuffer::getFileOrSTDIN(filename, /*IsText=*/false,
+                                         /*RequiresNullTerminator=*/false);
+  if (!fileOrErr)
+    return fileOrErr.getError();
+
+  // Offsets in a location are 32 bits.
+  if ((*fileOrErr)->getBufferSize() > std::numeric_limits<uint32_t>::max())
+    return std::make_error_code(std::errc::file_too_large);
+  return addBuffer(std::move(*fileOrErr));
+}
+
+uint32_t SourceManager::addBufferCopy(llvm::StringRef source,
+                                      llvm::StringRef name) {
+  return addBuffer(llvm::MemoryBuffer::getMemBufferCopy(source, name));
+}
+
+uint32_t
+SourceManager::addBuffer(std::unique_ptr<llvm::MemoryBuffer> buffer) {
+  auto source = std::make_unique<Source>(std::move(buffer));
+  std::lock_guard<std::mutex> lock(mutex);
+  if (freeIds.empty()) {
+    sources.push_back(std::move(source));
+    return sources.size() - 1;
+  }
+  uint32_t file = freeIds.back();
+  freeIds.pop_back();
+  sources[file] = std::move(source);
+  return file;
+}
+
+void SourceManager::removeSource(uint32_t file) {
+  // The buffer is freed once the lock is released.
+  std::unique_ptr<Source> source;
+  std::lock_guard<std::mutex> lock(mutex);
+  assert(file < sources.size() && sources[file] && "unknown source");
+  source = std::move(sources[file]);
+  freeIds.push_back(file);
+}
+
+SourceManager::Source &SourceManager::getSource(uint32_t file) {
+  std::lock_guard<std::mutex> lock(mutex);
+  assert(file < sources.size() && sources[file] && "unknown source");
+  return *sources[file];
+}
+
+llvm::StringRef SourceManager::getBuffer(uint32_t file) {
+  return getSource(file).buffer->getBuffer();
+}
+
+llvm::StringRef SourceManager::getBufferIdentifier(uint32_t file) {
+  return getSource(file).buffer->getBufferIdentifier();
+}
+
+LineColumn SourceManager::resolve(Location loc) {
+  Source &source = getSource(loc.file);
+  llvm::StringRef buffer = source.buffer->getBuffer();
+  std::call_once(source.lineStartsFlag, [&] {
+    source.lineStarts.push_back(0);
+    for (size_t pos = buffer.find('\n'); pos != llvm::StringRef::npos;
+         pos = buffer.find('\n', pos + 1))
+      source.lineStarts.push_back(pos + 1);
+  });
+
+  // The line is the last one starting at or before the offset.
+  auto it = std::upper_bound(source.lineStarts.begin(),
+                             source.lineStarts.end(), loc.offset);
+  unsigned line = it - source.lineStarts.begin();
+  return {source.buffer->getBufferIdentifier(), line,
+          loc.offset - *std::prev(it) + 1};
+}
+
+llvm::raw_ostream &toy::operator<<(llvm::raw_ostream &os,
+                                   const LineColumn &loc) {
+  return os << loc.filename << ":" << loc.line << ":" << loc.col;
+}
@@ -10,16 +10,27 @@
 //
 //===----------------------------------------------------------------------===//
 
+#include "toy/AllocationTracker.h"
+#include "toy/BatchRunner.h"
+#include "toy/Benchmark.h"
+#include "toy/CompileStats.h"
 #include "toy/Dialect.h"
+#include "toy/FrontEnd.h"
+#include "toy/Interpreter.h"
 #include "toy/MLIRGen.h"
 #include "toy/Parser.h"
 #include "toy/Passes.h"
+#include "toy/Profiler.h"
+#include "toy/Remarks.h"
+#include "toy/ShardedRunner.h"
+#include "toy/ToyJIT.h"
+#include "toy/Tuning.h"
 
-#include "mlir/Dialect/Affine/Passes.h"
 #include "mlir/ExecutionEngine/ExecutionEngine.h"
 #include "mlir/ExecutionEngine/OptUtils.h"
 #include "mlir/IR/AsmState.h"
 #include "mlir/IR/BuiltinOps.h"
+#include "mlir/IR/Diagnostics.h"
 #include "mlir/IR/MLIRContext.h"
 #include "mlir/IR/Verifier.h"
 #include "mlir/InitAllDialects.h"
@@ -28,24 +39,37 @@
 #include "mlir/Pass/PassManager.h"
 #include "mlir/Target/LLVMIR/Dialect/LLVMIR/LLVMToLLVMIRTranslation.h"
 #include "mlir/Target/LLVMIR/Export.h"
-#include "mlir/Transforms/Passes.h"
 
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/ScopeExit.h"
+#include "llvm/ADT/StringExtras.h"
 #include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/Twine.h"
+#include "llvm/Config/llvm-config.h"
 #include "llvm/IR/Module.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/ErrorOr.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
 #include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
 #include "llvm/Support/SourceMgr.h"
 #include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/ThreadPool.h"
 #include "llvm/Support/raw_ostream.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <numeric>
+
 using namespace toy;
 namespace cl = llvm::cl;
 
-static cl::opt<std::string> inputFilename(cl::Positional,
-                                          cl::desc("<input toy file>"),
-                                          cl::init("-"),
-                                          cl::value_desc("filename"));
+static cl::list<std::string> inputFilenames(cl::Positional,
+                                           cl::desc("<input toy files>"),
+                                           cl::value_desc("filename"));
 
 namespace {
 enum InputType { Toy, MLIR };
@@ -64,7 +88,9 @@ enum Action {
   DumpMLIRAffine,
   DumpMLIRLLVM,
   DumpLLVMIR,
-  RunJIT
+  RunJIT,
+  RunREPL,
+  RunBatch
 };
 } // namespace
 static cl::opt<enum Action> emitAction(
@@ -78,38 +104,219 @@ static cl::opt<enum Action> emitAction(
     cl::values(clEnumValN(DumpLLVMIR, "llvm", "output the LLVM IR dump")),
     cl::values(
         clEnumValN(RunJIT, "jit",
-                   "JIT the code and run it by invoking the main function")));
+                   "JIT the code and run it by invoking the main function")),
+    cl::values(clEnumValN(RunREPL, "repl",
+                          "read definitions and statements from the standard "
+                          "input and JIT them one at a time")),
+    cl::values(clEnumValN(RunBatch, "batch",
+                          "compile a kernel once and run it over the jobs of "
+                          "a manifest in parallel")));
 
 static cl::opt<bool> enableOpt("opt", cl::desc("Enable optimizations"));
 
-/// Returns a Toy AST resulting from parsing the file or a nullptr on error.
-std::unique_ptr<toy::ModuleAST> parseInputFile(llvm::StringRef filename) {
-  llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> fileOrErr =
-      llvm::MemoryBuffer::getFileOrSTDIN(filename);
-  if (std::error_code ec = fileOrErr.getError()) {
-    llvm::errs() << "Could not open input file: " << ec.message() << "\n";
-    return nullptr;
+static cl::opt<bool> fastMath(
+    "fast-math",
+    cl::desc("Apply the algebraic simplifications that may change the "
+             "rounding of the results or the sign of their zeros, e.g. "
+             "a * b + a * c = a * (b + c)"));
+
+static cl::opt<mlir::toy::LoweringPath> loweringPath(
+    "lower-via", cl::init(mlir::toy::LoweringPath::Affine),
+    cl::desc("Select the path through which Toy is lowered to loops"),
+    cl::values(clEnumValN(mlir::toy::LoweringPath::Affine, "affine",
+                          "lower each operation to an affine loop nest")),
+    cl::values(clEnumValN(mlir::toy::LoweringPath::Linalg, "linalg",
+                          "lower to linalg on tensors, tile and fuse, then "
+                          "bufferize")));
+
+static cl::list<int64_t>
+    tileSizes("linalg-tile-sizes",
+              cl::desc("Tile sizes of the loops when lowering via linalg"),
+              cl::CommaSeparated);
+
+static cl::opt<unsigned> codegenPartitions(
+    "codegen-partitions",
+    cl::desc("Split the LLVM module into <N> partitions, optimized and "
+             "compiled to machine code in parallel by the JIT"),
+    cl::init(1), cl::value_desc("N"));
+
+static cl::opt<bool>
+    profile("profile",
+            cl::desc("Time each lowered operation of the program run by the "
+                     "JIT, and report the time spent at each source location"));
+
+static cl::opt<std::string> profileTraceFilename(
+    "profile-trace",
+    cl::desc("Write the runs of the profiled operations to <filename>, in the "
+             "Chrome trace event format"),
+    cl::init("toy-profile.json"), cl::value_desc("filename"));
+
+static cl::opt<bool> trackAllocations(
+    "track-allocations",
+    cl::desc("Track the allocations and the memory traffic of the program run "
+             "by the JIT, and report the peak heap use and the bytes "
+             "allocated at each source location"));
+
+static cl::opt<bool> roofline(
+    "roofline",
+    cl::desc("Print the estimated FLOPs and bytes moved of each function, on "
+             "the Toy and the affine IR, and its placement on the roofline of "
+             "the host"));
+
+static cl::opt<std::string> remarksFilename(
+    "remarks",
+    cl::desc("Write the optimization remarks of the Toy passes, of the affine "
+             "optimizations and of the LLVM passes to <filename>, as YAML"),
+    cl::value_desc("filename"));
+
+static cl::opt<std::string> compileStatsFilename(
+    "compile-stats",
+    cl::desc("Write the time spent in each stage and pass of the compilation, "
+             "the effect of each pass on the IR, and the peak memory use to "
+             "<filename> as JSON"),
+    cl::value_desc("filename"));
+
+static cl::opt<bool> compileStatsIRBytes(
+    "compile-stats-ir-bytes",
+    cl::desc("Also measure the bytes of the IR before and after each pass "
+             "with -compile-stats, which slows the compilation down"));
+
+static cl::opt<unsigned> benchRuns(
+    "bench",
+    cl::desc("Compile once, then time <N> runs of the main function and "
+             "write their latency percentiles and hardware counters as JSON; "
+             "only the first run, a warmup by default, prints"),
+    cl::init(0), cl::value_desc("N"));
+
+static cl::opt<unsigned>
+    benchWarmups("bench-warmup",
+                 cl::desc("Run the main function <N> times before timing it"),
+                 cl::init(1), cl::value_desc("N"));
+
+static cl::opt<std::string> benchOutputFilename(
+    "bench-output", cl::desc("Write the results of -bench to <filename>"),
+    cl::init("toy-bench.json"), cl::value_desc("filename"));
+
+static cl::opt<bool> autotune(
+    "autotune",
+    cl::desc("Search the tile size, vector width and unroll factor of each "
+             "loop nest of the program, timing the runs of its main function "
+             "with each candidate, and save the fastest to the tuning "
+             "database"));
+
+static cl::opt<unsigned> autotuneRuns(
+    "autotune-runs",
+    cl::desc("Time <N> runs of the main function with each candidate of "
+             "-autotune"),
+    cl::init(5), cl::value_desc("N"));
+
+static cl::opt<std::string> tuningDatabaseFilename(
+    "tuning-db",
+    cl::desc("Read the tuned configurations of the loop nests from "
+             "<filename> when it exists, and save those of -autotune to it"),
+    cl::init("toy-tuning.json"), cl::value_desc("filename"));
+
+static cl::opt<uint64_t> interpretThreshold(
+    "interpret-threshold",
+    cl::desc("With -emit=jit, interpret the program once its shapes are "
+             "inferred instead of compiling it, when it computes fewer than "
+             "<N> elements; 0 always compiles"),
+    cl::init(1 << 22), cl::value_desc("N"));
+
+static cl::opt<std::string> batchManifestFilename(
+    "batch-manifest",
+    cl::desc("Read the jobs of -emit=batch from <filename>: one per line, the "
+             "output file then the input files, of raw f64 elements"),
+    cl::value_desc("filename"));
+
+static cl::opt<std::string>
+    batchKernel("batch-kernel",
+                cl::desc("The function -emit=batch runs on each job"),
+                cl::value_desc("name"));
+
+static cl::list<std::string> batchArgShapes(
+    "batch-arg-shapes",
+    cl::desc("The shapes of the arguments of -batch-kernel, e.g. 2x3,3x2"),
+    cl::CommaSeparated);
+
+static cl::opt<std::string> batchOutputFilename(
+    "batch-output", cl::desc("Write the results of -emit=batch to <filename>"),
+    cl::init("toy-batch.json"), cl::value_desc("filename"));
+
+static cl::opt<unsigned> batchProcesses(
+    "batch-processes",
+    cl::desc("Split the tensors of each job of -emit=batch along their outer "
+             "dimension among <N> worker processes pinned to the NUMA nodes, "
+             "which share them through POSIX shared memory; the kernel must "
+             "be elementwise"),
+    cl::init(1), cl::value_desc("N"));
+
+static cl::opt<unsigned>
+    numThreads("j",
+               cl::desc("Compile with <N> threads, all the cores by default"),
+               cl::init(0), cl::value_desc("N"));
+
+/// The telemetry of the compilation, with -compile-stats.
+static std::unique_ptr<CompileStats> compileStats;
+
+/// The tuned configurations of the loop nests, see -tuning-db.
+static mlir::toy::TuningDatabase tuningDatabase;
+
+/// Return the name of `severity` in the printed diagnostics.
+static llvm::StringRef getSeverityName(mlir::DiagnosticSeverity severity) {
+  switch (severity) {
+  case mlir::DiagnosticSeverity::Note:
+    return "note";
+  case mlir::DiagnosticSeverity::Warning:
+    return "warning";
+  case mlir::DiagnosticSeverity::Error:
+    return "error";
+  case mlir::DiagnosticSeverity::Remark:
+    return "remark";
   }
-  auto buffer = fileOrErr.get()->getBuffer();
-  LexerBuffer lexer(buffer.begin(), buffer.end(), std::string(filename));
-  Parser parser(lexer);
-  return parser.parseModule();
+  llvm_unreachable("unknown diagnostic severity");
+}
+
+/// Print `diag` and its notes to stderr. The locations of the Toy sources are
+/// only resolved to lines and columns here (see resolveLocation).
+static mlir::LogicalResult printDiagnostic(mlir::Diagnostic &diag) {
+  auto print = [](mlir::Diagnostic &diag) {
+    mlir::Location loc = resolveLocation(diag.getLocation());
+    if (!loc.isa<mlir::UnknownLoc>())
+      llvm::errs() << loc << ": ";
+    llvm::errs() << getSeverityName(diag.getSeverity()) << ": " << diag
+                 << "\n";
+  };
+  print(diag);
+  for (mlir::Diagnostic &note : diag.getNotes())
+    print(note);
+  return mlir::success();
 }
 
 int loadMLIR(mlir::MLIRContext &context, mlir::OwningModuleRef &module) {
-  // Handle '.toy' input to the compiler.
+  // Handle '.toy' input to the compiler: the files are parsed and emitted in
+  // parallel, then linked into a single module.
   if (inputType != InputType::MLIR &&
-      !llvm::StringRef(inputFilename).endswith(".mlir")) {
-    auto moduleAST = parseInputFile(inputFilename);
-    if (!moduleAST)
-      return 6;
-    module = mlirGen(context, *moduleAST);
+      !llvm::StringRef(inputFilenames.front()).endswith(".mlir")) {
+    std::vector<ToyFile> files;
+    {
+      CompileStats::Stage stage(compileStats.get(), "parse");
+      if (mlir::failed(parseToyFiles(context, inputFilenames, files)))
+        return 6;
+    }
+    CompileStats::Stage stage(compileStats.get(), "mlirgen");
+    module = mlirGenToyFiles(context, files);
     return !module ? 1 : 0;
   }
 
   // Otherwise, the input is '.mlir'.
+  CompileStats::Stage stage(compileStats.get(), "parse");
+  if (inputFilenames.size() != 1) {
+    llvm::errs() << "Only one MLIR input file can be loaded\n";
+    return 3;
+  }
   llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> fileOrErr =
-      llvm::MemoryBuffer::getFileOrSTDIN(inputFilename);
+      llvm::MemoryBuffer::getFileOrSTDIN(inputFilenames.front());
   if (std::error_code ec = fileOrErr.getError()) {
     llvm::errs() << "Could not open input file: " << ec.message() << "\n";
     return -1;
@@ -120,74 +327,114 @@ int loadMLIR(mlir::MLIRContext &context, mlir::OwningModuleRef &module) {
   sourceMgr.AddNewSourceBuffer(std::move(*fileOrErr), llvm::SMLoc());
   module = mlir::parseSourceFile(sourceMgr, &context);
   if (!module) {
-    llvm::errs() << "Error can't load file " << inputFilename << "\n";
+    llvm::errs() << "Error can't load file " << inputFilenames.front()
+                 << "\n";
     return 3;
   }
   return 0;
 }
 
+/// Return the options of the pipeline compiling down to the given levels.
+mlir::toy::ToyPipelineOptions getPipelineOptions(bool isLoweringToAffine,
+                                                 bool isLoweringToLLVM) {
+  mlir::toy::ToyPipelineOptions options;
+  options.enableOpt = enableOpt;
+  options.fastMath = fastMath;
+  options.isLoweringToAffine = isLoweringToAffine;
+  options.isLoweringToLLVM = isLoweringToLLVM;
+  options.loweringPath = loweringPath;
+  if (!tileSizes.empty())
+    options.tileSizes.assign(tileSizes.begin(), tileSizes.end());
+  // The interactive mode reports neither a profile nor the allocations.
+  options.profile = profile && emitAction != Action::RunREPL;
+  options.trackAllocations =
+      trackAllocations && emitAction != Action::RunREPL;
+  options.printCostReport = roofline && emitAction != Action::RunREPL;
+  options.emitRemarks = !remarksFilename.empty();
+  if (!tuningDatabase.empty())
+    options.tuningDatabase = &tuningDatabase;
+  return options;
+}
+
+/// Return whether the program may be interpreted rather than run by the JIT.
+/// The instrumentation and the benchmarks need the compiled code.
+bool mayInterpret() {
+  return emitAction == Action::RunJIT && interpretThreshold && !profile &&
+         !trackAllocations && !roofline && remarksFilename.empty() &&
+         !benchRuns;
+}
+
+/// Load the module and run the pipeline. With -emit=jit, a small program is
+/// left at the Toy level once its shapes are inferred, and `interpret` is set.
 int loadAndProcessMLIR(mlir::MLIRContext &context,
-                       mlir::OwningModuleRef &module) {
+                       mlir::OwningModuleRef &module, bool &interpret) {
+  interpret = false;
   if (int error = loadMLIR(context, module))
     return error;
 
-  mlir::PassManager pm(&context);
-  // Apply any generic pass manager command line options and run the pipeline.
-  applyPassManagerCLOptions(pm);
+  auto runPipeline = [&](const mlir::toy::ToyPipelineOptions &options) {
+    mlir::PassManager pm(&context);
+    // Apply any generic pass manager command line options and run the
+    // pipeline.
+    applyPassManagerCLOptions(pm);
+    if (compileStats)
+      compileStats->instrument(pm);
+    mlir::toy::buildToyPipeline(pm, options);
+
+    CompileStats::Stage stage(compileStats.get(), "passes");
+    return pm.run(*module);
+  };
 
   // Check to see what granularity of MLIR we are compiling to.
   bool isLoweringToAffine = emitAction >= Action::DumpMLIRAffine;
   bool isLoweringToLLVM = emitAction >= Action::DumpMLIRLLVM;
+  mlir::toy::ToyPipelineOptions options =
+      getPipelineOptions(isLoweringToAffine, isLoweringToLLVM);
+  if (!mayInterpret())
+    return mlir::failed(runPipeline(options)) ? 4 : 0;
 
-  if (enableOpt || isLoweringToAffine) {
-    // Inline all functions into main and then delete them.
-    pm.addPass(mlir::createInlinerPass());
-
-    // Now that there is only one function, we can infer the shapes of each of
-    // the operations.
-    mlir::OpPassManager &optPM = pm.nest<mlir::FuncOp>();
-    optPM.addPass(mlir::createCanonicalizerPass());
-    optPM.addPass(mlir::toy::createShapeInferencePass());
-    optPM.addPass(mlir::createCanonicalizerPass());
-    optPM.addPass(mlir::createCSEPass());
-  }
-
-  if (isLoweringToAffine) {
-    mlir::OpPassManager &optPM = pm.nest<mlir::FuncOp>();
-
-    // Partially lower the toy dialect with a few cleanups afterwards.
-    optPM.addPass(mlir::toy::createLowerToAffinePass());
-    optPM.addPass(mlir::createCanonicalizerPass());
-    optPM.addPass(mlir::createCSEPass());
-
-    // Add optimizations if enabled.
-    if (enableOpt) {
-      optPM.addPass(mlir::createLoopFusionPass());
-      optPM.addPass(mlir::createAffineScalarReplacementPass());
-    }
-  }
-
-  if (isLoweringToLLVM) {
-    // Finish lowering the toy IR to the LLVM dialect.
-    pm.addPass(mlir::toy::createLowerToLLVMPass());
-  }
-
-  if (mlir::failed(pm.run(*module)))
+  // Infer the shapes first: a small program is then interpreted sooner than
+  // the rest of the pipeline and the JIT would compile it.
+  options.stopAfterShapeInference = true;
+  if (mlir::failed(runPipeline(options)))
     return 4;
-  return 0;
+  llvm::Optional<uint64_t> work = mlir::toy::estimateInterpreterWork(*module);
+  if (work && *work < interpretThreshold) {
+    interpret = true;
+    return 0;
+  }
+  options.stopAfterShapeInference = false;
+  options.skipShapeInference = true;
+  return mlir::failed(runPipeline(options)) ? 4 : 0;
 }
 
-int dumpAST() {
+int dumpAST(mlir::MLIRContext &context) {
   if (inputType == InputType::MLIR) {
     llvm::errs() << "Can't dump a Toy AST when the input is MLIR\n";
     return 5;
   }
 
-  auto moduleAST = parseInputFile(inputFilename);
-  if (!moduleAST)
+  std::vector<ToyFile> files;
+  if (mlir::failed(parseToyFiles(context, inputFilenames, files)))
     return 1;
 
-  dump(*moduleAST);
+  for (ToyFile &file : files)
+    dump(*file.ast);
+  return 0;
+}
+
+/// Write the telemetry of the compilation so far, with -compile-stats.
+int writeCompileStats() {
+  if (!compileStats)
+    return 0;
+  std::error_code ec;
+  llvm::raw_fd_ostream os(compileStatsFilename, ec);
+  if (ec) {
+    llvm::errs() << "Could not open the compile stats: " << ec.message()
+                 << "\n";
+    return -1;
+  }
+  compileStats->writeJSON(os);
   return 0;
 }
 
@@ -197,7 +444,12 @@ int dumpLLVMIR(mlir::ModuleOp module) {
 
   // Convert the module to LLVM IR in a new LLVM IR context.
   llvm::LLVMContext llvmContext;
-  auto llvmModule = mlir::translateModuleToLLVMIR(module, llvmContext);
+  mlir::toy::forwardLLVMRemarks(llvmContext);
+  std::unique_ptr<llvm::Module> llvmModule;
+  {
+    CompileStats::Stage stage(compileStats.get(), "translate-to-llvm-ir");
+    llvmModule = mlir::translateModuleToLLVMIR(module, llvmContext);
+  }
   if (!llvmModule) {
     llvm::errs() << "Failed to emit LLVM IR\n";
     return -1;
@@ -212,12 +464,90 @@ int dumpLLVMIR(mlir::ModuleOp module) {
   auto optPipeline = mlir::makeOptimizingTransformer(
       /*optLevel=*/enableOpt ? 3 : 0, /*sizeLevel=*/0,
       /*targetMachine=*/nullptr);
-  if (auto err = optPipeline(llvmModule.get())) {
-    llvm::errs() << "Failed to optimize LLVM IR " << err << "\n";
-    return -1;
+  {
+    CompileStats::Stage stage(compileStats.get(), "llvm-opt");
+    if (auto err = optPipeline(llvmModule.get())) {
+      llvm::errs() << "Failed to optimize LLVM IR " << err << "\n";
+      return -1;
+    }
   }
   llvm::errs() << *llvmModule << "\n";
-  return 0;
+  return writeCompileStats();
+}
+
+/// The packed interface of the main function, see ToyJIT.h.
+using PackedMainFn = void (*)(void **);
+
+/// JIT-compile `module`, lowered to the LLVM dialect, with `jit`, and return
+/// the packed interface of its main function, or null on failure.
+PackedMainFn jitCompileMain(mlir::ModuleOp module, ToyJIT &jit) {
+  // Convert the module to LLVM IR, with a wrapper to invoke main.
+  llvm::LLVMContext llvmContext;
+  std::unique_ptr<llvm::Module> llvmModule;
+  {
+    CompileStats::Stage stage(compileStats.get(), "translate-to-llvm-ir");
+    llvmModule = mlir::translateModuleToLLVMIR(module, llvmContext);
+  }
+  if (!llvmModule) {
+    llvm::errs() << "Failed to emit LLVM IR\n";
+    return nullptr;
+  }
+  llvmModule->setDataLayout(jit.getDataLayout());
+  if (auto err = addPackedInterface(*llvmModule, "main")) {
+    llvm::errs() << "Failed to emit LLVM IR " << toString(std::move(err))
+                 << "\n";
+    return nullptr;
+  }
+
+  // An optimization pipeline to run on each partition of the module. The
+  // partitions are optimized concurrently, their times add up, and each only
+  // counts the CPU time of its thread.
+  auto optimize = mlir::makeOptimizingTransformer(
+      /*optLevel=*/enableOpt ? 3 : 0, /*sizeLevel=*/0,
+      /*targetMachine=*/nullptr);
+  auto optPipeline = [&](llvm::Module *partition) {
+    CompileStats::Stage stage(compileStats.get(), "llvm-opt",
+                              CompileStats::CPUTimeScope::Thread);
+    mlir::toy::forwardLLVMRemarks(partition->getContext());
+    return optimize(partition);
+  };
+
+  // Eagerly JIT-compile the module. The codegen stage includes the
+  // optimization of the partitions.
+  {
+    CompileStats::Stage stage(compileStats.get(), "codegen");
+    if (auto err = jit.addModuleInParallel(std::move(llvmModule),
+                                           codegenPartitions, numThreads,
+                                           optPipeline)) {
+      llvm::errs() << "JIT compilation failed " << toString(std::move(err))
+                   << "\n";
+      return nullptr;
+    }
+  }
+
+  auto mainFunc = jit.lookup(getPackedFunctionName("main"));
+  if (!mainFunc) {
+    llvm::errs() << "JIT invocation failed " << toString(mainFunc.takeError())
+                 << "\n";
+    return nullptr;
+  }
+  return reinterpret_cast<PackedMainFn>(mainFunc->getAddress());
+}
+
+/// Whether the calls to `printf` of the compiled code print, see benchPrintf.
+static bool isBenchOutputDiscarded = false;
+
+/// The `printf` of the compiled code when it is timed, with -bench or by the
+/// autotuner. The timed runs skip the printing, whose formatting of every
+/// element of the printed tensors would otherwise dominate their time.
+static int benchPrintf(const char *format, ...) {
+  if (isBenchOutputDiscarded)
+    return 0;
+  va_list args;
+  va_start(args, format);
+  int result = vprintf(format, args);
+  va_end(args);
+  return result;
 }
 
 int runJit(mlir::ModuleOp module) {
@@ -229,28 +559,625 @@ int runJit(mlir::ModuleOp module) {
   // can JIT-compile.
   mlir::registerLLVMDialectTranslation(*module->getContext());
 
-  // An optimization pipeline to use within the execution engine.
+  auto maybeJIT = ToyJIT::create();
+  if (!maybeJIT) {
+    llvm::errs() << "Failed to create the JIT "
+                 << toString(maybeJIT.takeError()) << "\n";
+    return -1;
+  }
+  auto &jit = *maybeJIT;
+  if (profile) {
+    if (auto err = jit->addHostSymbols(getProfilerRuntimeSymbols())) {
+      llvm::errs() << "Failed to define the profiler runtime "
+                   << toString(std::move(err)) << "\n";
+      return -1;
+    }
+  }
+  if (trackAllocations) {
+    if (auto err = jit->addHostSymbols(getAllocationTrackerRuntimeSymbols())) {
+      llvm::errs() << "Failed to define the allocation tracker runtime "
+                   << toString(std::move(err)) << "\n";
+      return -1;
+    }
+  }
+  if (benchRuns) {
+    if (auto err = jit->addHostSymbols(
+            {{"printf", reinterpret_cast<void *>(&benchPrintf)}})) {
+      llvm::errs() << "Failed to define the benchmark runtime "
+                   << toString(std::move(err)) << "\n";
+      return -1;
+    }
+  }
+
+  // Invoke the JIT-compiled function. The compilation ends with its lookup,
+  // the program itself isn't part of the stats.
+  PackedMainFn packedMain = jitCompileMain(module, *jit);
+  if (!packedMain)
+    return -1;
+  if (int error = writeCompileStats())
+    return error;
+  Profiler::get().reset();
+  AllocationTracker::get().reset();
+  double seconds;
+  if (benchRuns) {
+    // The reports of the profiler and of the allocation tracker add up the
+    // runs, warmups included. Only the first run prints.
+    unsigned numRuns = 0;
+    BenchmarkResult result = runBenchmark(
+        [&] {
+          isBenchOutputDiscarded = numRuns++ != 0;
+          packedMain(nullptr);
+        },
+        benchRuns, benchWarmups);
+    isBenchOutputDiscarded = false;
+    fflush(stdout);
+    seconds = std::accumulate(result.seconds.begin(), result.seconds.end(),
+                              0.0);
+    std::error_code ec;
+    llvm::raw_fd_ostream os(benchOutputFilename, ec);
+    if (ec) {
+      llvm::errs() << "Could not open the benchmark results: " << ec.message()
+                   << "\n";
+      return -1;
+    }
+    writeBenchmarkJSON(
+        os, llvm::join(inputFilenames.begin(), inputFilenames.end(), " "),
+        result);
+  } else {
+    auto start = std::chrono::steady_clock::now();
+    packedMain(nullptr);
+    std::chrono::duration<double> duration =
+        std::chrono::steady_clock::now() - start;
+    seconds = duration.count();
+  }
+
+  if (trackAllocations)
+    AllocationTracker::get().printReport(llvm::errs(), seconds);
+
+  if (profile) {
+    Profiler::get().printReport(llvm::errs());
+    std::error_code ec;
+    llvm::raw_fd_ostream trace(profileTraceFilename, ec);
+    if (ec) {
+      llvm::errs() << "Could not open the profile trace: " << ec.message()
+                   << "\n";
+      return -1;
+    }
+    Profiler::get().writeChromeTrace(trace);
+  }
+  return 0;
+}
+
+/// Interpret the main function of `module`, at the Toy level.
+int runInterpreter(mlir::ModuleOp module) {
+  if (int error = writeCompileStats())
+    return error;
+  return mlir::failed(mlir::toy::interpretMain(module)) ? -1 : 0;
+}
+
+int runAutotune(mlir::MLIRContext &context) {
+  if (loweringPath != mlir::toy::LoweringPath::Affine) {
+    llvm::errs() << "The autotuner tunes the loop nests of the affine path\n";
+    return -1;
+  }
+  mlir::OwningModuleRef module;
+  if (int error = loadMLIR(context, module))
+    return error;
+
+  llvm::InitializeNativeTarget();
+  llvm::InitializeNativeTargetAsmPrinter();
+  mlir::registerLLVMDialectTranslation(context);
+
+  // The candidates are compiled without any instrumentation.
+  auto getOptions = [](bool isLoweringToLLVM) {
+    mlir::toy::ToyPipelineOptions options =
+        getPipelineOptions(/*isLoweringToAffine=*/true, isLoweringToLLVM);
+    options.profile = false;
+    options.trackAllocations = false;
+    options.printCostReport = false;
+    options.emitRemarks = false;
+    return options;
+  };
+
+  // Find the nests on a copy of the module lowered to affine loops, the
+  // hottest ones are tuned first.
+  std::vector<mlir::toy::TunableNest> nests;
+  {
+    mlir::OwningModuleRef lowered(module->clone());
+    mlir::PassManager pm(&context);
+    applyPassManagerCLOptions(pm);
+    mlir::toy::buildToyPipeline(pm, getOptions(/*isLoweringToLLVM=*/false));
+    if (mlir::failed(pm.run(*lowered)))
+      return 4;
+    nests = mlir::toy::getTunableNests(*lowered);
+  }
+  llvm::stable_sort(nests, [](const mlir::toy::TunableNest &lhs,
+                              const mlir::toy::TunableNest &rhs) {
+    return lhs.getNumIterations() > rhs.getNumIterations();
+  });
+
+  // Return the median time of the main function compiled with `candidates`,
+  // or None if it doesn't compile.
+  auto timeCandidates = [&](const mlir::toy::TuningDatabase &candidates)
+      -> llvm::Optional<double> {
+    mlir::OwningModuleRef candidate(module->clone());
+    mlir::PassManager pm(&context);
+    applyPassManagerCLOptions(pm);
+    mlir::toy::ToyPipelineOptions options =
+        getOptions(/*isLoweringToLLVM=*/true);
+    options.tuningDatabase = &candidates;
+    mlir::toy::buildToyPipeline(pm, options);
+    if (mlir::failed(pm.run(*candidate)))
+      return llvm::None;
+
+    auto maybeJIT = ToyJIT::create();
+    if (!maybeJIT) {
+      llvm::errs() << "Failed to create the JIT "
+                   << toString(maybeJIT.takeError()) << "\n";
+      return llvm::None;
+    }
+    if (auto err = (*maybeJIT)->addHostSymbols(
+            {{"printf", reinterpret_cast<void *>(&benchPrintf)}})) {
+      llvm::errs() << "Failed to define the benchmark runtime "
+                   << toString(std::move(err)) << "\n";
+      return llvm::None;
+    }
+    PackedMainFn packedMain = jitCompileMain(*candidate, **maybeJIT);
+    if (!packedMain)
+      return llvm::None;
+
+    // The candidates print nothing, not even in their warmup.
+    isBenchOutputDiscarded = true;
+    BenchmarkResult result =
+        runBenchmark([&] { packedMain(nullptr); },
+                     std::max<unsigned>(autotuneRuns, 1), /*numWarmups=*/1);
+    isBenchOutputDiscarded = false;
+    llvm::sort(result.seconds);
+    return result.seconds[result.seconds.size() / 2];
+  };
+
+  // Each parameter is searched in turn, the others set to the best values so
+  // far. A candidate must be faster by 2% to win, so that the noise of the
+  // timings doesn't pick a configuration over the default.
+  struct Parameter {
+    const char *name;
+    unsigned mlir::toy::TuningConfig::*field;
+    llvm::ArrayRef<unsigned> values;
+  };
+  static const unsigned tileSizes[] = {0, 8, 16, 32, 64};
+  static const unsigned vectorWidths[] = {1, 4, 8};
+  static const unsigned unrollFactors[] = {1, 2, 4, 8};
+  const Parameter parameters[] = {
+      {"tile", &mlir::toy::TuningConfig::tileSize, tileSizes},
+      {"vector", &mlir::toy::TuningConfig::vectorWidth, vectorWidths},
+      {"unroll", &mlir::toy::TuningConfig::unrollFactor, unrollFactors},
+  };
+  auto printConfig = [](const mlir::toy::TuningConfig &config) {
+    llvm::errs() << llvm::format("tile %2u, vector %u, unroll %u",
+                                 config.tileSize, config.vectorWidth,
+                                 config.unrollFactor);
+  };
+
+  if (nests.empty())
+    llvm::errs() << "No loop nest to tune\n";
+  mlir::toy::TuningDatabase candidates = tuningDatabase;
+  for (const mlir::toy::TunableNest &nest : nests) {
+    llvm::errs() << "Tuning the " << nest.key.shape << " loop nest of "
+                 << nest.key.opKind << " on " << nest.key.cpu << "\n";
+    mlir::toy::TuningConfig best =
+        tuningDatabase.lookup(nest.key.opKind, nest.key.shape)
+            .getValueOr(mlir::toy::TuningConfig());
+    if (!nest.isApplicable(best))
+      best = mlir::toy::TuningConfig();
+    candidates.insert(nest.key, best);
+    llvm::Optional<double> bestSeconds = timeCandidates(candidates);
+    if (!bestSeconds)
+      return -1;
+
+    for (const Parameter &parameter : parameters) {
+      for (unsigned value : parameter.values) {
+        mlir::toy::TuningConfig config = best;
+        config.*parameter.field = value;
+        if (config == best || !nest.isApplicable(config))
+          continue;
+        candidates.insert(nest.key, config);
+        llvm::Optional<double> seconds = timeCandidates(candidates);
+        llvm::errs() << "  ";
+        printConfig(config);
+        if (!seconds) {
+          llvm::errs() << ": failed\n";
+          continue;
+        }
+        llvm::errs() << llvm::format(": %10.3f ms\n", *seconds * 1e3);
+        if (*seconds < *bestSeconds * 0.98) {
+          best = config;
+          bestSeconds = seconds;
+        }
+      }
+    }
+    candidates.insert(nest.key, best);
+    llvm::errs() << "  best: ";
+    printConfig(best);
+    llvm::errs() << llvm::format(", %.3f ms\n", *bestSeconds * 1e3);
+  }
+
+  return mlir::failed(candidates.save(tuningDatabaseFilename)) ? -1 : 0;
+}
+
+namespace {
+/// A variable declared at the top level of the interactive session. Its value
+/// stays resident in host memory, and is passed to the next statements.
+struct ReplVariable {
+  ExprAST *decl;
+  std::vector<int64_t> shape;
+  std::vector<double> data;
+
+  VarDeclExprAST &getDecl() { return llvm::cast<VarDeclExprAST>(*decl); }
+};
+
+/// The interactive mode. Definitions are kept as IR, since the Toy functions
+/// are generic over the shapes of their arguments. Each top-level statement is
+/// compiled with the definitions it calls into a function of the live
+/// variables, which the JIT runs once and then releases.
+class Repl {
+public:
+  Repl(mlir::MLIRContext &context, ToyJIT &jit)
+      : context(context), session(context), jit(jit) {}
+
+  /// Process a chunk of input made of complete definitions and statements.
+  /// The rest of the chunk is skipped after the first error.
+  void processChunk(const std::string &chunk);
+
+private:
+  mlir::LogicalResult runStatement(ExprAST *stmt);
+
+  mlir::MLIRContext &context;
+  MLIRGenSession session;
+  ToyJIT &jit;
+
+  /// The arenas of the definitions and of the variables, which must outlive
+  /// the session.
+  std::vector<std::unique_ptr<ASTArena>> arenas;
+
+  /// The live variables, in order of declaration.
+  std::vector<ReplVariable> variables;
+
+  /// The number of statements run so far, used to name their functions.
+  unsigned numStatements = 0;
+};
+} // namespace
+
+void Repl::processChunk(const std::string &chunk) {
+  Lexer lexer(SourceManager::get().addBufferCopy(chunk, "<stdin>"));
+  Parser parser(lexer);
+  lexer.getNextToken(); // prime the lexer
+
+  // The definitions and the declared variables of the chunk refer to its
+  // nodes, even after an error.
+  auto keepNodes =
+      llvm::make_scope_exit([&] { arenas.push_back(parser.takeArena()); });
+
+  while (true) {
+    // Ignore empty statements.
+    while (lexer.getCurToken() == ';')
+      lexer.consume(Token(';'));
+
+    switch (lexer.getCurToken()) {
+    case tok_eof:
+      return;
+    case tok_def:
+    case tok_struct: {
+      auto *record = parser.parseRecord();
+      if (!record || mlir::failed(session.addRecord(*record)))
+        return;
+      break;
+    }
+    default: {
+      auto *stmt = parser.parseStatement();
+      if (!stmt)
+        return;
+      if (lexer.getCurToken() != ';') {
+        LineColumn loc = SourceManager::get().resolve(lexer.getLastLocation());
+        llvm::errs() << "Parse error (" << loc.line << ", " << loc.col
+                     << "): expected ';' after statement\n";
+        return;
+      }
+      if (mlir::failed(runStatement(stmt)))
+        return;
+    }
+    }
+  }
+}
+
+mlir::LogicalResult Repl::runStatement(ExprAST *stmt) {
+  std::string name = ("__toy_repl_" + llvm::Twine(numStatements++)).str();
+  llvm::SmallVector<MLIRGenSession::Variable, 8> args;
+  for (ReplVariable &var : variables)
+    args.emplace_back(&var.getDecl(), var.shape);
+  mlir::OwningModuleRef module = session.genStatement(*stmt, name, args);
+  if (!module)
+    return mlir::failure();
+
+  // Compile the statement and the definitions it calls all the way down to
+  // LLVM IR.
+  mlir::PassManager pm(&context);
+  applyPassManagerCLOptions(pm);
+  mlir::toy::buildToyPipeline(
+      pm, getPipelineOptions(/*isLoweringToAffine=*/true,
+                             /*isLoweringToLLVM=*/true));
+  if (mlir::failed(pm.run(*module)))
+    return mlir::failure();
+
+  auto llvmContext = std::make_unique<llvm::LLVMContext>();
+  mlir::toy::forwardLLVMRemarks(*llvmContext);
+  auto llvmModule = mlir::translateModuleToLLVMIR(*module, *llvmContext, name);
+  if (!llvmModule) {
+    llvm::errs() << "Failed to emit LLVM IR\n";
+    return mlir::failure();
+  }
+  mlir::ExecutionEngine::setupTargetTriple(llvmModule.get());
+  llvmModule->setDataLayout(jit.getDataLayout());
   auto optPipeline = mlir::makeOptimizingTransformer(
       /*optLevel=*/enableOpt ? 3 : 0, /*sizeLevel=*/0,
       /*targetMachine=*/nullptr);
+  if (auto err = optPipeline(llvmModule.get())) {
+    llvm::errs() << "Failed to optimize LLVM IR " << err << "\n";
+    return mlir::failure();
+  }
+  if (auto err = addPackedInterface(*llvmModule, name)) {
+    llvm::errs() << "Failed to emit LLVM IR " << toString(std::move(err))
+                 << "\n";
+    return mlir::failure();
+  }
+
+  // A declared variable is returned as a memref descriptor, whose rank is
+  // given by the size of its arrays.
+  llvm::Optional<MemRefDescriptor> result;
+  auto *resultType = llvm::dyn_cast<llvm::StructType>(
+      llvmModule->getFunction(name)->getReturnType());
+  if (resultType)
+    result.emplace(resultType->getNumElements() == 3
+                       ? 0
+                       : resultType->getElementType(3)->getArrayNumElements());
 
-  // Create an MLIR execution engine. The execution engine eagerly JIT-compiles
-  // the module.
-  auto maybeEngine = mlir::ExecutionEngine::create(
-      module, /*llvmModuleBuilder=*/nullptr, optPipeline);
-  assert(maybeEngine && "failed to construct an execution engine");
-  auto &engine = maybeEngine.get();
-
-  // Invoke the JIT-compiled function.
-  auto invocationResult = engine->invokePacked("main");
-  if (invocationResult) {
-    llvm::errs() << "JIT invocation failed\n";
+  auto tracker = jit.getMainJITDylib().createResourceTracker();
+  if (auto err = jit.addModule(
+          llvm::orc::ThreadSafeModule(std::move(llvmModule),
+                                      std::move(llvmContext)),
+          tracker)) {
+    llvm::errs() << "JIT compilation failed " << toString(std::move(err))
+                 << "\n";
+    return mlir::failure();
+  }
+  auto symbol = jit.lookup(getPackedFunctionName(name));
+  if (!symbol) {
+    llvm::errs() << "JIT compilation failed "
+                 << toString(symbol.takeError()) << "\n";
+    return mlir::failure();
+  }
+
+  // Pass the live variables, then storage for the result.
+  std::vector<MemRefDescriptor> descriptors;
+  descriptors.reserve(variables.size());
+  llvm::SmallVector<void *, 32> packedArgs;
+  for (ReplVariable &var : variables) {
+    descriptors.emplace_back(var.data.data(), var.shape);
+    descriptors.back().appendPackedArguments(packedArgs);
+  }
+  if (result)
+    packedArgs.push_back(result->getStorage());
+  auto *packedFunc =
+      reinterpret_cast<void (*)(void **)>(symbol->getAddress());
+  packedFunc(packedArgs.data());
+  fflush(stdout);
+
+  if (auto err = tracker->remove())
+    llvm::errs() << "Failed to release JIT code " << toString(std::move(err))
+                 << "\n";
+  if (!result)
+    return mlir::success();
+
+  // Copy the value of the variable out of the buffer allocated by the
+  // statement, unless the statement returned one of its arguments.
+  ReplVariable var;
+  var.decl = stmt;
+  var.shape.assign(result->getSizes().begin(), result->getSizes().end());
+  var.data.assign(result->getData(),
+                  result->getData() + result->getNumElements());
+  double *allocatedPtr = result->getAllocatedPtr();
+  if (llvm::none_of(variables, [&](ReplVariable &other) {
+        return other.data.data() == allocatedPtr;
+      }))
+    free(allocatedPtr);
+
+  // A new declaration shadows any previous variable with the same name.
+  auto it = llvm::find_if(variables, [&](ReplVariable &other) {
+    return other.getDecl().getName() == var.getDecl().getName();
+  });
+  if (it != variables.end())
+    *it = std::move(var);
+  else
+    variables.push_back(std::move(var));
+  return mlir::success();
+}
+
+/// Read the next line of the standard input into `line`, without its newline.
+/// A line is returned as soon as it is typed, which a MemoryBuffer of the
+/// standard input can't do: it only returns once the whole input is read.
+/// Return false at the end of the input.
+static bool readStdinLine(std::string &line) {
+  static std::string pending;
+  for (;;) {
+    size_t newline = pending.find('\n');
+    if (newline != std::string::npos) {
+      line = pending.substr(0, newline);
+      pending.erase(0, newline + 1);
+      return true;
+    }
+    char buffer[4096];
+    llvm::Expected<size_t> numRead = llvm::sys::fs::readNativeFile(
+        llvm::sys::fs::getStdinHandle(), buffer);
+    // A read error ends the input like its end.
+    if (!numRead) {
+      llvm::errs() << "Failed to read the standard input "
+                   << toString(numRead.takeError()) << "\n";
+      pending.clear();
+      return false;
+    }
+    if (!*numRead) {
+      if (pending.empty())
+        return false;
+      line = std::move(pending);
+      pending.clear();
+      return true;
+    }
+    pending.append(buffer, *numRead);
+  }
+}
+
+int runRepl(mlir::MLIRContext &context) {
+  // Initialize LLVM targets.
+  llvm::InitializeNativeTarget();
+  llvm::InitializeNativeTargetAsmPrinter();
+
+  // Register the translation from MLIR to LLVM IR, which must happen before we
+  // can JIT-compile.
+  mlir::registerLLVMDialectTranslation(context);
+
+  // Favor the latency of compiling each statement unless asked to optimize.
+  auto maybeJIT = ToyJIT::create(enableOpt ? llvm::CodeGenOpt::Default
+                                           : llvm::CodeGenOpt::None);
+  if (!maybeJIT) {
+    llvm::errs() << "Failed to create the JIT "
+                 << toString(maybeJIT.takeError()) << "\n";
     return -1;
   }
+  Repl repl(context, **maybeJIT);
 
+  // Accumulate lines until the braces are balanced and the last line ends a
+  // definition or a statement, so that definitions can span multiple lines.
+  std::string chunk, line;
+  int depth = 0;
+  bool isIncomplete = false;
+  llvm::errs() << "toy> ";
+  while (readStdinLine(line)) {
+    chunk += line;
+    chunk += '\n';
+    llvm::StringRef code = llvm::StringRef(line).split('#').first.trim();
+    for (char c : code)
+      depth += (c == '{') - (c == '}');
+    if (!code.empty())
+      isIncomplete = !code.endswith(";") && !code.endswith("}");
+    if (depth > 0 || isIncomplete) {
+      llvm::errs() << "...> ";
+      continue;
+    }
+    repl.processChunk(chunk);
+    chunk.clear();
+    depth = 0;
+    llvm::errs() << "toy> ";
+  }
+  if (!chunk.empty())
+    repl.processChunk(chunk);
+  llvm::errs() << "\n";
   return 0;
 }
 
+int runBatchJobs() {
+  if (inputFilenames.size() != 1) {
+    llvm::errs() << "The batch mode compiles a single Toy file\n";
+    return 3;
+  }
+  if (batchKernel.empty() || batchManifestFilename.empty()) {
+    llvm::errs() << "The batch mode needs -batch-kernel and -batch-manifest\n";
+    return 3;
+  }
+
+  // Each shape is a list of sizes separated by 'x'.
+  KernelSignature kernel;
+  kernel.name = batchKernel;
+  for (llvm::StringRef shape : batchArgShapes) {
+    llvm::SmallVector<llvm::StringRef, 4> sizes;
+    shape.split(sizes, 'x');
+    kernel.argShapes.emplace_back();
+    for (llvm::StringRef size : sizes) {
+      int64_t value;
+      if (size.getAsInteger(10, value) || value < 0) {
+        llvm::errs() << "Invalid argument shape '" << shape << "'\n";
+        return 3;
+      }
+      kernel.argShapes.back().push_back(value);
+    }
+  }
+
+  auto sourceOrErr = llvm::MemoryBuffer::getFileOrSTDIN(inputFilenames.front());
+  if (std::error_code ec = sourceOrErr.getError()) {
+    llvm::errs() << "Could not open input file: " << ec.message() << "\n";
+    return -1;
+  }
+  auto manifestOrErr = llvm::MemoryBuffer::getFile(batchManifestFilename);
+  if (std::error_code ec = manifestOrErr.getError()) {
+    llvm::errs() << "Could not open the manifest: " << ec.message() << "\n";
+    return -1;
+  }
+  auto jobs = parseBatchManifest(
+      (*manifestOrErr)->getBuffer(),
+      llvm::sys::path::parent_path(batchManifestFilename));
+  if (!jobs) {
+    llvm::errs() << "Invalid manifest: " << toString(jobs.takeError())
+                 << "\n";
+    return 3;
+  }
+
+  // Compile once, then the jobs only invoke the kernel.
+  ToyCompiler compiler;
+  CompileOptions options;
+  options.enableOpt = enableOpt;
+  options.numCodegenPartitions = codegenPartitions;
+  options.loweringPath = loweringPath;
+  BatchResult result;
+  if (batchProcesses > 1) {
+    // Each job runs on all the worker processes, so the jobs run in turn.
+    auto sharded = ShardedKernel::compile(
+        compiler, (*sourceOrErr)->getBuffer(), kernel, batchProcesses, options);
+    if (!sharded) {
+      llvm::errs() << toString(sharded.takeError()) << "\n";
+      return 4;
+    }
+    result = runBatch(
+        *jobs, [&](const BatchJob &job) { return (*sharded)->run(job); },
+        /*numThreads=*/1);
+  } else {
+    options.kernels.push_back(kernel);
+    auto compiled = compiler.compile((*sourceOrErr)->getBuffer(), options);
+    if (!compiled) {
+      llvm::errs() << toString(compiled.takeError());
+      return 4;
+    }
+    result = runBatch(**compiled, kernel, *jobs, numThreads);
+  }
+  fflush(stdout);
+  for (const std::string &error : result.errors)
+    llvm::errs() << error << "\n";
+  llvm::errs() << llvm::format("Ran %zu jobs in %.3f s: %.1f jobs/s, %.1f MB/s",
+                               result.seconds.size(), result.wallSeconds,
+                               result.seconds.size() / result.wallSeconds,
+                               result.numBytes / result.wallSeconds / 1e6);
+  if (!result.errors.empty())
+    llvm::errs() << ", " << result.errors.size() << " failed";
+  llvm::errs() << "\n";
+
+  std::error_code ec;
+  llvm::raw_fd_ostream os(batchOutputFilename, ec);
+  if (ec) {
+    llvm::errs() << "Could not open the batch results: " << ec.message()
+                 << "\n";
+    return -1;
+  }
+  writeBatchJSON(os, inputFilenames.front(), result);
+  return result.errors.empty() ? 0 : -1;
+}
+
 int main(int argc, char **argv) {
   // Register any command line options.
   mlir::registerAsmPrinterCLOptions();
@@ -258,34 +1185,74 @@ int main(int argc, char **argv) {
   mlir::registerPassManagerCLOptions();
 
   cl::ParseCommandLineOptions(argc, argv, "toy compiler\n");
+  if (inputFilenames.empty())
+    inputFilenames.push_back("-");
+
+  // The files are parsed, and the passes run on the functions, in parallel
+  // unless compiling with a single thread.
+  mlir::MLIRContext context(mlir::MLIRContext::Threading::DISABLED);
+  llvm::ThreadPool threadPool(llvm::hardware_concurrency(numThreads));
+  if (numThreads != 1)
+    context.setThreadPool(threadPool);
+  // Load our Dialect in this MLIR Context.
+  context.getOrLoadDialect<mlir::toy::ToyDialect>();
+  mlir::ScopedDiagnosticHandler diagHandler(&context, printDiagnostic);
+  if (!compileStatsFilename.empty())
+    compileStats = std::make_unique<CompileStats>(compileStatsIRBytes);
+
+  std::unique_ptr<llvm::raw_fd_ostream> remarksFile;
+  if (!remarksFilename.empty()) {
+    std::error_code ec;
+    remarksFile = std::make_unique<llvm::raw_fd_ostream>(remarksFilename, ec);
+    if (ec) {
+      llvm::errs() << "Could not open the remarks file: " << ec.message()
+                   << "\n";
+      return -1;
+    }
+    mlir::toy::setRemarkStream(remarksFile.get());
+  }
+  auto closeRemarks =
+      llvm::make_scope_exit([] { mlir::toy::setRemarkStream(nullptr); });
+
+  // The tuned configurations are read by every compilation.
+  if (llvm::sys::fs::exists(tuningDatabaseFilename) &&
+      mlir::failed(tuningDatabase.load(tuningDatabaseFilename)))
+    return -1;
+  if (autotune)
+    return runAutotune(context);
 
   if (emitAction == Action::DumpAST)
-    return dumpAST();
+    return dumpAST(context);
 
   // If we aren't dumping the AST, then we are compiling with/to MLIR.
 
-  mlir::MLIRContext context;
-  // Load our Dialect in this MLIR Context.
-  context.getOrLoadDialect<mlir::toy::ToyDialect>();
+  // The interactive mode reads its own input.
+  if (emitAction == Action::RunREPL)
+    return runRepl(context);
+
+  // The batch mode compiles through the embedding API.
+  if (emitAction == Action::RunBatch)
+    return runBatchJobs();
 
   mlir::OwningModuleRef module;
-  if (int error = loadAndProcessMLIR(context, module))
+  bool interpret;
+  if (int error = loadAndProcessMLIR(context, module, interpret))
     return error;
 
   // If we aren't exporting to non-mlir, then we are done.
   bool isOutputingMLIR = emitAction <= Action::DumpMLIRLLVM;
   if (isOutputingMLIR) {
     module->dump();
-    return 0;
+    return writeCompileStats();
   }
 
   // Check to see if we are compiling to LLVM IR.
   if (emitAction == Action::DumpLLVMIR)
     return dumpLLVMIR(*module);
 
-  // Otherwise, we must be running the jit.
+  // Otherwise, we must be running the jit, or interpreting a small program.
   if (emitAction == Action::RunJIT)
-    return runJit(*module);
+    return interpret ? runInterpreter(*module) : runJit(*module);
 
   llvm::errs() << "No action specified (parsing only?), use -emit=<action>\n";
   return -1;